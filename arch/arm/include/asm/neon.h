@@ -0,0 +1,25 @@
+/*
+ *  arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Use of NEON instructions in the kernel must be bracketed by these
+ * calls.  Any live user space VFP/NEON state is saved first, and
+ * preemption stays disabled until kernel_neon_end(), so the section
+ * must not sleep.  Not usable from interrupt context.
+ */
+extern void kernel_neon_begin(void);
+extern void kernel_neon_end(void);
+
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ *  linux/arch/arm/lib/copy_bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ *  Throughput benchmark for memcpy(), memmove() and copy_page().
+ *
+ *  Every size from 16 bytes to 64KB is copied repeatedly until
+ *  bench_bytes have been moved, once with both buffers word aligned and
+ *  once with the source and destination off by one and three bytes.
+ *  memmove() is timed on overlapping buffers so that it takes its
+ *  backwards path rather than falling through to memcpy().  Results are
+ *  printed in MB/s when the module is loaded.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
+#include <asm/page.h>
+
+#define BENCH_MIN_SIZE		16
+#define BENCH_MAX_SIZE		(64 * 1024)
+
+static unsigned int bench_bytes = 16 * 1024 * 1024;
+module_param(bench_bytes, uint, S_IRUGO);
+MODULE_PARM_DESC(bench_bytes, "Bytes copied per measurement");
+
+enum {
+	BENCH_MEMCPY,
+	BENCH_MEMMOVE,
+};
+
+static unsigned int bench_rate(u64 bytes, s64 ns)
+{
+	if (ns <= 0)
+		return 0;
+	/* bytes per ns * 1000 is MB/s */
+	return div64_u64(bytes * 1000, ns);
+}
+
+static unsigned int bench_copy(int op, char *buf, size_t size,
+			       unsigned int src_off, unsigned int dst_off)
+{
+	unsigned int i, loops = max_t(unsigned int, bench_bytes / size, 1);
+	char *src = buf + src_off;
+	char *dst;
+	ktime_t start;
+
+	/* memmove() overlaps by half, memcpy() uses the second buffer */
+	if (op == BENCH_MEMMOVE)
+		dst = buf + size / 2 + dst_off;
+	else
+		dst = buf + BENCH_MAX_SIZE + PAGE_SIZE + dst_off;
+
+	start = ktime_get();
+	if (op == BENCH_MEMMOVE)
+		for (i = 0; i < loops; i++)
+			memmove(dst, src, size);
+	else
+		for (i = 0; i < loops; i++)
+			memcpy(dst, src, size);
+
+	return bench_rate((u64)loops * size,
+			  ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+static unsigned int bench_copy_page(char *buf)
+{
+	unsigned int i, loops = max_t(unsigned int, bench_bytes / PAGE_SIZE, 1);
+	void *from = (void *)PAGE_ALIGN((unsigned long)buf);
+	void *to = from + BENCH_MAX_SIZE;
+	unsigned int page = 0, pages = BENCH_MAX_SIZE / PAGE_SIZE;
+	ktime_t start;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		copy_page(to + page * PAGE_SIZE, from + page * PAGE_SIZE);
+		if (++page == pages)
+			page = 0;
+	}
+
+	return bench_rate((u64)loops * PAGE_SIZE,
+			  ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+static int __init copy_bench_init(void)
+{
+	size_t size;
+	char *buf;
+
+	/* two copy areas, plus slack for the page aligned copy_page() run */
+	buf = vmalloc(2 * (BENCH_MAX_SIZE + PAGE_SIZE));
+	if (!buf)
+		return -ENOMEM;
+	memset(buf, 0x5a, 2 * (BENCH_MAX_SIZE + PAGE_SIZE));
+
+	printk(KERN_INFO "copy_bench: MB/s over %u bytes per measurement\n",
+	       bench_bytes);
+	printk(KERN_INFO "copy_bench: %6s %10s %10s %10s %10s\n", "size",
+	       "memcpy", "memcpy+1", "memmove", "memmove+1");
+
+	for (size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size <<= 1) {
+		printk(KERN_INFO "copy_bench: %6zu %10u %10u %10u %10u\n",
+		       size,
+		       bench_copy(BENCH_MEMCPY, buf, size, 0, 0),
+		       bench_copy(BENCH_MEMCPY, buf, size, 1, 3),
+		       bench_copy(BENCH_MEMMOVE, buf, size, 0, 0),
+		       bench_copy(BENCH_MEMMOVE, buf, size, 1, 3));
+		cond_resched();
+	}
+
+	printk(KERN_INFO "copy_bench: copy_page %u\n", bench_copy_page(buf));
+
+	vfree(buf);
+	return 0;
+}
+
+static void __exit copy_bench_exit(void)
+{
+}
+
+module_init(copy_bench_init);
+module_exit(copy_bench_exit);
+
+MODULE_DESCRIPTION("memcpy/memmove/copy_page throughput benchmark");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,93 @@
+/*
+ *  linux/arch/arm/lib/copy_neon.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ *  Selects between the ldm/stm and NEON memory copy routines.
+ *
+ *  memcpy.S hands every copy of 1KB or more to memcpy_large(), and
+ *  copy_page() always comes through here.  NEON is only used when the
+ *  boot time CPU check enabled it, and only from process context with
+ *  interrupts on: kernel_neon_begin() may have to save a user task's
+ *  VFP registers, and the power collapse paths call memcpy() with
+ *  interrupts off and the VFP unit possibly unpowered.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/hardirq.h>
+#include <linux/irqflags.h>
+#include <asm/cputype.h>
+#include <asm/hwcap.h>
+#include <asm/neon.h>
+#include <asm/page.h>
+
+extern void *__memcpy_arm(void *dest, const void *src, size_t n);
+extern void __memcpy_neon(void *dest, const void *src, size_t n);
+extern void __copy_page_arm(void *to, const void *from);
+extern void __copy_page_neon(void *to, const void *from);
+
+/* -1 leaves the choice to copy_neon_init() */
+static int enable = -1;
+module_param(enable, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(enable, "Use NEON for large memcpy() and copy_page()");
+
+/* set once the VFP unit is known to be up and to implement NEON */
+static int neon_present;
+
+static inline int neon_copy_usable(void)
+{
+	return neon_present && enable > 0 &&
+	       !in_interrupt() && !irqs_disabled();
+}
+
+void *memcpy_large(void *dest, const void *src, size_t n)
+{
+	if (!neon_copy_usable())
+		return __memcpy_arm(dest, src, n);
+
+	kernel_neon_begin();
+	__memcpy_neon(dest, src, n);
+	kernel_neon_end();
+	return dest;
+}
+
+void copy_page(void *to, const void *from)
+{
+	if (!neon_copy_usable()) {
+		__copy_page_arm(to, from);
+		return;
+	}
+
+	kernel_neon_begin();
+	__copy_page_neon(to, from);
+	kernel_neon_end();
+}
+
+/*
+ * Scorpion (and later Qualcomm cores) and Cortex-A8 stream noticeably
+ * faster through NEON than through ldm/stm.  Cortex-A9 and A5 do about
+ * as well with the ARM routines, which avoids the VFP context save, so
+ * they are left alone.
+ */
+static int __init copy_neon_init(void)
+{
+	unsigned int id = read_cpuid_id();
+
+	/* HWCAP_NEON is set by vfp_init(), which is a plain late_initcall */
+	if (!(elf_hwcap & HWCAP_NEON))
+		return 0;
+
+	if (enable < 0)
+		enable = (id & 0xff000000) == 0x51000000 ||
+			 (id & 0xff00fff0) == 0x4100c080;
+	neon_present = 1;
+
+	printk(KERN_INFO "NEON memory copies %s (cpu id %08x)\n",
+	       enable > 0 ? "enabled" : "disabled", id);
+	return 0;
+}
+late_initcall_sync(copy_neon_init);
@@ -22,12 +22,15 @@
 
 #define DEBUG
 
+#include <linux/completion.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/platform_device.h>
 #include <linux/sched.h>
 #include <linux/skbuff.h>
+#include <linux/slab.h>
 #include <linux/wakelock.h>
 #include <linux/debugfs.h>
 
@@ -43,11 +46,49 @@
 #define SDIO_MUX_HDR_CMD_OPEN    1
 #define SDIO_MUX_HDR_CMD_CLOSE   2
 
+/* per channel tx queue depth, in packets */
+#define SDIO_MUX_TX_HIGH_WATERMARK	64
+#define SDIO_MUX_TX_LOW_WATERMARK	16
+
+/* bounds for a single aggregated transfer, in bytes */
+#define SDIO_MUX_AGG_MIN	4096
+#define SDIO_MUX_AGG_MAX	16384
+
+#define SDIO_MUX_LOOPBACK_AVAIL	SDIO_MUX_AGG_MAX
 
 static int msm_sdio_dmux_debug_enable;
 module_param_named(debug_enable, msm_sdio_dmux_debug_enable,
 		   int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/*
+ * In aggregation mode the write worker packs the frames queued on all
+ * channels back to back into one SDIO transfer.  The transfer goes out
+ * once agg_size bytes are pending or agg_delay_us after the first frame
+ * was queued, whichever comes first.  The mux header of every frame is
+ * kept, so the remote end parses the transfer as an ordinary stream.
+ */
+static int msm_sdio_dmux_agg_enable;
+module_param_named(agg_enable, msm_sdio_dmux_agg_enable,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+static int msm_sdio_dmux_agg_size = 8192;
+module_param_named(agg_size, msm_sdio_dmux_agg_size,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+static int msm_sdio_dmux_agg_delay_us = 500;
+module_param_named(agg_delay_us, msm_sdio_dmux_agg_delay_us,
+		   int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+/*
+ * Loopback hands every transfer straight back to the read worker instead
+ * of the SDIO channel, so OPEN commands and data frames come back on the
+ * channel that sent them.  The SDIO channel is then never opened, so
+ * this can only be chosen at boot (sdio_dmux.loopback=1).
+ */
+static int msm_sdio_dmux_loopback;
+module_param_named(loopback, msm_sdio_dmux_loopback,
+		   int, S_IRUGO);
+
 #if defined(DEBUG)
 static uint32_t sdio_dmux_read_cnt;
 static uint32_t sdio_dmux_write_cnt;
@@ -94,7 +135,7 @@ struct sdio_ch_info {
 	void (*write_done)(void *, struct sk_buff *);
 	void *priv;
 	spinlock_t lock;
-	struct sk_buff *skb;
+	struct sk_buff_head tx_q;
 };
 
 static struct sdio_channel *sdio_mux_ch;
@@ -128,6 +169,16 @@ static struct workqueue_struct *sdio_mux_read_workqueue;
 static struct workqueue_struct *sdio_mux_write_workqueue;
 static struct sdio_partial_pkt_info sdio_partial_pkt;
 
+static struct hrtimer sdio_mux_agg_timer;
+static atomic_t sdio_mux_tx_pending_bytes = ATOMIC_INIT(0);
+static void *sdio_mux_agg_buf;
+static struct sk_buff_head sdio_mux_loopback_q;
+
+static uint32_t sdio_mux_tx_xfers;
+static uint32_t sdio_mux_tx_pkts;
+static uint32_t sdio_mux_rx_reads;
+static uint32_t sdio_mux_rx_pkts;
+
 #define sdio_ch_is_open(x)						\
 	(sdio_ch[(x)].status == (SDIO_CH_LOCAL_OPEN | SDIO_CH_REMOTE_OPEN))
 
@@ -197,6 +248,7 @@ static void *handle_sdio_mux_data(struct sdio_mux_hdr *hdr,
 	}
 
 	skb_set_data(skb, (unsigned char *)(hdr + 1), hdr->pkt_len);
+	sdio_mux_rx_pkts++;
 	DBG("%s: head %p data %p tail %p end %p len %d\n",
 	    __func__, skb->head, skb->data, skb->tail, skb->end, skb->len);
 
@@ -270,6 +322,27 @@ static void *handle_sdio_partial_pkt(struct sk_buff *skb_mux)
 	return rp;
 }
 
+static void sdio_mux_parse(struct sdio_mux_hdr *hdr, struct sk_buff *skb_mux)
+{
+	/* probably do skb_pull instead of pointer adjustment */
+	while ((void *)hdr < (void *)skb_mux->tail) {
+
+		if (((void *)hdr + sizeof(*hdr)) > (void *)skb_mux->tail) {
+			/* handle partial header */
+			sdio_mux_save_partial_pkt(hdr, skb_mux);
+			break;
+		}
+
+		if (hdr->magic_num != SDIO_MUX_HDR_MAGIC_NO) {
+			pr_err("%s: packet error\n", __func__);
+			break;
+		}
+
+		hdr = handle_sdio_mux_command(hdr, skb_mux);
+	}
+	dev_kfree_skb_any(skb_mux);
+}
+
 static void sdio_mux_read_data(struct work_struct *work)
 {
 	struct sk_buff *skb_mux;
@@ -277,6 +350,20 @@ static void sdio_mux_read_data(struct work_struct *work)
 	int sz, rc, len = 0;
 	struct sdio_mux_hdr *hdr;
 
+	/*
+	 * Looped back transfers always hold whole frames, so they are
+	 * parsed on their own and never touch the partial packet state.
+	 */
+	skb_mux = skb_dequeue(&sdio_mux_loopback_q);
+	if (skb_mux) {
+		sdio_mux_rx_reads++;
+		sdio_mux_parse((struct sdio_mux_hdr *)skb_mux->data, skb_mux);
+		queue_work(sdio_mux_read_workqueue, &work_sdio_mux_read);
+		return;
+	}
+	if (msm_sdio_dmux_loopback)
+		return;
+
 	DBG("%s: reading\n", __func__);
 	/* should probably have a separate read lock */
 	mutex_lock(&sdio_mux_lock);
@@ -332,32 +419,44 @@ static void sdio_mux_read_data(struct work_struct *work)
 	mutex_unlock(&sdio_mux_lock);
 
 	DBG_INC_READ_CNT(sz);
+	sdio_mux_rx_reads++;
 	DBG("%s: head %p data %p tail %p end %p len %d\n", __func__,
 	    skb_mux->head, skb_mux->data, skb_mux->tail,
 	    skb_mux->end, skb_mux->len);
 
-	/* move to a separate function */
-	/* probably do skb_pull instead of pointer adjustment */
+	/*
+	 * A read may carry several frames, aggregated by the remote end,
+	 * and may end in the middle of one.
+	 */
 	hdr = handle_sdio_partial_pkt(skb_mux);
-	while ((void *)hdr < (void *)skb_mux->tail) {
+	sdio_mux_parse(hdr, skb_mux);
 
-		if (((void *)hdr + sizeof(*hdr)) > (void *)skb_mux->tail) {
-			/* handle partial header */
-			sdio_mux_save_partial_pkt(hdr, skb_mux);
-			break;
-		}
+	DBG("%s: read done\n", __func__);
+	queue_work(sdio_mux_read_workqueue, &work_sdio_mux_read);
+}
 
-		if (hdr->magic_num != SDIO_MUX_HDR_MAGIC_NO) {
-			pr_err("%s: packet error\n", __func__);
-			break;
-		}
+static int sdio_mux_write_avail(void)
+{
+	if (msm_sdio_dmux_loopback)
+		return SDIO_MUX_LOOPBACK_AVAIL;
+	return sdio_write_avail(sdio_mux_ch);
+}
 
-		hdr = handle_sdio_mux_command(hdr, skb_mux);
-	}
-	dev_kfree_skb_any(skb_mux);
+/* called with sdio_mux_lock held */
+static int sdio_mux_xfer(void *data, int len)
+{
+	struct sk_buff *skb;
 
-	DBG("%s: read done\n", __func__);
+	if (!msm_sdio_dmux_loopback)
+		return sdio_write(sdio_mux_ch, data, len);
+
+	skb = __dev_alloc_skb(len, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+	memcpy(skb_put(skb, len), data, len);
+	skb_queue_tail(&sdio_mux_loopback_q, skb);
 	queue_work(sdio_mux_read_workqueue, &work_sdio_mux_read);
+	return 0;
 }
 
 static int sdio_mux_write(struct sk_buff *skb)
@@ -365,15 +464,17 @@ static int sdio_mux_write(struct sk_buff *skb)
 	int rc, sz;
 
 	mutex_lock(&sdio_mux_lock);
-	sz = sdio_write_avail(sdio_mux_ch);
+	sz = sdio_mux_write_avail();
 	DBG("%s: avail %d len %d\n", __func__, sz, skb->len);
 	if (skb->len <= sz) {
-		rc = sdio_write(sdio_mux_ch, skb->data, skb->len);
+		rc = sdio_mux_xfer(skb->data, skb->len);
 		DBG("%s: write returned %d\n", __func__, rc);
 		if (rc)
 			rc = -EAGAIN;
-		else
+		else {
 			DBG_INC_WRITE_CNT(skb->len);
+			sdio_mux_tx_xfers++;
+		}
 	} else
 		rc = -ENOMEM;
 
@@ -386,13 +487,14 @@ static int sdio_mux_write_cmd(void *data, uint32_t len)
 	int avail, rc;
 	for (;;) {
 		mutex_lock(&sdio_mux_lock);
-		avail = sdio_write_avail(sdio_mux_ch);
+		avail = sdio_mux_write_avail();
 		DBG("%s: avail %d len %d\n", __func__, avail, len);
 		if (avail >= len) {
-			rc = sdio_write(sdio_mux_ch, data, len);
+			rc = sdio_mux_xfer(data, len);
 			DBG("%s: write returned %d\n", __func__, rc);
 			if (!rc) {
 				DBG_INC_WRITE_CNT(len);
+				sdio_mux_tx_xfers++;
 				break;
 			}
 		}
@@ -403,30 +505,155 @@ static int sdio_mux_write_cmd(void *data, uint32_t len)
 	return 0;
 }
 
-static void sdio_mux_write_data(struct work_struct *work)
+/*
+ * Write the queued frames one transfer each, round robin over the
+ * channels.  Returns non-zero if the worker should run again.
+ */
+static int sdio_mux_write_queued(void)
 {
-	int i, rc, reschedule = 0;
+	int i, rc, progress, reschedule = 0;
 	struct sk_buff *skb;
 	unsigned long flags;
 
-	for (i = 0; i < SDIO_DMUX_NUM_CHANNELS; ++i) {
-		spin_lock_irqsave(&sdio_ch[i].lock, flags);
-		if (sdio_ch_is_local_open(i) && sdio_ch[i].skb) {
-			skb = sdio_ch[i].skb;
+	do {
+		progress = 0;
+		for (i = 0; i < SDIO_DMUX_NUM_CHANNELS; ++i) {
+			spin_lock_irqsave(&sdio_ch[i].lock, flags);
+			skb = NULL;
+			if (sdio_ch_is_local_open(i))
+				skb = skb_peek(&sdio_ch[i].tx_q);
 			spin_unlock_irqrestore(&sdio_ch[i].lock, flags);
+			if (!skb)
+				continue;
+
 			DBG("%s: writing for ch %d\n", __func__, i);
 			rc = sdio_mux_write(skb);
 			if (rc == -EAGAIN) {
 				reschedule = 1;
 			} else if (!rc) {
+				atomic_sub(skb->len,
+					   &sdio_mux_tx_pending_bytes);
+				sdio_mux_tx_pkts++;
 				spin_lock_irqsave(&sdio_ch[i].lock, flags);
-				sdio_ch[i].skb = NULL;
+				__skb_unlink(skb, &sdio_ch[i].tx_q);
 				sdio_ch[i].write_done(sdio_ch[i].priv, skb);
 				spin_unlock_irqrestore(&sdio_ch[i].lock, flags);
+				progress = 1;
+			}
+		}
+	} while (progress);
+
+	return reschedule;
+}
+
+/*
+ * Pack as many queued frames as fit in limit bytes into the aggregation
+ * buffer, taking one frame per channel per round so that a busy channel
+ * cannot starve the others.  The frames are moved onto done[].
+ */
+static int sdio_mux_agg_fill(struct sk_buff_head *done, int limit)
+{
+	int i, more, len = 0;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	do {
+		more = 0;
+		for (i = 0; i < SDIO_DMUX_NUM_CHANNELS; ++i) {
+			spin_lock_irqsave(&sdio_ch[i].lock, flags);
+			skb = NULL;
+			if (sdio_ch_is_local_open(i)) {
+				skb = skb_peek(&sdio_ch[i].tx_q);
+				if (skb && len + skb->len <= limit)
+					__skb_unlink(skb, &sdio_ch[i].tx_q);
+				else
+					skb = NULL;
 			}
-		} else
 			spin_unlock_irqrestore(&sdio_ch[i].lock, flags);
+			if (!skb)
+				continue;
+
+			memcpy(sdio_mux_agg_buf + len, skb->data, skb->len);
+			len += skb->len;
+			__skb_queue_tail(&done[i], skb);
+			more = 1;
+		}
+	} while (more);
+
+	return len;
+}
+
+static int sdio_mux_write_aggregated(void)
+{
+	struct sk_buff_head done[SDIO_DMUX_NUM_CHANNELS];
+	struct sk_buff *skb;
+	unsigned long flags;
+	int i, rc, len, limit;
+
+	for (i = 0; i < SDIO_DMUX_NUM_CHANNELS; ++i)
+		__skb_queue_head_init(&done[i]);
+
+	for (;;) {
+		limit = clamp(msm_sdio_dmux_agg_size,
+			      SDIO_MUX_AGG_MIN, SDIO_MUX_AGG_MAX);
+
+		mutex_lock(&sdio_mux_lock);
+		limit = min(limit, sdio_mux_write_avail());
+		len = sdio_mux_agg_fill(done, limit);
+		if (!len) {
+			mutex_unlock(&sdio_mux_lock);
+			/* nothing left, or the head frame does not fit */
+			return sdio_mux_write_queued();
+		}
+
+		rc = sdio_mux_xfer(sdio_mux_agg_buf, len);
+		DBG("%s: write %d returned %d\n", __func__, len, rc);
+		if (!rc) {
+			DBG_INC_WRITE_CNT(len);
+			sdio_mux_tx_xfers++;
+		}
+		mutex_unlock(&sdio_mux_lock);
+
+		for (i = 0; i < SDIO_DMUX_NUM_CHANNELS; ++i) {
+			if (skb_queue_empty(&done[i]))
+				continue;
+
+			spin_lock_irqsave(&sdio_ch[i].lock, flags);
+			if (rc) {
+				/* put them back in order for the retry */
+				skb_queue_splice_init(&done[i],
+						      &sdio_ch[i].tx_q);
+			} else {
+				while ((skb = __skb_dequeue(&done[i]))) {
+					atomic_sub(skb->len,
+						   &sdio_mux_tx_pending_bytes);
+					sdio_mux_tx_pkts++;
+					sdio_ch[i].write_done(sdio_ch[i].priv,
+							      skb);
+				}
+			}
+			spin_unlock_irqrestore(&sdio_ch[i].lock, flags);
+		}
+
+		if (rc)
+			return 1;
 	}
+}
+
+static enum hrtimer_restart sdio_mux_agg_timer_func(struct hrtimer *timer)
+{
+	queue_work(sdio_mux_write_workqueue, &work_sdio_mux_write);
+	return HRTIMER_NORESTART;
+}
+
+static void sdio_mux_write_data(struct work_struct *work)
+{
+	int reschedule;
+
+	if (msm_sdio_dmux_agg_enable && sdio_mux_agg_buf)
+		reschedule = sdio_mux_write_aggregated();
+	else
+		reschedule = sdio_mux_write_queued();
 
 	/* probably should use delayed work */
 	if (reschedule)
@@ -439,6 +666,7 @@ int msm_sdio_dmux_write(uint32_t id, struct sk_buff *skb)
 	struct sdio_mux_hdr *hdr;
 	unsigned long flags;
 	struct sk_buff *new_skb;
+	int pending;
 
 	if (id >= SDIO_DMUX_NUM_CHANNELS)
 		return -EINVAL;
@@ -455,9 +683,9 @@ int msm_sdio_dmux_write(uint32_t id, struct sk_buff *skb)
 		goto write_done;
 	}
 
-	if (sdio_ch[id].skb) {
-		pr_err("%s: packet pending ch: %d\n", __func__, id);
-		rc = -EPERM;
+	if (skb_queue_len(&sdio_ch[id].tx_q) >= SDIO_MUX_TX_HIGH_WATERMARK) {
+		DBG("%s: tx queue full ch: %d\n", __func__, id);
+		rc = -EAGAIN;
 		goto write_done;
 	}
 
@@ -494,14 +722,45 @@ int msm_sdio_dmux_write(uint32_t id, struct sk_buff *skb)
 	DBG("%s: data %p, tail %p skb len %d pkt len %d pad len %d\n",
 	    __func__, skb->data, skb->tail, skb->len,
 	    hdr->pkt_len, hdr->pad_len);
-	sdio_ch[id].skb = skb;
-	queue_work(sdio_mux_write_workqueue, &work_sdio_mux_write);
+	__skb_queue_tail(&sdio_ch[id].tx_q, skb);
+
+	/* hold small writes back until there is enough to aggregate */
+	pending = atomic_add_return(skb->len, &sdio_mux_tx_pending_bytes);
+	if (msm_sdio_dmux_agg_enable && pending < msm_sdio_dmux_agg_size) {
+		if (!hrtimer_active(&sdio_mux_agg_timer))
+			hrtimer_start(&sdio_mux_agg_timer,
+				ktime_set(0, msm_sdio_dmux_agg_delay_us *
+					  NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+	} else
+		queue_work(sdio_mux_write_workqueue, &work_sdio_mux_write);
 
 write_done:
 	spin_unlock_irqrestore(&sdio_ch[id].lock, flags);
 	return rc;
 }
 
+/*
+ * Queue depth checks for flow control.  These are lockless so that they
+ * can be called from the write_done callback, which runs under the
+ * channel lock.
+ */
+int msm_sdio_dmux_is_ch_full(uint32_t id)
+{
+	if (id >= SDIO_DMUX_NUM_CHANNELS)
+		return -EINVAL;
+
+	return skb_queue_len(&sdio_ch[id].tx_q) >= SDIO_MUX_TX_HIGH_WATERMARK;
+}
+
+int msm_sdio_dmux_is_ch_low(uint32_t id)
+{
+	if (id >= SDIO_DMUX_NUM_CHANNELS)
+		return -EINVAL;
+
+	return skb_queue_len(&sdio_ch[id].tx_q) <= SDIO_MUX_TX_LOW_WATERMARK;
+}
+
 int msm_sdio_dmux_open(uint32_t id, void *priv,
 			void (*receive_cb)(void *, struct sk_buff *),
 			void (*write_done)(void *, struct sk_buff *))
@@ -554,7 +813,7 @@ int msm_sdio_dmux_close(uint32_t id)
 		return -ENODEV;
 	spin_lock_irqsave(&sdio_ch[id].lock, flags);
 
-	if (sdio_ch[id].skb) {
+	if (!skb_queue_empty(&sdio_ch[id].tx_q)) {
 		spin_unlock_irqrestore(&sdio_ch[id].lock, flags);
 		return -EINVAL;
 	}
@@ -608,6 +867,28 @@ static int debug_tbl(char *buf, int max)
 	return i;
 }
 
+static int debug_stats(char *buf, int max)
+{
+	int i = 0;
+	int j;
+
+	i += scnprintf(buf + i, max - i,
+		"tx transfers=%u  tx packets=%u  pending bytes=%d\n"
+		"rx reads=%u  rx packets=%u\n"
+		"aggregation=%s  loopback=%s\n",
+		sdio_mux_tx_xfers, sdio_mux_tx_pkts,
+		atomic_read(&sdio_mux_tx_pending_bytes),
+		sdio_mux_rx_reads, sdio_mux_rx_pkts,
+		msm_sdio_dmux_agg_enable ? "Y" : "N",
+		msm_sdio_dmux_loopback ? "Y" : "N");
+
+	for (j = 0; j < SDIO_DMUX_NUM_CHANNELS; ++j)
+		i += scnprintf(buf + i, max - i, "ch%02d  tx queued=%u\n",
+			j, skb_queue_len(&sdio_ch[j].tx_q));
+
+	return i;
+}
+
 #define DEBUG_BUFMAX 4096
 static char debug_buffer[DEBUG_BUFMAX];
 
@@ -638,6 +919,166 @@ static void debug_create(const char *name, mode_t mode,
 	debugfs_create_file(name, mode, dent, fill, &debug_ops);
 }
 
+/*
+ * Loopback self test.  Every channel nobody has open sends frames of
+ * assorted lengths, held back until enough are pending to fill whole
+ * aggregated transfers.  Each frame must come back once, intact and in
+ * order, on the channel that sent it, and it must take fewer transfers
+ * than frames.  Meant to be run on an otherwise idle mux.
+ */
+#define SDIO_MUX_TEST_FRAMES	48
+
+struct sdio_mux_test_ch {
+	uint32_t id;
+	int received;
+	int errors;
+	struct completion done;
+};
+
+static struct sdio_mux_test_ch sdio_mux_test_ch[SDIO_DMUX_NUM_CHANNELS];
+static DEFINE_MUTEX(sdio_mux_test_lock);
+
+static int sdio_mux_test_len(uint32_t id, int n)
+{
+	/* odd lengths too, so that the padding is exercised */
+	return 1 + (n * 97 + id * 31) % 1500;
+}
+
+static void sdio_mux_test_receive(void *priv, struct sk_buff *skb)
+{
+	struct sdio_mux_test_ch *t = priv;
+	int i, n = t->received;
+
+	if (skb->len != sdio_mux_test_len(t->id, n)) {
+		t->errors++;
+	} else {
+		for (i = 0; i < skb->len; i++)
+			if (skb->data[i] != (uint8_t)(n + i)) {
+				t->errors++;
+				break;
+			}
+	}
+	dev_kfree_skb_any(skb);
+
+	if (++t->received == SDIO_MUX_TEST_FRAMES)
+		complete(&t->done);
+}
+
+static void sdio_mux_test_write_done(void *priv, struct sk_buff *skb)
+{
+	dev_kfree_skb_any(skb);
+}
+
+static int sdio_mux_test_send(struct sdio_mux_test_ch *t, int n)
+{
+	struct sk_buff *skb;
+	int i, len = sdio_mux_test_len(t->id, n);
+
+	skb = dev_alloc_skb(sizeof(struct sdio_mux_hdr) + len + 3);
+	if (!skb)
+		return -ENOMEM;
+	skb_reserve(skb, sizeof(struct sdio_mux_hdr));
+	for (i = 0; i < len; i++)
+		*(uint8_t *)skb_put(skb, 1) = n + i;
+
+	if (msm_sdio_dmux_write(t->id, skb)) {
+		dev_kfree_skb_any(skb);
+		return -EIO;
+	}
+	return 0;
+}
+
+static int sdio_mux_loopback_test(char *buf, int max)
+{
+	int agg_enable, agg_size, agg_delay_us;
+	int i, j, nch = 0, frames = 0, lost = 0, errors = 0;
+	uint32_t xfers;
+
+	if (!sdio_mux_initialized || !msm_sdio_dmux_loopback)
+		return scnprintf(buf, max, "loopback not enabled\n");
+
+	mutex_lock(&sdio_mux_test_lock);
+	for (i = 0; i < SDIO_DMUX_NUM_CHANNELS; ++i) {
+		struct sdio_mux_test_ch *t = &sdio_mux_test_ch[nch];
+
+		if (sdio_ch_is_local_open(i))
+			continue;
+		t->id = i;
+		t->received = 0;
+		t->errors = 0;
+		init_completion(&t->done);
+		msm_sdio_dmux_open(i, t, sdio_mux_test_receive,
+				   sdio_mux_test_write_done);
+		nch++;
+	}
+	if (!nch) {
+		mutex_unlock(&sdio_mux_test_lock);
+		return scnprintf(buf, max, "no free channel\n");
+	}
+
+	/* only flush full transfers, the timer picks up the tail */
+	agg_enable = msm_sdio_dmux_agg_enable;
+	agg_size = msm_sdio_dmux_agg_size;
+	agg_delay_us = msm_sdio_dmux_agg_delay_us;
+	msm_sdio_dmux_agg_size = SDIO_MUX_AGG_MAX;
+	msm_sdio_dmux_agg_delay_us = 10000;
+	msm_sdio_dmux_agg_enable = 1;
+	xfers = sdio_mux_tx_xfers;
+
+	for (j = 0; j < SDIO_MUX_TEST_FRAMES; j++)
+		for (i = 0; i < nch; i++)
+			if (!sdio_mux_test_send(&sdio_mux_test_ch[i], j))
+				frames++;
+			else
+				sdio_mux_test_ch[i].errors++;
+
+	for (i = 0; i < nch; i++) {
+		struct sdio_mux_test_ch *t = &sdio_mux_test_ch[i];
+
+		wait_for_completion_timeout(&t->done, 5 * HZ);
+		lost += SDIO_MUX_TEST_FRAMES - t->received;
+		errors += t->errors;
+	}
+	xfers = sdio_mux_tx_xfers - xfers;
+
+	msm_sdio_dmux_agg_enable = agg_enable;
+	msm_sdio_dmux_agg_size = agg_size;
+	msm_sdio_dmux_agg_delay_us = agg_delay_us;
+
+	for (i = 0; i < nch; i++) {
+		/* the last frames may not have been unqueued yet */
+		for (j = 0; j < 100; j++) {
+			if (msm_sdio_dmux_close(sdio_mux_test_ch[i].id) !=
+			    -EINVAL)
+				break;
+			msleep(10);
+		}
+	}
+	mutex_unlock(&sdio_mux_test_lock);
+
+	return scnprintf(buf, max,
+		"channels=%d frames=%d transfers=%u lost=%d errors=%d %s\n",
+		nch, frames, xfers, lost, errors,
+		!lost && !errors && xfers < frames ? "PASS" : "FAIL");
+}
+
+/* only the first read of an open file runs the test */
+static ssize_t debug_loopback_test_read(struct file *file, char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	char result[128];
+	int len;
+
+	if (*ppos)
+		return 0;
+	len = sdio_mux_loopback_test(result, sizeof(result));
+	return simple_read_from_buffer(buf, count, ppos, result, len);
+}
+
+static const struct file_operations debug_loopback_test_ops = {
+	.read = debug_loopback_test_read,
+};
+
 #endif
 
 static int sdio_dmux_probe(struct platform_device *pdev)
@@ -660,15 +1101,31 @@ static int sdio_dmux_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}
 
-	for (rc = 0; rc < SDIO_DMUX_NUM_CHANNELS; ++rc)
+	for (rc = 0; rc < SDIO_DMUX_NUM_CHANNELS; ++rc) {
 		spin_lock_init(&sdio_ch[rc].lock);
+		skb_queue_head_init(&sdio_ch[rc].tx_q);
+	}
+	skb_queue_head_init(&sdio_mux_loopback_q);
+
+	hrtimer_init(&sdio_mux_agg_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sdio_mux_agg_timer.function = sdio_mux_agg_timer_func;
+
+	/* aggregation stays off if the buffer cannot be had */
+	sdio_mux_agg_buf = kmalloc(SDIO_MUX_AGG_MAX, GFP_KERNEL);
+	if (!sdio_mux_agg_buf)
+		pr_err("%s: cannot allocate aggregation buffer\n", __func__);
 
 	wake_lock_init(&sdio_mux_ch_wakelock, WAKE_LOCK_SUSPEND,
 		       "sdio_dmux");
-	rc = sdio_open("SDIO_RMNT", &sdio_mux_ch, NULL, sdio_mux_notify);
+	rc = 0;
+	if (!msm_sdio_dmux_loopback)
+		rc = sdio_open("SDIO_RMNT", &sdio_mux_ch, NULL,
+			       sdio_mux_notify);
 	if (rc < 0) {
 		pr_err("%s: sido open failed %d\n", __func__, rc);
 		wake_lock_destroy(&sdio_mux_ch_wakelock);
+		kfree(sdio_mux_agg_buf);
+		sdio_mux_agg_buf = NULL;
 		destroy_workqueue(sdio_mux_read_workqueue);
 		destroy_workqueue(sdio_mux_write_workqueue);
 		return rc;
@@ -692,9 +1149,16 @@ static int __init sdio_dmux_init(void)
 	struct dentry *dent;
 
 	dent = debugfs_create_dir("sdio_dmux", 0);
-	if (!IS_ERR(dent))
+	if (!IS_ERR(dent)) {
 		debug_create("tbl", 0444, dent, debug_tbl);
+		debug_create("stats", 0444, dent, debug_stats);
+		debugfs_create_file("loopback_test", 0444, dent, NULL,
+				    &debug_loopback_test_ops);
+	}
 #endif
+	/* loopback does not wait for sdio_al to find the channel */
+	if (msm_sdio_dmux_loopback)
+		sdio_dmux_probe(NULL);
 	return platform_driver_register(&sdio_dmux_driver);
 }
 
@@ -15,6 +15,7 @@
 #include <linux/sched.h>
 #include <linux/init.h>
 
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 
@@ -411,6 +412,34 @@ int vfp_flush_context(void)
 	return saved;
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Claim the NEON unit for kernel use.  Whatever VFP context is live in
+ * the registers is saved and ownership dropped, so the next VFP
+ * instruction from user space traps and reloads its state.  Preemption
+ * stays disabled so the kernel's register contents never need saving.
+ */
+void kernel_neon_begin(void)
+{
+	BUG_ON(in_interrupt());
+	preempt_disable();
+
+	vfp_flush_context();
+	fmxr(FPEXC, FPEXC_EN);
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* disable again, as the context switch code expects */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	preempt_enable();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#endif
+
 void vfp_reinit(void)
 {
 	/* ensure we have access to the vfp */
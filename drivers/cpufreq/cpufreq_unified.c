@@ -0,0 +1,1195 @@
+/*
+ * drivers/cpufreq/cpufreq_unified.c
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Based on the interactive governor by Mike Chan (mike@android.com)
+ * and on the smartassV2 governor by Erasmux.
+ *
+ * For a general overview of the unified governor see the relevant part
+ * in Documentation/cpu-freq/governors.txt
+ *
+ */
+
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/cpufreq.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/tick.h>
+#include <linux/time.h>
+#include <linux/timer.h>
+#include <linux/kthread.h>
+#include <linux/input.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/earlysuspend.h>
+#include <asm/cputime.h>
+
+static atomic_t active_count = ATOMIC_INIT(0);
+
+/*
+ * Frequency selection state.  Kept separate from the per-cpu sampling
+ * data so that the replay harness can drive the very same decision code
+ * with a simulated clock.
+ */
+struct unified_state {
+	unsigned int target_freq;
+	unsigned int floor_freq;
+	u64 floor_validate_time;
+	u64 hispeed_validate_time;
+};
+
+struct cpufreq_unified_cpuinfo {
+	struct timer_list cpu_timer;
+	spinlock_t lock;
+	u64 time_in_idle;
+	u64 time_stamp;
+	unsigned int load;
+	struct unified_state state;
+	struct cpufreq_policy *policy;
+	struct cpufreq_frequency_table *freq_table;
+	int governor_enabled;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_unified_cpuinfo, cpuinfo);
+
+/* realtime thread handles frequency changes in both directions */
+static struct task_struct *speedchange_task;
+static cpumask_t speedchange_cpumask;
+static spinlock_t speedchange_cpumask_lock;
+static struct mutex gov_lock;
+
+/******************** Tunable parameters: ********************/
+
+/* Hi speed to bump to from lo speed when load burst (default max) */
+static unsigned int hispeed_freq;
+
+/* Go to hi speed when CPU load at or above this value. */
+#define DEFAULT_GO_HISPEED_LOAD 85
+static unsigned long go_hispeed_load;
+
+/*
+ * Target load per frequency range, "load [freq:load ...]".  The governor
+ * picks the lowest speed at which the current work would run at or below
+ * the target load of that speed.
+ */
+#define DEFAULT_TARGET_LOAD 90
+#define MAX_TARGET_LOADS 8
+static unsigned int target_loads[MAX_TARGET_LOADS * 2 - 1] = {
+	DEFAULT_TARGET_LOAD,
+};
+static int ntarget_loads = 1;
+static spinlock_t target_loads_lock;
+
+/* The minimum amount of time to spend at a frequency before ramping down. */
+#define DEFAULT_MIN_SAMPLE_TIME (80 * USEC_PER_MSEC)
+static unsigned long min_sample_time;
+
+/* The sample rate of the per-cpu load timer. */
+#define DEFAULT_TIMER_RATE (20 * USEC_PER_MSEC)
+static unsigned long timer_rate;
+
+/* Wait this long before raising speed above hispeed. */
+#define DEFAULT_ABOVE_HISPEED_DELAY DEFAULT_TIMER_RATE
+static unsigned long above_hispeed_delay;
+
+/*
+ * Speed to hold for boost_duration us after an input event or a write to
+ * boostpulse (default hispeed_freq).
+ */
+static unsigned int boost_freq;
+#define DEFAULT_BOOST_DURATION (80 * USEC_PER_MSEC)
+static unsigned long boost_duration;
+static u64 boost_until;
+
+/*
+ * Early suspend profile: cap the speed at sleep_max_freq (0 disables the
+ * cap) and use sleep_target_load for every speed while the screen is off.
+ * Hispeed bursts and input boosts are ignored while suspended.
+ */
+static unsigned int sleep_max_freq;
+#define DEFAULT_SLEEP_TARGET_LOAD 95
+static unsigned long sleep_target_load;
+static unsigned int suspended;
+
+/*************** End of tunables ***************/
+
+static int cpufreq_governor_unified(struct cpufreq_policy *policy,
+		unsigned int event);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_UNIFIED
+static
+#endif
+struct cpufreq_governor cpufreq_gov_unified = {
+	.name = "unified",
+	.governor = cpufreq_governor_unified,
+	.max_transition_latency = 10000000,
+	.owner = THIS_MODULE,
+};
+
+static inline u64 unified_now(void)
+{
+	return ktime_to_us(ktime_get());
+}
+
+static unsigned int freq_to_target_load(unsigned int freq)
+{
+	int i;
+	unsigned int ret;
+	unsigned long flags;
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+
+	for (i = 0; i < ntarget_loads - 1 && freq >= target_loads[i + 1];
+	     i += 2)
+		;
+
+	ret = target_loads[i];
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+	return ret;
+}
+
+/*
+ * Lowest table speed within [lo, hi] that is at or above freq, or the
+ * highest one in range if none is.  Returns 0 for an empty range.
+ */
+static unsigned int unified_table_ceil(struct cpufreq_frequency_table *table,
+		unsigned int lo, unsigned int hi, unsigned int freq)
+{
+	unsigned int best = 0;
+	unsigned int below = 0;
+	unsigned int f;
+	int i;
+
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		f = table[i].frequency;
+		if (f == CPUFREQ_ENTRY_INVALID || f < lo || f > hi)
+			continue;
+
+		if (f >= freq) {
+			if (!best || f < best)
+				best = f;
+		} else if (f > below) {
+			below = f;
+		}
+	}
+
+	return best ? best : below;
+}
+
+/*
+ * Speed at which the work seen at cur/load runs at the target load.  The
+ * target load depends on the speed, so iterate until the choice settles.
+ */
+static unsigned int unified_choose_freq(struct cpufreq_frequency_table *table,
+		unsigned int lo, unsigned int hi, unsigned int cur,
+		unsigned int load, int sleeping)
+{
+	unsigned int loadadjfreq = cur * load;
+	unsigned int freq = cur;
+	unsigned int prev;
+	unsigned int tl;
+	int loops = 0;
+
+	do {
+		prev = freq;
+		tl = sleeping ? sleep_target_load : freq_to_target_load(freq);
+		if (!tl)
+			tl = DEFAULT_TARGET_LOAD;
+		freq = unified_table_ceil(table, lo, hi, loadadjfreq / tl);
+	} while (freq && freq != prev && ++loops < 4);
+
+	return freq;
+}
+
+static inline unsigned int unified_hispeed(unsigned int lo, unsigned int hi)
+{
+	unsigned int freq = hispeed_freq ? hispeed_freq : hi;
+
+	return clamp(freq, lo, hi);
+}
+
+static inline unsigned int unified_boost(unsigned int lo, unsigned int hi)
+{
+	return boost_freq ? clamp(boost_freq, lo, hi) :
+		unified_hispeed(lo, hi);
+}
+
+static inline unsigned int unified_max(struct cpufreq_policy *policy)
+{
+	if (suspended && sleep_max_freq && sleep_max_freq < policy->max)
+		return max(sleep_max_freq, policy->min);
+	return policy->max;
+}
+
+/*
+ * unified_next_freq: core speed selection.  Returns the speed the cpu
+ * should run at after a sample of the given load ending at now, and
+ * updates the state.
+ */
+static unsigned int unified_next_freq(struct unified_state *s,
+		struct cpufreq_frequency_table *table,
+		unsigned int lo, unsigned int hi, unsigned int load,
+		u64 now, int boosted, int sleeping)
+{
+	unsigned int cur = s->target_freq;
+	unsigned int hispeed = unified_hispeed(lo, hi);
+	unsigned int new_freq;
+
+	if (!sleeping && (load >= go_hispeed_load || boosted)) {
+		if (cur < hispeed) {
+			new_freq = hispeed;
+		} else {
+			new_freq = unified_choose_freq(table, lo, hi, cur,
+						       load, sleeping);
+			if (new_freq < hispeed)
+				new_freq = hispeed;
+		}
+	} else {
+		new_freq = unified_choose_freq(table, lo, hi, cur, load,
+					       sleeping);
+	}
+
+	if (!new_freq)
+		return cur;
+
+	if (boosted && !sleeping)
+		new_freq = max(new_freq, unified_boost(lo, hi));
+
+	if (cur >= hispeed && new_freq > cur &&
+	    now - s->hispeed_validate_time < above_hispeed_delay)
+		return cur;
+
+	s->hispeed_validate_time = now;
+
+	/*
+	 * Do not scale below the floor speed unless it has been held for
+	 * min_sample_time.
+	 */
+	if (new_freq < s->floor_freq &&
+	    now - s->floor_validate_time < min_sample_time)
+		return cur;
+
+	s->floor_freq = new_freq;
+	s->floor_validate_time = now;
+	s->target_freq = new_freq;
+	return new_freq;
+}
+
+static void unified_queue_speedchange(unsigned int cpu)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	cpumask_set_cpu(cpu, &speedchange_cpumask);
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+	wake_up_process(speedchange_task);
+}
+
+static void unified_timer_resched(struct cpufreq_unified_cpuinfo *pcpu)
+{
+	mod_timer(&pcpu->cpu_timer,
+		  jiffies + usecs_to_jiffies(timer_rate));
+}
+
+static void cpufreq_unified_timer(unsigned long data)
+{
+	struct cpufreq_unified_cpuinfo *pcpu = &per_cpu(cpuinfo, data);
+	unsigned int delta_idle;
+	unsigned int delta_time;
+	unsigned int cpu_load;
+	unsigned int old_freq;
+	unsigned int new_freq;
+	u64 now_idle;
+	u64 now;
+	unsigned long flags;
+
+	smp_rmb();
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	now_idle = get_cpu_idle_time_us(data, &now);
+	delta_idle = (unsigned int) cputime64_sub(now_idle, pcpu->time_in_idle);
+	delta_time = (unsigned int) cputime64_sub(now, pcpu->time_stamp);
+
+	/* If timer ran less than 1ms after the sample started, retry. */
+	if (delta_time < 1000)
+		goto rearm;
+
+	if (delta_idle > delta_time)
+		cpu_load = 0;
+	else
+		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
+
+	spin_lock_irqsave(&pcpu->lock, flags);
+	pcpu->time_in_idle = now_idle;
+	pcpu->time_stamp = now;
+	pcpu->load = cpu_load;
+	old_freq = pcpu->state.target_freq;
+	new_freq = unified_next_freq(&pcpu->state, pcpu->freq_table,
+				     pcpu->policy->min,
+				     unified_max(pcpu->policy), cpu_load, now,
+				     now <= boost_until, suspended);
+	spin_unlock_irqrestore(&pcpu->lock, flags);
+
+	if (new_freq != old_freq)
+		unified_queue_speedchange(data);
+
+rearm:
+	if (!timer_pending(&pcpu->cpu_timer))
+		unified_timer_resched(pcpu);
+}
+
+/*
+ * Raise every enabled cpu to at least the boost speed right away rather
+ * than waiting for its next sample.
+ */
+static void unified_boost_now(void)
+{
+	struct cpufreq_unified_cpuinfo *pcpu;
+	unsigned int freq;
+	unsigned long flags;
+	u64 now;
+	int cpu;
+
+	if (suspended || !boost_duration)
+		return;
+
+	now = unified_now();
+	boost_until = now + boost_duration;
+
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!pcpu->governor_enabled)
+			continue;
+
+		spin_lock_irqsave(&pcpu->lock, flags);
+		freq = unified_boost(pcpu->policy->min,
+				     unified_max(pcpu->policy));
+		if (pcpu->state.target_freq >= freq) {
+			spin_unlock_irqrestore(&pcpu->lock, flags);
+			continue;
+		}
+		pcpu->state.target_freq = freq;
+		pcpu->state.floor_freq = freq;
+		pcpu->state.floor_validate_time = now;
+		pcpu->state.hispeed_validate_time = now;
+		spin_unlock_irqrestore(&pcpu->lock, flags);
+
+		unified_queue_speedchange(cpu);
+	}
+}
+
+static int cpufreq_unified_speedchange_task(void *data)
+{
+	struct cpufreq_unified_cpuinfo *pcpu;
+	struct cpufreq_unified_cpuinfo *pjcpu;
+	unsigned int max_freq;
+	unsigned int cpu, j;
+	cpumask_t tmp_mask;
+	unsigned long flags;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+
+		if (cpumask_empty(&speedchange_cpumask)) {
+			spin_unlock_irqrestore(&speedchange_cpumask_lock,
+					       flags);
+			schedule();
+
+			if (kthread_should_stop())
+				break;
+
+			spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+		}
+
+		set_current_state(TASK_RUNNING);
+		tmp_mask = speedchange_cpumask;
+		cpumask_clear(&speedchange_cpumask);
+		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+		for_each_cpu(cpu, &tmp_mask) {
+			pcpu = &per_cpu(cpuinfo, cpu);
+			smp_rmb();
+
+			if (!pcpu->governor_enabled)
+				continue;
+
+			/* cpus sharing a clock run at the highest request */
+			max_freq = 0;
+			for_each_cpu(j, pcpu->policy->cpus) {
+				pjcpu = &per_cpu(cpuinfo, j);
+				if (pjcpu->governor_enabled &&
+				    pjcpu->state.target_freq > max_freq)
+					max_freq = pjcpu->state.target_freq;
+			}
+
+			if (max_freq && max_freq != pcpu->policy->cur)
+				__cpufreq_driver_target(pcpu->policy, max_freq,
+							CPUFREQ_RELATION_H);
+		}
+	}
+
+	return 0;
+}
+
+/* Input boost */
+
+static void cpufreq_unified_input_event(struct input_handle *handle,
+		unsigned int type, unsigned int code, int value)
+{
+	if (type == EV_SYN)
+		return;
+
+	/* one boost per gesture is enough, skip events inside a boost */
+	if (unified_now() + boost_duration / 2 < boost_until)
+		return;
+
+	unified_boost_now();
+}
+
+static int cpufreq_unified_input_connect(struct input_handler *handler,
+		struct input_dev *dev, const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_unified";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err2;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err1;
+
+	return 0;
+err1:
+	input_unregister_handle(handle);
+err2:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_unified_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_unified_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	}, /* multi-touch touchscreen */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	}, /* touchpad */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	}, /* keys */
+	{ },
+};
+
+static struct input_handler cpufreq_unified_input_handler = {
+	.event		= cpufreq_unified_input_event,
+	.connect	= cpufreq_unified_input_connect,
+	.disconnect	= cpufreq_unified_input_disconnect,
+	.name		= "cpufreq_unified",
+	.id_table	= cpufreq_unified_ids,
+};
+
+/* sysfs */
+
+static ssize_t show_target_loads(struct kobject *kobj,
+				 struct attribute *attr, char *buf)
+{
+	int i;
+	ssize_t ret = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+
+	for (i = 0; i < ntarget_loads; i++)
+		ret += sprintf(buf + ret, "%u%s", target_loads[i],
+			       i & 0x1 ? ":" : " ");
+
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+	buf[ret - 1] = '\n';
+	return ret;
+}
+
+static ssize_t store_target_loads(struct kobject *kobj,
+		struct attribute *attr, const char *buf, size_t count)
+{
+	unsigned int new_loads[MAX_TARGET_LOADS * 2 - 1];
+	const char *cp = buf;
+	unsigned long flags;
+	int ntokens = 0;
+	int i;
+
+	while (ntokens < ARRAY_SIZE(new_loads)) {
+		while (*cp == ' ' || *cp == ':')
+			cp++;
+		if (!*cp || *cp == '\n')
+			break;
+		if (sscanf(cp, "%u", &new_loads[ntokens]) != 1)
+			return -EINVAL;
+		ntokens++;
+		while (*cp && *cp != ' ' && *cp != ':' && *cp != '\n')
+			cp++;
+	}
+
+	/* odd count: load [freq load]..., frequencies ascending */
+	if (!(ntokens & 0x1))
+		return -EINVAL;
+
+	for (i = 0; i < ntokens; i += 2) {
+		if (!new_loads[i] || new_loads[i] > 100)
+			return -EINVAL;
+		if (i >= 4 && new_loads[i - 1] <= new_loads[i - 3])
+			return -EINVAL;
+	}
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+	memcpy(target_loads, new_loads, ntokens * sizeof(unsigned int));
+	ntarget_loads = ntokens;
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+	return count;
+}
+
+static struct global_attr target_loads_attr = __ATTR(target_loads, 0644,
+		show_target_loads, store_target_loads);
+
+#define show_one(name, fmt)						\
+static ssize_t show_##name(struct kobject *kobj,			\
+			   struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, fmt "\n", name);				\
+}
+
+#define store_one(name, lo, hi)						\
+static ssize_t store_##name(struct kobject *kobj,			\
+		struct attribute *attr, const char *buf, size_t count)	\
+{									\
+	unsigned long val;						\
+									\
+	if (strict_strtoul(buf, 0, &val) || val < lo || val > hi)	\
+		return -EINVAL;						\
+	name = val;							\
+	return count;							\
+}
+
+#define define_unified_rw_attr(name, fmt, lo, hi)			\
+show_one(name, fmt)							\
+store_one(name, lo, hi)							\
+static struct global_attr name##_attr =					\
+	__ATTR(name, 0644, show_##name, store_##name)
+
+define_unified_rw_attr(hispeed_freq, "%u", 0, UINT_MAX);
+define_unified_rw_attr(go_hispeed_load, "%lu", 1, 100);
+define_unified_rw_attr(min_sample_time, "%lu", 0, 10 * USEC_PER_SEC);
+define_unified_rw_attr(above_hispeed_delay, "%lu", 0, 10 * USEC_PER_SEC);
+define_unified_rw_attr(timer_rate, "%lu", 1000, USEC_PER_SEC);
+define_unified_rw_attr(boost_freq, "%u", 0, UINT_MAX);
+define_unified_rw_attr(boost_duration, "%lu", 0, 10 * USEC_PER_SEC);
+define_unified_rw_attr(sleep_max_freq, "%u", 0, UINT_MAX);
+define_unified_rw_attr(sleep_target_load, "%lu", 1, 100);
+
+static ssize_t store_boostpulse(struct kobject *kobj,
+		struct attribute *attr, const char *buf, size_t count)
+{
+	unified_boost_now();
+	return count;
+}
+
+static struct global_attr boostpulse_attr = __ATTR(boostpulse, 0200,
+		NULL, store_boostpulse);
+
+static struct attribute *unified_attributes[] = {
+	&hispeed_freq_attr.attr,
+	&go_hispeed_load_attr.attr,
+	&target_loads_attr.attr,
+	&min_sample_time_attr.attr,
+	&above_hispeed_delay_attr.attr,
+	&timer_rate_attr.attr,
+	&boost_freq_attr.attr,
+	&boost_duration_attr.attr,
+	&boostpulse_attr.attr,
+	&sleep_max_freq_attr.attr,
+	&sleep_target_load_attr.attr,
+	NULL,
+};
+
+static struct attribute_group unified_attr_group = {
+	.attrs = unified_attributes,
+	.name = "unified",
+};
+
+static int cpufreq_governor_unified(struct cpufreq_policy *policy,
+		unsigned int event)
+{
+	struct cpufreq_unified_cpuinfo *pcpu;
+	unsigned long flags;
+	unsigned int j;
+	u64 now;
+	int rc;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu))
+			return -EINVAL;
+
+		mutex_lock(&gov_lock);
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->policy = policy;
+			pcpu->freq_table = cpufreq_frequency_get_table(j);
+			if (!pcpu->freq_table) {
+				mutex_unlock(&gov_lock);
+				return -EINVAL;
+			}
+			pcpu->time_in_idle = get_cpu_idle_time_us(j,
+							&pcpu->time_stamp);
+			now = pcpu->time_stamp;
+			pcpu->state.target_freq = policy->cur;
+			pcpu->state.floor_freq = policy->cur;
+			pcpu->state.floor_validate_time = now;
+			pcpu->state.hispeed_validate_time = now;
+			pcpu->governor_enabled = 1;
+			smp_wmb();
+			pcpu->cpu_timer.expires =
+				jiffies + usecs_to_jiffies(timer_rate);
+			add_timer_on(&pcpu->cpu_timer, j);
+		}
+
+		/*
+		 * Do not register the input handler and create sysfs
+		 * entries if we have already done so.
+		 */
+		if (atomic_inc_return(&active_count) > 1) {
+			mutex_unlock(&gov_lock);
+			return 0;
+		}
+
+		rc = sysfs_create_group(cpufreq_global_kobject,
+				&unified_attr_group);
+		if (rc) {
+			mutex_unlock(&gov_lock);
+			return rc;
+		}
+
+		rc = input_register_handler(&cpufreq_unified_input_handler);
+		if (rc)
+			pr_warning("%s: failed to register input handler %d\n",
+				   __func__, rc);
+
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		mutex_lock(&gov_lock);
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->governor_enabled = 0;
+			smp_wmb();
+			del_timer_sync(&pcpu->cpu_timer);
+		}
+
+		if (atomic_dec_return(&active_count) > 0) {
+			mutex_unlock(&gov_lock);
+			return 0;
+		}
+
+		input_unregister_handler(&cpufreq_unified_input_handler);
+		sysfs_remove_group(cpufreq_global_kobject,
+				&unified_attr_group);
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->max, CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->min, CPUFREQ_RELATION_L);
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			spin_lock_irqsave(&pcpu->lock, flags);
+			pcpu->state.target_freq = policy->cur;
+			pcpu->state.floor_freq = policy->cur;
+			spin_unlock_irqrestore(&pcpu->lock, flags);
+		}
+		break;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_HAS_EARLYSUSPEND
+/* Early suspend profile */
+
+static void unified_early_suspend(struct early_suspend *handler)
+{
+	struct cpufreq_unified_cpuinfo *pcpu;
+	unsigned int cap;
+	unsigned long flags;
+	int cpu;
+
+	suspended = 1;
+	smp_wmb();
+
+	if (!sleep_max_freq)
+		return;
+
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!pcpu->governor_enabled)
+			continue;
+
+		spin_lock_irqsave(&pcpu->lock, flags);
+		cap = unified_max(pcpu->policy);
+		if (pcpu->state.target_freq <= cap) {
+			spin_unlock_irqrestore(&pcpu->lock, flags);
+			continue;
+		}
+		pcpu->state.target_freq = cap;
+		pcpu->state.floor_freq = cap;
+		spin_unlock_irqrestore(&pcpu->lock, flags);
+
+		unified_queue_speedchange(cpu);
+	}
+}
+
+static void unified_late_resume(struct early_suspend *handler)
+{
+	suspended = 0;
+	smp_wmb();
+
+	/* the screen coming on is user interaction, boost for it */
+	unified_boost_now();
+}
+
+static struct early_suspend unified_power_suspend = {
+	.suspend = unified_early_suspend,
+	.resume = unified_late_resume,
+};
+#endif
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Replay harness.
+ *
+ * A load trace is written to /sys/kernel/debug/cpufreq_unified/replay as
+ * lines of "<duration_us> <demand> [input]", where demand is the busy
+ * percentage the work would cause at the top speed of cpu0 and a non-zero
+ * third field marks an input event at the start of the sample.  Writing
+ * "reset" discards the trace.  Reading the file replays the trace through
+ * the governor's speed selection with the current tunables, one sample
+ * every timer_rate us, and reports how long the cpu was under-provisioned
+ * after each load step (ramp latency), how much demand went unserved and
+ * the time spent at each speed.
+ */
+
+struct unified_sample {
+	u32 duration;
+	u8 demand;
+	u8 input;
+};
+
+#define REPLAY_MAX_SAMPLES	16384
+#define REPLAY_MAX_FREQS	32
+#define REPLAY_LINE_MAX		64
+
+static struct unified_sample *replay_trace;
+static unsigned int replay_nr;
+static char replay_line[REPLAY_LINE_MAX];
+static unsigned int replay_line_len;
+static DEFINE_MUTEX(replay_lock);
+static struct dentry *unified_debugfs;
+
+struct unified_replay_result {
+	unsigned int nfreqs;
+	unsigned int freqs[REPLAY_MAX_FREQS];
+	u64 time_in_state[REPLAY_MAX_FREQS];
+	u64 total_time;
+	u64 demand_time;
+	u64 unserved_time;
+	u64 freq_time;
+	unsigned int transitions;
+	unsigned int ramps;
+	u64 ramp_total;
+	u64 ramp_max;
+};
+
+static int unified_cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int unified_replay_run(struct unified_replay_result *r)
+{
+	struct cpufreq_frequency_table *table;
+	struct cpufreq_policy *policy;
+	struct unified_state s;
+	unsigned int lo, hi, fmax;
+	unsigned int i, idx, cur, load, new_freq;
+	unsigned int demand, capacity;
+	unsigned int step = timer_rate;
+	u64 now = 0, sim_boost_until = 0, ramp_start = 0;
+	u64 weighted, left, take;
+	unsigned int pos = 0;
+	u32 pos_used = 0;
+	int ramping = 0;
+	int boosted;
+
+	table = cpufreq_frequency_get_table(0);
+	policy = cpufreq_cpu_get(0);
+	if (!table || !policy) {
+		if (policy)
+			cpufreq_cpu_put(policy);
+		return -ENODEV;
+	}
+	lo = policy->min;
+	hi = policy->max;
+	cpufreq_cpu_put(policy);
+
+	memset(r, 0, sizeof(*r));
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		unsigned int f = table[i].frequency;
+
+		if (f == CPUFREQ_ENTRY_INVALID || f < lo || f > hi)
+			continue;
+		if (r->nfreqs == REPLAY_MAX_FREQS)
+			break;
+		r->freqs[r->nfreqs++] = f;
+	}
+	if (!r->nfreqs)
+		return -ENODEV;
+	sort(r->freqs, r->nfreqs, sizeof(unsigned int), unified_cmp_uint,
+	     NULL);
+	fmax = r->freqs[r->nfreqs - 1];
+
+	memset(&s, 0, sizeof(s));
+	s.target_freq = r->freqs[0];
+	s.floor_freq = s.target_freq;
+
+	while (pos < replay_nr) {
+		/* time weighted demand over the next sampling period */
+		weighted = 0;
+		left = step;
+		boosted = 0;
+		while (left && pos < replay_nr) {
+			if (!pos_used && replay_trace[pos].input)
+				boosted = 1;
+			take = min_t(u64, left,
+				     replay_trace[pos].duration - pos_used);
+			weighted += take * replay_trace[pos].demand;
+			left -= take;
+			pos_used += take;
+			if (pos_used >= replay_trace[pos].duration) {
+				pos++;
+				pos_used = 0;
+			}
+		}
+		take = step - left;
+		if (!take)
+			break;
+		demand = div_u64(weighted, take);
+
+		if (boosted && boost_duration) {
+			sim_boost_until = now + boost_duration;
+			if (s.target_freq < unified_boost(lo, fmax)) {
+				s.target_freq = unified_boost(lo, fmax);
+				s.floor_freq = s.target_freq;
+				s.floor_validate_time = now;
+				s.hispeed_validate_time = now;
+				r->transitions++;
+			}
+		}
+
+		cur = s.target_freq;
+		for (idx = 0; idx < r->nfreqs - 1; idx++)
+			if (r->freqs[idx] >= cur)
+				break;
+
+		capacity = cur * 100 / fmax;
+		load = min(100u, demand * fmax / cur);
+
+		r->time_in_state[idx] += take;
+		r->total_time += take;
+		r->freq_time += (u64)cur * take;
+		r->demand_time += (u64)demand * take;
+		if (demand > capacity) {
+			r->unserved_time += (u64)(demand - capacity) * take;
+			if (!ramping) {
+				ramping = 1;
+				ramp_start = now;
+			}
+		} else if (ramping) {
+			ramping = 0;
+			r->ramps++;
+			r->ramp_total += now - ramp_start;
+			r->ramp_max = max(r->ramp_max, now - ramp_start);
+		}
+
+		now += take;
+		new_freq = unified_next_freq(&s, table, lo, fmax, load, now,
+					     now <= sim_boost_until, 0);
+		if (new_freq != cur)
+			r->transitions++;
+	}
+
+	if (ramping) {
+		r->ramps++;
+		r->ramp_total += now - ramp_start;
+		r->ramp_max = max(r->ramp_max, now - ramp_start);
+	}
+
+	return 0;
+}
+
+static int unified_replay_show(struct seq_file *m, void *unused)
+{
+	struct unified_replay_result *r;
+	unsigned int i;
+	int ret;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	mutex_lock(&replay_lock);
+	ret = unified_replay_run(r);
+	seq_printf(m, "samples: %u\n", replay_nr);
+	mutex_unlock(&replay_lock);
+	if (ret)
+		goto out;
+
+	seq_printf(m, "time_us: %llu\n", r->total_time);
+	seq_printf(m, "timer_rate_us: %lu\n", timer_rate);
+	seq_printf(m, "transitions: %u\n", r->transitions);
+	seq_printf(m, "ramps: %u\n", r->ramps);
+	seq_printf(m, "ramp_avg_us: %llu\n",
+		   r->ramps ? div_u64(r->ramp_total, r->ramps) : 0);
+	seq_printf(m, "ramp_max_us: %llu\n", r->ramp_max);
+	seq_printf(m, "unserved_permille: %llu\n", r->demand_time ?
+		   div64_u64(r->unserved_time * 1000, r->demand_time) : 0);
+	seq_printf(m, "avg_khz: %llu\n", r->total_time ?
+		   div64_u64(r->freq_time, r->total_time) : 0);
+	seq_printf(m, "time_in_state:\n");
+	for (i = 0; i < r->nfreqs; i++)
+		seq_printf(m, "%u %llu\n", r->freqs[i], r->time_in_state[i]);
+out:
+	kfree(r);
+	return ret;
+}
+
+static int unified_replay_add_line(char *line)
+{
+	unsigned int duration, demand, input = 0;
+
+	line = strstrip(line);
+	if (!*line || *line == '#')
+		return 0;
+
+	if (!strcmp(line, "reset")) {
+		replay_nr = 0;
+		return 0;
+	}
+
+	if (sscanf(line, "%u %u %u", &duration, &demand, &input) < 2)
+		return -EINVAL;
+	if (!duration || demand > 100)
+		return -EINVAL;
+
+	if (!replay_trace) {
+		replay_trace = vmalloc(REPLAY_MAX_SAMPLES *
+				       sizeof(struct unified_sample));
+		if (!replay_trace)
+			return -ENOMEM;
+	}
+	if (replay_nr == REPLAY_MAX_SAMPLES)
+		return -ENOSPC;
+
+	replay_trace[replay_nr].duration = duration;
+	replay_trace[replay_nr].demand = demand;
+	replay_trace[replay_nr].input = !!input;
+	replay_nr++;
+	return 0;
+}
+
+static ssize_t unified_replay_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	char c;
+	size_t i;
+	int ret = 0;
+
+	mutex_lock(&replay_lock);
+	for (i = 0; i < count; i++) {
+		if (get_user(c, ubuf + i)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (c != '\n') {
+			if (replay_line_len == REPLAY_LINE_MAX - 1) {
+				replay_line_len = 0;
+				ret = -EINVAL;
+				break;
+			}
+			replay_line[replay_line_len++] = c;
+			continue;
+		}
+
+		replay_line[replay_line_len] = '\0';
+		replay_line_len = 0;
+		ret = unified_replay_add_line(replay_line);
+		if (ret)
+			break;
+	}
+	mutex_unlock(&replay_lock);
+
+	return ret ? ret : count;
+}
+
+static int unified_replay_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, unified_replay_show, NULL);
+}
+
+static const struct file_operations unified_replay_fops = {
+	.open		= unified_replay_open,
+	.read		= seq_read,
+	.write		= unified_replay_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void unified_debugfs_init(void)
+{
+	unified_debugfs = debugfs_create_dir("cpufreq_unified", NULL);
+	if (IS_ERR_OR_NULL(unified_debugfs))
+		return;
+
+	debugfs_create_file("replay", 0644, unified_debugfs, NULL,
+			    &unified_replay_fops);
+}
+
+static void unified_debugfs_exit(void)
+{
+	debugfs_remove_recursive(unified_debugfs);
+	vfree(replay_trace);
+}
+#else
+static inline void unified_debugfs_init(void) { }
+static inline void unified_debugfs_exit(void) { }
+#endif /* CONFIG_DEBUG_FS */
+
+static int __init cpufreq_unified_init(void)
+{
+	struct cpufreq_unified_cpuinfo *pcpu;
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	unsigned int i;
+
+	go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
+	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	above_hispeed_delay = DEFAULT_ABOVE_HISPEED_DELAY;
+	timer_rate = DEFAULT_TIMER_RATE;
+	boost_duration = DEFAULT_BOOST_DURATION;
+	sleep_target_load = DEFAULT_SLEEP_TARGET_LOAD;
+
+	/* Initalize per-cpu timers */
+	for_each_possible_cpu(i) {
+		pcpu = &per_cpu(cpuinfo, i);
+		init_timer_deferrable(&pcpu->cpu_timer);
+		pcpu->cpu_timer.function = cpufreq_unified_timer;
+		pcpu->cpu_timer.data = i;
+		spin_lock_init(&pcpu->lock);
+	}
+
+	spin_lock_init(&target_loads_lock);
+	spin_lock_init(&speedchange_cpumask_lock);
+	mutex_init(&gov_lock);
+
+	speedchange_task = kthread_create(cpufreq_unified_speedchange_task,
+					  NULL, "kunified");
+	if (IS_ERR(speedchange_task))
+		return PTR_ERR(speedchange_task);
+
+	sched_setscheduler_nocheck(speedchange_task, SCHED_FIFO, &param);
+	get_task_struct(speedchange_task);
+
+	/* kick the task once so it sleeps in its loop */
+	wake_up_process(speedchange_task);
+
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	register_early_suspend(&unified_power_suspend);
+#endif
+	unified_debugfs_init();
+
+	return cpufreq_register_governor(&cpufreq_gov_unified);
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_UNIFIED
+fs_initcall(cpufreq_unified_init);
+#else
+module_init(cpufreq_unified_init);
+#endif
+
+static void __exit cpufreq_unified_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_unified);
+	unified_debugfs_exit();
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	unregister_early_suspend(&unified_power_suspend);
+#endif
+	kthread_stop(speedchange_task);
+	put_task_struct(speedchange_task);
+}
+
+module_exit(cpufreq_unified_exit);
+
+MODULE_DESCRIPTION("'cpufreq_unified' - A load tracking, input boost aware "
+	"cpufreq governor");
+MODULE_LICENSE("GPL");
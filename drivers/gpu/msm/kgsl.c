@@ -963,6 +963,8 @@ static long kgsl_ioctl_rb_issueibcmds(struct kgsl_device_private *dev_priv,
 	if (result != 0)
 		goto free_ibdesc;
 
+	kgsl_pwrscale_submit(dev_priv->device, param->timestamp);
+
 	/* this is a check to try to detect if a command buffer was freed
 	 * during issueibcmds().
 	 */
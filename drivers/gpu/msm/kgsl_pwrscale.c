@@ -46,6 +46,7 @@ static struct kgsl_pwrscale_policy *kgsl_pwrscale_policies[] = {
 #ifdef CONFIG_MSM_SLEEP_STATS
 	&kgsl_pwrscale_policy_idlestats,
 #endif
+	&kgsl_pwrscale_policy_framepredict,
 	NULL
 };
 
@@ -239,6 +240,15 @@ void kgsl_pwrscale_idle(struct kgsl_device *device)
 }
 EXPORT_SYMBOL(kgsl_pwrscale_idle);
 
+/* Called with the device mutex held after a successful issueibcmds */
+void kgsl_pwrscale_submit(struct kgsl_device *device, unsigned int timestamp)
+{
+	if (device->pwrscale.policy && device->pwrscale.policy->submit)
+		device->pwrscale.policy->submit(device, &device->pwrscale,
+						timestamp);
+}
+EXPORT_SYMBOL(kgsl_pwrscale_submit);
+
 int kgsl_pwrscale_policy_add_files(struct kgsl_device *device,
 				   struct kgsl_pwrscale *pwrscale,
 				   struct attribute_group *attr_group)
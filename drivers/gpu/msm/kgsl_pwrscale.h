@@ -30,6 +30,8 @@ struct kgsl_pwrscale_policy  {
 		struct kgsl_pwrscale *pwrscale);
 	void (*wake)(struct kgsl_device *device,
 		struct kgsl_pwrscale *pwrscale);
+	void (*submit)(struct kgsl_device *device,
+		struct kgsl_pwrscale *pwrscale, unsigned int timestamp);
 };
 
 struct kgsl_pwrscale {
@@ -54,6 +56,7 @@ struct kgsl_pwrscale_policy_attribute {
 
 extern struct kgsl_pwrscale_policy kgsl_pwrscale_policy_tz;
 extern struct kgsl_pwrscale_policy kgsl_pwrscale_policy_idlestats;
+extern struct kgsl_pwrscale_policy kgsl_pwrscale_policy_framepredict;
 
 int kgsl_pwrscale_init(struct kgsl_device *device);
 void kgsl_pwrscale_close(struct kgsl_device *device);
@@ -66,6 +69,7 @@ void kgsl_pwrscale_idle(struct kgsl_device *device);
 void kgsl_pwrscale_busy(struct kgsl_device *device);
 void kgsl_pwrscale_sleep(struct kgsl_device *device);
 void kgsl_pwrscale_wake(struct kgsl_device *device);
+void kgsl_pwrscale_submit(struct kgsl_device *device, unsigned int timestamp);
 
 int kgsl_pwrscale_policy_add_files(struct kgsl_device *device,
 				   struct kgsl_pwrscale *pwrscale,
@@ -0,0 +1,373 @@
+/* Copyright (c) 2011, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Frame based predictive GPU DCVS.
+ *
+ * Command submissions are grouped into frames of one vsync period.  For
+ * every completed frame the busy time reported by the core is normalized
+ * to the turbo clock and stored in a small history window.  The next
+ * frame's work is predicted from that window and the lowest power level
+ * that still finishes the predicted work inside the vsync deadline (minus
+ * some headroom) is selected.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+
+#include "kgsl.h"
+#include "kgsl_pwrscale.h"
+#include "kgsl_device.h"
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/kgsl.h>
+
+#define FP_MAX_WINDOW		32
+#define FP_DEFAULT_WINDOW	8
+#define FP_DEFAULT_VSYNC_US	16667
+#define FP_DEFAULT_TARGET	85
+
+struct fp_priv {
+	/* Normalized (turbo clock) busy time of the last frames, in us */
+	unsigned int hist[FP_MAX_WINDOW];
+	unsigned int head;
+	unsigned int count;
+	unsigned int window;
+	unsigned int vsync_us;
+	unsigned int target;
+	s64 frame_start;
+	s64 frame_busy;
+	/* Statistics */
+	unsigned int frames;
+	unsigned int missed;
+	unsigned int level_changes;
+	u64 energy;
+};
+
+/* Convert busy time at the active level into busy time at turbo */
+static unsigned int fp_normalize(struct kgsl_pwrctrl *pwr, s64 busy)
+{
+	unsigned int max = pwr->pwrlevels[0].gpu_freq;
+	unsigned int cur = pwr->pwrlevels[pwr->active_pwrlevel].gpu_freq;
+
+	if (busy <= 0)
+		return 0;
+	if (max == 0 || cur == 0)
+		return (unsigned int) busy;
+
+	return (unsigned int) div_u64((u64) busy * (cur / 1000),
+				      max / 1000);
+}
+
+static unsigned int fp_predict(struct fp_priv *priv)
+{
+	unsigned int i, idx, last, max = 0;
+	u64 sum = 0;
+
+	if (priv->count == 0)
+		return 0;
+
+	last = priv->hist[(priv->head + FP_MAX_WINDOW - 1) % FP_MAX_WINDOW];
+
+	for (i = 0; i < priv->count; i++) {
+		idx = (priv->head + FP_MAX_WINDOW - 1 - i) % FP_MAX_WINDOW;
+		sum += priv->hist[idx];
+		if (priv->hist[idx] > max)
+			max = priv->hist[idx];
+	}
+
+	sum = div_u64(sum, priv->count);
+
+	/* Bias the average towards the peak of the window so that periodic
+	   heavy frames are not starved, and follow a sudden ramp up of the
+	   last frame immediately. */
+	sum += (max - (unsigned int) sum) / 2;
+	return max_t(unsigned int, (unsigned int) sum, last);
+}
+
+/* Lowest power level (highest index) that meets the frame deadline */
+static unsigned int fp_select_level(struct kgsl_pwrctrl *pwr,
+				    struct fp_priv *priv, unsigned int work)
+{
+	unsigned int max = pwr->pwrlevels[0].gpu_freq / 1000;
+	unsigned int budget = priv->vsync_us * priv->target / 100;
+	int i;
+
+	for (i = pwr->num_pwrlevels - 2; i > pwr->thermal_pwrlevel; i--) {
+		unsigned int freq = pwr->pwrlevels[i].gpu_freq / 1000;
+
+		if (freq == 0)
+			continue;
+
+		if (div_u64((u64) work * max, freq) <= budget)
+			return i;
+	}
+
+	return pwr->thermal_pwrlevel;
+}
+
+static void fp_frame_done(struct kgsl_device *device,
+			  struct fp_priv *priv, unsigned int timestamp)
+{
+	struct kgsl_pwrctrl *pwr = &device->pwrctrl;
+	unsigned int work, pred, level, busy;
+
+	busy = (unsigned int) priv->frame_busy;
+	work = fp_normalize(pwr, priv->frame_busy);
+
+	priv->hist[priv->head] = work;
+	priv->head = (priv->head + 1) % FP_MAX_WINDOW;
+	if (priv->count < priv->window)
+		priv->count++;
+
+	priv->frames++;
+	if (busy > priv->vsync_us)
+		priv->missed++;
+
+	/* Energy proxy: busy time weighted by the clock it ran at (MHz*us) */
+	priv->energy += (u64) busy *
+		(pwr->pwrlevels[pwr->active_pwrlevel].gpu_freq / 1000000);
+
+	pred = fp_predict(priv);
+	level = fp_select_level(pwr, priv, pred);
+
+	trace_kgsl_fp_frame(timestamp, busy, work, pred,
+			    pwr->active_pwrlevel, level,
+			    busy > priv->vsync_us);
+
+	if (level != pwr->active_pwrlevel) {
+		priv->level_changes++;
+		kgsl_pwrctrl_pwrlevel_change(device, level);
+	}
+}
+
+static void fp_submit(struct kgsl_device *device,
+		      struct kgsl_pwrscale *pwrscale, unsigned int timestamp)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	struct kgsl_power_stats stats;
+	s64 now = ktime_to_us(ktime_get());
+
+	if (priv->frame_start == 0) {
+		/* Prime the busy counters for the new frame */
+		device->ftbl->power_stats(device, &stats);
+		priv->frame_start = now;
+		priv->frame_busy = 0;
+		return;
+	}
+
+	if (now - priv->frame_start < priv->vsync_us)
+		return;
+
+	device->ftbl->power_stats(device, &stats);
+	priv->frame_busy += stats.busy_time;
+
+	fp_frame_done(device, priv, timestamp);
+
+	priv->frame_start = now;
+	priv->frame_busy = 0;
+}
+
+static void fp_idle(struct kgsl_device *device, struct kgsl_pwrscale *pwrscale)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	struct kgsl_power_stats stats;
+
+	/* Accumulate the busy time before the core goes to nap, since the
+	   counters are not preserved across a power collapse. */
+	if (priv->frame_start == 0)
+		return;
+
+	device->ftbl->power_stats(device, &stats);
+	priv->frame_busy += stats.busy_time;
+}
+
+static void fp_sleep(struct kgsl_device *device,
+		     struct kgsl_pwrscale *pwrscale)
+{
+	struct fp_priv *priv = pwrscale->priv;
+
+	/* A frame does not span a sleep; the history is kept so that the
+	   first frame after wake up starts at the predicted level. */
+	priv->frame_start = 0;
+	priv->frame_busy = 0;
+}
+
+static void fp_wake(struct kgsl_device *device,
+		    struct kgsl_pwrscale *pwrscale)
+{
+	struct fp_priv *priv = pwrscale->priv;
+
+	if (priv->count)
+		kgsl_pwrctrl_pwrlevel_change(device,
+			fp_select_level(&device->pwrctrl, priv,
+					fp_predict(priv)));
+}
+
+static ssize_t fp_uint_show(char *buf, unsigned int val)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", val);
+}
+
+static int fp_uint_store(struct kgsl_device *device, const char *buf,
+			 unsigned int min, unsigned int max,
+			 unsigned int *val)
+{
+	unsigned long tmp;
+
+	if (strict_strtoul(buf, 0, &tmp) || tmp < min || tmp > max)
+		return -EINVAL;
+
+	mutex_lock(&device->mutex);
+	*val = tmp;
+	mutex_unlock(&device->mutex);
+	return 0;
+}
+
+static ssize_t fp_window_show(struct kgsl_device *device,
+			      struct kgsl_pwrscale *pwrscale, char *buf)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	return fp_uint_show(buf, priv->window);
+}
+
+static ssize_t fp_window_store(struct kgsl_device *device,
+			       struct kgsl_pwrscale *pwrscale,
+			       const char *buf, size_t count)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	int ret;
+
+	ret = fp_uint_store(device, buf, 1, FP_MAX_WINDOW, &priv->window);
+	if (ret)
+		return ret;
+
+	mutex_lock(&device->mutex);
+	priv->count = min(priv->count, priv->window);
+	mutex_unlock(&device->mutex);
+	return count;
+}
+
+static ssize_t fp_vsync_show(struct kgsl_device *device,
+			     struct kgsl_pwrscale *pwrscale, char *buf)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	return fp_uint_show(buf, priv->vsync_us);
+}
+
+static ssize_t fp_vsync_store(struct kgsl_device *device,
+			      struct kgsl_pwrscale *pwrscale,
+			      const char *buf, size_t count)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	int ret = fp_uint_store(device, buf, 1000, 1000000, &priv->vsync_us);
+	return ret ? ret : count;
+}
+
+static ssize_t fp_target_show(struct kgsl_device *device,
+			      struct kgsl_pwrscale *pwrscale, char *buf)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	return fp_uint_show(buf, priv->target);
+}
+
+static ssize_t fp_target_store(struct kgsl_device *device,
+			       struct kgsl_pwrscale *pwrscale,
+			       const char *buf, size_t count)
+{
+	struct fp_priv *priv = pwrscale->priv;
+	int ret = fp_uint_store(device, buf, 10, 100, &priv->target);
+	return ret ? ret : count;
+}
+
+static ssize_t fp_stats_show(struct kgsl_device *device,
+			     struct kgsl_pwrscale *pwrscale, char *buf)
+{
+	struct fp_priv *priv = pwrscale->priv;
+
+	return snprintf(buf, PAGE_SIZE,
+			"frames: %u\nmissed: %u\nlevel_changes: %u\n"
+			"energy: %llu\npredicted: %u\n",
+			priv->frames, priv->missed, priv->level_changes,
+			priv->energy, fp_predict(priv));
+}
+
+static ssize_t fp_stats_store(struct kgsl_device *device,
+			      struct kgsl_pwrscale *pwrscale,
+			      const char *buf, size_t count)
+{
+	struct fp_priv *priv = pwrscale->priv;
+
+	/* Any write resets the counters */
+	mutex_lock(&device->mutex);
+	priv->frames = 0;
+	priv->missed = 0;
+	priv->level_changes = 0;
+	priv->energy = 0;
+	mutex_unlock(&device->mutex);
+	return count;
+}
+
+PWRSCALE_POLICY_ATTR(window, 0644, fp_window_show, fp_window_store);
+PWRSCALE_POLICY_ATTR(vsync_us, 0644, fp_vsync_show, fp_vsync_store);
+PWRSCALE_POLICY_ATTR(target_load, 0644, fp_target_show, fp_target_store);
+PWRSCALE_POLICY_ATTR(stats, 0644, fp_stats_show, fp_stats_store);
+
+static struct attribute *fp_attrs[] = {
+	&policy_attr_window.attr,
+	&policy_attr_vsync_us.attr,
+	&policy_attr_target_load.attr,
+	&policy_attr_stats.attr,
+	NULL
+};
+
+static struct attribute_group fp_attr_group = {
+	.attrs = fp_attrs,
+};
+
+static int fp_init(struct kgsl_device *device, struct kgsl_pwrscale *pwrscale)
+{
+	struct fp_priv *priv;
+
+	priv = pwrscale->priv = kzalloc(sizeof(struct fp_priv), GFP_KERNEL);
+	if (pwrscale->priv == NULL)
+		return -ENOMEM;
+
+	priv->window = FP_DEFAULT_WINDOW;
+	priv->vsync_us = FP_DEFAULT_VSYNC_US;
+	priv->target = FP_DEFAULT_TARGET;
+
+	kgsl_pwrscale_policy_add_files(device, pwrscale, &fp_attr_group);
+
+	return 0;
+}
+
+static void fp_close(struct kgsl_device *device,
+		     struct kgsl_pwrscale *pwrscale)
+{
+	kgsl_pwrscale_policy_remove_files(device, pwrscale, &fp_attr_group);
+	kfree(pwrscale->priv);
+	pwrscale->priv = NULL;
+}
+
+struct kgsl_pwrscale_policy kgsl_pwrscale_policy_framepredict = {
+	.name = "framepredict",
+	.init = fp_init,
+	.submit = fp_submit,
+	.idle = fp_idle,
+	.sleep = fp_sleep,
+	.wake = fp_wake,
+	.close = fp_close
+};
+EXPORT_SYMBOL(kgsl_pwrscale_policy_framepredict);
@@ -24,6 +24,10 @@
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/kobject.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #ifdef CONFIG_MEMORY_HOTPLUG
 #include <linux/memory.h>
 #include <linux/memory_hotplug.h>
@@ -44,6 +48,11 @@
 
 #define PMEM_INITIAL_NUM_BITMAP_ALLOCATIONS (64)
 
+#define PMEM_EXTENT_HIST_ORDERS (32)
+
+/* mms of exited owners a compaction pass may hold before it stops */
+#define PMEM_COMPACT_MAX_MMPUT (8)
+
 #define PMEM_32BIT_WORD_ORDER (5)
 #define PMEM_BITS_PER_WORD_MASK (BITS_PER_LONG - 1)
 
@@ -70,6 +79,12 @@
  */
 #define PMEM_FLAGS_SUBMAP 0x1 << 3
 #define PMEM_FLAGS_UNSUBMAP 0x1 << 4
+/* the owner allows the allocation to be moved by compaction until its
+ * physical address is handed out (PMEM_SET_RELOCATABLE) */
+#define PMEM_FLAGS_RELOCATABLE 0x1 << 5
+/* the physical address was handed out for good (PMEM_GET_PHYS,
+ * get_pmem_file or a connected file), the allocation must never move */
+#define PMEM_FLAGS_PINNED 0x1 << 6
 
 struct pmem_data {
 	/* in alloc mode: an index into the bitmap
@@ -95,6 +110,11 @@ struct pmem_data {
 	struct list_head region_list;
 	/* a linked list of data so we can access them for debugging */
 	struct list_head list;
+	/* the mmap of a master file and the range it was created with, so
+	 * compaction can move the pages of a relocatable allocation */
+	struct vm_area_struct *master_vma;
+	unsigned long master_vm_start;
+	unsigned long master_vm_end;
 #if PMEM_DEBUG
 	int ref;
 #endif
@@ -110,6 +130,17 @@ struct pmem_region_node {
 	struct list_head list;
 };
 
+/* a run of free quanta in a bitmap allocator region */
+struct pmem_extent {
+	struct rb_node addr_node;	/* keyed by start */
+	union {
+		struct rb_node size_node; /* keyed by (len, start) */
+		struct list_head spare;	/* when not in the trees */
+	};
+	unsigned int start;
+	unsigned int len;
+};
+
 #define PMEM_DEBUG_MSGS 0
 #if PMEM_DEBUG_MSGS
 #define DLOG(fmt,args...) \
@@ -211,7 +242,25 @@ struct pmem_info {
 			struct {
 				short bit;
 				unsigned short quanta;
+				unsigned short spacing;
 			} *bitm_alloc;
+			/* the free quanta as extents, indexed by address to
+			 * coalesce on free and by size for best fit.  One
+			 * extent more than there are allocations is kept
+			 * allocated (in the trees or on spare_extents), so
+			 * a free never has to allocate memory.
+			 */
+			struct rb_root free_by_addr;
+			struct rb_root free_by_size;
+			struct list_head spare_extents;
+			unsigned int free_extents;
+			unsigned long alloc_failures;
+			unsigned long alloc_frag_failures;
+			/* compaction of relocatable allocations */
+			unsigned long compact_runs;
+			unsigned long compact_moved;
+			unsigned long long compact_bytes;
+			unsigned long long compact_ns;
 		} bitmap;
 
 		struct {
@@ -533,6 +582,109 @@ static ssize_t show_pmem_bits_allocated(int id, char *buf)
 }
 RO_PMEM_ATTR(bits_allocated);
 
+static ssize_t show_pmem_free_extents(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "%u\n",
+		pmem[id].allocator.bitmap.free_extents);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(free_extents);
+
+static ssize_t show_pmem_largest_free_extent(int id, char *buf)
+{
+	struct rb_node *node;
+	unsigned int largest = 0;
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	node = rb_last(&pmem[id].allocator.bitmap.free_by_size);
+	if (node)
+		largest = rb_entry(node, struct pmem_extent, size_node)->len;
+	ret = scnprintf(buf, PAGE_SIZE, "%u\n", largest);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(largest_free_extent);
+
+static ssize_t show_pmem_free_extent_histogram(int id, char *buf)
+{
+	unsigned int hist[PMEM_EXTENT_HIST_ORDERS] = { 0 };
+	struct pmem_extent *ext;
+	struct rb_node *node;
+	int order, max_order = -1;
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	for (node = rb_first(&pmem[id].allocator.bitmap.free_by_size); node;
+			node = rb_next(node)) {
+		ext = rb_entry(node, struct pmem_extent, size_node);
+		order = fls(ext->len) - 1;
+		hist[order]++;
+		max_order = order;
+	}
+	mutex_unlock(&pmem[id].arena_mutex);
+
+	ret = scnprintf(buf, PAGE_SIZE, "order\tquanta\textents\n");
+	for (order = 0; order <= max_order; order++)
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, "%d\t%u\t%u\n",
+			order, 1U << order, hist[order]);
+	return ret;
+}
+RO_PMEM_ATTR(free_extent_histogram);
+
+static ssize_t show_pmem_alloc_failures(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "%lu\n",
+		pmem[id].allocator.bitmap.alloc_failures);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(alloc_failures);
+
+static ssize_t show_pmem_alloc_frag_failures(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "%lu\n",
+		pmem[id].allocator.bitmap.alloc_frag_failures);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(alloc_frag_failures);
+
+static int pmem_compact(int id, int nonblock);
+
+static ssize_t store_pmem_compact(int id, const char *buf, size_t count)
+{
+	pmem_compact(id, 0);
+	return count;
+}
+WO_PMEM_ATTR(compact);
+
+static ssize_t show_pmem_compact_stats(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE,
+		"runs\t%lu\nmoved\t%lu\nbytes\t%llu\ntime_us\t%llu\n",
+		pmem[id].allocator.bitmap.compact_runs,
+		pmem[id].allocator.bitmap.compact_moved,
+		pmem[id].allocator.bitmap.compact_bytes,
+		div_u64(pmem[id].allocator.bitmap.compact_ns, NSEC_PER_USEC));
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(compact_stats);
+
 static struct attribute *pmem_bitmap_attrs[] = {
 	PMEM_COMMON_SYSFS_ATTRS,
 
@@ -540,6 +692,13 @@ static struct attribute *pmem_bitmap_attrs[] = {
 
 	&pmem_attr_free_quanta.attr,
 	&pmem_attr_bits_allocated.attr,
+	&pmem_attr_free_extents.attr,
+	&pmem_attr_largest_free_extent.attr,
+	&pmem_attr_free_extent_histogram.attr,
+	&pmem_attr_alloc_failures.attr,
+	&pmem_attr_alloc_frag_failures.attr,
+	&pmem_attr_compact.attr,
+	&pmem_attr_compact_stats.attr,
 
 	NULL
 };
@@ -729,6 +888,237 @@ static void bitmap_bits_clear_all(uint32_t *bitp, int bit_start, int bit_end)
 	}
 }
 
+static void pmem_extent_link_addr(int id, struct pmem_extent *ext)
+{
+	struct rb_node **p = &pmem[id].allocator.bitmap.free_by_addr.rb_node;
+	struct rb_node *parent = NULL;
+	struct pmem_extent *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct pmem_extent, addr_node);
+		if (ext->start < entry->start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&ext->addr_node, parent, p);
+	rb_insert_color(&ext->addr_node,
+		&pmem[id].allocator.bitmap.free_by_addr);
+}
+
+static void pmem_extent_link_size(int id, struct pmem_extent *ext)
+{
+	struct rb_node **p = &pmem[id].allocator.bitmap.free_by_size.rb_node;
+	struct rb_node *parent = NULL;
+	struct pmem_extent *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct pmem_extent, size_node);
+		if (ext->len < entry->len ||
+		    (ext->len == entry->len && ext->start < entry->start))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&ext->size_node, parent, p);
+	rb_insert_color(&ext->size_node,
+		&pmem[id].allocator.bitmap.free_by_size);
+}
+
+/* caller should hold the lock on arena_mutex and have a spare extent! */
+static void pmem_extent_insert(int id, unsigned int start, unsigned int len)
+{
+	struct pmem_extent *ext;
+
+	ext = list_first_entry(&pmem[id].allocator.bitmap.spare_extents,
+		struct pmem_extent, spare);
+	list_del(&ext->spare);
+	ext->start = start;
+	ext->len = len;
+	pmem_extent_link_addr(id, ext);
+	pmem_extent_link_size(id, ext);
+	pmem[id].allocator.bitmap.free_extents++;
+}
+
+static void pmem_extent_remove(int id, struct pmem_extent *ext)
+{
+	rb_erase(&ext->addr_node, &pmem[id].allocator.bitmap.free_by_addr);
+	rb_erase(&ext->size_node, &pmem[id].allocator.bitmap.free_by_size);
+	list_add(&ext->spare, &pmem[id].allocator.bitmap.spare_extents);
+	pmem[id].allocator.bitmap.free_extents--;
+}
+
+/*
+ * Only valid when the new range doesn't cross a neighbouring extent, so
+ * the address tree stays ordered and only the size tree needs updating.
+ */
+static void pmem_extent_resize(int id, struct pmem_extent *ext,
+		unsigned int start, unsigned int len)
+{
+	rb_erase(&ext->size_node, &pmem[id].allocator.bitmap.free_by_size);
+	ext->start = start;
+	ext->len = len;
+	pmem_extent_link_size(id, ext);
+}
+
+/* take [start, start + quanta) out of the free extent ext */
+static void pmem_extent_carve(int id, struct pmem_extent *ext,
+		unsigned int start, unsigned int quanta)
+{
+	unsigned int end = start + quanta, ext_end = ext->start + ext->len;
+
+	if (start > ext->start && end < ext_end) {
+		pmem_extent_insert(id, end, ext_end - end);
+		pmem_extent_resize(id, ext, ext->start, start - ext->start);
+	} else if (start > ext->start)
+		pmem_extent_resize(id, ext, ext->start, start - ext->start);
+	else if (end < ext_end)
+		pmem_extent_resize(id, ext, end, ext_end - end);
+	else
+		pmem_extent_remove(id, ext);
+}
+
+/*
+ * Best fit: take the smallest free extent that holds quanta quanta at a
+ * multiple of spacing, lowest address first among equal sizes, and
+ * return the first quantum or -1.  Only extents shorter than
+ * quanta + spacing - 1 can be too short once aligned, so the walk up
+ * the size tree ends at the latest there.
+ */
+static int pmem_extent_alloc(int id, unsigned int quanta,
+		unsigned int spacing)
+{
+	struct rb_node *node = pmem[id].allocator.bitmap.free_by_size.rb_node;
+	struct rb_node *fit = NULL;
+	struct pmem_extent *ext = NULL;
+	unsigned int start = 0;
+
+	while (node) {
+		ext = rb_entry(node, struct pmem_extent, size_node);
+		if (ext->len >= quanta) {
+			fit = node;
+			node = node->rb_left;
+		} else
+			node = node->rb_right;
+	}
+
+	for (; fit; fit = rb_next(fit)) {
+		ext = rb_entry(fit, struct pmem_extent, size_node);
+		start = roundup(ext->start, spacing);
+		if (start + quanta <= ext->start + ext->len)
+			break;
+	}
+	if (!fit)
+		return -1;
+
+	pmem_extent_carve(id, ext, start, quanta);
+	return start;
+}
+
+/*
+ * For compaction: take the lowest free extent that holds quanta quanta
+ * at a multiple of spacing and ends before limit, or return -1.
+ */
+static int pmem_extent_alloc_below(int id, unsigned int quanta,
+		unsigned int spacing, unsigned int limit)
+{
+	struct rb_node *node;
+	struct pmem_extent *ext;
+	unsigned int start;
+
+	for (node = rb_first(&pmem[id].allocator.bitmap.free_by_addr); node;
+			node = rb_next(node)) {
+		ext = rb_entry(node, struct pmem_extent, addr_node);
+		if (ext->start >= limit)
+			break;
+		/* it ends at limit at the latest, limit is allocated */
+		start = roundup(ext->start, spacing);
+		if (start + quanta <= ext->start + ext->len) {
+			pmem_extent_carve(id, ext, start, quanta);
+			return start;
+		}
+	}
+	return -1;
+}
+
+/* return [start, start + len) to the free extents, merging neighbours */
+static void pmem_extent_free(int id, unsigned int start, unsigned int len)
+{
+	struct rb_node *node = pmem[id].allocator.bitmap.free_by_addr.rb_node;
+	struct pmem_extent *prev = NULL, *next = NULL, *entry;
+	unsigned int end = start + len;
+
+	while (node) {
+		entry = rb_entry(node, struct pmem_extent, addr_node);
+		if (entry->start < start) {
+			prev = entry;
+			node = node->rb_right;
+		} else {
+			next = entry;
+			node = node->rb_left;
+		}
+	}
+	if (prev && prev->start + prev->len != start)
+		prev = NULL;
+	if (next && next->start != end)
+		next = NULL;
+
+	if (prev && next) {
+		len += next->len;
+		pmem_extent_remove(id, next);
+		pmem_extent_resize(id, prev, prev->start, prev->len + len);
+	} else if (prev)
+		pmem_extent_resize(id, prev, prev->start, prev->len + len);
+	else if (next)
+		pmem_extent_resize(id, next, start, next->len + len);
+	else
+		pmem_extent_insert(id, start, len);
+}
+
+static int pmem_extent_add_spare(int id)
+{
+	struct pmem_extent *ext = kmalloc(sizeof(*ext), GFP_KERNEL);
+
+	if (!ext)
+		return -ENOMEM;
+	list_add(&ext->spare, &pmem[id].allocator.bitmap.spare_extents);
+	return 0;
+}
+
+static void pmem_extent_drop_spare(int id)
+{
+	struct list_head *spares = &pmem[id].allocator.bitmap.spare_extents;
+	struct pmem_extent *ext;
+
+	if (list_empty(spares))
+		return;
+	ext = list_first_entry(spares, struct pmem_extent, spare);
+	list_del(&ext->spare);
+	kfree(ext);
+}
+
+/* the trees and spare list must be initialised already */
+static int pmem_extents_init(int id)
+{
+	if (pmem_extent_add_spare(id))
+		return -ENOMEM;
+	pmem_extent_insert(id, 0, pmem[id].num_entries);
+	return 0;
+}
+
+static void pmem_extents_destroy(int id)
+{
+	struct rb_node *node;
+
+	while ((node = rb_first(&pmem[id].allocator.bitmap.free_by_addr)))
+		pmem_extent_remove(id,
+			rb_entry(node, struct pmem_extent, addr_node));
+	while (!list_empty(&pmem[id].allocator.bitmap.spare_extents))
+		pmem_extent_drop_spare(id);
+}
+
 static int pmem_free_bitmap(int id, int bitnum)
 {
 	/* caller should hold the lock on arena_mutex! */
@@ -747,6 +1137,8 @@ static int pmem_free_bitmap(int id, int bitnum)
 
 			bitmap_bits_clear_all(pmem[id].allocator.bitmap.bitmap,
 				curr_bit, curr_bit + curr_quanta);
+			pmem_extent_free(id, curr_bit, curr_quanta);
+			pmem_extent_drop_spare(id);
 			pmem[id].allocator.bitmap.bitmap_free += curr_quanta;
 			pmem[id].allocator.bitmap.bitm_alloc[i].bit = -1;
 			pmem[id].allocator.bitmap.bitm_alloc[i].quanta = 0;
@@ -783,48 +1175,17 @@ static int pmem_free_system(int id, int index)
 
 static int pmem_free_space_bitmap(int id, struct pmem_freespace *fs)
 {
-	int i, j;
-	int max_allocs = pmem[id].allocator.bitmap.bitmap_allocs;
-	int alloc_start = 0;
-	int next_alloc;
-	unsigned long size = 0;
+	/* caller should hold the lock on arena_mutex! */
+	struct rb_node *node;
 
-	fs->total = 0;
+	fs->total = (unsigned long)pmem[id].allocator.bitmap.bitmap_free *
+		pmem[id].quantum;
 	fs->largest = 0;
 
-	for (i = 0; i < max_allocs; i++) {
-
-		int alloc_quanta = 0;
-		int alloc_idx = 0;
-		next_alloc = pmem[id].num_entries;
-
-		/* Look for the lowest bit where next allocation starts */
-		for (j = 0; j < max_allocs; j++) {
-			const int curr_alloc = pmem[id].allocator.
-						bitmap.bitm_alloc[j].bit;
-			if (curr_alloc != -1) {
-				if (alloc_start == curr_alloc)
-					alloc_idx = j;
-				if (alloc_start >= curr_alloc)
-					continue;
-				if (curr_alloc < next_alloc)
-					next_alloc = curr_alloc;
-			}
-		}
-		alloc_quanta = pmem[id].allocator.bitmap.
-				bitm_alloc[alloc_idx].quanta;
-		size = (next_alloc - (alloc_start + alloc_quanta)) *
-				pmem[id].quantum;
-
-		if (size > fs->largest)
-			fs->largest = size;
-		fs->total += size;
-
-		if (next_alloc == pmem[id].num_entries)
-			break;
-		else
-			alloc_start = next_alloc;
-	}
+	node = rb_last(&pmem[id].allocator.bitmap.free_by_size);
+	if (node)
+		fs->largest = (unsigned long)rb_entry(node, struct pmem_extent,
+			size_node)->len * pmem[id].quantum;
 
 	return 0;
 }
@@ -933,6 +1294,7 @@ static int pmem_open(struct inode *inode, struct file *file)
 	data->vma = NULL;
 	data->pid = 0;
 	data->master_file = NULL;
+	data->master_vma = NULL;
 #if PMEM_DEBUG
 	data->ref = 0;
 #endif
@@ -1072,61 +1434,11 @@ static void bitmap_bits_set_all(uint32_t *bitp, int bit_start, int bit_end)
 	}
 }
 
-static int
-bitmap_allocate_contiguous(uint32_t *bitp, int num_bits_to_alloc,
-		int total_bits, int spacing)
+static inline unsigned int bitmap_spacing(const int id, unsigned int align)
 {
-	int bit_start, last_bit, word_index;
-
-	if (num_bits_to_alloc <= 0)
-		return -1;
-
-	for (bit_start = 0; ;
-		bit_start = (last_bit +
-			(word_index << PMEM_32BIT_WORD_ORDER) + spacing - 1)
-			& ~(spacing - 1)) {
-		int bit_end = bit_start + num_bits_to_alloc, total_words;
-
-		if (bit_end > total_bits)
-			return -1; /* out of contiguous memory */
-
-		word_index = bit_start >> PMEM_32BIT_WORD_ORDER;
-		total_words = compute_total_words(bit_end, word_index);
+	unsigned int spacing = align / pmem[id].quantum;
 
-		if (total_words <= 0)
-			return -1;
-
-		if (total_words == 1) {
-			last_bit = fls(bitp[word_index] &
-					(start_mask(bit_start) &
-						end_mask(bit_end)));
-			if (last_bit)
-				continue;
-		} else {
-			int end_word = word_index + (total_words - 1);
-			last_bit =
-				fls(bitp[word_index] & start_mask(bit_start));
-			if (last_bit)
-				continue;
-
-			for (word_index++;
-					word_index < end_word;
-					word_index++) {
-				last_bit = fls(bitp[word_index]);
-				if (last_bit)
-					break;
-			}
-			if (last_bit)
-				continue;
-
-			last_bit = fls(bitp[word_index] & end_mask(bit_end));
-			if (last_bit)
-				continue;
-		}
-		bitmap_bits_set_all(bitp, bit_start, bit_end);
-		return bit_start;
-	}
-	return -1;
+	return spacing > 1 ? spacing : 1;
 }
 
 static int reserve_quanta(const unsigned int quanta_needed,
@@ -1156,13 +1468,12 @@ static int reserve_quanta(const unsigned int quanta_needed,
 #endif
 		return -1;
 	}
-	spacing = align / pmem[id].quantum;
-	spacing = spacing > 1 ? spacing : 1;
+	spacing = bitmap_spacing(id, align);
 
-	ret = bitmap_allocate_contiguous(pmem[id].allocator.bitmap.bitmap,
-		quanta_needed,
-		(pmem[id].size + pmem[id].quantum - 1) / pmem[id].quantum,
-		spacing);
+	ret = pmem_extent_alloc(id, quanta_needed, spacing);
+	if (ret >= 0)
+		bitmap_bits_set_all(pmem[id].allocator.bitmap.bitmap,
+			ret, ret + quanta_needed);
 
 #if PMEM_DEBUG
 	if (ret < 0)
@@ -1203,13 +1514,12 @@ static int pmem_allocator_bitmap(const int id,
 			"PMEM memory region exhausted, id %d."
 			" Unable to comply with allocation request.\n", id);
 #endif
+		pmem[id].allocator.bitmap.alloc_failures++;
 		return -1;
 	}
 
-	bitnum = reserve_quanta(quanta_needed, id, align);
-	if (bitnum == -1)
-		goto leave;
-
+	/* find (or make) the bitm_alloc slot first, so that failing to
+	 * grow it doesn't leave reserved quanta behind */
 	for (i = 0;
 		i < pmem[id].allocator.bitmap.bitmap_allocs &&
 			pmem[id].allocator.bitmap.bitm_alloc[i].bit != -1;
@@ -1258,18 +1568,34 @@ static int pmem_allocator_bitmap(const int id,
 
 		for (j = i; j < new_bitmap_allocs; j++) {
 			pmem[id].allocator.bitmap.bitm_alloc[j].bit = -1;
-			pmem[id].allocator.bitmap.bitm_alloc[i].quanta = 0;
+			pmem[id].allocator.bitmap.bitm_alloc[j].quanta = 0;
 		}
 
 		DLOG("increased # of allocated regions to %d for id %d\n",
 			pmem[id].allocator.bitmap.bitmap_allocs, id);
 	}
 
+	/* each allocation brings the extent a later free may need */
+	if (pmem_extent_add_spare(id)) {
+		pmem[id].allocator.bitmap.alloc_failures++;
+		return -1;
+	}
+
+	bitnum = reserve_quanta(quanta_needed, id, align);
+	if (bitnum == -1) {
+		pmem_extent_drop_spare(id);
+		pmem[id].allocator.bitmap.alloc_failures++;
+		pmem[id].allocator.bitmap.alloc_frag_failures++;
+		goto leave;
+	}
+
 	DLOG("bitnum %d, bitm_alloc index %d\n", bitnum, i);
 
 	pmem[id].allocator.bitmap.bitmap_free -= quanta_needed;
 	pmem[id].allocator.bitmap.bitm_alloc[i].bit = bitnum;
 	pmem[id].allocator.bitmap.bitm_alloc[i].quanta = quanta_needed;
+	pmem[id].allocator.bitmap.bitm_alloc[i].spacing =
+		bitmap_spacing(id, align);
 leave:
 	return bitnum;
 }
@@ -1488,6 +1814,290 @@ static int pmem_remap_pfn_range(int id, struct vm_area_struct *vma,
 	return pmem_map_pfn_range(id, vma, data, offset, len);
 }
 
+static int pmem_bitmap_find_alloc(int id, int bitnum)
+{
+	int i;
+
+	for (i = 0; i < pmem[id].allocator.bitmap.bitmap_allocs; i++)
+		if (pmem[id].allocator.bitmap.bitm_alloc[i].bit == bitnum)
+			return i;
+	return -1;
+}
+
+static int pmem_is_movable(struct pmem_data *data)
+{
+	/* caller should hold data->sem! */
+	struct vm_area_struct *vma = data->master_vma;
+
+	if (!(data->flags & PMEM_FLAGS_RELOCATABLE) ||
+	    (data->flags & (PMEM_FLAGS_PINNED | PMEM_FLAGS_CONNECTED)) ||
+	    data->index == -1)
+		return 0;
+	/* a split or mremapped mapping no longer maps the allocation
+	 * from its start, leave it alone */
+	if (vma && (vma->vm_start != data->master_vm_start ||
+		    vma->vm_end != data->master_vm_end))
+		return 0;
+	return 1;
+}
+
+struct pmem_mmput_work {
+	struct work_struct work;
+	struct mm_struct *mm;
+};
+
+static void pmem_mmput_work_fn(struct work_struct *work)
+{
+	struct pmem_mmput_work *w =
+		container_of(work, struct pmem_mmput_work, work);
+
+	mmput(w->mm);
+	kfree(w);
+}
+
+/*
+ * Drop the last reference to an exited owner's mm from a worker.
+ * exit_mmap() releases the pmem files, and releasing a master revokes
+ * its submaps under their data->sem, which an allocating caller of
+ * pmem_compact() may hold.
+ */
+static void pmem_mmput_async(struct mm_struct *mm)
+{
+	struct pmem_mmput_work *w;
+
+	/* there is nowhere safe to fall back to */
+	w = kmalloc(sizeof(*w), GFP_KERNEL | __GFP_NOFAIL);
+	INIT_WORK(&w->work, pmem_mmput_work_fn);
+	w->mm = mm;
+	schedule_work(&w->work);
+}
+
+static void pmem_copy_quanta(int id, int from, int to, unsigned long len)
+{
+	void *src = pmem[id].vbase + from * pmem[id].quantum;
+	void *dst = pmem[id].vbase + to * pmem[id].quantum;
+
+	/* the owner may have written through an uncached or write
+	 * combined mapping, don't copy stale lines */
+	if (pmem[id].cached) {
+		dmac_flush_range(src, src + len);
+#ifdef CONFIG_OUTER_CACHE
+		outer_flush_range(paddr_from_bit(id, from),
+			paddr_from_bit(id, from) + len);
+#endif
+	}
+	memcpy(dst, src, len);
+	if (pmem[id].cached) {
+		dmac_flush_range(dst, dst + len);
+#ifdef CONFIG_OUTER_CACHE
+		outer_flush_range(paddr_from_bit(id, to),
+			paddr_from_bit(id, to) + len);
+#endif
+	}
+}
+
+/*
+ * Move one relocatable allocation to the lowest free extent below it
+ * that fits, fixing up the owner's mapping, and return the number of
+ * bytes moved.  Only trylocks are taken on the mm and the data, see
+ * pmem_compact().
+ *
+ * If the owner exited meanwhile, the mm reference taken here is the
+ * last one, and dropping it would run exit_mmap() and so pmem_release()
+ * under the caller's data_list_mutex.  The mm is then left in *last_mm
+ * for the caller to mmput() once it has dropped the mutex.
+ */
+static unsigned long pmem_move_allocation(int id, struct pmem_data *data,
+		struct mm_struct **last_mm)
+{
+	struct vm_area_struct *vma;
+	struct mm_struct *mm = NULL;
+	unsigned long len = 0, vma_len = 0;
+	int slot, old, new = -1;
+
+	*last_mm = NULL;
+	if (!down_read_trylock(&data->sem))
+		return 0;
+	if (!pmem_is_movable(data)) {
+		up_read(&data->sem);
+		return 0;
+	}
+	vma = data->master_vma;
+	if (vma) {
+		mm = vma->vm_mm;
+		if (!atomic_inc_not_zero(&mm->mm_users)) {
+			/* exiting, the mapping is about to go anyway */
+			up_read(&data->sem);
+			return 0;
+		}
+	}
+	up_read(&data->sem);
+
+	if (mm && !down_write_trylock(&mm->mmap_sem))
+		goto out_mmput;
+	if (!down_write_trylock(&data->sem))
+		goto out_mm;
+	/* things may have changed while data->sem was dropped */
+	vma = data->master_vma;
+	if (!pmem_is_movable(data) || (vma && vma->vm_mm != mm))
+		goto out_data;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	old = data->index;
+	slot = pmem_bitmap_find_alloc(id, old);
+	if (slot >= 0 && !pmem_extent_add_spare(id)) {
+		new = pmem_extent_alloc_below(id,
+			pmem[id].allocator.bitmap.bitm_alloc[slot].quanta,
+			pmem[id].allocator.bitmap.bitm_alloc[slot].spacing,
+			old);
+		if (new < 0)
+			pmem_extent_drop_spare(id);
+	}
+	if (new < 0) {
+		mutex_unlock(&pmem[id].arena_mutex);
+		goto out_data;
+	}
+	len = pmem[id].allocator.bitmap.bitm_alloc[slot].quanta;
+	bitmap_bits_set_all(pmem[id].allocator.bitmap.bitmap, new, new + len);
+	len *= pmem[id].quantum;
+	/* both ranges belong to us now, copy without the arena lock */
+	mutex_unlock(&pmem[id].arena_mutex);
+
+	if (vma) {
+		vma_len = vma->vm_end - vma->vm_start;
+		zap_page_range(vma, vma->vm_start, vma_len, NULL);
+	}
+	pmem_copy_quanta(id, old, new, len);
+	data->index = new;
+	/*
+	 * Map it as pmem_mmap() did: io_remap_pfn_range() over the whole
+	 * vma also moves vm_pgoff to the new pfn, and unlike
+	 * vm_insert_pfn() is fine with private mappings.
+	 */
+	if (vma && pmem_map_pfn_range(id, vma, data, 0, vma_len)) {
+		pr_err("pmem: %s: can't remap moved allocation on %s\n",
+			__func__, pmem[id].name);
+		zap_page_range(vma, vma->vm_start, vma_len, NULL);
+		pmem_map_garbage(id, vma, data, 0, vma_len);
+	}
+
+	mutex_lock(&pmem[id].arena_mutex);
+	bitmap_bits_clear_all(pmem[id].allocator.bitmap.bitmap, old,
+		old + pmem[id].allocator.bitmap.bitm_alloc[slot].quanta);
+	pmem_extent_free(id, old,
+		pmem[id].allocator.bitmap.bitm_alloc[slot].quanta);
+	pmem_extent_drop_spare(id);
+	pmem[id].allocator.bitmap.bitm_alloc[slot].bit = new;
+	mutex_unlock(&pmem[id].arena_mutex);
+
+out_data:
+	up_write(&data->sem);
+out_mm:
+	if (mm)
+		up_write(&mm->mmap_sem);
+out_mmput:
+	if (mm && !atomic_add_unless(&mm->mm_users, -1, 1))
+		*last_mm = mm;
+	return len;
+}
+
+/*
+ * Slide the relocatable allocations of a bitmap region down into the
+ * lowest free extents below them so that free space collects in large
+ * extents at the top, and return the number of allocations moved.
+ *
+ * This runs from the allocation paths with the allocating file's
+ * data->sem (and, from mmap, the caller's mmap_sem) held, against the
+ * usual lock order, so the other files and their mms are only
+ * trylocked and whatever is busy stays where it is.  nonblock does the
+ * same for data_list_mutex.
+ */
+static int pmem_compact(int id, int nonblock)
+{
+	struct mm_struct *last_mms[PMEM_COMPACT_MAX_MMPUT];
+	struct mm_struct *mm;
+	int nr_mms = 0;
+	struct pmem_data *data;
+	unsigned long long bytes = 0;
+	unsigned long len;
+	ktime_t start;
+	int moved = 0;
+
+	if (pmem[id].allocator_type != PMEM_ALLOCATORTYPE_BITMAP ||
+	    !pmem[id].vbase)
+		return 0;
+
+	if (nonblock) {
+		if (!mutex_trylock(&pmem[id].data_list_mutex))
+			return 0;
+	} else
+		mutex_lock(&pmem[id].data_list_mutex);
+
+	start = ktime_get();
+	list_for_each_entry(data, &pmem[id].data_list, list) {
+		len = pmem_move_allocation(id, data, &mm);
+		if (len) {
+			moved++;
+			bytes += len;
+		}
+		if (mm) {
+			last_mms[nr_mms++] = mm;
+			if (nr_mms == PMEM_COMPACT_MAX_MMPUT)
+				break;
+		}
+	}
+	mutex_unlock(&pmem[id].data_list_mutex);
+
+	/* releasing pmem files takes data_list_mutex, see above */
+	while (nr_mms) {
+		mm = last_mms[--nr_mms];
+		if (nonblock)
+			pmem_mmput_async(mm);
+		else
+			mmput(mm);
+	}
+
+	mutex_lock(&pmem[id].arena_mutex);
+	pmem[id].allocator.bitmap.compact_runs++;
+	pmem[id].allocator.bitmap.compact_moved += moved;
+	pmem[id].allocator.bitmap.compact_bytes += bytes;
+	pmem[id].allocator.bitmap.compact_ns +=
+		ktime_to_ns(ktime_sub(ktime_get(), start));
+	mutex_unlock(&pmem[id].arena_mutex);
+
+	DLOG("compacted %s: moved %d allocations, %llu bytes\n",
+		pmem[id].name, moved, bytes);
+	return moved;
+}
+
+/*
+ * pmem[id].allocate, retried once after compaction when a bitmap region
+ * had enough free quanta but no extent to fit them.  Caller should hold
+ * data->sem for write but not the arena_mutex.
+ */
+static int pmem_allocate_compact(const int id, const unsigned long len,
+		const unsigned int align)
+{
+	unsigned long frag_failures = 0;
+	int index;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BITMAP)
+		frag_failures = pmem[id].allocator.bitmap.alloc_frag_failures;
+	index = pmem[id].allocate(id, len, align);
+	if (index == -1 &&
+	    pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BITMAP &&
+	    pmem[id].allocator.bitmap.alloc_frag_failures != frag_failures) {
+		mutex_unlock(&pmem[id].arena_mutex);
+		if (!pmem_compact(id, 1))
+			return -1;
+		mutex_lock(&pmem[id].arena_mutex);
+		index = pmem[id].allocate(id, len, align);
+	}
+	mutex_unlock(&pmem[id].arena_mutex);
+	return index;
+}
+
 static void pmem_vma_open(struct vm_area_struct *vma)
 {
 	struct file *file = vma->vm_file;
@@ -1544,6 +2154,8 @@ static void pmem_vma_close(struct vm_area_struct *vma)
 		    (data->flags & PMEM_FLAGS_SUBMAP))
 			data->flags |= PMEM_FLAGS_UNSUBMAP;
 	}
+	if (data->master_vma == vma)
+		data->master_vma = NULL;
 	/* the kernel is going to free this vma now anyway */
 	up_write(&data->sem);
 }
@@ -1593,11 +2205,9 @@ static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 	}
 	/* if file->private_data == unalloced, alloc*/
 	if (data->index == -1) {
-		mutex_lock(&pmem[id].arena_mutex);
-		index = pmem[id].allocate(id,
+		index = pmem_allocate_compact(id,
 				vma->vm_end - vma->vm_start,
 				SZ_4K);
-		mutex_unlock(&pmem[id].arena_mutex);
 		/* either no space was available or an error occured */
 		if (index == -1) {
 			pr_err("pmem: mmap unable to allocate memory"
@@ -1661,6 +2271,9 @@ static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 		}
 		data->flags |= PMEM_FLAGS_MASTERMAP;
 		data->pid = current->pid;
+		data->master_vma = vma;
+		data->master_vm_start = vma->vm_start;
+		data->master_vm_end = vma->vm_end;
 	}
 	vma->vm_ops = &vm_ops;
 error:
@@ -1711,7 +2324,7 @@ int get_pmem_addr(struct file *file, unsigned long *start,
 	if (is_pmem_file(file)) {
 		struct pmem_data *data = file->private_data;
 
-		down_read(&data->sem);
+		down_write(&data->sem);
 		if (has_allocation(file)) {
 			int id = get_id(file);
 
@@ -1719,18 +2332,21 @@ int get_pmem_addr(struct file *file, unsigned long *start,
 			*len = pmem[id].len(id, data);
 			*vstart = (unsigned long)
 				pmem_start_vaddr(id, data);
-			up_read(&data->sem);
+			/* the caller hands the address to hardware and many
+			 * keep using it after put_pmem_file, as with
+			 * PMEM_GET_PHYS the allocation may never move again */
+			data->flags &= ~PMEM_FLAGS_RELOCATABLE;
+			data->flags |= PMEM_FLAGS_PINNED;
 #if PMEM_DEBUG
-			down_write(&data->sem);
 			data->ref++;
-			up_write(&data->sem);
 #endif
+			up_write(&data->sem);
 			DLOG("returning start %#lx len %lu "
 				"vstart %#lx\n",
 				*start, *len, *vstart);
 			ret = 0;
 		} else {
-			up_read(&data->sem);
+			up_write(&data->sem);
 		}
 	}
 	return ret;
@@ -1903,6 +2519,65 @@ end:
 	up_read(&data->sem);
 }
 
+/*
+ * Report the range of the file that flush_pmem_file(file, offset, len)
+ * would actually flush, so callers can drop duplicate flushes.  Returns
+ * 1 when the range needs no cleaning (not pmem, or an uncached region),
+ * and -EINVAL when the file has no allocation or, for a connected file,
+ * no single region holds the whole range.
+ */
+int pmem_flush_extent(struct file *file, unsigned long offset,
+		      unsigned long len, unsigned long *start,
+		      unsigned long *size)
+{
+	struct pmem_data *data;
+	struct pmem_region_node *region_node;
+	struct list_head *elt;
+	int id, ret = -EINVAL;
+
+	if (!is_pmem_file(file))
+		return 1;
+
+	id = get_id(file);
+	if (!pmem[id].cached)
+		return 1;
+
+	data = file->private_data;
+
+	down_read(&data->sem);
+	if (!has_allocation(file))
+		goto end;
+
+	if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_SYSTEM) {
+		*start = 0;
+		*size = ((struct alloc_list *)(data->index))->size;
+		ret = 0;
+		goto end;
+	}
+
+	if (unlikely(!(data->flags & PMEM_FLAGS_CONNECTED))) {
+		*start = 0;
+		*size = pmem[id].len(id, data);
+		ret = 0;
+		goto end;
+	}
+
+	list_for_each(elt, &data->region_list) {
+		region_node = list_entry(elt, struct pmem_region_node, list);
+		if ((offset >= region_node->region.offset) &&
+		    ((offset + len) <= (region_node->region.offset +
+			region_node->region.len))) {
+			*start = region_node->region.offset;
+			*size = region_node->region.len;
+			ret = 0;
+			break;
+		}
+	}
+end:
+	up_read(&data->sem);
+	return ret;
+}
+
 int pmem_cache_maint(struct file *file, unsigned int cmd,
 		struct pmem_addr *pmem_addr)
 {
@@ -2134,10 +2809,10 @@ static int pmem_connect(unsigned long connect, struct file *file)
 			goto put_src_file;
 		}
 
-		down_read(&src_data->sem);
+		down_write(&src_data->sem);
 
 		if (unlikely(!has_allocation(src_file))) {
-			up_read(&src_data->sem);
+			up_write(&src_data->sem);
 			pr_err("pmem: %s: src file has no allocation!\n",
 				__func__);
 			ret = -EINVAL;
@@ -2145,7 +2820,10 @@ static int pmem_connect(unsigned long connect, struct file *file)
 			struct pmem_data *data;
 			int src_index = src_data->index;
 
-			up_read(&src_data->sem);
+			/* the connected file shares the allocation */
+			src_data->flags &= ~PMEM_FLAGS_RELOCATABLE;
+			src_data->flags |= PMEM_FLAGS_PINNED;
+			up_write(&src_data->sem);
 
 			data = file->private_data;
 			if (!data) {
@@ -2407,7 +3085,9 @@ static void pmem_get_size(struct pmem_region *region, struct file *file)
 		region->offset = 0;
 		region->len = 0;
 	} else {
-		region->offset = pmem[id].start_addr(id, data);
+		/* a relocatable allocation has no fixed address */
+		region->offset = data->flags & PMEM_FLAGS_RELOCATABLE ? 0 :
+			pmem[id].start_addr(id, data);
 		region->len = pmem[id].len(id, data);
 	}
 	up_read(&data->sem);
@@ -2437,15 +3117,18 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			struct pmem_region region;
 
 			DLOG("get_phys\n");
-			down_read(&data->sem);
+			down_write(&data->sem);
 			if (!has_allocation(file)) {
 				region.offset = 0;
 				region.len = 0;
 			} else {
 				region.offset = pmem[id].start_addr(id, data);
 				region.len = pmem[id].len(id, data);
+				/* user space knows where it is now */
+				data->flags &= ~PMEM_FLAGS_RELOCATABLE;
+				data->flags |= PMEM_FLAGS_PINNED;
 			}
-			up_read(&data->sem);
+			up_write(&data->sem);
 
 			if (copy_to_user((void __user *)arg, &region,
 						sizeof(struct pmem_region)))
@@ -2531,11 +3214,9 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				return -EINVAL;
 			}
 
-			mutex_lock(&pmem[id].arena_mutex);
-			data->index = pmem[id].allocate(id,
+			data->index = pmem_allocate_compact(id,
 					arg,
 					SZ_4K);
-			mutex_unlock(&pmem[id].arena_mutex);
 			ret = data->index == -1 ? -ENOMEM :
 				data->index;
 			up_write(&data->sem);
@@ -2578,16 +3259,33 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				return -EINVAL;
 			}
 
-			mutex_lock(&pmem[id].arena_mutex);
-			data->index = pmem[id].allocate(id,
+			data->index = pmem_allocate_compact(id,
 					alloc.size,
 					alloc.align);
-			mutex_unlock(&pmem[id].arena_mutex);
 			ret = data->index == -1 ? -ENOMEM :
 				data->index;
 			up_write(&data->sem);
 			return ret;
 		}
+	case PMEM_SET_RELOCATABLE:
+		{
+			int ret = 0;
+
+			DLOG("set relocatable %lu\n", arg);
+			if (pmem[id].allocator_type !=
+					PMEM_ALLOCATORTYPE_BITMAP)
+				return -EINVAL;
+			down_write(&data->sem);
+			if (!arg)
+				data->flags &= ~PMEM_FLAGS_RELOCATABLE;
+			else if (data->flags &
+				 (PMEM_FLAGS_PINNED | PMEM_FLAGS_CONNECTED))
+				ret = -EBUSY;
+			else
+				data->flags |= PMEM_FLAGS_RELOCATABLE;
+			up_write(&data->sem);
+			return ret;
+		}
 	case PMEM_CONNECT:
 		DLOG("connect\n");
 		return pmem_connect(arg, file);
@@ -2954,6 +3652,10 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 			goto err_reset_pmem_info;
 		}
 
+		pmem[id].allocator.bitmap.free_by_addr = RB_ROOT;
+		pmem[id].allocator.bitmap.free_by_size = RB_ROOT;
+		INIT_LIST_HEAD(&pmem[id].allocator.bitmap.spare_extents);
+
 		if (kobject_init_and_add(&pmem[id].kobj,
 				&pmem_bitmap_ktype, NULL,
 				"%s", pdata->name))
@@ -2978,6 +3680,13 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 		}
 		pmem[id].allocator.bitmap.bitmap_free = pmem[id].num_entries;
 
+		if (pmem_extents_init(id)) {
+			pr_alert("pmem: %s: Unable to register pmem "
+				"driver - can't allocate free extents!\n",
+				__func__);
+			goto err_cant_register_device;
+		}
+
 		pmem[id].allocate = pmem_allocator_bitmap;
 		pmem[id].free = pmem_free_bitmap;
 		pmem[id].free_space = pmem_free_space_bitmap;
@@ -3075,6 +3784,7 @@ out_put_kobj:
 	if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BUDDYBESTFIT)
 		kfree(pmem[id].allocator.buddy_bestfit.buddy_bitmap);
 	else if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BITMAP) {
+		pmem_extents_destroy(id);
 		kfree(pmem[id].allocator.bitmap.bitmap);
 		kfree(pmem[id].allocator.bitmap.bitm_alloc);
 	}
@@ -25,6 +25,10 @@
 #include <linux/io.h>
 #include <linux/crc16.h>
 #include <linux/bitrev.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/dma.h>
 #include <asm/mach/flash.h>
@@ -67,6 +71,26 @@ unsigned crci_mask;
 
 #define VERBOSE 0
 
+/* Pages queued on one data mover command pointer list by the single
+ * controller read and write paths.
+ */
+#define MSM_NAND_READ_PIPELINE 4
+#define MSM_NAND_WRITE_PIPELINE 4
+
+enum {
+	MSM_NAND_STATS_READ,
+	MSM_NAND_STATS_WRITE,
+	MSM_NAND_STATS_ERASE,
+	MSM_NAND_STATS_NR,
+};
+
+struct msm_nand_op_stats {
+	unsigned long ops;
+	unsigned long pages;
+	uint64_t bytes;
+	uint64_t usecs;
+};
+
 struct msm_nand_chip {
 	struct device *dev;
 	wait_queue_head_t wait_queue;
@@ -76,6 +100,9 @@ struct msm_nand_chip {
 	dma_addr_t dma_addr;
 	unsigned CFG0, CFG1;
 	uint32_t ecc_buf_cfg;
+	spinlock_t stats_lock;
+	struct msm_nand_op_stats stats[MSM_NAND_STATS_NR];
+	struct dentry *stats_dent;
 };
 
 #define CFG1_WIDE_FLASH (1U << 1)
@@ -226,6 +253,20 @@ static void msm_nand_release_dma_buffer(struct msm_nand_chip *chip,
 	wake_up(&chip->wait_queue);
 }
 
+static void msm_nand_account(struct msm_nand_chip *chip, int type,
+			     unsigned pages, size_t bytes, ktime_t start)
+{
+	struct msm_nand_op_stats *stats = &chip->stats[type];
+	s64 usecs = ktime_us_delta(ktime_get(), start);
+	unsigned long flags;
+
+	spin_lock_irqsave(&chip->stats_lock, flags);
+	stats->ops++;
+	stats->pages += pages;
+	stats->bytes += bytes;
+	stats->usecs += usecs;
+	spin_unlock_irqrestore(&chip->stats_lock, flags);
+}
 
 unsigned flash_rd_reg(struct msm_nand_chip *chip, unsigned addr)
 {
@@ -734,25 +775,31 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 	struct msm_nand_chip *chip = mtd->priv;
 
 	struct {
-		dmov_s cmd[8 * 5 + 2];
-		unsigned cmdptr;
 		struct {
-			uint32_t cmd;
-			uint32_t addr0;
-			uint32_t addr1;
-			uint32_t chipsel;
-			uint32_t cfg0;
-			uint32_t cfg1;
-			uint32_t exec;
-			uint32_t ecccfg;
+			dmov_s cmd[8 * 5 + 2];
 			struct {
-				uint32_t flash_status;
-				uint32_t buffer_status;
-			} result[8];
-		} data;
+				uint32_t cmd;
+				uint32_t addr0;
+				uint32_t addr1;
+				uint32_t chipsel;
+				uint32_t cfg0;
+				uint32_t cfg1;
+				uint32_t exec;
+				uint32_t ecccfg;
+				struct {
+					uint32_t flash_status;
+					uint32_t buffer_status;
+				} result[8];
+			} data;
+		} pg[MSM_NAND_READ_PIPELINE];
+		unsigned cmdptr[MSM_NAND_READ_PIPELINE];
 	} *dma_buffer;
+	typeof(dma_buffer->pg[0]) *pg;
 	dmov_s *cmd;
 	unsigned n;
+	unsigned b, batch;
+	uint32_t oob_left[MSM_NAND_READ_PIPELINE];
+	ktime_t start = ktime_get();
 	unsigned page = 0;
 	uint32_t oob_len;
 	uint32_t sectordatasize;
@@ -859,238 +906,274 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 		oob_col >>= 1;
 
 	err = 0;
-	while (page_count-- > 0) {
-		cmd = dma_buffer->cmd;
+	while (page_count > 0) {
+		/* Queue up to MSM_NAND_READ_PIPELINE pages on one data
+		 * mover pointer list, so the controller starts on the next
+		 * page as soon as the current one has been transferred
+		 * instead of waiting for the completion interrupt and a
+		 * new command from us.
+		 */
+		batch = min(page_count, (unsigned)MSM_NAND_READ_PIPELINE);
+		for (b = 0; b < batch; b++) {
+			pg = &dma_buffer->pg[b];
+			cmd = pg->cmd;
+
+			/* CMD / ADDR0 / ADDR1 / CHIPSEL program values */
+			if (ops->mode != MTD_OOB_RAW) {
+				pg->data.cmd = MSM_NAND_CMD_PAGE_READ_ECC;
+				pg->data.cfg0 =
+				(chip->CFG0 & ~(7U << 6))
+					| (((cwperpage-1) - start_sector) << 6);
+				pg->data.cfg1 = chip->CFG1;
+			} else {
+				pg->data.cmd = MSM_NAND_CMD_PAGE_READ;
+				pg->data.cfg0 = (MSM_NAND_CFG0_RAW &
+					~(7U << 6)) | ((cwperpage-1) << 6);
+				pg->data.cfg1 = MSM_NAND_CFG1_RAW |
+						(chip->CFG1 & CFG1_WIDE_FLASH);
+			}
 
-		/* CMD / ADDR0 / ADDR1 / CHIPSEL program values */
-		if (ops->mode != MTD_OOB_RAW) {
-			dma_buffer->data.cmd = MSM_NAND_CMD_PAGE_READ_ECC;
-			dma_buffer->data.cfg0 =
-			(chip->CFG0 & ~(7U << 6))
-				| (((cwperpage-1) - start_sector) << 6);
-			dma_buffer->data.cfg1 = chip->CFG1;
-		} else {
-			dma_buffer->data.cmd = MSM_NAND_CMD_PAGE_READ;
-			dma_buffer->data.cfg0 = (MSM_NAND_CFG0_RAW
-					& ~(7U << 6)) | ((cwperpage-1) << 6);
-			dma_buffer->data.cfg1 = MSM_NAND_CFG1_RAW |
-					(chip->CFG1 & CFG1_WIDE_FLASH);
-		}
+			pg->data.addr0 = ((page + b) << 16) | oob_col;
+			pg->data.addr1 = ((page + b) >> 16) & 0xff;
+			/* chipsel_0 + enable DM interface */
+			pg->data.chipsel = 0 | 4;
 
-		dma_buffer->data.addr0 = (page << 16) | oob_col;
-		dma_buffer->data.addr1 = (page >> 16) & 0xff;
-		/* chipsel_0 + enable DM interface */
-		dma_buffer->data.chipsel = 0 | 4;
 
+			/* GO bit for the EXEC register */
+			pg->data.exec = 1;
 
-		/* GO bit for the EXEC register */
-		dma_buffer->data.exec = 1;
 
+			BUILD_BUG_ON(8 != ARRAY_SIZE(pg->data.result));
 
-		BUILD_BUG_ON(8 != ARRAY_SIZE(dma_buffer->data.result));
+			for (n = start_sector; n < cwperpage; n++) {
+				/* flash + buffer status return words */
+				pg->data.result[n].flash_status = 0xeeeeeeee;
+				pg->data.result[n].buffer_status = 0xeeeeeeee;
 
-		for (n = start_sector; n < cwperpage; n++) {
-			/* flash + buffer status return words */
-			dma_buffer->data.result[n].flash_status = 0xeeeeeeee;
-			dma_buffer->data.result[n].buffer_status = 0xeeeeeeee;
+				/* block on cmd ready, then
+				 * write CMD / ADDR0 / ADDR1 / CHIPSEL
+				 * regs in a burst
+				 */
+				cmd->cmd = DST_CRCI_NAND_CMD;
+				cmd->src = msm_virt_to_dma(chip, &pg->data.cmd);
+				cmd->dst = MSM_NAND_FLASH_CMD;
+				if (n == start_sector)
+					cmd->len = 16;
+				else
+					cmd->len = 4;
+				cmd++;
 
-			/* block on cmd ready, then
-			 * write CMD / ADDR0 / ADDR1 / CHIPSEL
-			 * regs in a burst
-			 */
-			cmd->cmd = DST_CRCI_NAND_CMD;
-			cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.cmd);
-			cmd->dst = MSM_NAND_FLASH_CMD;
-			if (n == start_sector)
-				cmd->len = 16;
-			else
-				cmd->len = 4;
-			cmd++;
+				if (n == start_sector) {
+					cmd->cmd = 0;
+					cmd->src = msm_virt_to_dma(chip,
+								&pg->data.cfg0);
+					cmd->dst = MSM_NAND_DEV0_CFG0;
+					cmd->len = 8;
+					cmd++;
 
-			if (n == start_sector) {
-				cmd->cmd = 0;
-				cmd->src = msm_virt_to_dma(chip,
-							&dma_buffer->data.cfg0);
-				cmd->dst = MSM_NAND_DEV0_CFG0;
-				cmd->len = 8;
-				cmd++;
+					pg->data.ecccfg = chip->ecc_buf_cfg;
+					cmd->cmd = 0;
+					cmd->src = msm_virt_to_dma(chip,
+							&pg->data.ecccfg);
+					cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
+					cmd->len = 4;
+					cmd++;
+				}
 
-				dma_buffer->data.ecccfg = chip->ecc_buf_cfg;
+				/* kick the execute register */
 				cmd->cmd = 0;
-				cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.ecccfg);
-				cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
+				cmd->src =
+					msm_virt_to_dma(chip, &pg->data.exec);
+				cmd->dst = MSM_NAND_EXEC_CMD;
 				cmd->len = 4;
 				cmd++;
-			}
 
-			/* kick the execute register */
-			cmd->cmd = 0;
-			cmd->src =
-				msm_virt_to_dma(chip, &dma_buffer->data.exec);
-			cmd->dst = MSM_NAND_EXEC_CMD;
-			cmd->len = 4;
-			cmd++;
-
-			/* block on data ready, then
-			 * read the status register
-			 */
-			cmd->cmd = SRC_CRCI_NAND_DATA;
-			cmd->src = MSM_NAND_FLASH_STATUS;
-			cmd->dst = msm_virt_to_dma(chip,
-						   &dma_buffer->data.result[n]);
-			/* MSM_NAND_FLASH_STATUS + MSM_NAND_BUFFER_STATUS */
-			cmd->len = 8;
-			cmd++;
-
-			/* read data block
-			 * (only valid if status says success)
-			 */
-			if (ops->datbuf) {
-				if (ops->mode != MTD_OOB_RAW)
-					sectordatasize = (n < (cwperpage - 1))
-					? 516 : (512 - ((cwperpage - 1) << 2));
-				else
-					sectordatasize = 528;
-
-				cmd->cmd = 0;
-				cmd->src = MSM_NAND_FLASH_BUFFER;
-				cmd->dst = data_dma_addr_curr;
-				data_dma_addr_curr += sectordatasize;
-				cmd->len = sectordatasize;
+				/* block on data ready, then
+				 * read the status register
+				 */
+				cmd->cmd = SRC_CRCI_NAND_DATA;
+				cmd->src = MSM_NAND_FLASH_STATUS;
+				cmd->dst = msm_virt_to_dma(chip,
+							   &pg->data.result[n]);
+				/* MSM_NAND_FLASH_STATUS +
+				 * MSM_NAND_BUFFER_STATUS
+				 */
+				cmd->len = 8;
 				cmd++;
-			}
 
-			if (ops->oobbuf && (n == (cwperpage - 1)
-			     || ops->mode != MTD_OOB_AUTO)) {
-				cmd->cmd = 0;
-				if (n == (cwperpage - 1)) {
-					cmd->src = MSM_NAND_FLASH_BUFFER +
+				/* read data block
+				 * (only valid if status says success)
+				 */
+				if (ops->datbuf) {
+					if (ops->mode != MTD_OOB_RAW)
+						sectordatasize =
+						(n < (cwperpage - 1)) ? 516 :
 						(512 - ((cwperpage - 1) << 2));
-					sectoroobsize = (cwperpage << 2);
-					if (ops->mode != MTD_OOB_AUTO)
-						sectoroobsize += 10;
-				} else {
-					cmd->src = MSM_NAND_FLASH_BUFFER + 516;
-					sectoroobsize = 10;
-				}
+					else
+						sectordatasize = 528;
 
-				cmd->dst = oob_dma_addr_curr;
-				if (sectoroobsize < oob_len)
-					cmd->len = sectoroobsize;
-				else
-					cmd->len = oob_len;
-				oob_dma_addr_curr += cmd->len;
-				oob_len -= cmd->len;
-				if (cmd->len > 0)
+					cmd->cmd = 0;
+					cmd->src = MSM_NAND_FLASH_BUFFER;
+					cmd->dst = data_dma_addr_curr;
+					data_dma_addr_curr += sectordatasize;
+					cmd->len = sectordatasize;
 					cmd++;
+				}
+
+				if (ops->oobbuf && (n == (cwperpage - 1)
+				     || ops->mode != MTD_OOB_AUTO)) {
+					cmd->cmd = 0;
+					if (n == (cwperpage - 1)) {
+						cmd->src =
+						MSM_NAND_FLASH_BUFFER +
+						(512 - ((cwperpage - 1) << 2));
+						sectoroobsize =
+							(cwperpage << 2);
+						if (ops->mode != MTD_OOB_AUTO)
+							sectoroobsize += 10;
+					} else {
+						cmd->src =
+						MSM_NAND_FLASH_BUFFER + 516;
+						sectoroobsize = 10;
+					}
+
+					cmd->dst = oob_dma_addr_curr;
+					if (sectoroobsize < oob_len)
+						cmd->len = sectoroobsize;
+					else
+						cmd->len = oob_len;
+					oob_dma_addr_curr += cmd->len;
+					oob_len -= cmd->len;
+					if (cmd->len > 0)
+						cmd++;
+				}
 			}
-		}
 
-		BUILD_BUG_ON(8 * 5 + 2 != ARRAY_SIZE(dma_buffer->cmd));
-		BUG_ON(cmd - dma_buffer->cmd > ARRAY_SIZE(dma_buffer->cmd));
-		dma_buffer->cmd[0].cmd |= CMD_OCB;
-		cmd[-1].cmd |= CMD_OCU | CMD_LC;
+			BUILD_BUG_ON(8 * 5 + 2 != ARRAY_SIZE(pg->cmd));
+			BUILD_BUG_ON(sizeof(*dma_buffer) >
+				     MSM_NAND_DMA_BUFFER_SIZE / 2);
+			BUG_ON(cmd - pg->cmd > ARRAY_SIZE(pg->cmd));
+			pg->cmd[0].cmd |= CMD_OCB;
+			cmd[-1].cmd |= CMD_OCU | CMD_LC;
 
-		dma_buffer->cmdptr =
-			(msm_virt_to_dma(chip, dma_buffer->cmd) >> 3)
-			| CMD_PTR_LP;
+			dma_buffer->cmdptr[b] =
+				msm_virt_to_dma(chip, pg->cmd) >> 3;
+			oob_left[b] = oob_len;
+		}
+		dma_buffer->cmdptr[batch - 1] |= CMD_PTR_LP;
 
 		dsb();
 		msm_dmov_exec_cmd(chip->dma_channel, crci_mask,
 			DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(msm_virt_to_dma(chip,
-			&dma_buffer->cmdptr)));
+			dma_buffer->cmdptr)));
 		dsb();
 
-		/* if any of the writes failed (0x10), or there
-		 * was a protection violation (0x100), we lose
-		 */
-		pageerr = rawerr = 0;
-		for (n = start_sector; n < cwperpage; n++) {
-			if (dma_buffer->data.result[n].flash_status & 0x110) {
-				rawerr = -EIO;
-				break;
+		for (b = 0; b < batch; b++) {
+			pg = &dma_buffer->pg[b];
+
+			/* if any of the writes failed (0x10), or there
+			 * was a protection violation (0x100), we lose
+			 */
+			pageerr = rawerr = 0;
+			for (n = start_sector; n < cwperpage; n++) {
+				if (pg->data.result[n].flash_status & 0x110) {
+					rawerr = -EIO;
+					break;
+				}
 			}
-		}
-		if (rawerr) {
-			if (ops->datbuf && ops->mode != MTD_OOB_RAW) {
-				uint8_t *datbuf = ops->datbuf +
-					pages_read * mtd->writesize;
+			if (rawerr) {
+				if (ops->datbuf && ops->mode != MTD_OOB_RAW) {
+					uint8_t *datbuf = ops->datbuf +
+						pages_read * mtd->writesize;
+
+					dma_sync_single_for_cpu(chip->dev,
+						data_dma_addr +
+						pages_read * mtd->writesize,
+						mtd->writesize,
+						DMA_BIDIRECTIONAL);
+
+					for (n = 0; n < mtd->writesize; n++) {
+						/* empty blocks read 0x54 at
+						 * these offsets
+						 */
+						if (n % 516 == 3 &&
+						    datbuf[n] == 0x54)
+							datbuf[n] = 0xff;
+						if (datbuf[n] != 0xff) {
+							pageerr = rawerr;
+							break;
+						}
+					}
 
-				dma_sync_single_for_cpu(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
+					dma_sync_single_for_device(chip->dev,
+						data_dma_addr +
+						pages_read * mtd->writesize,
+						mtd->writesize,
+						DMA_BIDIRECTIONAL);
 
-				for (n = 0; n < mtd->writesize; n++) {
-					/* empty blocks read 0x54 at
-					 * these offsets
-					 */
-					if (n % 516 == 3 && datbuf[n] == 0x54)
-						datbuf[n] = 0xff;
-					if (datbuf[n] != 0xff) {
-						pageerr = rawerr;
-						break;
+				}
+				if (ops->oobbuf) {
+					for (n = 0; n < ops->ooblen; n++) {
+						if (ops->oobbuf[n] != 0xff) {
+							pageerr = rawerr;
+							break;
+						}
 					}
 				}
-
-				dma_sync_single_for_device(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
-
 			}
-			if (ops->oobbuf) {
-				for (n = 0; n < ops->ooblen; n++) {
-					if (ops->oobbuf[n] != 0xff) {
-						pageerr = rawerr;
+			if (pageerr) {
+				for (n = start_sector; n < cwperpage; n++) {
+					if (pg->data.result[n].buffer_status
+							& 0x8) {
+						/* not thread safe */
+						mtd->ecc_stats.failed++;
+						pageerr = -EBADMSG;
 						break;
 					}
 				}
 			}
-		}
-		if (pageerr) {
-			for (n = start_sector; n < cwperpage; n++) {
-				if (dma_buffer->data.result[n].buffer_status
-						& 0x8) {
-					/* not thread safe */
-					mtd->ecc_stats.failed++;
-					pageerr = -EBADMSG;
-					break;
-				}
-			}
-		}
-		if (!rawerr) { /* check for corretable errors */
-			for (n = start_sector; n < cwperpage; n++) {
-				ecc_errors = dma_buffer->data.
-					result[n].buffer_status & 0x7;
-				if (ecc_errors) {
-					total_ecc_errors += ecc_errors;
-					/* not thread safe */
-					mtd->ecc_stats.corrected += ecc_errors;
-					if (ecc_errors > 1)
-						pageerr = -EUCLEAN;
+			if (!rawerr) { /* check for corretable errors */
+				for (n = start_sector; n < cwperpage; n++) {
+					ecc_errors = pg->data.
+						result[n].buffer_status & 0x7;
+					if (ecc_errors) {
+						total_ecc_errors += ecc_errors;
+						/* not thread safe */
+						mtd->ecc_stats.corrected +=
+							ecc_errors;
+						if (ecc_errors > 1)
+							pageerr = -EUCLEAN;
+					}
 				}
 			}
-		}
-		if (pageerr && (pageerr != -EUCLEAN || err == 0))
-			err = pageerr;
+			if (pageerr && (pageerr != -EUCLEAN || err == 0))
+				err = pageerr;
 
 #if VERBOSE
-		if (rawerr && !pageerr) {
-			pr_err("msm_nand_read_oob %llx %x %x empty page\n",
-			       (loff_t)page * mtd->writesize, ops->len,
-			       ops->ooblen);
-		} else {
-			for (n = start_sector; n < cwperpage; n++)
-				pr_info("flash_status[%d] = %x,\
-				buffr_status[%d] = %x\n",
-				n, dma_buffer->data.result[n].flash_status,
-				n, dma_buffer->data.result[n].buffer_status);
-		}
+			if (rawerr && !pageerr) {
+				pr_err("msm_nand_read_oob %llx %x %x "
+				       "empty page\n",
+				       (loff_t)page * mtd->writesize,
+				       ops->len, ops->ooblen);
+			} else {
+				for (n = start_sector; n < cwperpage; n++)
+					pr_info("flash_status[%d] = %x,\
+					buffr_status[%d] = %x\n",
+					n, pg->data.result[n].flash_status,
+					n, pg->data.result[n].buffer_status);
+			}
 #endif
-		if (err && err != -EUCLEAN && err != -EBADMSG)
+			if (err && err != -EUCLEAN && err != -EBADMSG) {
+				/* later pages of the batch are not returned */
+				oob_len = oob_left[b];
+				break;
+			}
+			pages_read++;
+			page++;
+		}
+		if (b < batch)
 			break;
-		pages_read++;
-		page++;
+		page_count -= batch;
 	}
 	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
 
@@ -1110,6 +1193,8 @@ err_dma_map_oobbuf_failed:
 		ops->retlen = (mtd->writesize +  mtd->oobsize) *
 							pages_read;
 	ops->oobretlen = ops->ooblen - oob_len;
+	msm_nand_account(chip, MSM_NAND_STATS_READ, pages_read,
+			 ops->retlen + ops->oobretlen, start);
 	if (err)
 		pr_err("msm_nand_read_oob %llx %x %x failed %d, corrected %d\n",
 		       from, ops->datbuf ? ops->len : 0, ops->ooblen, err,
@@ -1913,24 +1998,30 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 {
 	struct msm_nand_chip *chip = mtd->priv;
 	struct {
-		dmov_s cmd[8 * 7 + 2];
-		unsigned cmdptr;
 		struct {
-			uint32_t cmd;
-			uint32_t addr0;
-			uint32_t addr1;
-			uint32_t chipsel;
-			uint32_t cfg0;
-			uint32_t cfg1;
-			uint32_t exec;
-			uint32_t ecccfg;
-			uint32_t clrfstatus;
-			uint32_t clrrstatus;
-			uint32_t flash_status[8];
-		} data;
+			dmov_s cmd[8 * 7 + 2];
+			struct {
+				uint32_t cmd;
+				uint32_t addr0;
+				uint32_t addr1;
+				uint32_t chipsel;
+				uint32_t cfg0;
+				uint32_t cfg1;
+				uint32_t exec;
+				uint32_t ecccfg;
+				uint32_t clrfstatus;
+				uint32_t clrrstatus;
+				uint32_t flash_status[8];
+			} data;
+		} pg[MSM_NAND_WRITE_PIPELINE];
+		unsigned cmdptr[MSM_NAND_WRITE_PIPELINE];
 	} *dma_buffer;
+	typeof(dma_buffer->pg[0]) *pg;
 	dmov_s *cmd;
 	unsigned n;
+	unsigned b, batch;
+	uint32_t oob_left[MSM_NAND_WRITE_PIPELINE];
+	ktime_t start = ktime_get();
 	unsigned page = 0;
 	uint32_t oob_len;
 	uint32_t sectordatawritesize;
@@ -2024,182 +2115,210 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 	wait_event(chip->wait_queue, (dma_buffer =
 			msm_nand_get_dma_buffer(chip, sizeof(*dma_buffer))));
 
-	while (page_count-- > 0) {
-		cmd = dma_buffer->cmd;
-
-		if (ops->mode != MTD_OOB_RAW) {
-			dma_buffer->data.cfg0 = chip->CFG0;
-			dma_buffer->data.cfg1 = chip->CFG1;
-		} else {
-			dma_buffer->data.cfg0 = (MSM_NAND_CFG0_RAW &
+	while (page_count > 0) {
+		/* Chain up to MSM_NAND_WRITE_PIPELINE pages on one data
+		 * mover pointer list so the next page is loaded into the
+		 * controller as soon as the previous program completes.
+		 * If a page fails, the rest of the batch has still been
+		 * programmed, but it is not reported as written and the
+		 * block is going bad anyway.
+		 */
+		batch = min(page_count, (unsigned)MSM_NAND_WRITE_PIPELINE);
+		for (b = 0; b < batch; b++) {
+			pg = &dma_buffer->pg[b];
+			cmd = pg->cmd;
+
+			if (ops->mode != MTD_OOB_RAW) {
+				pg->data.cfg0 = chip->CFG0;
+				pg->data.cfg1 = chip->CFG1;
+			} else {
+				pg->data.cfg0 = (MSM_NAND_CFG0_RAW &
 					~(7U << 6)) | ((cwperpage-1) << 6);
-			dma_buffer->data.cfg1 = MSM_NAND_CFG1_RAW |
-						(chip->CFG1 & CFG1_WIDE_FLASH);
-		}
+				pg->data.cfg1 = MSM_NAND_CFG1_RAW |
+					(chip->CFG1 & CFG1_WIDE_FLASH);
+			}
 
-		/* CMD / ADDR0 / ADDR1 / CHIPSEL program values */
-		dma_buffer->data.cmd = MSM_NAND_CMD_PRG_PAGE;
-		dma_buffer->data.addr0 = page << 16;
-		dma_buffer->data.addr1 = (page >> 16) & 0xff;
-		/* chipsel_0 + enable DM interface */
-		dma_buffer->data.chipsel = 0 | 4;
+			/* CMD / ADDR0 / ADDR1 / CHIPSEL program values */
+			pg->data.cmd = MSM_NAND_CMD_PRG_PAGE;
+			pg->data.addr0 = (page + b) << 16;
+			pg->data.addr1 = ((page + b) >> 16) & 0xff;
+			/* chipsel_0 + enable DM interface */
+			pg->data.chipsel = 0 | 4;
 
 
-		/* GO bit for the EXEC register */
-		dma_buffer->data.exec = 1;
-		dma_buffer->data.clrfstatus = 0x00000020;
-		dma_buffer->data.clrrstatus = 0x000000C0;
+			/* GO bit for the EXEC register */
+			pg->data.exec = 1;
+			pg->data.clrfstatus = 0x00000020;
+			pg->data.clrrstatus = 0x000000C0;
 
-		BUILD_BUG_ON(8 != ARRAY_SIZE(dma_buffer->data.flash_status));
+			BUILD_BUG_ON(8 != ARRAY_SIZE(pg->data.flash_status));
 
-		for (n = 0; n < cwperpage ; n++) {
-			/* status return words */
-			dma_buffer->data.flash_status[n] = 0xeeeeeeee;
-			/* block on cmd ready, then
-			 * write CMD / ADDR0 / ADDR1 / CHIPSEL regs in a burst
-			 */
-			cmd->cmd = DST_CRCI_NAND_CMD;
-			cmd->src =
-				msm_virt_to_dma(chip, &dma_buffer->data.cmd);
-			cmd->dst = MSM_NAND_FLASH_CMD;
-			if (n == 0)
-				cmd->len = 16;
-			else
-				cmd->len = 4;
-			cmd++;
-
-			if (n == 0) {
-				cmd->cmd = 0;
-				cmd->src = msm_virt_to_dma(chip,
-							&dma_buffer->data.cfg0);
-				cmd->dst = MSM_NAND_DEV0_CFG0;
-				cmd->len = 8;
+			for (n = 0; n < cwperpage ; n++) {
+				/* status return words */
+				pg->data.flash_status[n] = 0xeeeeeeee;
+				/* block on cmd ready, then
+				 * write CMD / ADDR0 / ADDR1 / CHIPSEL regs
+				 * in a burst
+				 */
+				cmd->cmd = DST_CRCI_NAND_CMD;
+				cmd->src =
+					msm_virt_to_dma(chip, &pg->data.cmd);
+				cmd->dst = MSM_NAND_FLASH_CMD;
+				if (n == 0)
+					cmd->len = 16;
+				else
+					cmd->len = 4;
 				cmd++;
 
-				dma_buffer->data.ecccfg = chip->ecc_buf_cfg;
-				cmd->cmd = 0;
-				cmd->src = msm_virt_to_dma(chip,
-						 &dma_buffer->data.ecccfg);
-				cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
-				cmd->len = 4;
-				cmd++;
-			}
+				if (n == 0) {
+					cmd->cmd = 0;
+					cmd->src = msm_virt_to_dma(chip,
+								&pg->data.cfg0);
+					cmd->dst = MSM_NAND_DEV0_CFG0;
+					cmd->len = 8;
+					cmd++;
 
-			/* write data block */
-			if (ops->mode != MTD_OOB_RAW)
-				sectordatawritesize = (n < (cwperpage - 1)) ?
-					516 : (512 - ((cwperpage - 1) << 2));
-			else
-				sectordatawritesize = 528;
+					pg->data.ecccfg = chip->ecc_buf_cfg;
+					cmd->cmd = 0;
+					cmd->src = msm_virt_to_dma(chip,
+							 &pg->data.ecccfg);
+					cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
+					cmd->len = 4;
+					cmd++;
+				}
 
-			cmd->cmd = 0;
-			cmd->src = data_dma_addr_curr;
-			data_dma_addr_curr += sectordatawritesize;
-			cmd->dst = MSM_NAND_FLASH_BUFFER;
-			cmd->len = sectordatawritesize;
-			cmd++;
+				/* write data block */
+				if (ops->mode != MTD_OOB_RAW)
+					sectordatawritesize =
+						(n < (cwperpage - 1)) ? 516 :
+						(512 - ((cwperpage - 1) << 2));
+				else
+					sectordatawritesize = 528;
 
-			if (ops->oobbuf) {
-				if (n == (cwperpage - 1)) {
-					cmd->cmd = 0;
-					cmd->src = oob_dma_addr_curr;
-					cmd->dst = MSM_NAND_FLASH_BUFFER +
+				cmd->cmd = 0;
+				cmd->src = data_dma_addr_curr;
+				data_dma_addr_curr += sectordatawritesize;
+				cmd->dst = MSM_NAND_FLASH_BUFFER;
+				cmd->len = sectordatawritesize;
+				cmd++;
+
+				if (ops->oobbuf) {
+					if (n == (cwperpage - 1)) {
+						cmd->cmd = 0;
+						cmd->src = oob_dma_addr_curr;
+						cmd->dst =
+						MSM_NAND_FLASH_BUFFER +
 						(512 - ((cwperpage - 1) << 2));
-					if ((cwperpage << 2) < oob_len)
-						cmd->len = (cwperpage << 2);
-					else
-						cmd->len = oob_len;
-					oob_dma_addr_curr += cmd->len;
-					oob_len -= cmd->len;
-					if (cmd->len > 0)
-						cmd++;
-				}
-				if (ops->mode != MTD_OOB_AUTO) {
-					/* skip ecc bytes in oobbuf */
-					if (oob_len < 10) {
-						oob_dma_addr_curr += 10;
-						oob_len -= 10;
-					} else {
-						oob_dma_addr_curr += oob_len;
-						oob_len = 0;
+						if ((cwperpage << 2) < oob_len)
+							cmd->len =
+							(cwperpage << 2);
+						else
+							cmd->len = oob_len;
+						oob_dma_addr_curr += cmd->len;
+						oob_len -= cmd->len;
+						if (cmd->len > 0)
+							cmd++;
+					}
+					if (ops->mode != MTD_OOB_AUTO) {
+						/* skip ecc bytes in oobbuf */
+						if (oob_len < 10) {
+							oob_dma_addr_curr += 10;
+							oob_len -= 10;
+						} else {
+							oob_dma_addr_curr +=
+								oob_len;
+							oob_len = 0;
+						}
 					}
 				}
-			}
 
-			/* kick the execute register */
-			cmd->cmd = 0;
-			cmd->src =
-				msm_virt_to_dma(chip, &dma_buffer->data.exec);
-			cmd->dst = MSM_NAND_EXEC_CMD;
-			cmd->len = 4;
-			cmd++;
+				/* kick the execute register */
+				cmd->cmd = 0;
+				cmd->src =
+					msm_virt_to_dma(chip, &pg->data.exec);
+				cmd->dst = MSM_NAND_EXEC_CMD;
+				cmd->len = 4;
+				cmd++;
 
-			/* block on data ready, then
-			 * read the status register
-			 */
-			cmd->cmd = SRC_CRCI_NAND_DATA;
-			cmd->src = MSM_NAND_FLASH_STATUS;
-			cmd->dst = msm_virt_to_dma(chip,
-					     &dma_buffer->data.flash_status[n]);
-			cmd->len = 4;
-			cmd++;
+				/* block on data ready, then
+				 * read the status register
+				 */
+				cmd->cmd = SRC_CRCI_NAND_DATA;
+				cmd->src = MSM_NAND_FLASH_STATUS;
+				cmd->dst = msm_virt_to_dma(chip,
+						     &pg->data.flash_status[n]);
+				cmd->len = 4;
+				cmd++;
 
-			cmd->cmd = 0;
-			cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.clrfstatus);
-			cmd->dst = MSM_NAND_FLASH_STATUS;
-			cmd->len = 4;
-			cmd++;
+				cmd->cmd = 0;
+				cmd->src = msm_virt_to_dma(chip,
+							&pg->data.clrfstatus);
+				cmd->dst = MSM_NAND_FLASH_STATUS;
+				cmd->len = 4;
+				cmd++;
 
-			cmd->cmd = 0;
-			cmd->src = msm_virt_to_dma(chip,
-						&dma_buffer->data.clrrstatus);
-			cmd->dst = MSM_NAND_READ_STATUS;
-			cmd->len = 4;
-			cmd++;
+				cmd->cmd = 0;
+				cmd->src = msm_virt_to_dma(chip,
+							&pg->data.clrrstatus);
+				cmd->dst = MSM_NAND_READ_STATUS;
+				cmd->len = 4;
+				cmd++;
 
-		}
+			}
 
-		dma_buffer->cmd[0].cmd |= CMD_OCB;
-		cmd[-1].cmd |= CMD_OCU | CMD_LC;
-		BUILD_BUG_ON(8 * 7 + 2 != ARRAY_SIZE(dma_buffer->cmd));
-		BUG_ON(cmd - dma_buffer->cmd > ARRAY_SIZE(dma_buffer->cmd));
-		dma_buffer->cmdptr =
-			(msm_virt_to_dma(chip, dma_buffer->cmd) >> 3) |
-			CMD_PTR_LP;
+			pg->cmd[0].cmd |= CMD_OCB;
+			cmd[-1].cmd |= CMD_OCU | CMD_LC;
+			BUILD_BUG_ON(8 * 7 + 2 != ARRAY_SIZE(pg->cmd));
+			BUILD_BUG_ON(sizeof(*dma_buffer) >
+				     MSM_NAND_DMA_BUFFER_SIZE / 2);
+			BUG_ON(cmd - pg->cmd > ARRAY_SIZE(pg->cmd));
+			dma_buffer->cmdptr[b] =
+				msm_virt_to_dma(chip, pg->cmd) >> 3;
+			oob_left[b] = oob_len;
+		}
+		dma_buffer->cmdptr[batch - 1] |= CMD_PTR_LP;
 
 		dsb();
 		msm_dmov_exec_cmd(chip->dma_channel, crci_mask,
 			DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(
-				msm_virt_to_dma(chip, &dma_buffer->cmdptr)));
+				msm_virt_to_dma(chip, dma_buffer->cmdptr)));
 		dsb();
 
-		/* if any of the writes failed (0x10), or there was a
-		 * protection violation (0x100), or the program success
-		 * bit (0x80) is unset, we lose
-		 */
 		err = 0;
-		for (n = 0; n < cwperpage; n++) {
-			if (dma_buffer->data.flash_status[n] & 0x110) {
-				err = -EIO;
-				break;
-			}
-			if (!(dma_buffer->data.flash_status[n] & 0x80)) {
-				err = -EIO;
-				break;
+		for (b = 0; b < batch; b++) {
+			pg = &dma_buffer->pg[b];
+
+			/* if any of the writes failed (0x10), or there was a
+			 * protection violation (0x100), or the program success
+			 * bit (0x80) is unset, we lose
+			 */
+			for (n = 0; n < cwperpage; n++) {
+				if (pg->data.flash_status[n] & 0x110) {
+					err = -EIO;
+					break;
+				}
+				if (!(pg->data.flash_status[n] & 0x80)) {
+					err = -EIO;
+					break;
+				}
 			}
-		}
 
 #if VERBOSE
-		for (n = 0; n < cwperpage; n++)
-			pr_info("write pg %d: flash_status[%d] = %x\n", page,
-				n, dma_buffer->data.flash_status[n]);
+			for (n = 0; n < cwperpage; n++)
+				pr_info("write pg %d: flash_status[%d] = %x\n",
+					page, n, pg->data.flash_status[n]);
 
 #endif
-		if (err)
+			if (err) {
+				oob_len = oob_left[b];
+				break;
+			}
+			pages_written++;
+			page++;
+		}
+		if (b < batch)
 			break;
-		pages_written++;
-		page++;
+		page_count -= batch;
 	}
 	if (ops->mode != MTD_OOB_RAW)
 		ops->retlen = mtd->writesize * pages_written;
@@ -2207,6 +2326,8 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 		ops->retlen = (mtd->writesize + mtd->oobsize) * pages_written;
 
 	ops->oobretlen = ops->ooblen - oob_len;
+	msm_nand_account(chip, MSM_NAND_STATS_WRITE, pages_written,
+			 ops->retlen + ops->oobretlen, start);
 
 	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
 
@@ -2880,6 +3001,7 @@ msm_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 	} *dma_buffer;
 	dmov_s *cmd;
 	unsigned page = 0;
+	ktime_t start = ktime_get();
 
 	if (mtd->writesize == 2048)
 		page = instr->addr >> 11;
@@ -2973,6 +3095,9 @@ msm_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 		err = 0;
 
 	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
+	msm_nand_account(chip, MSM_NAND_STATS_ERASE,
+			 err ? 0 : mtd->erasesize / mtd->writesize,
+			 err ? 0 : mtd->erasesize, start);
 	if (err) {
 		pr_err("%s: erase failed, 0x%llx\n", __func__, instr->addr);
 		instr->fail_addr = instr->addr;
@@ -6733,6 +6858,63 @@ struct msm_nand_info {
 	struct msm_nand_chip	msm_nand;
 };
 
+#ifdef CONFIG_DEBUG_FS
+static const char *msm_nand_stats_names[MSM_NAND_STATS_NR] = {
+	[MSM_NAND_STATS_READ]	= "read",
+	[MSM_NAND_STATS_WRITE]	= "write",
+	[MSM_NAND_STATS_ERASE]	= "erase",
+};
+
+static int msm_nand_stats_show(struct seq_file *m, void *unused)
+{
+	struct msm_nand_chip *chip = m->private;
+	struct msm_nand_op_stats stats[MSM_NAND_STATS_NR];
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&chip->stats_lock, flags);
+	memcpy(stats, chip->stats, sizeof(stats));
+	spin_unlock_irqrestore(&chip->stats_lock, flags);
+
+	seq_printf(m, "%-6s %10s %10s %12s %12s %8s\n",
+		   "op", "calls", "pages", "bytes", "usecs", "KB/s");
+	for (i = 0; i < MSM_NAND_STATS_NR; i++)
+		seq_printf(m, "%-6s %10lu %10lu %12llu %12llu %8llu\n",
+			   msm_nand_stats_names[i], stats[i].ops,
+			   stats[i].pages, stats[i].bytes, stats[i].usecs,
+			   stats[i].usecs ? div64_u64((stats[i].bytes >> 10) *
+					USEC_PER_SEC, stats[i].usecs) : 0);
+	return 0;
+}
+
+static int msm_nand_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_nand_stats_show, inode->i_private);
+}
+
+static const struct file_operations msm_nand_stats_fops = {
+	.open		= msm_nand_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void msm_nand_debugfs_init(struct msm_nand_chip *chip)
+{
+	chip->stats_dent = debugfs_create_file(dev_name(chip->dev), S_IRUGO,
+					       NULL, chip,
+					       &msm_nand_stats_fops);
+}
+
+static void msm_nand_debugfs_exit(struct msm_nand_chip *chip)
+{
+	debugfs_remove(chip->stats_dent);
+}
+#else
+static inline void msm_nand_debugfs_init(struct msm_nand_chip *chip) {}
+static inline void msm_nand_debugfs_exit(struct msm_nand_chip *chip) {}
+#endif
+
 /* duplicating the NC01 XFR contents to NC10 */
 static int msm_nand_nc10_xfr_settings(struct mtd_info *mtd)
 {
@@ -6876,6 +7058,7 @@ no_dual_nand_ctlr_support:
 	info->msm_nand.dev = &pdev->dev;
 
 	init_waitqueue_head(&info->msm_nand.wait_queue);
+	spin_lock_init(&info->msm_nand.stats_lock);
 
 	info->msm_nand.dma_channel = res->start;
 	pr_info("%s: dmac 0x%x\n", __func__, info->msm_nand.dma_channel);
@@ -6916,6 +7099,7 @@ no_dual_nand_ctlr_support:
 
 	setup_mtd_device(pdev, info);
 	dev_set_drvdata(&pdev->dev, info);
+	msm_nand_debugfs_init(&info->msm_nand);
 
 	return 0;
 
@@ -6936,6 +7120,7 @@ static int __devexit msm_nand_remove(struct platform_device *pdev)
 	dev_set_drvdata(&pdev->dev, NULL);
 
 	if (info) {
+		msm_nand_debugfs_exit(&info->msm_nand);
 #ifdef CONFIG_MTD_PARTITIONS
 		if (info->parts)
 			del_mtd_partitions(&info->mtd);
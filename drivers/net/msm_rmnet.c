@@ -47,6 +47,21 @@
 
 #define HEADROOM_FOR_QOS    8
 
+/* NAPI budget per poll of one channel */
+#define RMNET_NAPI_WEIGHT 64
+
+/* Transmitted skbs kept for reuse as receive buffers, per device. They
+ * must hold the largest frame we accept.
+ */
+#define RMNET_RX_RECYCLE_MAX 32
+#define RMNET_RX_SKB_SIZE (RMNET_DATA_LEN + ETH_HLEN + NET_IP_ALIGN)
+
+/* Bytes of tx backlog at which the stack is stopped, and to which the
+ * backlog must drain before it is woken again.
+ */
+#define RMNET_TX_HIGH_WATERMARK (4 * RMNET_DATA_LEN)
+#define RMNET_TX_LOW_WATERMARK RMNET_DATA_LEN
+
 static const char *ch_name[8] = {
 	"DATA5",
 	"DATA6",
@@ -72,9 +87,13 @@ struct rmnet_private
 	unsigned long wakeups_rcv;
 	unsigned long timeout_us;
 #endif
-	struct sk_buff *skb;
+	struct sk_buff_head txq;	/* tx backlog waiting for SMD space */
+	unsigned tx_queued_bytes;
+	unsigned long tx_stops;
 	spinlock_t lock;
 	struct tasklet_struct tsklt;
+	struct napi_struct napi;
+	struct sk_buff_head rx_recycle;
 	u32 operation_mode;    /* IOCTL specified mode (protocol, QoS header) */
 	struct platform_driver pdrv;
 	struct completion complete;
@@ -190,6 +209,15 @@ static ssize_t wakeups_rcv_show(struct device *d, struct device_attribute *attr,
 
 DEVICE_ATTR(wakeups_rcv, 0444, wakeups_rcv_show, NULL);
 
+static ssize_t tx_stops_show(struct device *d, struct device_attribute *attr,
+		char *buf)
+{
+	struct rmnet_private *p = netdev_priv(to_net_dev(d));
+	return sprintf(buf, "%lu\n", p->tx_stops);
+}
+
+DEVICE_ATTR(tx_stops, 0444, tx_stops_show, NULL);
+
 /* Set timeout in us. */
 static ssize_t timeout_store(struct device *d, struct device_attribute *attr,
 		const char *buf, size_t n)
@@ -237,139 +265,204 @@ static __be16 rmnet_ip_type_trans(struct sk_buff *skb, struct net_device *dev)
 	return protocol;
 }
 
+static int rmnet_rx_pending(struct rmnet_private *p)
+{
+	int sz;
+
+	if (!p->ch)
+		return 0;
+	sz = smd_cur_packet_size(p->ch);
+	return sz && smd_read_avail(p->ch) >= sz;
+}
+
+static struct sk_buff *rmnet_alloc_rx_skb(struct rmnet_private *p, int sz)
+{
+	struct sk_buff *skb;
+
+	skb = skb_dequeue(&p->rx_recycle);
+	if (!skb)
+		skb = dev_alloc_skb(sz + NET_IP_ALIGN);
+	if (skb)
+		skb_reserve(skb, NET_IP_ALIGN);
+	return skb;
+}
+
 /* Called in soft-irq context */
-static void smd_net_data_handler(unsigned long arg)
+static int rmnet_poll(struct napi_struct *napi, int budget)
 {
-	struct net_device *dev = (struct net_device *) arg;
-	struct rmnet_private *p = netdev_priv(dev);
+	struct rmnet_private *p = container_of(napi, struct rmnet_private,
+					       napi);
+	struct net_device *dev = napi->dev;
 	struct sk_buff *skb;
-	void *ptr = 0;
+	void *ptr;
 	int sz;
-	u32 opmode = p->operation_mode;
+	int work = 0;
+	u32 opmode;
 	unsigned long flags;
 
-	for (;;) {
+	/* Handle Rx frame format */
+	spin_lock_irqsave(&p->lock, flags);
+	opmode = p->operation_mode;
+	spin_unlock_irqrestore(&p->lock, flags);
+
+	while (work < budget && rmnet_rx_pending(p)) {
 		sz = smd_cur_packet_size(p->ch);
-		if (sz == 0) break;
-		if (smd_read_avail(p->ch) < sz) break;
+		work++;
 
 		if (RMNET_IS_MODE_IP(opmode) ? (sz > dev->mtu) :
 						(sz > (dev->mtu + ETH_HLEN))) {
 			pr_err("rmnet_recv() discarding %d len (%d mtu)\n",
 				sz, RMNET_IS_MODE_IP(opmode) ?
 					dev->mtu : (dev->mtu + ETH_HLEN));
-			ptr = 0;
+			goto discard;
+		}
+
+		skb = rmnet_alloc_rx_skb(p, sz);
+		if (skb == NULL) {
+			pr_err("rmnet_recv() cannot allocate skb\n");
+			goto discard;
+		}
+
+		skb->dev = dev;
+		ptr = skb_put(skb, sz);
+		if (smd_read(p->ch, ptr, sz) != sz) {
+			pr_err("rmnet_recv() smd lied about avail?!");
+			dev_kfree_skb(skb);
+			continue;
+		}
+
+		if (RMNET_IS_MODE_IP(opmode)) {
+			/* Driver in IP mode */
+			skb->protocol = rmnet_ip_type_trans(skb, dev);
 		} else {
-			skb = dev_alloc_skb(sz + NET_IP_ALIGN);
-			if (skb == NULL) {
-				pr_err("rmnet_recv() cannot allocate skb\n");
-			} else {
-				skb->dev = dev;
-				skb_reserve(skb, NET_IP_ALIGN);
-				ptr = skb_put(skb, sz);
-				wake_lock_timeout(&p->wake_lock, HZ / 2);
-				if (smd_read(p->ch, ptr, sz) != sz) {
-					pr_err("rmnet_recv() smd lied about avail?!");
-					ptr = 0;
-					dev_kfree_skb_irq(skb);
-				} else {
-					/* Handle Rx frame format */
-					spin_lock_irqsave(&p->lock, flags);
-					opmode = p->operation_mode;
-					spin_unlock_irqrestore(&p->lock, flags);
-
-					if (RMNET_IS_MODE_IP(opmode)) {
-						/* Driver in IP mode */
-						skb->protocol =
-						  rmnet_ip_type_trans(skb, dev);
-					} else {
-						/* Driver in Ethernet mode */
-						skb->protocol =
-						  eth_type_trans(skb, dev);
-					}
-					if (RMNET_IS_MODE_IP(opmode) ||
-					    count_this_packet(ptr, skb->len)) {
+			/* Driver in Ethernet mode */
+			skb->protocol = eth_type_trans(skb, dev);
+		}
+		if (RMNET_IS_MODE_IP(opmode) ||
+		    count_this_packet(ptr, skb->len)) {
 #ifdef CONFIG_MSM_RMNET_DEBUG
-						p->wakeups_rcv +=
-							rmnet_cause_wakeup(p);
+			p->wakeups_rcv += rmnet_cause_wakeup(p);
 #endif
-						p->stats.rx_packets++;
-						p->stats.rx_bytes += skb->len;
-					}
-					netif_rx(skb);
-				}
-				continue;
-			}
+			p->stats.rx_packets++;
+			p->stats.rx_bytes += skb->len;
 		}
-		if (smd_read(p->ch, ptr, sz) != sz)
+
+		/* GRO matches flows on the link header, which raw IP
+		 * frames do not have, so only Ethernet mode can use it.
+		 */
+		if (RMNET_IS_MODE_IP(opmode))
+			netif_receive_skb(skb);
+		else
+			napi_gro_receive(napi, skb);
+		continue;
+
+discard:
+		if (smd_read(p->ch, NULL, sz) != sz)
 			pr_err("rmnet_recv() smd lied about avail?!");
 	}
-}
 
-static DECLARE_TASKLET(smd_net_data_tasklet, smd_net_data_handler, 0);
+	if (work)
+		wake_lock_timeout(&p->wake_lock, HZ / 2);
 
-static int _rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
+	if (work < budget) {
+		napi_complete(napi);
+		/* a notification that raced with the last check found the
+		 * poll still scheduled and was dropped
+		 */
+		if (rmnet_rx_pending(p))
+			napi_reschedule(napi);
+	}
+
+	return work;
+}
+
+/* Write as much of the tx backlog to SMD as fits, oldest first. Written
+ * skbs are moved to @done so that they can be released once the caller
+ * drops p->lock. Called with p->lock held.
+ */
+static void rmnet_tx_drain(struct net_device *dev, struct sk_buff_head *done)
 {
 	struct rmnet_private *p = netdev_priv(dev);
-	smd_channel_t *ch = p->ch;
+	struct sk_buff *skb;
 	int smd_ret;
-	struct QMI_QOS_HDR_S *qmih;
-	u32 opmode;
-	unsigned long flags;
 
-	/* For QoS mode, prepend QMI header and assign flow ID from skb->mark */
-	spin_lock_irqsave(&p->lock, flags);
-	opmode = p->operation_mode;
-	spin_unlock_irqrestore(&p->lock, flags);
+	while ((skb = skb_peek(&p->txq)) != NULL) {
+		if (!p->ch || smd_write_avail(p->ch) < skb->len)
+			break;
 
-	if (RMNET_IS_MODE_QOS(opmode)) {
-		qmih = (struct QMI_QOS_HDR_S *)
-			skb_push(skb, sizeof(struct QMI_QOS_HDR_S));
-		qmih->version = 1;
-		qmih->flags = 0;
-		qmih->flow_id = skb->mark;
+		__skb_unlink(skb, &p->txq);
+		p->tx_queued_bytes -= skb->len;
+
+		dev->trans_start = jiffies;
+		smd_ret = smd_write(p->ch, skb->data, skb->len);
+		if (smd_ret != skb->len) {
+			pr_err("%s: smd_write returned error %d",
+			       __func__, smd_ret);
+			p->stats.tx_errors++;
+		} else if (RMNET_IS_MODE_IP(p->operation_mode) ||
+			   count_this_packet(skb->data, skb->len)) {
+			p->stats.tx_packets++;
+			p->stats.tx_bytes += skb->len;
+#ifdef CONFIG_MSM_RMNET_DEBUG
+			p->wakeups_xmit += rmnet_cause_wakeup(p);
+#endif
+		}
+		__skb_queue_tail(done, skb);
 	}
 
-	dev->trans_start = jiffies;
-	smd_ret = smd_write(ch, skb->data, skb->len);
-	if (smd_ret != skb->len) {
-		pr_err("%s: smd_write returned error %d", __func__, smd_ret);
-		goto xmit_out;
+	/* Only ask for a notification from the modem's reads while there
+	 * is a backlog, and stop or wake the stack with some hysteresis so
+	 * a busy channel is not toggled on every packet. The backlog may
+	 * also build up while the channel is closed.
+	 */
+	if (p->ch) {
+		if (skb_queue_empty(&p->txq))
+			smd_disable_read_intr(p->ch);
+		else
+			smd_enable_read_intr(p->ch);
 	}
 
-	if (RMNET_IS_MODE_IP(opmode) ||
-	    count_this_packet(skb->data, skb->len)) {
-		p->stats.tx_packets++;
-		p->stats.tx_bytes += skb->len;
-#ifdef CONFIG_MSM_RMNET_DEBUG
-		p->wakeups_xmit += rmnet_cause_wakeup(p);
-#endif
+	if (p->tx_queued_bytes >= RMNET_TX_HIGH_WATERMARK) {
+		if (!netif_queue_stopped(dev)) {
+			netif_stop_queue(dev);
+			p->tx_stops++;
+		}
+	} else if (p->tx_queued_bytes <= RMNET_TX_LOW_WATERMARK &&
+		   netif_queue_stopped(dev) && netif_running(dev)) {
+		netif_wake_queue(dev);
 	}
+}
 
-xmit_out:
-	/* data xmited, safe to release skb */
-	dev_kfree_skb_irq(skb);
-	return 0;
+/* data xmited, safe to release skbs or reuse them for receive */
+static void rmnet_tx_complete(struct rmnet_private *p,
+			      struct sk_buff_head *done)
+{
+	struct sk_buff *skb;
+
+	while ((skb = __skb_dequeue(done)) != NULL) {
+		if (skb_queue_len(&p->rx_recycle) < RMNET_RX_RECYCLE_MAX &&
+		    skb_recycle_check(skb, RMNET_RX_SKB_SIZE))
+			skb_queue_head(&p->rx_recycle, skb);
+		else
+			dev_kfree_skb_any(skb);
+	}
 }
 
 static void _rmnet_resume_flow(unsigned long param)
 {
 	struct net_device *dev = (struct net_device *)param;
 	struct rmnet_private *p = netdev_priv(dev);
-	struct sk_buff *skb = NULL;
+	struct sk_buff_head done;
 	unsigned long flags;
 
-	/* xmit and enable the flow only once even if
-	   multiple tasklets were scheduled by smd_net_notify */
+	/* drain the backlog only once even if multiple
+	   tasklets were scheduled by smd_net_notify */
+	__skb_queue_head_init(&done);
 	spin_lock_irqsave(&p->lock, flags);
-	if (p->skb && (smd_write_avail(p->ch) >= p->skb->len)) {
-		skb = p->skb;
-		p->skb = NULL;
-		spin_unlock_irqrestore(&p->lock, flags);
-		_rmnet_xmit(skb, dev);
-		netif_wake_queue(dev);
-	} else
-		spin_unlock_irqrestore(&p->lock, flags);
+	rmnet_tx_drain(dev, &done);
+	spin_unlock_irqrestore(&p->lock, flags);
+
+	rmnet_tx_complete(p, &done);
 }
 
 static void msm_rmnet_unload_modem(void *pil)
@@ -407,23 +500,22 @@ static void *msm_rmnet_load_modem(struct net_device *dev)
 static void smd_net_notify(void *_dev, unsigned event)
 {
 	struct rmnet_private *p = netdev_priv((struct net_device *)_dev);
+	struct sk_buff *skb;
 
 	if (event != SMD_EVENT_DATA)
 		return;
 
 	spin_lock(&p->lock);
-	if (p->skb && (smd_write_avail(p->ch) >= p->skb->len)) {
+	skb = skb_peek(&p->txq);
+	if (skb && (smd_write_avail(p->ch) >= skb->len)) {
 		smd_disable_read_intr(p->ch);
 		tasklet_hi_schedule(&p->tsklt);
 	}
 
 	spin_unlock(&p->lock);
 
-	if (smd_read_avail(p->ch) &&
-	    (smd_read_avail(p->ch) >= smd_cur_packet_size(p->ch))) {
-		smd_net_data_tasklet.data = (unsigned long) _dev;
-		tasklet_schedule(&smd_net_data_tasklet);
-	}
+	if (rmnet_rx_pending(p))
+		napi_schedule(&p->napi);
 }
 
 static int __rmnet_open(struct net_device *dev)
@@ -472,13 +564,19 @@ static int __rmnet_close(struct net_device *dev)
 
 static int rmnet_open(struct net_device *dev)
 {
+	struct rmnet_private *p = netdev_priv(dev);
 	int rc = 0;
 
 	pr_info("rmnet_open()\n");
 
 	rc = __rmnet_open(dev);
-	if (rc == 0)
+	if (rc == 0) {
+		napi_enable(&p->napi);
 		netif_start_queue(dev);
+		/* pick up anything that arrived while NAPI was disabled */
+		if (rmnet_rx_pending(p))
+			napi_schedule(&p->napi);
+	}
 
 	return rc;
 }
@@ -486,11 +584,23 @@ static int rmnet_open(struct net_device *dev)
 static int rmnet_stop(struct net_device *dev)
 {
 	struct rmnet_private *p = netdev_priv(dev);
+	struct sk_buff_head backlog;
+	unsigned long flags;
 
 	pr_info("rmnet_stop()\n");
 
 	netif_stop_queue(dev);
 	tasklet_kill(&p->tsklt);
+	napi_disable(&p->napi);
+	skb_queue_purge(&p->rx_recycle);
+
+	__skb_queue_head_init(&backlog);
+	spin_lock_irqsave(&p->lock, flags);
+	skb_queue_splice_init(&p->txq, &backlog);
+	p->tx_queued_bytes = 0;
+	spin_unlock_irqrestore(&p->lock, flags);
+	p->stats.tx_dropped += skb_queue_len(&backlog);
+	__skb_queue_purge(&backlog);
 
 	/* TODO: unload modem safely,
 	   currently, this causes unnecessary unloads */
@@ -517,7 +627,9 @@ static int rmnet_change_mtu(struct net_device *dev, int new_mtu)
 static int rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct rmnet_private *p = netdev_priv(dev);
-	smd_channel_t *ch = p->ch;
+	struct QMI_QOS_HDR_S *qmih;
+	struct sk_buff_head done;
+	u32 opmode;
 	unsigned long flags;
 
 	if (netif_queue_stopped(dev)) {
@@ -525,18 +637,30 @@ static int rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 		return 0;
 	}
 
+	/* For QoS mode, prepend QMI header and assign flow ID from skb->mark */
 	spin_lock_irqsave(&p->lock, flags);
-	smd_enable_read_intr(ch);
-	if (smd_write_avail(ch) < skb->len) {
-		netif_stop_queue(dev);
-		p->skb = skb;
-		spin_unlock_irqrestore(&p->lock, flags);
-		return 0;
+	opmode = p->operation_mode;
+	spin_unlock_irqrestore(&p->lock, flags);
+
+	if (RMNET_IS_MODE_QOS(opmode)) {
+		qmih = (struct QMI_QOS_HDR_S *)
+			skb_push(skb, sizeof(struct QMI_QOS_HDR_S));
+		qmih->version = 1;
+		qmih->flags = 0;
+		qmih->flow_id = skb->mark;
 	}
-	smd_disable_read_intr(ch);
+
+	/* Queue behind any backlog so packets stay in order; with an empty
+	 * backlog and room in SMD this writes the skb straight away.
+	 */
+	__skb_queue_head_init(&done);
+	spin_lock_irqsave(&p->lock, flags);
+	__skb_queue_tail(&p->txq, skb);
+	p->tx_queued_bytes += skb->len;
+	rmnet_tx_drain(dev, &done);
 	spin_unlock_irqrestore(&p->lock, flags);
 
-	_rmnet_xmit(skb, dev);
+	rmnet_tx_complete(p, &done);
 
 	return 0;
 }
@@ -691,6 +815,7 @@ static void __init rmnet_setup(struct net_device *dev)
 	/* set this after calling ether_setup */
 	dev->mtu = RMNET_DATA_LEN;
 	dev->needed_headroom = HEADROOM_FOR_QOS;
+	dev->features |= NETIF_F_GRO;
 
 	random_ether_addr(dev->dev_addr);
 
@@ -739,10 +864,13 @@ static int __init rmnet_init(void)
 		p->chname = ch_name[n];
 		/* Initial config uses Ethernet */
 		p->operation_mode = RMNET_MODE_LLP_ETH;
-		p->skb = NULL;
+		skb_queue_head_init(&p->txq);
+		p->tx_queued_bytes = 0;
 		spin_lock_init(&p->lock);
 		tasklet_init(&p->tsklt, _rmnet_resume_flow,
 				(unsigned long)dev);
+		netif_napi_add(dev, &p->napi, rmnet_poll, RMNET_NAPI_WEIGHT);
+		skb_queue_head_init(&p->rx_recycle);
 		wake_lock_init(&p->wake_lock, WAKE_LOCK_SUSPEND, ch_name[n]);
 #ifdef CONFIG_MSM_RMNET_DEBUG
 		p->timeout_us = timeout_us;
@@ -776,6 +904,8 @@ static int __init rmnet_init(void)
 			continue;
 		if (device_create_file(d, &dev_attr_wakeups_rcv))
 			continue;
+		if (device_create_file(d, &dev_attr_tx_stops))
+			continue;
 #ifdef CONFIG_HAS_EARLYSUSPEND
 		if (device_create_file(d, &dev_attr_timeout_suspend))
 			continue;
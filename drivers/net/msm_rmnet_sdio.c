@@ -281,6 +281,7 @@ static int _rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 	struct QMI_QOS_HDR_S *qmih;
 	u32 opmode;
 	unsigned long flags;
+	int count, len;
 
 	/* For QoS mode, prepend QMI header and assign flow ID from skb->mark */
 	spin_lock_irqsave(&p->lock, flags);
@@ -295,17 +296,22 @@ static int _rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 		qmih->flow_id = skb->mark;
 	}
 
+	/* the mux owns the skb once queued, sample it beforehand */
+	count = count_this_packet(skb->data, skb->len);
+	len = skb->len;
+
 	dev->trans_start = jiffies;
 	sdio_ret = msm_sdio_dmux_write(p->ch_id, skb);
 
 	if (sdio_ret != 0) {
 		pr_err("%s: write returned error %d", __func__, sdio_ret);
+		p->stats.tx_dropped++;
 		goto xmit_out;
 	}
 
-	if (count_this_packet(skb->data, skb->len)) {
+	if (count) {
 		p->stats.tx_packets++;
-		p->stats.tx_bytes += skb->len;
+		p->stats.tx_bytes += len;
 #ifdef CONFIG_MSM_RMNET_DEBUG
 		p->wakeups_xmit += rmnet_cause_wakeup(p);
 #endif
@@ -320,9 +326,15 @@ xmit_out:
 
 static void sdio_write_done(void *dev, struct sk_buff *skb)
 {
+	struct rmnet_private *p = netdev_priv(dev);
+
 	DBG("%s: write complete\n", __func__);
 	dev_kfree_skb_any(skb);
-	netif_wake_queue(dev);
+
+	if (netif_queue_stopped(dev) && msm_sdio_dmux_is_ch_low(p->ch_id)) {
+		DBG("%s: Low WM hit, waking queue\n", __func__);
+		netif_wake_queue(dev);
+	}
 }
 
 static int __rmnet_open(struct net_device *dev)
@@ -397,14 +409,24 @@ static int rmnet_change_mtu(struct net_device *dev, int new_mtu)
 
 static int rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 {
+	struct rmnet_private *p = netdev_priv(dev);
+
 	if (netif_queue_stopped(dev)) {
 		pr_err("fatal: rmnet_xmit called when netif_queue is stopped");
 		return 0;
 	}
 
-	netif_stop_queue(dev);
 	_rmnet_xmit(skb, dev);
 
+	/* the mux queues several packets, stop only once it is full */
+	if (msm_sdio_dmux_is_ch_full(p->ch_id)) {
+		netif_stop_queue(dev);
+		DBG("%s: High WM hit, stopping queue\n", __func__);
+		/* the queue may have drained before we stopped */
+		if (msm_sdio_dmux_is_ch_low(p->ch_id))
+			netif_wake_queue(dev);
+	}
+
 	return 0;
 }
 
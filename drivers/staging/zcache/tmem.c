@@ -25,7 +25,10 @@
  */
 
 #include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
 #include <linux/spinlock.h>
+#include <linux/vmalloc.h>
 #include <asm/atomic.h>
 
 #include "tmem.h"
@@ -69,9 +72,40 @@ void tmem_register_pamops(struct tmem_pamops *m)
  * Each hashbucket also has a lock to manage concurrent access.
  *
  * The following routines manage tmem_objs.  When any tmem_obj is accessed,
- * the hashbucket lock must be held.
+ * the hashbucket lock must be held, and the pool hash_lock must be held
+ * for read so that its bucket cannot be moved by a resize underneath.
  */
 
+/* the bucket oid hashes to, in the new table if its old one has moved */
+static struct tmem_hashbucket *tmem_oid_bucket(struct tmem_pool *pool,
+						struct tmem_oid *oidp)
+{
+	unsigned int i = tmem_oid_hash(oidp, pool->hash_bits);
+
+	if (pool->new_hashbucket != NULL && i < pool->rehash_idx)
+		return &pool->new_hashbucket[tmem_oid_hash(oidp,
+							pool->new_hash_bits)];
+	return &pool->hashbucket[i];
+}
+
+static struct tmem_hashbucket *tmem_hashbucket_lock(struct tmem_pool *pool,
+						struct tmem_oid *oidp)
+{
+	struct tmem_hashbucket *hb;
+
+	read_lock(&pool->hash_lock);
+	hb = tmem_oid_bucket(pool, oidp);
+	spin_lock(&hb->lock);
+	return hb;
+}
+
+static void tmem_hashbucket_unlock(struct tmem_pool *pool,
+					struct tmem_hashbucket *hb)
+{
+	spin_unlock(&hb->lock);
+	read_unlock(&pool->hash_lock);
+}
+
 /* searches for object==oid in pool, returns locked object if found */
 static struct tmem_obj *tmem_obj_find(struct tmem_hashbucket *hb,
 					struct tmem_oid *oidp)
@@ -123,31 +157,18 @@ static void tmem_obj_free(struct tmem_obj *obj, struct tmem_hashbucket *hb)
 	rb_erase(&obj->rb_tree_node, &hb->obj_rb_root);
 }
 
-/*
- * initialize, and insert an tmem_object_root (called only if find failed)
- */
-static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
-					struct tmem_pool *pool,
-					struct tmem_oid *oidp)
+/* link obj into the rb_tree of hb, it must not already be present */
+static void tmem_obj_insert(struct tmem_obj *obj, struct tmem_hashbucket *hb)
 {
 	struct rb_root *root = &hb->obj_rb_root;
 	struct rb_node **new = &(root->rb_node), *parent = NULL;
 	struct tmem_obj *this;
 
-	BUG_ON(pool == NULL);
-	atomic_inc(&pool->obj_count);
-	obj->objnode_tree_height = 0;
-	obj->objnode_tree_root = NULL;
-	obj->pool = pool;
-	obj->oid = *oidp;
-	obj->objnode_count = 0;
-	obj->pampd_count = 0;
-	SET_SENTINEL(obj, OBJ);
 	while (*new) {
 		BUG_ON(RB_EMPTY_NODE(*new));
 		this = rb_entry(*new, struct tmem_obj, rb_tree_node);
 		parent = *new;
-		switch (tmem_oid_compare(oidp, &this->oid)) {
+		switch (tmem_oid_compare(&obj->oid, &this->oid)) {
 		case 0:
 			BUG(); /* already present; should never happen! */
 			break;
@@ -163,6 +184,25 @@ static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
 	rb_insert_color(&obj->rb_tree_node, root);
 }
 
+/*
+ * initialize, and insert an tmem_object_root (called only if find failed)
+ */
+static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
+					struct tmem_pool *pool,
+					struct tmem_oid *oidp)
+{
+	BUG_ON(pool == NULL);
+	atomic_inc(&pool->obj_count);
+	obj->objnode_tree_height = 0;
+	obj->objnode_tree_root = NULL;
+	obj->pool = pool;
+	obj->oid = *oidp;
+	obj->objnode_count = 0;
+	obj->pampd_count = 0;
+	SET_SENTINEL(obj, OBJ);
+	tmem_obj_insert(obj, hb);
+}
+
 /*
  * Tmem is managed as a set of tmem_pools with certain attributes, such as
  * "ephemeral" vs "persistent".  These attributes apply to all tmem_objs
@@ -171,16 +211,46 @@ static void tmem_obj_init(struct tmem_obj *obj, struct tmem_hashbucket *hb,
  * mounted or unmounted.
  */
 
-/* flush all data from a pool and, optionally, free it */
-static void tmem_pool_flush(struct tmem_pool *pool, bool destroy)
+/*
+ * Hash tables larger than a page come from vmalloc, so growing a pool
+ * does not depend on high-order allocations succeeding.
+ */
+static struct tmem_hashbucket *tmem_hash_alloc(unsigned int bits)
+{
+	struct tmem_hashbucket *table, *hb;
+	size_t size = sizeof(struct tmem_hashbucket) << bits;
+	int i;
+
+	if (size <= PAGE_SIZE)
+		table = kmalloc(size, GFP_KERNEL);
+	else
+		table = vmalloc(size);
+	if (table == NULL)
+		goto out;
+	for (i = 0, hb = table; i < (1 << bits); i++, hb++) {
+		hb->obj_rb_root = RB_ROOT;
+		spin_lock_init(&hb->lock);
+	}
+out:
+	return table;
+}
+
+static void tmem_hash_free(struct tmem_hashbucket *table)
+{
+	if (is_vmalloc_addr(table))
+		vfree(table);
+	else
+		kfree(table);
+}
+
+static void tmem_hash_flush(struct tmem_pool *pool,
+				struct tmem_hashbucket *hb, int nr)
 {
 	struct rb_node *rbnode;
 	struct tmem_obj *obj;
-	struct tmem_hashbucket *hb = &pool->hashbucket[0];
 	int i;
 
-	BUG_ON(pool == NULL);
-	for (i = 0; i < TMEM_HASH_BUCKETS; i++, hb++) {
+	for (i = 0; i < nr; i++, hb++) {
 		spin_lock(&hb->lock);
 		rbnode = rb_first(&hb->obj_rb_root);
 		while (rbnode != NULL) {
@@ -192,6 +262,19 @@ static void tmem_pool_flush(struct tmem_pool *pool, bool destroy)
 		}
 		spin_unlock(&hb->lock);
 	}
+}
+
+/* flush all data from a pool and, optionally, free it */
+static void tmem_pool_flush(struct tmem_pool *pool, bool destroy)
+{
+	BUG_ON(pool == NULL);
+	read_lock(&pool->hash_lock);
+	/* old buckets below rehash_idx are already empty */
+	tmem_hash_flush(pool, pool->hashbucket, 1 << pool->hash_bits);
+	if (pool->new_hashbucket != NULL)
+		tmem_hash_flush(pool, pool->new_hashbucket,
+				1 << pool->new_hash_bits);
+	read_unlock(&pool->hash_lock);
 	if (destroy)
 		list_del(&pool->pool_list);
 }
@@ -274,7 +357,8 @@ static void tmem_objnode_free(struct tmem_objnode *objnode)
 /*
  * lookup index in object and return associated pampd (or NULL if not found)
  */
-static void *tmem_pampd_lookup_in_obj(struct tmem_obj *obj, uint32_t index)
+static void **__tmem_pampd_lookup_in_obj(struct tmem_obj *obj,
+						uint32_t index)
 {
 	unsigned int height, shift;
 	struct tmem_objnode **slot = NULL;
@@ -303,6 +387,13 @@ static void *tmem_pampd_lookup_in_obj(struct tmem_obj *obj, uint32_t index)
 		height--;
 	}
 out:
+	return (void **)slot;
+}
+
+static void *tmem_pampd_lookup_in_obj(struct tmem_obj *obj, uint32_t index)
+{
+	void **slot = __tmem_pampd_lookup_in_obj(obj, index);
+
 	return slot != NULL ? *slot : NULL;
 }
 
@@ -512,8 +603,7 @@ int tmem_put(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 	struct tmem_hashbucket *hb;
 
 	ephemeral = is_ephemeral(pool);
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
-	spin_lock(&hb->lock);
+	hb = tmem_hashbucket_lock(pool, oidp);
 	obj = objfound = tmem_obj_find(hb, oidp);
 	if (obj != NULL) {
 		pampd = tmem_pampd_lookup_in_obj(objfound, index);
@@ -557,7 +647,7 @@ free:
 		(*tmem_hostops.obj_free)(objnew, pool);
 	}
 out:
-	spin_unlock(&hb->lock);
+	tmem_hashbucket_unlock(pool, hb);
 	return ret;
 }
 
@@ -582,8 +672,7 @@ int tmem_get(struct tmem_pool *pool, struct tmem_oid *oidp,
 	uint32_t ret = -1;
 	struct tmem_hashbucket *hb;
 
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
-	spin_lock(&hb->lock);
+	hb = tmem_hashbucket_lock(pool, oidp);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
 		goto out;
@@ -607,7 +696,52 @@ int tmem_get(struct tmem_pool *pool, struct tmem_oid *oidp,
 	}
 	ret = 0;
 out:
-	spin_unlock(&hb->lock);
+	tmem_hashbucket_unlock(pool, hb);
+	return ret;
+}
+
+/*
+ * Like tmem_get, for several indices of one object at once: the object is
+ * hashed, locked and found once for the whole batch.  Sets bit i of *hits
+ * for each pages[i] that was filled from indices[i] and returns the number
+ * filled.
+ */
+int tmem_get_pages(struct tmem_pool *pool, struct tmem_oid *oidp,
+			uint32_t *indices, struct page **pages, int nr,
+			unsigned long *hits)
+{
+	struct tmem_obj *obj;
+	void *pampd;
+	bool ephemeral = is_ephemeral(pool);
+	int i, ret = 0;
+	struct tmem_hashbucket *hb;
+
+	BUG_ON(nr > BITS_PER_LONG);
+	*hits = 0;
+	hb = tmem_hashbucket_lock(pool, oidp);
+	obj = tmem_obj_find(hb, oidp);
+	if (obj == NULL)
+		goto out;
+	for (i = 0; i < nr; i++) {
+		if (ephemeral)
+			pampd = tmem_pampd_delete_from_obj(obj, indices[i]);
+		else
+			pampd = tmem_pampd_lookup_in_obj(obj, indices[i]);
+		if (pampd == NULL)
+			continue;
+		if ((*tmem_pamops.get_data)(pages[i], pampd, pool) < 0)
+			continue;
+		if (ephemeral)
+			(*tmem_pamops.free)(pampd, pool);
+		*hits |= 1UL << i;
+		ret++;
+	}
+	if (ephemeral && obj->pampd_count == 0) {
+		tmem_obj_free(obj, hb);
+		(*tmem_hostops.obj_free)(obj, pool);
+	}
+out:
+	tmem_hashbucket_unlock(pool, hb);
 	return ret;
 }
 
@@ -624,8 +758,7 @@ int tmem_flush_page(struct tmem_pool *pool,
 	int ret = -1;
 	struct tmem_hashbucket *hb;
 
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
-	spin_lock(&hb->lock);
+	hb = tmem_hashbucket_lock(pool, oidp);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
 		goto out;
@@ -640,7 +773,36 @@ int tmem_flush_page(struct tmem_pool *pool,
 	ret = 0;
 
 out:
-	spin_unlock(&hb->lock);
+	tmem_hashbucket_unlock(pool, hb);
+	return ret;
+}
+
+/*
+ * Switch the PAM-specific data for a handle from old_pampd to new_pampd,
+ * for a PAM implementation that moves data around (e.g. to compact it).
+ * Fails, leaving tmem untouched, if the handle no longer maps to
+ * old_pampd because it was flushed or overwritten in the meantime.
+ */
+int tmem_replace(struct tmem_pool *pool, struct tmem_oid *oidp,
+			uint32_t index, void *old_pampd, void *new_pampd)
+{
+	struct tmem_obj *obj;
+	void **slot;
+	int ret = -1;
+	struct tmem_hashbucket *hb;
+
+	hb = tmem_hashbucket_lock(pool, oidp);
+	obj = tmem_obj_find(hb, oidp);
+	if (obj == NULL)
+		goto out;
+	slot = __tmem_pampd_lookup_in_obj(obj, index);
+	if (slot == NULL || *slot != old_pampd)
+		goto out;
+	*slot = new_pampd;
+	ret = 0;
+
+out:
+	tmem_hashbucket_unlock(pool, hb);
 	return ret;
 }
 
@@ -653,8 +815,7 @@ int tmem_flush_object(struct tmem_pool *pool, struct tmem_oid *oidp)
 	struct tmem_hashbucket *hb;
 	int ret = -1;
 
-	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
-	spin_lock(&hb->lock);
+	hb = tmem_hashbucket_lock(pool, oidp);
 	obj = tmem_obj_find(hb, oidp);
 	if (obj == NULL)
 		goto out;
@@ -664,7 +825,7 @@ int tmem_flush_object(struct tmem_pool *pool, struct tmem_oid *oidp)
 	ret = 0;
 
 out:
-	spin_unlock(&hb->lock);
+	tmem_hashbucket_unlock(pool, hb);
 	return ret;
 }
 
@@ -679,6 +840,8 @@ int tmem_destroy_pool(struct tmem_pool *pool)
 	if (pool == NULL)
 		goto out;
 	tmem_pool_flush(pool, 1);
+	tmem_hash_free(pool->hashbucket);
+	pool->hashbucket = NULL;
 	ret = 0;
 out:
 	return ret;
@@ -690,21 +853,83 @@ static LIST_HEAD(tmem_global_pool_list);
  * Create a new tmem_pool with the provided flag and return
  * a pool id provided by the tmem host implementation.
  */
-void tmem_new_pool(struct tmem_pool *pool, uint32_t flags)
+int tmem_new_pool(struct tmem_pool *pool, uint32_t flags)
 {
 	int persistent = flags & TMEM_POOL_PERSIST;
 	int shared = flags & TMEM_POOL_SHARED;
-	struct tmem_hashbucket *hb = &pool->hashbucket[0];
-	int i;
 
-	for (i = 0; i < TMEM_HASH_BUCKETS; i++, hb++) {
-		hb->obj_rb_root = RB_ROOT;
-		spin_lock_init(&hb->lock);
-	}
+	pool->hashbucket = tmem_hash_alloc(TMEM_HASH_BUCKET_BITS);
+	if (pool->hashbucket == NULL)
+		return -ENOMEM;
+	pool->hash_bits = TMEM_HASH_BUCKET_BITS;
+	pool->new_hashbucket = NULL;
+	rwlock_init(&pool->hash_lock);
 	INIT_LIST_HEAD(&pool->pool_list);
 	atomic_set(&pool->obj_count, 0);
 	SET_SENTINEL(pool, POOL);
 	list_add_tail(&pool->pool_list, &tmem_global_pool_list);
 	pool->persistent = persistent;
 	pool->shared = shared;
+	return 0;
+}
+
+/*
+ * Rehash every tmem_obj in the pool into a table of 1 << bits buckets.
+ * The caller must keep the pool from being destroyed meanwhile and be
+ * able to sleep.  Buckets are moved one at a time, each under a short
+ * write hold of hash_lock, so accessors are only shut out while the
+ * objects of a single bucket are relinked.
+ */
+int tmem_resize_pool(struct tmem_pool *pool, unsigned int bits)
+{
+	struct tmem_hashbucket *table, *hb;
+	struct rb_node *rbnode;
+	struct tmem_obj *obj;
+	unsigned long flags;
+	int ret = 0;
+
+	if (bits > TMEM_HASH_BUCKET_BITS_MAX)
+		return -EINVAL;
+	table = tmem_hash_alloc(bits);
+	if (table == NULL)
+		return -ENOMEM;
+	write_lock_irqsave(&pool->hash_lock, flags);
+	if (pool->new_hashbucket != NULL)
+		ret = -EBUSY;
+	else if (pool->hash_bits == bits)
+		ret = 1;
+	if (ret) {
+		write_unlock_irqrestore(&pool->hash_lock, flags);
+		tmem_hash_free(table);
+		return ret < 0 ? ret : 0;
+	}
+	pool->new_hashbucket = table;
+	pool->new_hash_bits = bits;
+	pool->rehash_idx = 0;
+	write_unlock_irqrestore(&pool->hash_lock, flags);
+
+	for (;;) {
+		write_lock_irqsave(&pool->hash_lock, flags);
+		if (pool->rehash_idx == (1 << pool->hash_bits))
+			break;
+		hb = &pool->hashbucket[pool->rehash_idx];
+		while ((rbnode = rb_first(&hb->obj_rb_root)) != NULL) {
+			obj = rb_entry(rbnode, struct tmem_obj, rb_tree_node);
+			ASSERT_SENTINEL(obj, OBJ);
+			rb_erase(rbnode, &hb->obj_rb_root);
+			tmem_obj_insert(obj,
+				&table[tmem_oid_hash(&obj->oid, bits)]);
+		}
+		pool->rehash_idx++;
+		write_unlock_irqrestore(&pool->hash_lock, flags);
+		cond_resched();
+	}
+	/* every bucket has moved, retire the old table */
+	hb = pool->hashbucket;
+	pool->hashbucket = table;
+	pool->hash_bits = bits;
+	pool->new_hashbucket = NULL;
+	write_unlock_irqrestore(&pool->hash_lock, flags);
+	tmem_hash_free(hb);
+	return 0;
 }
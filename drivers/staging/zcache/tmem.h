@@ -12,6 +12,7 @@
 #include <linux/types.h>
 #include <linux/highmem.h>
 #include <linux/hash.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 /*
@@ -54,11 +55,17 @@
  * usually corresponds to a large independent set of pages such as
  * a filesystem.  Each pool has an id, and certain attributes and counters.
  * It also contains a set of hash buckets, each of which contains an rbtree
- * of objects and a lock to manage concurrency within the pool.
+ * of objects and a lock to manage concurrency within the pool.  The hash
+ * table starts at TMEM_HASH_BUCKET_BITS and can be grown by the host (see
+ * tmem_resize_pool) once the pool holds more than TMEM_HASH_LOAD objects
+ * per bucket.  A resize moves one old bucket at a time into new_hashbucket;
+ * old buckets below rehash_idx are empty and their objects are looked up
+ * in the new table.  hash_lock is only write-locked to move one bucket.
  */
 
-#define TMEM_HASH_BUCKET_BITS	8
-#define TMEM_HASH_BUCKETS	(1<<TMEM_HASH_BUCKET_BITS)
+#define TMEM_HASH_BUCKET_BITS		8
+#define TMEM_HASH_BUCKET_BITS_MAX	14
+#define TMEM_HASH_LOAD			4
 
 struct tmem_hashbucket {
 	struct rb_root obj_rb_root;
@@ -73,13 +80,27 @@ struct tmem_pool {
 	bool shared;
 	atomic_t obj_count;
 	atomic_t refcount;
-	struct tmem_hashbucket hashbucket[TMEM_HASH_BUCKETS];
+	rwlock_t hash_lock;
+	unsigned int hash_bits;
+	struct tmem_hashbucket *hashbucket;
+	/* only while a resize is in progress */
+	unsigned int new_hash_bits;
+	unsigned int rehash_idx;
+	struct tmem_hashbucket *new_hashbucket;
 	DECL_SENTINEL
 };
 
 #define is_persistent(_p)  (_p->persistent)
 #define is_ephemeral(_p)   (!(_p->persistent))
 
+/* racy, but only used as a hint for when to resize */
+static inline bool tmem_pool_wants_grow(struct tmem_pool *pool)
+{
+	return pool->hash_bits < TMEM_HASH_BUCKET_BITS_MAX &&
+		atomic_read(&pool->obj_count) >
+			(TMEM_HASH_LOAD << pool->hash_bits);
+}
+
 /*
  * An object id ("oid") is large: 192-bits (to ensure, for example, files
  * in a modern filesystem can be uniquely identified).
@@ -124,10 +145,9 @@ static inline int tmem_oid_compare(struct tmem_oid *left,
 	return ret;
 }
 
-static inline unsigned tmem_oid_hash(struct tmem_oid *oidp)
+static inline unsigned tmem_oid_hash(struct tmem_oid *oidp, unsigned bits)
 {
-	return hash_long(oidp->oid[0] ^ oidp->oid[1] ^ oidp->oid[2],
-				TMEM_HASH_BUCKET_BITS);
+	return hash_long(oidp->oid[0] ^ oidp->oid[1] ^ oidp->oid[2], bits);
 }
 
 /*
@@ -187,9 +207,15 @@ extern int tmem_put(struct tmem_pool *, struct tmem_oid *, uint32_t index,
 			struct page *page);
 extern int tmem_get(struct tmem_pool *, struct tmem_oid *, uint32_t index,
 			struct page *page);
+extern int tmem_get_pages(struct tmem_pool *, struct tmem_oid *,
+			uint32_t *indices, struct page **pages, int nr,
+			unsigned long *hits);
 extern int tmem_flush_page(struct tmem_pool *, struct tmem_oid *,
 			uint32_t index);
+extern int tmem_replace(struct tmem_pool *, struct tmem_oid *, uint32_t index,
+			void *old_pampd, void *new_pampd);
 extern int tmem_flush_object(struct tmem_pool *, struct tmem_oid *);
 extern int tmem_destroy_pool(struct tmem_pool *);
-extern void tmem_new_pool(struct tmem_pool *, uint32_t);
+extern int tmem_new_pool(struct tmem_pool *, uint32_t);
+extern int tmem_resize_pool(struct tmem_pool *, unsigned int bits);
 #endif /* _TMEM_H */
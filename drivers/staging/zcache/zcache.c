@@ -13,7 +13,10 @@
  * so maximizes space efficiency, while zbud allows pairs (and potentially,
  * in the future, more than a pair of) compressed pages to be closely linked
  * so that reclaiming can be done via the kernel's physical-page-oriented
- * "shrinker" interface.
+ * "shrinker" interface.  Booting with "zcache_alloc=zspan" instead stores
+ * both kinds of pages in "zspans", multi-page spans of equal-sized slots
+ * that pack more than two compressed pages per pageframe and can still
+ * be compacted and shrunk.
  *
  * [1] For a definition of page-accessible memory (aka PAM), see:
  *   http://marc.info/?l=linux-mm&m=127811271605009
@@ -21,11 +24,14 @@
 
 #include <linux/cpu.h>
 #include <linux/highmem.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/lzo.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 #include <asm/atomic.h>
 #include "tmem.h"
 
@@ -64,6 +70,11 @@
  * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
  * the one unbuddied zbud uses.  The data inside a zbpg cannot be
  * read or written unless the zbpg's lock is held.
+ *
+ * Each cpu has its own set of these lists under its own lock, so puts
+ * on different cpus do not contend.  A zbpg remembers which cpu's lists
+ * it is on; puts look for a buddy on the local lists first and only
+ * trylock other cpus' lists before falling back to a fresh page.
  */
 
 #define ZBH_SENTINEL  0x43214321
@@ -82,6 +93,7 @@ struct zbud_hdr {
 struct zbud_page {
 	struct list_head bud_list;
 	spinlock_t lock;
+	unsigned int cpu; /* whose zbud_lists bud_list is on */
 	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
 	DECL_SENTINEL
 	/* followed by NUM_CHUNK aligned CHUNK_SIZE-byte chunks */
@@ -94,25 +106,23 @@ struct zbud_page {
 				CHUNK_MASK) >> CHUNK_SHIFT)
 #define MAX_CHUNK	(NCHUNKS-1)
 
-static struct {
-	struct list_head list;
-	unsigned count;
-} zbud_unbuddied[NCHUNKS];
-/* list N contains pages with N chunks USED and NCHUNKS-N unused */
-/* element 0 is never used but optimizing that isn't worth it */
-static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
-
-struct list_head zbud_buddied_list;
-static unsigned long zcache_zbud_buddied_count;
-
-/* protects the buddied list and all unbuddied lists */
-static DEFINE_SPINLOCK(zbud_budlists_spinlock);
-
-static LIST_HEAD(zbpg_unused_list);
-static unsigned long zcache_zbpg_unused_list_count;
+struct zbud_lists {
+	/* protects all the lists below */
+	spinlock_t lock;
+	struct {
+		struct list_head list;
+		unsigned count;
+	} unbuddied[NCHUNKS];
+	/* list N contains pages with N chunks USED and NCHUNKS-N unused */
+	/* element 0 is never used but optimizing that isn't worth it */
+	struct list_head buddied;
+	unsigned long buddied_count;
+	struct list_head unused;
+	unsigned long unused_count;
+};
+static DEFINE_PER_CPU(struct zbud_lists, zbud_lists);
 
-/* protects the unused page list */
-static DEFINE_SPINLOCK(zbpg_unused_list_spinlock);
+static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
 
 static atomic_t zcache_zbud_curr_raw_pages;
 static atomic_t zcache_zbud_curr_zpages;
@@ -180,22 +190,22 @@ static char *zbud_data(struct zbud_hdr *zh, unsigned size)
  * zbud raw page management
  */
 
-static struct zbud_page *zbud_alloc_raw_page(void)
+static struct zbud_page *zbud_alloc_raw_page(struct zbud_lists *zl)
 {
 	struct zbud_page *zbpg = NULL;
 	struct zbud_hdr *zh0, *zh1;
 	bool recycled = 0;
 
 	/* if any pages on the zbpg list, use one */
-	spin_lock(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
-		zbpg = list_first_entry(&zbpg_unused_list,
+	spin_lock(&zl->lock);
+	if (!list_empty(&zl->unused)) {
+		zbpg = list_first_entry(&zl->unused,
 				struct zbud_page, bud_list);
 		list_del_init(&zbpg->bud_list);
-		zcache_zbpg_unused_list_count--;
+		zl->unused_count--;
 		recycled = 1;
 	}
-	spin_unlock(&zbpg_unused_list_spinlock);
+	spin_unlock(&zl->lock);
 	if (zbpg == NULL)
 		/* none on zbpg list, try to get a kernel page */
 		zbpg = zcache_get_free_page();
@@ -223,6 +233,7 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 static void zbud_free_raw_page(struct zbud_page *zbpg)
 {
 	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
+	struct zbud_lists *zl;
 
 	ASSERT_SENTINEL(zbpg, ZBPG);
 	BUG_ON(!list_empty(&zbpg->bud_list));
@@ -231,10 +242,13 @@ static void zbud_free_raw_page(struct zbud_page *zbpg)
 	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
 	INVERT_SENTINEL(zbpg, ZBPG);
 	spin_unlock(&zbpg->lock);
-	spin_lock(&zbpg_unused_list_spinlock);
-	list_add(&zbpg->bud_list, &zbpg_unused_list);
-	zcache_zbpg_unused_list_count++;
-	spin_unlock(&zbpg_unused_list_spinlock);
+	/* park it on the local cpu, where the next put will look first */
+	zl = &get_cpu_var(zbud_lists);
+	spin_lock(&zl->lock);
+	list_add(&zbpg->bud_list, &zl->unused);
+	zl->unused_count++;
+	spin_unlock(&zl->lock);
+	put_cpu_var(zbud_lists);
 }
 
 /*
@@ -264,6 +278,7 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 	unsigned budnum = zbud_budnum(zh), size;
 	struct zbud_page *zbpg =
 		container_of(zh, struct zbud_page, buddy[budnum]);
+	struct zbud_lists *zl;
 
 	spin_lock(&zbpg->lock);
 	if (list_empty(&zbpg->bud_list)) {
@@ -271,62 +286,98 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 		spin_unlock(&zbpg->lock);
 		return;
 	}
+	zl = &per_cpu(zbud_lists, zbpg->cpu);
 	size = zbud_free(zh);
 	ASSERT_SPINLOCK(&zbpg->lock);
 	zh_other = &zbpg->buddy[(budnum == 0) ? 1 : 0];
 	if (zh_other->size == 0) { /* was unbuddied: unlist and free */
 		chunks = zbud_size_to_chunks(size) ;
-		spin_lock(&zbud_budlists_spinlock);
-		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
+		spin_lock(&zl->lock);
+		BUG_ON(list_empty(&zl->unbuddied[chunks].list));
 		list_del_init(&zbpg->bud_list);
-		zbud_unbuddied[chunks].count--;
-		spin_unlock(&zbud_budlists_spinlock);
+		zl->unbuddied[chunks].count--;
+		spin_unlock(&zl->lock);
 		zbud_free_raw_page(zbpg);
 	} else { /* was buddied: move remaining buddy to unbuddied list */
 		chunks = zbud_size_to_chunks(zh_other->size) ;
-		spin_lock(&zbud_budlists_spinlock);
+		spin_lock(&zl->lock);
 		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		list_add_tail(&zbpg->bud_list, &zbud_unbuddied[chunks].list);
-		zbud_unbuddied[chunks].count++;
-		spin_unlock(&zbud_budlists_spinlock);
+		zl->buddied_count--;
+		list_add_tail(&zbpg->bud_list, &zl->unbuddied[chunks].list);
+		zl->unbuddied[chunks].count++;
+		spin_unlock(&zl->lock);
 		spin_unlock(&zbpg->lock);
 	}
 }
 
+/*
+ * Find a zbpg on zl with room for nchunks.  On success both zl->lock and
+ * the zbpg lock are held and *found is the unbuddied list it came from.
+ * Remote cpus' lists are only trylocked so a put never waits on them.
+ */
+static struct zbud_page *zbud_find_unbuddied(struct zbud_lists *zl,
+				unsigned nchunks, bool trylock, int *found)
+{
+	struct zbud_page *zbpg;
+	int i;
+
+	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
+		/* unlocked peek, rechecked below under the lock */
+		if (list_empty(&zl->unbuddied[i].list))
+			continue;
+		if (!trylock)
+			spin_lock(&zl->lock);
+		else if (!spin_trylock(&zl->lock))
+			break;
+		list_for_each_entry(zbpg, &zl->unbuddied[i].list, bud_list) {
+			if (spin_trylock(&zbpg->lock)) {
+				*found = i;
+				return zbpg;
+			}
+		}
+		spin_unlock(&zl->lock);
+	}
+	return NULL;
+}
+
 static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 					uint32_t index, struct page *page,
 					void *cdata, unsigned size)
 {
 	struct zbud_hdr *zh0, *zh1, *zh = NULL;
-	struct zbud_page *zbpg = NULL, *ztmp;
+	struct zbud_page *zbpg = NULL;
+	struct zbud_lists *zl;
 	unsigned nchunks;
 	char *to;
-	int i, found_good_buddy = 0;
+	int cpu, this_cpu, found_good_buddy = 0;
 
+	BUG_ON(!irqs_disabled());
+	this_cpu = smp_processor_id();
 	nchunks = zbud_size_to_chunks(size) ;
-	for (i = MAX_CHUNK - nchunks + 1; i > 0; i--) {
-		spin_lock(&zbud_budlists_spinlock);
-		if (!list_empty(&zbud_unbuddied[i].list)) {
-			list_for_each_entry_safe(zbpg, ztmp,
-				    &zbud_unbuddied[i].list, bud_list) {
-				if (spin_trylock(&zbpg->lock)) {
-					found_good_buddy = i;
-					goto found_unbuddied;
-				}
-			}
-		}
-		spin_unlock(&zbud_budlists_spinlock);
+	zl = &per_cpu(zbud_lists, this_cpu);
+	zbpg = zbud_find_unbuddied(zl, nchunks, false, &found_good_buddy);
+	if (zbpg != NULL)
+		goto found_unbuddied;
+	for_each_online_cpu(cpu) {
+		if (cpu == this_cpu)
+			continue;
+		zl = &per_cpu(zbud_lists, cpu);
+		zbpg = zbud_find_unbuddied(zl, nchunks, true,
+						&found_good_buddy);
+		if (zbpg != NULL)
+			goto found_unbuddied;
 	}
 	/* didn't find a good buddy, try allocating a new page */
-	zbpg = zbud_alloc_raw_page();
+	zl = &per_cpu(zbud_lists, this_cpu);
+	zbpg = zbud_alloc_raw_page(zl);
 	if (unlikely(zbpg == NULL))
 		goto out;
 	/* ok, have a page, now compress the data before taking locks */
 	spin_lock(&zbpg->lock);
-	spin_lock(&zbud_budlists_spinlock);
-	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
-	zbud_unbuddied[nchunks].count++;
+	spin_lock(&zl->lock);
+	zbpg->cpu = this_cpu;
+	list_add_tail(&zbpg->bud_list, &zl->unbuddied[nchunks].list);
+	zl->unbuddied[nchunks].count++;
 	zh = &zbpg->buddy[0];
 	goto init_zh;
 
@@ -343,9 +394,9 @@ found_unbuddied:
 	} else
 		BUG();
 	list_del_init(&zbpg->bud_list);
-	zbud_unbuddied[found_good_buddy].count--;
-	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
-	zcache_zbud_buddied_count++;
+	zl->unbuddied[found_good_buddy].count--;
+	list_add_tail(&zbpg->bud_list, &zl->buddied);
+	zl->buddied_count++;
 
 init_zh:
 	SET_SENTINEL(zh, ZBH);
@@ -354,7 +405,7 @@ init_zh:
 	zh->oid = *oid;
 	zh->pool_id = pool_id;
 	/* can wait to copy the data until the list locks are dropped */
-	spin_unlock(&zbud_budlists_spinlock);
+	spin_unlock(&zl->lock);
 
 	to = zbud_data(zh, size);
 	memcpy(to, cdata, size);
@@ -446,6 +497,39 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 	zbud_free_raw_page(zbpg);
 }
 
+/*
+ * Buddied pages all free one pageframe when evicted, but the data they
+ * drop varies with how well their two buddies compressed.  Of the first
+ * ZBUD_EVICT_SCAN pages on the list, pick the one holding the fewest
+ * compressed bytes; if it is busy, fall back to any page we can lock.
+ * Called with zl->lock held, returns the zbpg locked or NULL.
+ */
+#define ZBUD_EVICT_SCAN	8
+
+static struct zbud_page *zbud_pick_buddied(struct zbud_lists *zl)
+{
+	struct zbud_page *zbpg, *victim = NULL;
+	unsigned size, best = UINT_MAX;
+	int n = 0;
+
+	list_for_each_entry(zbpg, &zl->buddied, bud_list) {
+		if (n++ >= ZBUD_EVICT_SCAN)
+			break;
+		/* sizes only change under zbpg->lock, this is just a hint */
+		size = zbpg->buddy[0].size + zbpg->buddy[1].size;
+		if (size < best) {
+			best = size;
+			victim = zbpg;
+		}
+	}
+	if (victim != NULL && spin_trylock(&victim->lock))
+		return victim;
+	list_for_each_entry(zbpg, &zl->buddied, bud_list)
+		if (spin_trylock(&zbpg->lock))
+			return zbpg;
+	return NULL;
+}
+
 /*
  * Free nr pages.  This code is funky because we want to hold the locks
  * protecting various lists for as short a time as possible, and in some
@@ -456,66 +540,76 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
  */
 static void zbud_evict_pages(int nr)
 {
+	struct zbud_lists *zl;
 	struct zbud_page *zbpg;
-	int i;
+	int i, cpu;
 
-	/* first try freeing any pages on unused list */
+	/* first try freeing any pages on unused lists */
+	for_each_possible_cpu(cpu) {
+		zl = &per_cpu(zbud_lists, cpu);
 retry_unused_list:
-	spin_lock_bh(&zbpg_unused_list_spinlock);
-	if (!list_empty(&zbpg_unused_list)) {
-		/* can't walk list here, since it may change when unlocked */
-		zbpg = list_first_entry(&zbpg_unused_list,
-				struct zbud_page, bud_list);
-		list_del_init(&zbpg->bud_list);
-		zcache_zbpg_unused_list_count--;
-		atomic_dec(&zcache_zbud_curr_raw_pages);
-		spin_unlock_bh(&zbpg_unused_list_spinlock);
-		zcache_free_page(zbpg);
-		zcache_evicted_raw_pages++;
-		if (--nr <= 0)
-			goto out;
-		goto retry_unused_list;
+		spin_lock_bh(&zl->lock);
+		if (!list_empty(&zl->unused)) {
+			/* can't walk list here, since it may change when
+			 * unlocked */
+			zbpg = list_first_entry(&zl->unused,
+					struct zbud_page, bud_list);
+			list_del_init(&zbpg->bud_list);
+			zl->unused_count--;
+			atomic_dec(&zcache_zbud_curr_raw_pages);
+			spin_unlock_bh(&zl->lock);
+			zcache_free_page(zbpg);
+			zcache_evicted_raw_pages++;
+			if (--nr <= 0)
+				goto out;
+			goto retry_unused_list;
+		}
+		spin_unlock_bh(&zl->lock);
 	}
-	spin_unlock_bh(&zbpg_unused_list_spinlock);
 
 	/* now try freeing unbuddied pages, starting with least space avail */
 	for (i = 0; i < MAX_CHUNK; i++) {
+		for_each_possible_cpu(cpu) {
+			zl = &per_cpu(zbud_lists, cpu);
 retry_unbud_list_i:
-		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
-			spin_unlock_bh(&zbud_budlists_spinlock);
-			continue;
-		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
-			if (unlikely(!spin_trylock(&zbpg->lock)))
+			spin_lock_bh(&zl->lock);
+			if (list_empty(&zl->unbuddied[i].list)) {
+				spin_unlock_bh(&zl->lock);
 				continue;
-			list_del_init(&zbpg->bud_list);
-			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
-			zcache_evicted_unbuddied_pages++;
-			/* want budlists unlocked when doing zbpg eviction */
-			zbud_evict_zbpg(zbpg);
-			local_bh_enable();
-			if (--nr <= 0)
-				goto out;
-			goto retry_unbud_list_i;
+			}
+			list_for_each_entry(zbpg, &zl->unbuddied[i].list,
+								bud_list) {
+				if (unlikely(!spin_trylock(&zbpg->lock)))
+					continue;
+				list_del_init(&zbpg->bud_list);
+				zl->unbuddied[i].count--;
+				spin_unlock(&zl->lock);
+				zcache_evicted_unbuddied_pages++;
+				/* want budlists unlocked when doing zbpg
+				 * eviction */
+				zbud_evict_zbpg(zbpg);
+				local_bh_enable();
+				if (--nr <= 0)
+					goto out;
+				goto retry_unbud_list_i;
+			}
+			spin_unlock_bh(&zl->lock);
 		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
 	}
 
-	/* as a last resort, free buddied pages */
+	/* as a last resort, free buddied pages, least data first */
+	for_each_possible_cpu(cpu) {
+		zl = &per_cpu(zbud_lists, cpu);
 retry_bud_list:
-	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
-	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
-		if (unlikely(!spin_trylock(&zbpg->lock)))
+		spin_lock_bh(&zl->lock);
+		zbpg = zbud_pick_buddied(zl);
+		if (zbpg == NULL) {
+			spin_unlock_bh(&zl->lock);
 			continue;
+		}
 		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
-		spin_unlock(&zbud_budlists_spinlock);
+		zl->buddied_count--;
+		spin_unlock(&zl->lock);
 		zcache_evicted_buddied_pages++;
 		/* want budlists unlocked when doing zbpg eviction */
 		zbud_evict_zbpg(zbpg);
@@ -524,20 +618,26 @@ retry_bud_list:
 			goto out;
 		goto retry_bud_list;
 	}
-	spin_unlock_bh(&zbud_budlists_spinlock);
 out:
 	return;
 }
 
 static void zbud_init(void)
 {
-	int i;
-
-	INIT_LIST_HEAD(&zbud_buddied_list);
-	zcache_zbud_buddied_count = 0;
-	for (i = 0; i < NCHUNKS; i++) {
-		INIT_LIST_HEAD(&zbud_unbuddied[i].list);
-		zbud_unbuddied[i].count = 0;
+	struct zbud_lists *zl;
+	int i, cpu;
+
+	for_each_possible_cpu(cpu) {
+		zl = &per_cpu(zbud_lists, cpu);
+		spin_lock_init(&zl->lock);
+		INIT_LIST_HEAD(&zl->buddied);
+		zl->buddied_count = 0;
+		INIT_LIST_HEAD(&zl->unused);
+		zl->unused_count = 0;
+		for (i = 0; i < NCHUNKS; i++) {
+			INIT_LIST_HEAD(&zl->unbuddied[i].list);
+			zl->unbuddied[i].count = 0;
+		}
 	}
 }
 
@@ -549,15 +649,39 @@ static void zbud_init(void)
  */
 static int zbud_show_unbuddied_list_counts(char *buf)
 {
-	int i;
+	unsigned count;
+	int i, cpu;
 	char *p = buf;
 
-	for (i = 0; i < NCHUNKS - 1; i++)
-		p += sprintf(p, "%u ", zbud_unbuddied[i].count);
-	p += sprintf(p, "%d\n", zbud_unbuddied[i].count);
+	for (i = 0; i < NCHUNKS; i++) {
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += per_cpu(zbud_lists, cpu).unbuddied[i].count;
+		p += sprintf(p, i < NCHUNKS - 1 ? "%u " : "%u\n", count);
+	}
 	return p - buf;
 }
 
+static int zbud_show_buddied_count(char *buf)
+{
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu(zbud_lists, cpu).buddied_count;
+	return sprintf(buf, "%lu\n", count);
+}
+
+static int zbud_show_unused_list_count(char *buf)
+{
+	unsigned long count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu(zbud_lists, cpu).unused_count;
+	return sprintf(buf, "%lu\n", count);
+}
+
 static int zbud_show_cumul_chunk_counts(char *buf)
 {
 	unsigned long i, chunks = 0, total_chunks = 0, sum_total_chunks = 0;
@@ -665,6 +789,465 @@ static void zv_decompress(struct page *page, struct zv_hdr *zv)
 	BUG_ON(clen != PAGE_SIZE);
 }
 
+/**********
+ * "zspan" is a third PAM implementation, selected at boot with
+ * "zcache_alloc=zspan", that replaces both zbud and zv.  Zbud never packs
+ * more than two compressed pages into a pageframe however well they
+ * compress, and xvmalloc can't give pageframes back to a shrinker.
+ *
+ * A zspan is a block of ZSPAN_PAGES pageframes carved into equal slots
+ * of one size class, so small compressed pages pack many to a span.
+ * Each slot holds a zspan_obj (the tmem handle plus the compressed size)
+ * immediately followed by the compressed data; the handle lets a span
+ * be evicted like a zbpg and lets compaction move an object and retarget
+ * tmem at its new slot.  Each size class keeps its partially used and
+ * full spans on separate lists.  Ephemeral and persistent pages use
+ * separate classes so that evicting a span never drops a frontswap page.
+ */
+
+#define ZSO_SENTINEL  0x5a050b1e
+#define ZSPAN_SENTINEL  0x5a5a5a5a
+
+#define ZSPAN_ORDER		1
+#define ZSPAN_PAGES		(1 << ZSPAN_ORDER)
+#define ZSPAN_SIZE		(PAGE_SIZE << ZSPAN_ORDER)
+#define ZSPAN_ALIGN_SHIFT	5
+#define ZSPAN_ALIGN		(1 << ZSPAN_ALIGN_SHIFT)
+/* a slot is never smaller than its header plus a byte, rounded up */
+#define ZSPAN_MAX_SLOTS		(ZSPAN_SIZE / (2 * ZSPAN_ALIGN))
+/* slots of up to half a span, which covers zv_max_page_size */
+#define ZSPAN_NR_CLASSES	((ZSPAN_SIZE / 2 / ZSPAN_ALIGN) + 1)
+#define ZSPAN_EVICT_SCAN	8
+
+struct zspan_class {
+	/* protects the lists and every span on them */
+	spinlock_t lock;
+	struct list_head partial;
+	struct list_head full;
+	unsigned long nr_spans;
+	unsigned short size; /* bytes per slot, header included */
+	unsigned short nslots;
+	atomic_t *curr_pages;
+	atomic_t *curr_zpages;
+};
+
+struct zspan {
+	struct list_head list;
+	struct zspan_class *zc;
+	uint16_t inuse;
+	uint8_t isolated; /* off the lists, being compacted or evicted */
+	uint8_t zombie; /* being evicted, gets must fail */
+	DECLARE_BITMAP(used, ZSPAN_MAX_SLOTS);
+	DECL_SENTINEL
+	/* followed by nslots slots of zc->size bytes */
+};
+
+#define ZSPAN_HDR_SIZE	ALIGN(sizeof(struct zspan), ZSPAN_ALIGN)
+
+struct zspan_obj {
+	uint32_t pool_id;
+	struct tmem_oid oid;
+	uint32_t index;
+	uint16_t size; /* compressed size in bytes */
+	DECL_SENTINEL
+};
+
+static int zcache_use_zspan;
+
+static struct zspan_class zspan_eph_classes[ZSPAN_NR_CLASSES];
+static struct zspan_class zspan_pers_classes[ZSPAN_NR_CLASSES];
+
+static atomic_t zcache_zspan_eph_pages;
+static atomic_t zcache_zspan_eph_zpages;
+static atomic_t zcache_zspan_pers_pages;
+static atomic_t zcache_zspan_pers_zpages;
+static unsigned long zcache_zspan_compacted_zpages;
+static unsigned long zcache_zspan_compacted_spans;
+static unsigned long zcache_zspan_evicted_spans;
+
+/* spans are naturally aligned, being page allocator blocks */
+static inline struct zspan *zspan_of(struct zspan_obj *zo)
+{
+	return (struct zspan *)((unsigned long)zo & ~(ZSPAN_SIZE - 1));
+}
+
+static inline struct zspan_obj *zspan_slot(struct zspan *zs, unsigned i)
+{
+	return (struct zspan_obj *)((char *)zs + ZSPAN_HDR_SIZE +
+					i * zs->zc->size);
+}
+
+static inline unsigned zspan_slot_index(struct zspan *zs,
+					struct zspan_obj *zo)
+{
+	return ((char *)zo - (char *)zs - ZSPAN_HDR_SIZE) / zs->zc->size;
+}
+
+/* take a free slot from the first partial span, zc->lock must be held */
+static struct zspan_obj *zspan_alloc_slot(struct zspan_class *zc)
+{
+	struct zspan *zs;
+	unsigned i;
+
+	if (list_empty(&zc->partial))
+		return NULL;
+	zs = list_first_entry(&zc->partial, struct zspan, list);
+	ASSERT_SENTINEL(zs, ZSPAN);
+	i = find_first_zero_bit(zs->used, zc->nslots);
+	BUG_ON(i >= zc->nslots);
+	__set_bit(i, zs->used);
+	if (++zs->inuse == zc->nslots)
+		list_move(&zs->list, &zc->full);
+	return zspan_slot(zs, i);
+}
+
+/*
+ * Release a slot, zc->lock must be held.  Isolated spans are left off
+ * the lists for whoever isolated them to deal with.  Otherwise a full
+ * span goes back on the partial list, and a span that empties is
+ * unlinked and returned so the caller can free it.
+ */
+static struct zspan *zspan_free_slot(struct zspan *zs, struct zspan_obj *zo)
+{
+	struct zspan_class *zc = zs->zc;
+	unsigned i = zspan_slot_index(zs, zo);
+
+	BUG_ON(!test_bit(i, zs->used));
+	INVERT_SENTINEL(zo, ZSO);
+	__clear_bit(i, zs->used);
+	if (zs->isolated) {
+		zs->inuse--;
+		return NULL;
+	}
+	if (zs->inuse-- == zc->nslots)
+		list_move(&zs->list, &zc->partial);
+	if (zs->inuse > 0)
+		return NULL;
+	list_del_init(&zs->list);
+	zc->nr_spans--;
+	return zs;
+}
+
+static void zspan_release(struct zspan *zs)
+{
+	ASSERT_SENTINEL(zs, ZSPAN);
+	BUG_ON(zs->inuse);
+	INVERT_SENTINEL(zs, ZSPAN);
+	atomic_sub(ZSPAN_PAGES, zs->zc->curr_pages);
+	free_pages((unsigned long)zs, ZSPAN_ORDER);
+}
+
+static struct zspan_obj *zspan_create(struct zspan_class *classes,
+					uint32_t pool_id, struct tmem_oid *oid,
+					uint32_t index, void *cdata,
+					unsigned clen)
+{
+	struct zspan_class *zc;
+	struct zspan_obj *zo = NULL;
+	struct zspan *zs;
+	unsigned size;
+
+	BUG_ON(!irqs_disabled());
+	size = ALIGN(sizeof(struct zspan_obj) + clen, ZSPAN_ALIGN);
+	if (unlikely((size >> ZSPAN_ALIGN_SHIFT) >= ZSPAN_NR_CLASSES))
+		goto out;
+	zc = &classes[size >> ZSPAN_ALIGN_SHIFT];
+	spin_lock(&zc->lock);
+	zo = zspan_alloc_slot(zc);
+	if (zo == NULL) {
+		/* no room in this class, start a span from the preload */
+		zs = zcache_get_free_page();
+		if (unlikely(zs == NULL))
+			goto out_unlock;
+		zs->zc = zc;
+		zs->inuse = 0;
+		zs->isolated = 0;
+		zs->zombie = 0;
+		bitmap_zero(zs->used, ZSPAN_MAX_SLOTS);
+		SET_SENTINEL(zs, ZSPAN);
+		list_add(&zs->list, &zc->partial);
+		zc->nr_spans++;
+		atomic_add(ZSPAN_PAGES, zc->curr_pages);
+		zo = zspan_alloc_slot(zc);
+	}
+	zo->pool_id = pool_id;
+	zo->oid = *oid;
+	zo->index = index;
+	zo->size = clen;
+	SET_SENTINEL(zo, ZSO);
+	memcpy((char *)zo + sizeof(struct zspan_obj), cdata, clen);
+	atomic_inc(zc->curr_zpages);
+out_unlock:
+	spin_unlock(&zc->lock);
+out:
+	return zo;
+}
+
+static void zspan_free(struct zspan_obj *zo)
+{
+	struct zspan *zs = zspan_of(zo);
+	struct zspan_class *zc = zs->zc;
+	struct zspan *empty;
+
+	ASSERT_SENTINEL(zs, ZSPAN);
+	spin_lock(&zc->lock);
+	ASSERT_SENTINEL(zo, ZSO);
+	empty = zspan_free_slot(zs, zo);
+	atomic_dec(zc->curr_zpages);
+	spin_unlock(&zc->lock);
+	if (empty != NULL)
+		zspan_release(empty);
+}
+
+static int zspan_decompress(struct page *page, struct zspan_obj *zo)
+{
+	struct zspan *zs = zspan_of(zo);
+	size_t out_len = PAGE_SIZE;
+	char *to_va;
+	int ret;
+
+	ASSERT_SENTINEL(zs, ZSPAN);
+	/*
+	 * The span can't be freed under us: eviction flushes each object
+	 * through tmem first, which waits for the hashbucket lock we hold.
+	 */
+	spin_lock(&zs->zc->lock);
+	ret = zs->zombie ? -EINVAL : 0;
+	spin_unlock(&zs->zc->lock);
+	if (ret)
+		goto out;
+	ASSERT_SENTINEL(zo, ZSO);
+	BUG_ON(zo->size == 0 || zo->size > zv_max_page_size);
+	to_va = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe((char *)zo + sizeof(struct zspan_obj),
+					zo->size, to_va, &out_len);
+	kunmap_atomic(to_va, KM_USER0);
+	BUG_ON(ret != LZO_E_OK);
+	BUG_ON(out_len != PAGE_SIZE);
+out:
+	return ret;
+}
+
+/*
+ * Empty the sparsest partial span of a class into the other partial
+ * spans, provided they have room for all of it.  The source span is
+ * isolated so none of its slots can be reused while an object is in
+ * flight, and tmem only switches to the copy if the handle still maps
+ * to the original, so a racing get, flush or put simply wins.  Returns
+ * 1 if a span was freed.
+ */
+static int zspan_compact_class(struct zspan_class *zc)
+{
+	struct zspan *zs, *src = NULL, *empty;
+	struct zspan_obj *from, *to;
+	struct tmem_pool *pool;
+	struct tmem_oid oid;
+	uint32_t pool_id, index;
+	unsigned i, room = 0;
+	int moved, ret = 0;
+
+	spin_lock_bh(&zc->lock);
+	list_for_each_entry(zs, &zc->partial, list) {
+		room += zc->nslots - zs->inuse;
+		if (src == NULL || zs->inuse < src->inuse)
+			src = zs;
+	}
+	if (src == NULL || room - (zc->nslots - src->inuse) < src->inuse) {
+		spin_unlock_bh(&zc->lock);
+		goto out;
+	}
+	list_del_init(&src->list);
+	src->isolated = 1;
+	for (i = 0; i < zc->nslots; i++) {
+		if (!test_bit(i, src->used))
+			continue;
+		to = zspan_alloc_slot(zc);
+		if (to == NULL)
+			break;
+		from = zspan_slot(src, i);
+		memcpy(to, from, zc->size);
+		pool_id = from->pool_id;
+		oid = from->oid;
+		index = from->index;
+		spin_unlock(&zc->lock);
+		pool = zcache_get_pool_by_id(pool_id);
+		moved = pool != NULL &&
+			tmem_replace(pool, &oid, index, from, to) == 0;
+		zcache_put_pool(pool);
+		spin_lock(&zc->lock);
+		if (moved) {
+			zspan_free_slot(src, from);
+			zcache_zspan_compacted_zpages++;
+		} else {
+			empty = zspan_free_slot(zspan_of(to), to);
+			if (empty != NULL)
+				zspan_release(empty);
+		}
+	}
+	src->isolated = 0;
+	if (src->inuse == 0) {
+		zc->nr_spans--;
+		spin_unlock_bh(&zc->lock);
+		zspan_release(src);
+		zcache_zspan_compacted_spans++;
+		ret = 1;
+	} else {
+		list_add(&src->list, &zc->partial);
+		spin_unlock_bh(&zc->lock);
+	}
+out:
+	return ret;
+}
+
+static int zspan_compact(struct zspan_class *classes, int nr)
+{
+	int i, freed = 0;
+
+	for (i = 0; i < ZSPAN_NR_CLASSES && freed < nr; i++)
+		while (freed < nr && zspan_compact_class(&classes[i]))
+			freed++;
+	return freed;
+}
+
+/*
+ * Pick the ephemeral span whose eviction drops the fewest compressed
+ * bytes, looking at the first few partial spans and the first full span
+ * of every class.  The best candidate's class stays locked while the
+ * rest are scanned so it can't be freed under us; nothing else ever
+ * holds two class locks, and the shrinker is serialized.  Returns the
+ * span isolated and marked zombie, or NULL.
+ */
+static struct zspan *zspan_pick_victim(void)
+{
+	struct zspan_class *zc, *vzc = NULL;
+	struct zspan *zs, *victim = NULL, *best_here;
+	unsigned long bytes, best = ULONG_MAX, best_here_bytes;
+	int i, n;
+
+	local_bh_disable();
+	for (i = 0; i < ZSPAN_NR_CLASSES; i++) {
+		zc = &zspan_eph_classes[i];
+		spin_lock(&zc->lock);
+		best_here = NULL;
+		best_here_bytes = best;
+		n = 0;
+		list_for_each_entry(zs, &zc->partial, list) {
+			if (n++ >= ZSPAN_EVICT_SCAN)
+				break;
+			bytes = zs->inuse * zc->size;
+			if (bytes < best_here_bytes) {
+				best_here_bytes = bytes;
+				best_here = zs;
+			}
+		}
+		if (!list_empty(&zc->full) &&
+		    zc->nslots * zc->size < best_here_bytes) {
+			best_here_bytes = zc->nslots * zc->size;
+			best_here = list_first_entry(&zc->full,
+						struct zspan, list);
+		}
+		if (best_here == NULL) {
+			spin_unlock(&zc->lock);
+			continue;
+		}
+		if (vzc != NULL)
+			spin_unlock(&vzc->lock);
+		vzc = zc;
+		victim = best_here;
+		best = best_here_bytes;
+	}
+	if (victim != NULL) {
+		list_del_init(&victim->list);
+		vzc->nr_spans--;
+		victim->isolated = 1;
+		victim->zombie = 1;
+		spin_unlock(&vzc->lock);
+	}
+	local_bh_enable();
+	return victim;
+}
+
+/*
+ * Flush every object in a zombie span from tmem, then free the span.
+ * Like zbud_evict_zbpg, the class lock is dropped around each flush.
+ */
+static void zspan_evict(struct zspan *zs)
+{
+	struct zspan_class *zc = zs->zc;
+	struct zspan_obj *zo;
+	struct tmem_pool *pool;
+	struct tmem_oid oid;
+	uint32_t pool_id, index;
+	unsigned i;
+
+	for (i = 0; i < zc->nslots; i++) {
+		spin_lock_bh(&zc->lock);
+		if (!test_bit(i, zs->used)) {
+			spin_unlock_bh(&zc->lock);
+			continue;
+		}
+		zo = zspan_slot(zs, i);
+		pool_id = zo->pool_id;
+		oid = zo->oid;
+		index = zo->index;
+		spin_unlock_bh(&zc->lock);
+		pool = zcache_get_pool_by_id(pool_id);
+		if (pool != NULL) {
+			local_bh_disable();
+			tmem_flush_page(pool, &oid, index);
+			local_bh_enable();
+			zcache_put_pool(pool);
+		}
+		/* an ephemeral get that found us zombie orphans its slot */
+		spin_lock_bh(&zc->lock);
+		if (test_bit(i, zs->used)) {
+			zspan_free_slot(zs, zo);
+			atomic_dec(zc->curr_zpages);
+		}
+		spin_unlock_bh(&zc->lock);
+	}
+	zspan_release(zs);
+	zcache_zspan_evicted_spans++;
+}
+
+static void zspan_evict_spans(int nr)
+{
+	struct zspan *zs;
+
+	while (nr-- > 0 && (zs = zspan_pick_victim()) != NULL)
+		zspan_evict(zs);
+}
+
+static void zspan_init_classes(struct zspan_class *classes,
+				atomic_t *curr_pages, atomic_t *curr_zpages)
+{
+	struct zspan_class *zc;
+	int i;
+
+	for (i = 0; i < ZSPAN_NR_CLASSES; i++) {
+		zc = &classes[i];
+		spin_lock_init(&zc->lock);
+		INIT_LIST_HEAD(&zc->partial);
+		INIT_LIST_HEAD(&zc->full);
+		zc->nr_spans = 0;
+		zc->size = i << ZSPAN_ALIGN_SHIFT;
+		zc->nslots = zc->size == 0 ? 0 :
+			min_t(unsigned, ZSPAN_MAX_SLOTS,
+			      (ZSPAN_SIZE - ZSPAN_HDR_SIZE) / zc->size);
+		zc->curr_pages = curr_pages;
+		zc->curr_zpages = curr_zpages;
+	}
+}
+
+static void zspan_init(void)
+{
+	BUILD_BUG_ON(sizeof(struct zspan_obj) + 1 <= ZSPAN_ALIGN);
+	zspan_init_classes(zspan_eph_classes, &zcache_zspan_eph_pages,
+				&zcache_zspan_eph_zpages);
+	zspan_init_classes(zspan_pers_classes, &zcache_zspan_pers_pages,
+				&zcache_zspan_pers_zpages);
+}
+
 /*
  * zcache core code starts here
  */
@@ -676,6 +1259,7 @@ static unsigned long zcache_flobj_total;
 static unsigned long zcache_flobj_found;
 static unsigned long zcache_failed_eph_puts;
 static unsigned long zcache_failed_pers_puts;
+static unsigned long zcache_pool_resizes;
 
 #define MAX_POOLS_PER_CLIENT 16
 
@@ -717,9 +1301,11 @@ static unsigned long zcache_aborted_preload;
 static unsigned long zcache_aborted_shrink;
 
 /*
- * Ensure that memory allocation requests in zcache don't result
- * in direct reclaim requests via the shrinker, which would cause
- * an infinite loop.  Maybe a GFP flag would be better?
+ * Serializes the shrinker.  Preloads used to take this too, to keep
+ * their allocations from recursing into the shrinker, but that made
+ * every put on every cpu contend for it.  ZCACHE_GFP_MASK has no
+ * __GFP_WAIT, so those allocations never enter direct reclaim and
+ * cannot recurse anyway.
  */
 static DEFINE_SPINLOCK(zcache_direct_reclaim_lock);
 
@@ -741,13 +1327,18 @@ static unsigned long zcache_curr_objnode_count_max;
  * actually do a malloc
  */
 struct zcache_preload {
-	void *page;
+	void *page; /* or a whole span for zspan */
 	struct tmem_obj *obj;
 	int nr;
 	struct tmem_objnode *objnodes[OBJNODE_TREE_MAX_PATH];
 };
 static DEFINE_PER_CPU(struct zcache_preload, zcache_preloads) = { 0, };
 
+static inline unsigned zcache_page_order(void)
+{
+	return zcache_use_zspan ? ZSPAN_ORDER : 0;
+}
+
 static int zcache_do_preload(struct tmem_pool *pool)
 {
 	struct zcache_preload *kp;
@@ -760,10 +1351,6 @@ static int zcache_do_preload(struct tmem_pool *pool)
 		goto out;
 	if (unlikely(zcache_obj_cache == NULL))
 		goto out;
-	if (!spin_trylock(&zcache_direct_reclaim_lock)) {
-		zcache_aborted_preload++;
-		goto out;
-	}
 	preempt_disable();
 	kp = &__get_cpu_var(zcache_preloads);
 	while (kp->nr < ARRAY_SIZE(kp->objnodes)) {
@@ -772,7 +1359,7 @@ static int zcache_do_preload(struct tmem_pool *pool)
 				ZCACHE_GFP_MASK);
 		if (unlikely(objnode == NULL)) {
 			zcache_failed_alloc++;
-			goto unlock_out;
+			goto out;
 		}
 		preempt_disable();
 		kp = &__get_cpu_var(zcache_preloads);
@@ -781,30 +1368,42 @@ static int zcache_do_preload(struct tmem_pool *pool)
 		else
 			kmem_cache_free(zcache_objnode_cache, objnode);
 	}
-	preempt_enable_no_resched();
-	obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
-	if (unlikely(obj == NULL)) {
-		zcache_failed_alloc++;
-		goto unlock_out;
+	if (kp->obj == NULL) {
+		preempt_enable_no_resched();
+		obj = kmem_cache_alloc(zcache_obj_cache, ZCACHE_GFP_MASK);
+		if (unlikely(obj == NULL)) {
+			zcache_failed_alloc++;
+			goto out;
+		}
+		preempt_disable();
+		kp = &__get_cpu_var(zcache_preloads);
+		if (kp->obj == NULL)
+			kp->obj = obj;
+		else
+			kmem_cache_free(zcache_obj_cache, obj);
 	}
-	page = (void *)__get_free_page(ZCACHE_GFP_MASK);
-	if (unlikely(page == NULL)) {
-		zcache_failed_get_free_pages++;
-		goto unlock_out;
+	/*
+	 * The page is only used when a put finds no room in an existing
+	 * zbud page or span, and it stays preloaded until then.  Failing
+	 * to get one, which for a span's higher order is likely once
+	 * memory is fragmented, doesn't fail the put: it can still go
+	 * into a free slot, and zcache_get_free_page() returns NULL
+	 * otherwise.
+	 */
+	if (kp->page == NULL) {
+		preempt_enable_no_resched();
+		page = (void *)__get_free_pages(ZCACHE_GFP_MASK,
+						zcache_page_order());
+		if (unlikely(page == NULL))
+			zcache_failed_get_free_pages++;
+		preempt_disable();
+		kp = &__get_cpu_var(zcache_preloads);
+		if (kp->page == NULL)
+			kp->page = page;
+		else if (page != NULL)
+			free_pages((unsigned long)page, zcache_page_order());
 	}
-	preempt_disable();
-	kp = &__get_cpu_var(zcache_preloads);
-	if (kp->obj == NULL)
-		kp->obj = obj;
-	else
-		kmem_cache_free(zcache_obj_cache, obj);
-	if (kp->page == NULL)
-		kp->page = page;
-	else
-		free_page((unsigned long)page);
 	ret = 0;
-unlock_out:
-	spin_unlock(&zcache_direct_reclaim_lock);
 out:
 	return ret;
 }
@@ -816,7 +1415,6 @@ static void *zcache_get_free_page(void)
 
 	kp = &__get_cpu_var(zcache_preloads);
 	page = kp->page;
-	BUG_ON(page == NULL);
 	kp->page = NULL;
 	return page;
 }
@@ -914,12 +1512,21 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 		if (ret == 0)
 
 			goto out;
-		if (clen == 0 || clen > zbud_max_buddy_size()) {
-			zcache_compress_poor++;
-			goto out;
+		if (zcache_use_zspan) {
+			if (clen == 0 || clen > zv_max_page_size) {
+				zcache_compress_poor++;
+				goto out;
+			}
+			pampd = (void *)zspan_create(zspan_eph_classes,
+					pool->pool_id, oid, index, cdata, clen);
+		} else {
+			if (clen == 0 || clen > zbud_max_buddy_size()) {
+				zcache_compress_poor++;
+				goto out;
+			}
+			pampd = (void *)zbud_create(pool->pool_id, oid, index,
+							page, cdata, clen);
 		}
-		pampd = (void *)zbud_create(pool->pool_id, oid, index,
-						page, cdata, clen);
 		if (pampd != NULL) {
 			count = atomic_inc_return(&zcache_curr_eph_pampd_count);
 			if (count > zcache_curr_eph_pampd_count_max)
@@ -941,8 +1548,12 @@ static void *zcache_pampd_create(struct tmem_pool *pool, struct tmem_oid *oid,
 			zcache_compress_poor++;
 			goto out;
 		}
-		pampd = (void *)zv_create(zcache_client.xvpool, pool->pool_id,
-						oid, index, cdata, clen);
+		if (zcache_use_zspan)
+			pampd = (void *)zspan_create(zspan_pers_classes,
+					pool->pool_id, oid, index, cdata, clen);
+		else
+			pampd = (void *)zv_create(zcache_client.xvpool,
+					pool->pool_id, oid, index, cdata, clen);
 		if (pampd == NULL)
 			goto out;
 		count = atomic_inc_return(&zcache_curr_pers_pampd_count);
@@ -962,7 +1573,9 @@ static int zcache_pampd_get_data(struct page *page, void *pampd,
 {
 	int ret = 0;
 
-	if (is_ephemeral(pool))
+	if (zcache_use_zspan)
+		ret = zspan_decompress(page, pampd);
+	else if (is_ephemeral(pool))
 		ret = zbud_decompress(page, pampd);
 	else
 		zv_decompress(page, pampd);
@@ -976,11 +1589,17 @@ static int zcache_pampd_get_data(struct page *page, void *pampd,
 static void zcache_pampd_free(void *pampd, struct tmem_pool *pool)
 {
 	if (is_ephemeral(pool)) {
-		zbud_free_and_delist((struct zbud_hdr *)pampd);
+		if (zcache_use_zspan)
+			zspan_free((struct zspan_obj *)pampd);
+		else
+			zbud_free_and_delist((struct zbud_hdr *)pampd);
 		atomic_dec(&zcache_curr_eph_pampd_count);
 		BUG_ON(atomic_read(&zcache_curr_eph_pampd_count) < 0);
 	} else {
-		zv_free(zcache_client.xvpool, (struct zv_hdr *)pampd);
+		if (zcache_use_zspan)
+			zspan_free((struct zspan_obj *)pampd);
+		else
+			zv_free(zcache_client.xvpool, (struct zv_hdr *)pampd);
 		atomic_dec(&zcache_curr_pers_pampd_count);
 		BUG_ON(atomic_read(&zcache_curr_pers_pampd_count) < 0);
 	}
@@ -1052,8 +1671,11 @@ static int zcache_cpu_notifier(struct notifier_block *nb,
 			kp->objnodes[kp->nr - 1] = NULL;
 			kp->nr--;
 		}
-		kmem_cache_free(zcache_obj_cache, kp->obj);
-		free_page((unsigned long)kp->page);
+		if (kp->obj)
+			kmem_cache_free(zcache_obj_cache, kp->obj);
+		kp->obj = NULL;
+		free_pages((unsigned long)kp->page, zcache_page_order());
+		kp->page = NULL;
 		break;
 	default:
 		break;
@@ -1066,6 +1688,44 @@ static struct notifier_block zcache_cpu_notifier_block = {
 };
 
 #ifdef CONFIG_SYSFS
+/*
+ * Pageframes used per compressed page stored, for comparing allocators
+ * under the same workload.  Zbud counts its unused pages, xvmalloc its
+ * total pool size.
+ */
+static char *zcache_sprint_density(char *p, const char *name,
+				unsigned long pages, unsigned long zpages)
+{
+	unsigned long milli = zpages ? pages * 1000 / zpages : 0;
+
+	return p + sprintf(p, "%s: %lu pages / %lu zpages = %lu.%03lu\n",
+			name, pages, zpages, milli / 1000, milli % 1000);
+}
+
+static int zcache_show_pages_per_zpage(char *buf)
+{
+	char *p = buf;
+
+	if (zcache_use_zspan) {
+		p = zcache_sprint_density(p, "zspan_eph",
+				atomic_read(&zcache_zspan_eph_pages),
+				atomic_read(&zcache_zspan_eph_zpages));
+		p = zcache_sprint_density(p, "zspan_pers",
+				atomic_read(&zcache_zspan_pers_pages),
+				atomic_read(&zcache_zspan_pers_zpages));
+		return p - buf;
+	}
+	p = zcache_sprint_density(p, "zbud",
+			atomic_read(&zcache_zbud_curr_raw_pages),
+			atomic_read(&zcache_zbud_curr_zpages));
+	if (zcache_client.xvpool != NULL)
+		p = zcache_sprint_density(p, "xvmalloc",
+			DIV_ROUND_UP(xv_get_total_size_bytes(
+					zcache_client.xvpool), PAGE_SIZE),
+			atomic_read(&zcache_curr_pers_pampd_count));
+	return p - buf;
+}
+
 #define ZCACHE_SYSFS_RO(_name) \
 	static ssize_t zcache_##_name##_show(struct kobject *kobj, \
 				struct kobj_attribute *attr, char *buf) \
@@ -1110,8 +1770,7 @@ ZCACHE_SYSFS_RO(failed_pers_puts);
 ZCACHE_SYSFS_RO(zbud_curr_zbytes);
 ZCACHE_SYSFS_RO(zbud_cumul_zpages);
 ZCACHE_SYSFS_RO(zbud_cumul_zbytes);
-ZCACHE_SYSFS_RO(zbud_buddied_count);
-ZCACHE_SYSFS_RO(zbpg_unused_list_count);
+ZCACHE_SYSFS_RO(pool_resizes);
 ZCACHE_SYSFS_RO(evicted_raw_pages);
 ZCACHE_SYSFS_RO(evicted_unbuddied_pages);
 ZCACHE_SYSFS_RO(evicted_buddied_pages);
@@ -1121,6 +1780,13 @@ ZCACHE_SYSFS_RO(put_to_flush);
 ZCACHE_SYSFS_RO(aborted_preload);
 ZCACHE_SYSFS_RO(aborted_shrink);
 ZCACHE_SYSFS_RO(compress_poor);
+ZCACHE_SYSFS_RO(zspan_compacted_zpages);
+ZCACHE_SYSFS_RO(zspan_compacted_spans);
+ZCACHE_SYSFS_RO(zspan_evicted_spans);
+ZCACHE_SYSFS_RO_ATOMIC(zspan_eph_pages);
+ZCACHE_SYSFS_RO_ATOMIC(zspan_eph_zpages);
+ZCACHE_SYSFS_RO_ATOMIC(zspan_pers_pages);
+ZCACHE_SYSFS_RO_ATOMIC(zspan_pers_zpages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_raw_pages);
 ZCACHE_SYSFS_RO_ATOMIC(zbud_curr_zpages);
 ZCACHE_SYSFS_RO_ATOMIC(curr_obj_count);
@@ -1129,6 +1795,22 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
+ZCACHE_SYSFS_RO_CUSTOM(zbud_buddied_count, zbud_show_buddied_count);
+ZCACHE_SYSFS_RO_CUSTOM(zbpg_unused_list_count, zbud_show_unused_list_count);
+ZCACHE_SYSFS_RO_CUSTOM(pages_per_zpage, zcache_show_pages_per_zpage);
+
+#ifdef CONFIG_ZCACHE_BENCH
+static ssize_t zcache_bench_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf);
+static ssize_t zcache_bench_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count);
+static struct kobj_attribute zcache_bench_attr = {
+	.attr = { .name = "bench", .mode = 0644 },
+	.show = zcache_bench_show,
+	.store = zcache_bench_store,
+};
+#endif
 
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
@@ -1159,6 +1841,18 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_pool_resizes_attr.attr,
+	&zcache_zspan_eph_pages_attr.attr,
+	&zcache_zspan_eph_zpages_attr.attr,
+	&zcache_zspan_pers_pages_attr.attr,
+	&zcache_zspan_pers_zpages_attr.attr,
+	&zcache_zspan_compacted_zpages_attr.attr,
+	&zcache_zspan_compacted_spans_attr.attr,
+	&zcache_zspan_evicted_spans_attr.attr,
+	&zcache_pages_per_zpage_attr.attr,
+#ifdef CONFIG_ZCACHE_BENCH
+	&zcache_bench_attr.attr,
+#endif
 	NULL,
 };
 
@@ -1178,8 +1872,20 @@ static struct attribute_group zcache_attr_group = {
 static bool zcache_freeze;
 
 /*
- * zcache shrinker interface (only useful for ephemeral pages, so zbud only)
+ * zcache shrinker interface (only useful for ephemeral pages, so zbud
+ * only, or with zspan, compaction of both kinds and then eviction of
+ * ephemeral spans)
  */
+static void zspan_shrink(int nr)
+{
+	int spans = DIV_ROUND_UP(nr, ZSPAN_PAGES);
+
+	/* compaction drops no data, so try it before evicting */
+	spans -= zspan_compact(zspan_eph_classes, spans);
+	spans -= zspan_compact(zspan_pers_classes, spans);
+	zspan_evict_spans(spans);
+}
+
 static int shrink_zcache_memory(struct shrinker *shrink, int nr, gfp_t gfp_mask)
 {
 	int ret = -1;
@@ -1189,12 +1895,18 @@ static int shrink_zcache_memory(struct shrinker *shrink, int nr, gfp_t gfp_mask)
 			/* does this case really need to be skipped? */
 			goto out;
 		if (spin_trylock(&zcache_direct_reclaim_lock)) {
-			zbud_evict_pages(nr);
+			if (zcache_use_zspan)
+				zspan_shrink(nr);
+			else
+				zbud_evict_pages(nr);
 			spin_unlock(&zcache_direct_reclaim_lock);
 		} else
 			zcache_aborted_shrink++;
 	}
-	ret = (int)atomic_read(&zcache_zbud_curr_raw_pages);
+	if (zcache_use_zspan)
+		ret = (int)atomic_read(&zcache_zspan_eph_pages);
+	else
+		ret = (int)atomic_read(&zcache_zbud_curr_raw_pages);
 out:
 	return ret;
 }
@@ -1204,6 +1916,32 @@ static struct shrinker zcache_shrinker = {
 	.seeks = DEFAULT_SEEKS,
 };
 
+/*
+ * Pools start out with a small tmem hash table.  Puts that push a pool
+ * past its load factor kick this worker, which grows the table from
+ * process context where a large allocation is allowed to sleep.
+ */
+static void zcache_resize_pools(struct work_struct *work)
+{
+	struct tmem_pool *pool;
+	int i;
+
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		pool = zcache_get_pool_by_id(i);
+		if (pool == NULL)
+			continue;
+		while (tmem_pool_wants_grow(pool) &&
+		       tmem_resize_pool(pool, pool->hash_bits + 1) == 0) {
+			zcache_pool_resizes++;
+			pr_info("zcache: pool id=%d hash grown to %u buckets\n",
+				i, 1 << pool->hash_bits);
+		}
+		zcache_put_pool(pool);
+	}
+}
+
+static DECLARE_WORK(zcache_resize_work, zcache_resize_pools);
+
 /*
  * zcache shims between cleancache/frontswap ops and tmem
  */
@@ -1226,7 +1964,8 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 				zcache_failed_eph_puts++;
 			else
 				zcache_failed_pers_puts++;
-		}
+		} else if (unlikely(tmem_pool_wants_grow(pool)))
+			schedule_work(&zcache_resize_work);
 		zcache_put_pool(pool);
 		preempt_enable_no_resched();
 	} else {
@@ -1258,6 +1997,27 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 	return ret;
 }
 
+static int zcache_get_pages(int pool_id, struct tmem_oid *oidp,
+				uint32_t *indices, struct page **pages, int nr,
+				unsigned long *hits)
+{
+	struct tmem_pool *pool;
+	int ret = 0;
+	unsigned long flags;
+
+	*hits = 0;
+	local_irq_save(flags);
+	pool = zcache_get_pool_by_id(pool_id);
+	if (likely(pool != NULL)) {
+		if (atomic_read(&pool->obj_count) > 0)
+			ret = tmem_get_pages(pool, oidp, indices, pages, nr,
+						hits);
+		zcache_put_pool(pool);
+	}
+	local_irq_restore(flags);
+	return ret;
+}
+
 static int zcache_flush_page(int pool_id, struct tmem_oid *oidp, uint32_t index)
 {
 	struct tmem_pool *pool;
@@ -1344,7 +2104,12 @@ static int zcache_new_pool(uint32_t flags)
 	atomic_set(&pool->refcount, 0);
 	pool->client = &zcache_client;
 	pool->pool_id = poolid;
-	tmem_new_pool(pool, flags);
+	if (tmem_new_pool(pool, flags)) {
+		pr_info("zcache: pool creation failed: out of memory\n");
+		kfree(pool);
+		poolid = -1;
+		goto out;
+	}
 	zcache_client.tmem_pools[poolid] = pool;
 	pr_info("zcache: created %s tmem pool, id=%d\n",
 		flags & TMEM_POOL_PERSIST ? "persistent" : "ephemeral",
@@ -1386,6 +2151,43 @@ static int zcache_cleancache_get_page(int pool_id,
 	return ret;
 }
 
+static int zcache_cleancache_get_pages(int pool_id,
+					struct cleancache_filekey key,
+					struct page **pages, int nr,
+					unsigned long *hits)
+{
+	uint32_t ind[CLEANCACHE_BATCH];
+	struct tmem_oid oid = *(struct tmem_oid *)&key;
+	int i;
+
+	*hits = 0;
+	for (i = 0; i < nr; i++) {
+		ind[i] = (u32)pages[i]->index;
+		if (unlikely(ind[i] != pages[i]->index))
+			return 0;
+	}
+	return zcache_get_pages(pool_id, &oid, ind, pages, nr, hits);
+}
+
+/* one pass with interrupts off, rather than toggling them per page */
+static void zcache_cleancache_put_pages(int pool_id,
+					struct cleancache_filekey key,
+					struct page **pages, int nr)
+{
+	struct tmem_oid oid = *(struct tmem_oid *)&key;
+	unsigned long flags;
+	u32 ind;
+	int i;
+
+	local_irq_save(flags);
+	for (i = 0; i < nr; i++) {
+		ind = (u32)pages[i]->index;
+		if (likely(ind == pages[i]->index))
+			(void)zcache_put_page(pool_id, &oid, ind, pages[i]);
+	}
+	local_irq_restore(flags);
+}
+
 static void zcache_cleancache_flush_page(int pool_id,
 					struct cleancache_filekey key,
 					pgoff_t index)
@@ -1431,6 +2233,8 @@ static int zcache_cleancache_init_shared_fs(char *uuid, size_t pagesize)
 static struct cleancache_ops zcache_cleancache_ops = {
 	.put_page = zcache_cleancache_put_page,
 	.get_page = zcache_cleancache_get_page,
+	.put_pages = zcache_cleancache_put_pages,
+	.get_pages = zcache_cleancache_get_pages,
 	.flush_page = zcache_cleancache_flush_page,
 	.flush_inode = zcache_cleancache_flush_inode,
 	.flush_fs = zcache_cleancache_flush_fs,
@@ -1561,11 +2365,31 @@ static int zcache_enabled;
 
 static int __init enable_zcache(char *s)
 {
+	/* "zcache" prefixes "zcache_alloc=", leave that to its handler */
+	if (*s == '_')
+		return 0;
 	zcache_enabled = 1;
 	return 1;
 }
 __setup("zcache", enable_zcache);
 
+/*
+ * "zcache_alloc=zspan" stores both ephemeral and persistent pages in
+ * zspans; the default, "zcache_alloc=zbud", uses zbud and xvmalloc
+ */
+static int __init zcache_set_alloc(char *s)
+{
+	if (!strcmp(s, "zspan"))
+		zcache_use_zspan = 1;
+	else if (!strcmp(s, "zbud"))
+		zcache_use_zspan = 0;
+	else
+		pr_warning("zcache: unknown allocator \"%s\"\n", s);
+	return 1;
+}
+
+__setup("zcache_alloc=", zcache_set_alloc);
+
 /* allow independent dynamic disabling of cleancache and frontswap */
 
 static int use_cleancache = 1;
@@ -1588,6 +2412,185 @@ static int __init no_frontswap(char *s)
 
 __setup("nofrontswap", no_frontswap);
 
+#ifdef CONFIG_ZCACHE_BENCH
+/*
+ * Put/get microbenchmark.  Writing N to /sys/kernel/mm/zcache/bench
+ * runs, on every online cpu at once, N puts followed by N gets against
+ * a private ephemeral pool (and a persistent one if frontswap is up).
+ * Since the cpus run concurrently, any lock they share shows up as the
+ * aggregate rate failing to scale with the number of cpus.
+ */
+
+/* pages per tmem object, so the pool grows its hash table as it fills */
+#define ZCACHE_BENCH_OBJ_PAGES	64
+
+struct zcache_bench_stat {
+	bool active;
+	unsigned long puts;
+	unsigned long gets;
+	u64 put_ns;
+	u64 get_ns;
+};
+
+struct zcache_bench_run {
+	int pool_id;
+	unsigned long nr_pages;
+	atomic_t running;
+	struct completion done;
+};
+
+static DEFINE_PER_CPU(struct zcache_bench_stat, zcache_bench_stats);
+static DEFINE_MUTEX(zcache_bench_mutex);
+static char zcache_bench_result[512];
+
+static int zcache_bench_thread(void *data)
+{
+	struct zcache_bench_run *run = data;
+	struct zcache_bench_stat *st;
+	struct tmem_oid oid = { .oid = { 0 } };
+	struct page *page;
+	unsigned long i, flags;
+	ktime_t start;
+	char *va;
+	int cpu, off;
+
+	cpu = raw_smp_processor_id(); /* bound to it by the creator */
+	st = &per_cpu(zcache_bench_stats, cpu);
+	page = alloc_page(GFP_KERNEL);
+	if (page == NULL)
+		goto out;
+	/* text compresses to well under a zbud, like typical page cache */
+	va = kmap(page);
+	for (off = 0, i = 0; off < PAGE_SIZE - 64; i++)
+		off += sprintf(va + off, "zcache bench cpu %d line %lu\n",
+				cpu, i);
+	memset(va + off, 0, PAGE_SIZE - off);
+	kunmap(page);
+
+	oid.oid[0] = cpu;
+	start = ktime_get();
+	for (i = 0; i < run->nr_pages; i++) {
+		oid.oid[1] = i / ZCACHE_BENCH_OBJ_PAGES;
+		local_irq_save(flags);
+		if (zcache_put_page(run->pool_id, &oid,
+				i % ZCACHE_BENCH_OBJ_PAGES, page) >= 0)
+			st->puts++;
+		local_irq_restore(flags);
+	}
+	st->put_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < run->nr_pages; i++) {
+		oid.oid[1] = i / ZCACHE_BENCH_OBJ_PAGES;
+		if (zcache_get_page(run->pool_id, &oid,
+				i % ZCACHE_BENCH_OBJ_PAGES, page) >= 0)
+			st->gets++;
+	}
+	st->get_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	__free_page(page);
+out:
+	if (atomic_dec_and_test(&run->running))
+		complete(&run->done);
+	return 0;
+}
+
+/* rate in pages per second for n pages over ns nanoseconds */
+static unsigned long zcache_bench_rate(unsigned long n, u64 ns)
+{
+	return ns ? (unsigned long)div64_u64((u64)n * NSEC_PER_SEC, ns) : 0;
+}
+
+static int zcache_bench_pool(uint32_t flags, unsigned long nr_pages,
+				char *buf, int max)
+{
+	struct zcache_bench_run run;
+	struct zcache_bench_stat *st, sum = { 0 };
+	struct task_struct *task;
+	u64 put_max = 0, get_max = 0;
+	int cpu, ncpus = 0;
+
+	run.pool_id = zcache_new_pool(flags);
+	if (run.pool_id < 0)
+		return scnprintf(buf, max, "pool creation failed\n");
+	run.nr_pages = nr_pages;
+	atomic_set(&run.running, 1);
+	init_completion(&run.done);
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		task = kthread_create(zcache_bench_thread, &run,
+					"zcache_bench/%d", cpu);
+		if (IS_ERR(task))
+			continue;
+		st = &per_cpu(zcache_bench_stats, cpu);
+		memset(st, 0, sizeof(*st));
+		st->active = true;
+		kthread_bind(task, cpu);
+		atomic_inc(&run.running);
+		wake_up_process(task);
+	}
+	if (atomic_dec_and_test(&run.running))
+		complete(&run.done);
+	wait_for_completion(&run.done);
+
+	for_each_online_cpu(cpu) {
+		st = &per_cpu(zcache_bench_stats, cpu);
+		if (!st->active)
+			continue;
+		ncpus++;
+		sum.puts += st->puts;
+		sum.gets += st->gets;
+		put_max = max(put_max, st->put_ns);
+		get_max = max(get_max, st->get_ns);
+		st->active = false;
+	}
+	put_online_cpus();
+
+	zcache_destroy_pool(run.pool_id);
+
+	/* the slowest cpu bounds the aggregate rate */
+	return scnprintf(buf, max,
+		"%s: cpus=%d pages=%lu puts=%lu (%lu/s) gets=%lu (%lu/s)\n",
+		flags & TMEM_POOL_PERSIST ? "persistent" : "ephemeral",
+		ncpus, nr_pages, sum.puts, zcache_bench_rate(sum.puts, put_max),
+		sum.gets, zcache_bench_rate(sum.gets, get_max));
+}
+
+static ssize_t zcache_bench_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&zcache_bench_mutex);
+	ret = sprintf(buf, "%s", zcache_bench_result);
+	mutex_unlock(&zcache_bench_mutex);
+	return ret;
+}
+
+static ssize_t zcache_bench_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int len;
+
+	if (!zcache_enabled)
+		return -ENODEV;
+	if (strict_strtoul(buf, 10, &nr_pages) || nr_pages == 0)
+		return -EINVAL;
+
+	mutex_lock(&zcache_bench_mutex);
+	len = zcache_bench_pool(0, nr_pages, zcache_bench_result,
+				sizeof(zcache_bench_result));
+	if (zcache_client.xvpool != NULL)
+		zcache_bench_pool(TMEM_POOL_PERSIST, nr_pages,
+				zcache_bench_result + len,
+				sizeof(zcache_bench_result) - len);
+	mutex_unlock(&zcache_bench_mutex);
+	return count;
+}
+#endif /* CONFIG_ZCACHE_BENCH */
+
 static int __init zcache_init(void)
 {
 #ifdef CONFIG_SYSFS
@@ -1603,6 +2606,10 @@ static int __init zcache_init(void)
 	if (zcache_enabled) {
 		unsigned int cpu;
 
+		if (zcache_use_zspan)
+			zspan_init();
+		else
+			zbud_init();
 		tmem_register_hostops(&zcache_hostops);
 		tmem_register_pamops(&zcache_pamops);
 		ret = register_cpu_notifier(&zcache_cpu_notifier_block);
@@ -1625,11 +2632,11 @@ static int __init zcache_init(void)
 	if (zcache_enabled && use_cleancache) {
 		struct cleancache_ops old_ops;
 
-		zbud_init();
 		register_shrinker(&zcache_shrinker);
 		old_ops = zcache_cleancache_register_ops();
 		pr_info("zcache: cleancache enabled using kernel "
-			"transcendent memory and compression buddies\n");
+			"transcendent memory and %s\n", zcache_use_zspan ?
+			"zspan" : "compression buddies");
 		if (old_ops.init_fs != NULL)
 			pr_warning("zcache: cleancache_ops overridden");
 	}
@@ -1638,14 +2645,17 @@ static int __init zcache_init(void)
 	if (zcache_enabled && use_frontswap) {
 		struct frontswap_ops old_ops;
 
-		zcache_client.xvpool = xv_create_pool();
-		if (zcache_client.xvpool == NULL) {
-			pr_err("zcache: can't create xvpool\n");
-			goto out;
+		if (!zcache_use_zspan) {
+			zcache_client.xvpool = xv_create_pool();
+			if (zcache_client.xvpool == NULL) {
+				pr_err("zcache: can't create xvpool\n");
+				goto out;
+			}
 		}
 		old_ops = zcache_frontswap_register_ops();
 		pr_info("zcache: frontswap enabled using kernel "
-			"transcendent memory and xvmalloc\n");
+			"transcendent memory and %s\n", zcache_use_zspan ?
+			"zspan" : "xvmalloc");
 		if (old_ops.init != NULL)
 			pr_warning("ktmem: frontswap_ops overridden");
 	}
@@ -232,6 +232,30 @@ static inline unsigned int fsr_stl_page_size(stl_info_t *ssp)
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0)
 #include <linux/blkdev.h>
 
+/* Requests fetched and completed together by bml_request() */
+#define BML_BATCH_REQS		8
+/* Largest read gathered through the bounce buffer */
+#define BML_BOUNCE_SIZE		(16 * 1024)
+
+/* A destination segment of a batch */
+struct bml_seg
+{
+	char			*buf;
+	u32			nsect;
+};
+
+/* A run of consecutive sectors read with one BML call */
+struct bml_run
+{
+	u32			sector;
+	u32			nsect;
+	int			seg;		/* first segment */
+	int			nsegs;
+	int			contig;		/* segments are virtually contiguous */
+	int			first_req;	/* batch requests covered */
+	int			last_req;
+};
+
 struct fsr_dev 
 {
 	struct request		*req;        
@@ -242,6 +266,11 @@ struct fsr_dev
 	struct gendisk		*gd;
 	int			dev_id;
 	struct scatterlist	*sg;
+	struct request		*batch[BML_BATCH_REQS];
+	int			batch_err[BML_BATCH_REQS];
+	struct bml_seg		*segs;		/* BML_BATCH_REQS * max segments */
+	struct bml_run		*runs;
+	char			*bounce;
 };
 #else
 /* Kernel 2.4 */
@@ -31,6 +31,14 @@
 #define DEVICE_NAME             "tfsr"
 #define MAJOR_NR                BLK_DEVICE_TINY_FSR
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 34)
+#define bml_max_segments(q)	queue_max_segments(q)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
+#define bml_max_segments(q)	queue_max_phys_segments(q)
+#else
+#define bml_max_segments(q)	((q)->max_phys_segments)
+#endif
+
 /**
  * list to keep track of each created block devices
  */
@@ -52,6 +60,238 @@ EXPORT_SYMBOL(bml_module_resume);
 
 #endif /* end of CONFIG_PM */
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
+/**
+ * read one run of consecutive sectors from BML
+ * @param volume        : device number
+ * @param n1stVpn       : first virtual page of the partition
+ * @param sector        : first sector of the run
+ * @param nsect         : number of sectors
+ * @param buf           : destination buffer
+ * @return              0 on success, -EIO on failure
+ *
+ * Page aligned runs use FSR_BML_Read() so that multi-page reads go out as
+ * one BML operation, others fall back to FSR_BML_ReadScts().
+ */
+static int bml_read_run(u32 volume, u32 n1stVpn, u32 sector, u32 nsect, char *buf)
+{
+	FSRVolSpec *vs;
+	u32 spp_shift, spp_mask;
+	int ret;
+
+	vs = fsr_get_vol_spec(volume);
+	spp_shift = ffs(vs->nSctsPerPg) - 1;
+	spp_mask = vs->nSctsPerPg - 1;
+
+	if (!(sector & spp_mask) && !(nsect & spp_mask))
+	{
+		ret = FSR_BML_Read(volume, n1stVpn + (sector >> spp_shift),
+				nsect >> spp_shift, buf, NULL, FSR_BML_FLAG_ECC_ON);
+	}
+	else
+	{
+		ret = FSR_BML_ReadScts(volume, n1stVpn + (sector >> spp_shift),
+				sector & spp_mask, nsect, buf, NULL, FSR_BML_FLAG_ECC_ON);
+	}
+
+	if (ret != FSR_BML_SUCCESS)
+	{
+		ERRPRINTK("TINY: transfer error = %X\n", ret);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/**
+ * split a batch of requests into runs of consecutive sectors
+ * @param dev           : fsr block device
+ * @param nreq          : number of requests in dev->batch
+ * @return              number of runs in dev->runs
+ *
+ * Segments which continue both the sector range and the buffer of the
+ * previous run are read with it directly. Other sector-contiguous
+ * segments are gathered through the bounce buffer, up to BML_BOUNCE_SIZE.
+ * Runs may span requests.
+ */
+static int bml_build_runs(struct fsr_dev *dev, int nreq)
+{
+	struct request_queue *rq = dev->queue;
+	struct scatterlist *sg;
+	struct bml_run *run = NULL;
+	struct bml_seg *seg;
+	u32 sector, nsect;
+	int i, j, nsg, nsegs = 0, nruns = 0;
+	char *buf;
+
+	for (i = 0; i < nreq; i++)
+	{
+		struct request *req = dev->batch[i];
+
+		if (!blk_fs_request(req) || rq_data_dir(req) != READ)
+		{
+			ERRPRINTK("Unknown request 0x%x\n", (u32) rq_data_dir(req));
+			dev->batch_err[i] = -EIO;
+			run = NULL;
+			continue;
+		}
+
+		sector = blk_rq_pos(req);
+		nsg = blk_rq_map_sg(rq, req, dev->sg);
+
+		for_each_sg(dev->sg, sg, nsg, j)
+		{
+			buf = sg_virt(sg);
+			nsect = sg->length >> SECTOR_BITS;
+
+			seg = &dev->segs[nsegs];
+			seg->buf = buf;
+			seg->nsect = nsect;
+
+			if (run && run->sector + run->nsect == sector)
+			{
+				struct bml_seg *prev = &dev->segs[nsegs - 1];
+				int contig = run->contig &&
+					prev->buf + (prev->nsect << SECTOR_BITS) == buf;
+
+				if (contig ||
+				    ((run->nsect + nsect) << SECTOR_BITS) <= BML_BOUNCE_SIZE)
+				{
+					run->contig = contig;
+					run->nsect += nsect;
+					run->nsegs++;
+					run->last_req = i;
+					nsegs++;
+					sector += nsect;
+					continue;
+				}
+			}
+
+			run = &dev->runs[nruns++];
+			run->sector = sector;
+			run->nsect = nsect;
+			run->seg = nsegs;
+			run->nsegs = 1;
+			run->contig = 1;
+			run->first_req = i;
+			run->last_req = i;
+			nsegs++;
+			sector += nsect;
+		}
+	}
+
+	return nruns;
+}
+
+/**
+ * read a batch of requests
+ * @param dev           : fsr block device
+ * @param nreq          : number of requests in dev->batch
+ * @return              none
+ *
+ * Called without the queue lock. Failures are recorded in dev->batch_err.
+ */
+static void bml_transfer_batch(struct fsr_dev *dev, int nreq)
+{
+	u32 minor, volume, partno, n1stVpn = 0, nPgsPerUnit = 0;
+	struct bml_run *run;
+	struct bml_seg *seg;
+	char *buf;
+	int i, j, nruns, ret;
+
+	minor = dev->gd->first_minor;
+	volume = fsr_vol(minor);
+	partno = fsr_part(minor);
+
+	DEBUG(DL3,"TINY[I]: volume(%d), partno(%d), %d requests\n", volume, partno, nreq);
+
+	if (!fsr_is_whole_dev(partno))
+	{
+		if (FSR_BML_GetVirUnitInfo(volume,
+			fsr_part_start(fsr_get_part_spec(volume), partno),
+				&n1stVpn, &nPgsPerUnit) != FSR_BML_SUCCESS)
+		{
+			ERRPRINTK("FSR_BML_GetVirUnitInfo FAIL\n");
+			for (i = 0; i < nreq; i++)
+				dev->batch_err[i] = -EIO;
+			return;
+		}
+	}
+
+	nruns = bml_build_runs(dev, nreq);
+
+	for (i = 0; i < nruns; i++)
+	{
+		run = &dev->runs[i];
+		seg = &dev->segs[run->seg];
+		buf = run->contig ? seg->buf : dev->bounce;
+
+		ret = bml_read_run(volume, n1stVpn, run->sector, run->nsect, buf);
+		if (ret)
+		{
+			for (j = run->first_req; j <= run->last_req; j++)
+				dev->batch_err[j] = ret;
+			continue;
+		}
+
+		if (run->contig)
+			continue;
+
+		for (j = 0; j < run->nsegs; j++, seg++)
+		{
+			memcpy(seg->buf, buf, seg->nsect << SECTOR_BITS);
+			buf += seg->nsect << SECTOR_BITS;
+		}
+	}
+
+	DEBUG(DL3,"TINY[O]: volume(%d), partno(%d)\n", volume, partno);
+}
+
+/**
+ * request function which is do read/write sector
+ * @param rq    : request queue which is created by blk_init_queue()
+ * @return              none
+ *
+ * Up to BML_BATCH_REQS requests are taken off the queue at once, read with
+ * the queue lock dropped and then completed together.
+ */
+static void bml_request(struct request_queue *rq)
+{
+	struct request *req;
+	struct fsr_dev *dev;
+	int i, nreq;
+
+	DEBUG(DL3,"TINY[I]\n");
+
+	dev = rq->queuedata;
+	if (dev->req)
+		return;
+
+	while ((req = blk_fetch_request(rq)) != NULL)
+	{
+		nreq = 0;
+		do
+		{
+			dev->batch[nreq] = req;
+			dev->batch_err[nreq] = 0;
+			nreq++;
+		} while (nreq < BML_BATCH_REQS &&
+			 (req = blk_fetch_request(rq)) != NULL);
+
+		dev->req = dev->batch[0];
+		spin_unlock_irq(rq->queue_lock);
+
+		bml_transfer_batch(dev, nreq);
+
+		spin_lock_irq(rq->queue_lock);
+		for (i = 0; i < nreq; i++)
+			__blk_end_request_all(dev->batch[i], dev->batch_err[i]);
+		dev->req = NULL;
+	}
+
+	DEBUG(DL3,"TINY[O]\n");
+}
+#else
 /**
  * transger data from BML to buffer cache
  * @param volume        : device number
@@ -61,11 +301,7 @@ EXPORT_SYMBOL(bml_module_resume);
  *
  * It will erase a block before it do write the data
  */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-static int bml_transfer(u32 volume, u32 partno, const struct request *req, u32 data_len)
-#else
 static int bml_transfer(u32 volume, u32 partno, const struct request *req)
-#endif
 {
 	unsigned long sector, nsect;
 	char *buf;
@@ -81,13 +317,8 @@ static int bml_transfer(u32 volume, u32 partno, const struct request *req)
 		return 0;
 	}
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	sector = blk_rq_pos(req);
-	nsect = data_len >> 9;
-#else
 	sector = req->sector;
 	nsect = req->current_nr_sectors;
-#endif
 	buf = req->buffer;
 	
 	vs = fsr_get_vol_spec(volume);
@@ -156,10 +387,6 @@ static void bml_request(struct request_queue *rq)
 	int ret;
 #endif
 	int trans_ret;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	int error = 0;
-	u32 len = 0;
-#endif
 
 	FSRVolSpec *vs;
 
@@ -169,11 +396,7 @@ static void bml_request(struct request_queue *rq)
 	if (dev->req)
 		return;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	while ((dev->req = req = blk_peek_request(rq)) != NULL)
-#else
 	while ((dev->req = req = elv_next_request(rq)) != NULL) 
-#endif
 	{
 		spin_unlock_irq(rq->queue_lock);
 		
@@ -185,23 +408,6 @@ static void bml_request(struct request_queue *rq)
 		
 		DEBUG(DL3,"TINY[I]: volume(%d), partno(%d)\n", volume, partno);
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-		len = blk_rq_cur_bytes(req);
-		if (!( blk_rq_pos(req) & spp_mask) && ( blk_rq_cur_sectors(req) != blk_rq_sectors(req)))
-		{
-			blk_rq_map_sg(rq, req, dev->sg);
-			if (!((dev->sg->length >> SECTOR_BITS) & 0x7))
-			{
-				len = dev->sg->length;
-			}
-			if (len > blk_rq_bytes(req))
-			{
-				len = blk_rq_bytes(req);
-			}
-
-		}
-		trans_ret = bml_transfer(volume, partno, req, len);
-#else
 		if (!(req->sector & spp_mask) && (req->current_nr_sectors != req->nr_sectors))
 		{
 			blk_rq_map_sg(rq, req, dev->sg);
@@ -215,23 +421,9 @@ static void bml_request(struct request_queue *rq)
 			}
 		}
 		trans_ret = bml_transfer(volume, partno, req);
-#endif
 		
 		spin_lock_irq(rq->queue_lock);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-		if (trans_ret)
-		{
-			error = 0;
-		} else
-		{
-			error = -EIO;
-		}
-		/* don't need to check if request is finished */
-		if (blk_rq_sectors(req) <= (len >> 9))
-			list_del_init(&req->queuelist);
-		__blk_end_request(req, error, len);
-
-#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 25)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 25)
 		req->hard_cur_sectors = req->current_nr_sectors;
 		end_request(req, trans_ret);
 #else	
@@ -253,6 +445,7 @@ static void bml_request(struct request_queue *rq)
 
 	DEBUG(DL3,"TINY[O]\n");
 }
+#endif
 
 /**
  * add each partitions as disk
@@ -289,21 +482,32 @@ static int bml_add_disk(u32 volume, u32 partno)
 	dev->req = NULL;
 
 	/* alloc scatterlist */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	dev->sg = kmalloc(sizeof(struct scatterlist) * dev->queue->limits.max_phys_segments, GFP_KERNEL);
-#else
-	dev->sg = kmalloc(sizeof(struct scatterlist) * dev->queue->max_phys_segments, GFP_KERNEL);
-#endif
+	dev->sg = kmalloc(sizeof(struct scatterlist) * bml_max_segments(dev->queue), GFP_KERNEL);
 	if (!dev->sg)
 	{
 		kfree(dev);
 		return -ENOMEM;
 	}
 
+	memset(dev->sg, 0, sizeof(struct scatterlist) * bml_max_segments(dev->queue));
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	memset(dev->sg, 0, sizeof(struct scatterlist) * dev->queue->limits.max_phys_segments);
-#else
-	memset(dev->sg, 0, sizeof(struct scatterlist) * dev->queue->max_phys_segments);
+	/* batch segment, run and bounce buffers */
+	dev->segs = kmalloc(sizeof(struct bml_seg) * BML_BATCH_REQS *
+			bml_max_segments(dev->queue), GFP_KERNEL);
+	dev->runs = kmalloc(sizeof(struct bml_run) * BML_BATCH_REQS *
+			bml_max_segments(dev->queue), GFP_KERNEL);
+	dev->bounce = kmalloc(BML_BOUNCE_SIZE, GFP_KERNEL);
+	if (!dev->segs || !dev->runs || !dev->bounce)
+	{
+		kfree(dev->bounce);
+		kfree(dev->runs);
+		kfree(dev->segs);
+		kfree(dev->sg);
+		list_del(&dev->list);
+		kfree(dev);
+		return -ENOMEM;
+	}
 #endif
 
 	/* Each partition is a physical disk which has one partition */
@@ -311,6 +515,9 @@ static int bml_add_disk(u32 volume, u32 partno)
 	/* memory error */
 	if (!dev->gd) 
 	{
+		kfree(dev->bounce);
+		kfree(dev->runs);
+		kfree(dev->segs);
 		kfree(dev->sg);
 		list_del(&dev->list);
 		kfree(dev);
@@ -369,6 +576,9 @@ static void bml_del_disk(struct fsr_dev *dev)
 		put_disk(dev->gd);
 	}
 
+	kfree(dev->bounce);
+	kfree(dev->runs);
+	kfree(dev->segs);
 	kfree(dev->sg);
 
 	if (dev->queue)
@@ -646,6 +646,39 @@ void mdp_set_dma_pan_info(struct fb_info *info, struct mdp_dirty_region *dirty,
 void mdp_dma_pan_update(struct fb_info *info);
 void mdp_refresh_screen(unsigned long data);
 int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req);
+
+struct mdp_blit_img {
+	unsigned long start;
+	unsigned long len;
+	struct file *file;
+};
+
+int mdp_ppp_get_blit_imgs(struct fb_info *info, struct mdp_blit_req *req,
+			  struct mdp_blit_img *src, struct mdp_blit_img *dst);
+void mdp_ppp_put_blit_imgs(struct mdp_blit_img *src, struct mdp_blit_img *dst);
+int mdp_ppp_blit_imgs(struct fb_info *info, struct mdp_blit_req *req,
+		      struct mdp_blit_img *src, struct mdp_blit_img *dst);
+
+/* Source cache maintenance done per blit list, see mdp_ppp.c */
+struct mdp_ppp_flush_stat {
+	unsigned long lists;
+	unsigned long ranges_req;
+	unsigned long ranges;
+	unsigned long skipped;
+	unsigned long long bytes_req;
+	unsigned long long bytes;
+	unsigned long last_bytes;
+};
+
+#ifdef CONFIG_FB_MSM_MDP40
+static inline void mdp_ppp_flush_blit_list(struct fb_info *info,
+		struct mdp_blit_req *req, struct mdp_blit_img *imgs,
+		int count) { }
+#else
+extern struct mdp_ppp_flush_stat mdp_ppp_flush_stat;
+void mdp_ppp_flush_blit_list(struct fb_info *info, struct mdp_blit_req *req,
+			     struct mdp_blit_img *imgs, int count);
+#endif
 void mdp_lcd_update_workqueue_handler(struct work_struct *work);
 void mdp_vsync_resync_workqueue_handler(struct work_struct *work);
 void mdp_dma2_update(struct msm_fb_data_type *mfd);
@@ -1178,6 +1178,21 @@ struct mdp4_overlay_pipe *mdp4_overlay_stage_pipe(int mixer, int stage)
 	return ctrl->stage[mixer][stage];
 }
 
+/*
+ * mdp4_overlay_active: true if any pipe is staged above the base layer
+ */
+int mdp4_overlay_active(int mixer)
+{
+	int i;
+
+	for (i = MDP4_MIXER_STAGE0; i < MDP4_MAX_STAGE + 2; i++) {
+		if (ctrl->stage[mixer][i])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 struct mdp4_overlay_pipe *mdp4_overlay_ndx2pipe(int ndx)
 {
 	struct mdp4_overlay_pipe *pipe;
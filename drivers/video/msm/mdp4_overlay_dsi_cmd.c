@@ -40,6 +40,7 @@
 static struct mdp4_overlay_pipe *dsi_pipe;
 static struct msm_fb_data_type *dsi_mfd;
 static int busy_wait_cnt;
+static int dsi_partial;		/* last base layer update was partial */
 
 static int vsync_start_y_adjust = 4;
 
@@ -96,6 +97,7 @@ void mdp4_overlay_update_dsi_cmd(struct msm_fb_data_type *mfd)
 	struct mdp4_overlay_pipe *pipe;
 	int bpp;
 	int ret;
+	int partial = 0;
 
 	if (mfd->key != MFD_KEY)
 		return;
@@ -133,7 +135,10 @@ void mdp4_overlay_update_dsi_cmd(struct msm_fb_data_type *mfd)
 		pipe = dsi_pipe;
 	}
 
-	/* whole screen for base layer */
+	/*
+	 * whole screen for base layer, or only the dirty region when
+	 * the panel supports it and nothing is staged above the base
+	 */
 	src = (uint8 *) iBuf->buf;
 
 	{
@@ -150,6 +155,24 @@ void mdp4_overlay_update_dsi_cmd(struct msm_fb_data_type *mfd)
 			pipe->dst_w = pipe->src_width_3d;
 			pipe->srcp0_ystride = msm_fb_line_length(0,
 						pipe->src_width, bpp);
+		} else if (mfd->panel_info.mipi.partial_update &&
+				!mdp4_overlay_active(MDP4_MIXER0) &&
+				(iBuf->dma_w != fbi->var.xres ||
+				 iBuf->dma_h != fbi->var.yres)) {
+			/* 2D, dirty region only */
+			bpp = iBuf->bpp;
+			src += (iBuf->dma_x + iBuf->dma_y * iBuf->ibuf_width)
+						* bpp;
+			pipe->src_height = iBuf->dma_h;
+			pipe->src_width = iBuf->dma_w;
+			pipe->src_h = iBuf->dma_h;
+			pipe->src_w = iBuf->dma_w;
+			pipe->dst_h = iBuf->dma_h;
+			pipe->dst_w = iBuf->dma_w;
+			pipe->srcp0_ystride = fbi->fix.line_length;
+			pipe->dst_y = iBuf->dma_y;
+			pipe->dst_x = iBuf->dma_x;
+			partial = 1;
 		} else {
 			 /* 2D */
 			pipe->src_height = fbi->var.yres;
@@ -162,11 +185,25 @@ void mdp4_overlay_update_dsi_cmd(struct msm_fb_data_type *mfd)
 		}
 		pipe->src_y = 0;
 		pipe->src_x = 0;
-		pipe->dst_y = 0;
-		pipe->dst_x = 0;
+		if (!partial) {
+			pipe->dst_y = 0;
+			pipe->dst_x = 0;
+		}
 		pipe->srcp0_addr = (uint32)src;
 	}
 
+	/*
+	 * The panel keeps the last column/page window, so it has to be
+	 * reprogrammed for a partial update and restored afterwards.
+	 */
+	if (partial || dsi_partial)
+		mipi_dsi_cmd_mdp_window(&mfd->panel_info.mipi,
+				pipe->dst_x, pipe->dst_y,
+				pipe->dst_w, pipe->dst_h);
+	dsi_partial = partial;
+	if (partial)
+		mdp4_stat.kickoff_dsi_partial++;
+	mdp4_stat.dsi_lines += pipe->dst_h;
 
 	mdp4_overlay_rgb_setup(pipe);
 
@@ -304,6 +341,13 @@ void mdp4_dsi_cmd_dma_busy_wait(struct msm_fb_data_type *mfd)
 void mdp4_dsi_cmd_kickoff_video(struct msm_fb_data_type *mfd,
 				struct mdp4_overlay_pipe *pipe)
 {
+	/*
+	 * base layer was left programmed for a dirty region,
+	 * blend against the whole screen again
+	 */
+	if (dsi_partial)
+		mdp4_overlay_update_dsi_cmd(mfd);
+
 	mdp4_dsi_cmd_overlay_kickoff(mfd, pipe);
 }
 
@@ -332,7 +376,10 @@ void mdp4_dsi_cmd_overlay(struct msm_fb_data_type *mfd)
 
 	if (mfd && mfd->panel_power_on) {
 		mdp4_dsi_cmd_dma_busy_wait(mfd);
+		down(&mfd->sem);
 		mdp4_overlay_update_dsi_cmd(mfd);
+		mfd->ibuf_flushed = TRUE;
+		up(&mfd->sem);
 
 		mdp4_dsi_cmd_kickoff_ui(mfd, dsi_pipe);
 
@@ -29,6 +29,7 @@
 #include <linux/semaphore.h>
 #include <linux/uaccess.h>
 #include <asm/system.h>
+#include <asm/div64.h>
 #include <asm/mach-types.h>
 #include <mach/hardware.h>
 
@@ -343,10 +344,18 @@ static ssize_t mdp_stat_read(
 					mdp4_stat.kickoff_atv);
 	bp += len;
 	dlen -= len;
-	len = snprintf(bp, dlen, "kickoff_dsi:       %08lu\n\n",
+	len = snprintf(bp, dlen, "kickoff_dsi:       %08lu\n",
 					mdp4_stat.kickoff_dsi);
 	bp += len;
 	dlen -= len;
+	len = snprintf(bp, dlen, "kickoff_dsi_part:  %08lu\n",
+					mdp4_stat.kickoff_dsi_partial);
+	bp += len;
+	dlen -= len;
+	len = snprintf(bp, dlen, "dsi_lines:         %08lu\n\n",
+					mdp4_stat.dsi_lines);
+	bp += len;
+	dlen -= len;
 	len = snprintf(bp, dlen, "overlay0_set:   %08lu\n",
 					mdp4_stat.overlay_set[0]);
 	bp += len;
@@ -419,6 +428,76 @@ static const struct file_operations mdp_stat_fops = {
 };
 #endif
 
+#ifndef CONFIG_FB_MSM_MDP40
+static int mdp_flush_open(struct inode *inode, struct file *file)
+{
+	/* non-seekable */
+	file->f_mode &= ~(FMODE_LSEEK | FMODE_PREAD | FMODE_PWRITE);
+	return 0;
+}
+
+static int mdp_flush_release(struct inode *inode, struct file *file)
+{
+	return 0;
+}
+
+static ssize_t mdp_flush_write(
+	struct file *file,
+	const char __user *buff,
+	size_t count,
+	loff_t *ppos)
+{
+	memset(&mdp_ppp_flush_stat, 0, sizeof(mdp_ppp_flush_stat)); /* reset */
+	return count;
+}
+
+static ssize_t mdp_flush_read(
+	struct file *file,
+	char __user *buff,
+	size_t count,
+	loff_t *ppos)
+{
+	struct mdp_ppp_flush_stat st = mdp_ppp_flush_stat;
+	unsigned long long avg = 0;
+	int tot;
+
+	if (*ppos)
+		return 0;	/* the end */
+
+	if (st.lists) {
+		avg = st.bytes;
+		do_div(avg, st.lists);
+	}
+
+	tot = snprintf(debug_buf, sizeof(debug_buf),
+		"blit_lists:      %08lu\n"
+		"src_ranges:      %08lu\n"
+		"flushed_ranges:  %08lu\n"
+		"skipped_ranges:  %08lu\n"
+		"bytes_requested: %llu\n"
+		"bytes_flushed:   %llu\n"
+		"bytes_per_list:  %llu\n"
+		"bytes_last_list: %lu\n",
+		st.lists, st.ranges_req, st.ranges, st.skipped,
+		st.bytes_req, st.bytes, avg, st.last_bytes);
+	tot++;
+
+	if (copy_to_user(buff, debug_buf, tot))
+		return -EFAULT;
+
+	*ppos += tot;	/* increase offset */
+
+	return tot;
+}
+
+static const struct file_operations mdp_flush_fops = {
+	.open = mdp_flush_open,
+	.release = mdp_flush_release,
+	.read = mdp_flush_read,
+	.write = mdp_flush_write,
+};
+#endif
+
 /*
  * MDDI
  *
@@ -1186,6 +1265,13 @@ int mdp_debugfs_init(void)
 			__FILE__, __LINE__);
 		return -1;
 	}
+#else
+	if (debugfs_create_file("ppp_flush", 0644, dent, 0, &mdp_flush_fops)
+			== NULL) {
+		printk(KERN_ERR "%s(%d): debugfs_create_file: debug fail\n",
+			__FILE__, __LINE__);
+		return -1;
+	}
 #endif
 
 	dent = debugfs_create_dir("mddi", NULL);
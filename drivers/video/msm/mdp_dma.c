@@ -485,14 +485,33 @@ void mdp_set_dma_pan_info(struct fb_info *info, struct mdp_dirty_region *dirty,
 	iBuf->vsync_enable = sync;
 
 	if (dirty) {
+		int x, y, x2, y2;
+
 		/*
 		 * ToDo: dirty region check inside var.xoffset+xres
 		 * <-> var.yoffset+yres
 		 */
-		iBuf->dma_x = dirty->xoffset % info->var.xres;
-		iBuf->dma_y = dirty->yoffset % info->var.yres;
-		iBuf->dma_w = dirty->width;
-		iBuf->dma_h = dirty->height;
+		x = dirty->xoffset % info->var.xres;
+		y = dirty->yoffset % info->var.yres;
+		x2 = x + dirty->width;
+		y2 = y + dirty->height;
+
+		/*
+		 * A previous pan may not have been pushed to the panel
+		 * yet; grow the pending window instead of replacing it
+		 * so that damage is never dropped.
+		 */
+		if (!mfd->ibuf_flushed) {
+			x = min(x, (int)iBuf->dma_x);
+			y = min(y, (int)iBuf->dma_y);
+			x2 = max(x2, (int)(iBuf->dma_x + iBuf->dma_w));
+			y2 = max(y2, (int)(iBuf->dma_y + iBuf->dma_h));
+		}
+
+		iBuf->dma_x = x;
+		iBuf->dma_y = y;
+		iBuf->dma_w = x2 - x;
+		iBuf->dma_h = y2 - y;
 	} else {
 		iBuf->dma_x = 0;
 		iBuf->dma_y = 0;
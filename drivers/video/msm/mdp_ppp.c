@@ -24,6 +24,8 @@
 #include <linux/file.h>
 #include <linux/android_pmem.h>
 #include <linux/major.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
 
 #include "linux/proc_fs.h"
 
@@ -544,6 +546,8 @@ static void mdp_ppp_setbg(MDPIBUF *iBuf)
 	((format == MDP_Y_CBCR_H2V2 || format == MDP_Y_CRCB_H2V2) ?  2 :\
 	(format == MDP_Y_CBCR_H2V1 || format == MDP_Y_CRCB_H2V1) ?  1 : 1)
 
+struct mdp_ppp_flush_stat mdp_ppp_flush_stat;
+
 #ifdef CONFIG_ANDROID_PMEM
 static void get_len(struct mdp_img *img, struct mdp_rect *rect, uint32_t bpp,
 			uint32_t *len0, uint32_t *len1)
@@ -574,9 +578,168 @@ static void flush_imgs(struct mdp_blit_req *req, int src_bpp, int dst_bpp,
 	}
 
 }
+
+struct mdp_flush_extent {
+	struct file *file;
+	unsigned long start;
+	unsigned long size;
+};
+
+static DEFINE_SPINLOCK(mdp_ppp_flush_lock);
+
+static int mdp_flush_extent_cmp(const void *a, const void *b)
+{
+	const struct mdp_flush_extent *x = a, *y = b;
+
+	if (x->file != y->file)
+		return x->file < y->file ? -1 : 1;
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Queue the extent covering one plane of a source image.  Returns 0 if
+ * it was queued or the plane lives in uncached memory, and -EINVAL if
+ * the range can't be resolved, in which case the blit is left to
+ * flush_imgs().
+ */
+static int mdp_flush_extent_add(struct mdp_flush_extent *ext, int *n,
+				struct file *file, unsigned long offset,
+				unsigned long len, int *skipped)
+{
+	unsigned long start, size;
+	int ret;
+
+	ret = pmem_flush_extent(file, offset, len, &start, &size);
+	if (ret < 0)
+		return ret;
+	if (ret > 0) {
+		/* uncached: nothing to clean for this plane */
+		(*skipped)++;
+		return 0;
+	}
+	ext[*n].file = file;
+	ext[*n].start = start;
+	ext[*n].size = size;
+	(*n)++;
+	return 0;
+}
+
+/*
+ * Flush the source images of a whole blit list once, before any of its
+ * requests is started.  Each source range is translated into the extent
+ * flush_pmem_file() really cleans (the whole buffer or its connected
+ * region), duplicate and contained extents are dropped, and the requests
+ * are then tagged MDP_BLIT_NON_CACHED so that flush_imgs() does not
+ * clean them again per blit (or per split of a blit).  The two planes
+ * of a pseudo planar source are looked up separately, as they may sit
+ * in different regions of a connected file; a request any of whose
+ * planes can't be resolved is left untagged.
+ *
+ * imgs, when given, holds the images already looked up by
+ * mdp_ppp_get_blit_imgs(); otherwise the files are looked up here.
+ */
+void mdp_ppp_flush_blit_list(struct fb_info *info, struct mdp_blit_req *req,
+			     struct mdp_blit_img *imgs, int count)
+{
+	struct msm_fb_data_type *mfd = (struct msm_fb_data_type *)info->par;
+	struct mdp_flush_extent *ext;
+	struct file **files;
+	unsigned long vstart, pstart, plen, bytes = 0, bytes_req = 0;
+	uint32_t len0, len1;
+	int i, n = 0, nsrc = 0, nflush = 0, skipped = 0, bpp, n0, skipped0;
+	unsigned long flags;
+
+	if (count <= 0)
+		return;
+
+	/* up to two planes per source */
+	ext = kmalloc(count * (2 * sizeof(*ext) + sizeof(*files)),
+		      GFP_KERNEL);
+	if (!ext)
+		return;	/* fall back to flushing per blit */
+	files = (struct file **)(ext + 2 * count);
+
+	for (i = 0; i < count; i++) {
+		struct mdp_blit_req *r = &req[i];
+		struct file *file = NULL;
+
+		files[i] = NULL;
+		if (r->flags & (MDP_NO_BLIT | MDP_BLIT_NON_CACHED |
+				MDP_BLIT_SRC_GEM))
+			continue;
+
+		if (imgs) {
+			file = imgs[2 * i].file;
+		} else if (!get_pmem_file(r->src.memory_id, &pstart, &vstart,
+					  &plen, &file)) {
+			files[i] = file;
+		}
+		if (!file)
+			continue;
+
+		bpp = mdp_get_bytes_per_pixel(r->src.format, mfd);
+		if (bpp <= 0)
+			continue;
+
+		get_len(&r->src, &r->src_rect, bpp, &len0, &len1);
+		bytes_req += len0 + len1;
+		nsrc++;
+
+		n0 = n;
+		skipped0 = skipped;
+		if (mdp_flush_extent_add(ext, &n, file, r->src.offset, len0,
+					 &skipped) ||
+		    (IS_PSEUDOPLNR(r->src.format) &&
+		     mdp_flush_extent_add(ext, &n, file,
+					  r->src.offset + len0, len1,
+					  &skipped))) {
+			/* flush_imgs() cleans this one per plane */
+			n = n0;
+			skipped = skipped0;
+			continue;
+		}
+		r->flags |= MDP_BLIT_NON_CACHED;
+	}
+
+	sort(ext, n, sizeof(*ext), mdp_flush_extent_cmp, NULL);
+
+	for (i = 0; i < n; i++) {
+		if (i && ext[i].file == ext[i - 1].file &&
+		    ext[i].start + ext[i].size <=
+		    ext[i - 1].start + ext[i - 1].size) {
+			/* contained in (or equal to) the previous extent */
+			ext[i] = ext[i - 1];
+			skipped++;
+			continue;
+		}
+		flush_pmem_file(ext[i].file, ext[i].start, ext[i].size);
+		bytes += ext[i].size;
+		nflush++;
+	}
+
+	for (i = 0; i < count; i++)
+		if (files[i])
+			put_pmem_file(files[i]);
+	kfree(ext);
+
+	spin_lock_irqsave(&mdp_ppp_flush_lock, flags);
+	mdp_ppp_flush_stat.lists++;
+	mdp_ppp_flush_stat.ranges_req += nsrc;
+	mdp_ppp_flush_stat.ranges += nflush;
+	mdp_ppp_flush_stat.skipped += skipped;
+	mdp_ppp_flush_stat.bytes_req += bytes_req;
+	mdp_ppp_flush_stat.bytes += bytes;
+	mdp_ppp_flush_stat.last_bytes = bytes;
+	spin_unlock_irqrestore(&mdp_ppp_flush_lock, flags);
+}
 #else
 static void flush_imgs(struct mdp_blit_req *req, int src_bpp, int dst_bpp,
 			struct file *p_src_file, struct file *p_dst_file) { }
+
+void mdp_ppp_flush_blit_list(struct fb_info *info, struct mdp_blit_req *req,
+			     struct mdp_blit_img *imgs, int count) { }
 #endif
 
 static void mdp_start_ppp(struct msm_fb_data_type *mfd, MDPIBUF *iBuf,
@@ -1300,43 +1463,77 @@ void put_img(struct file *p_src_file)
 }
 
 
-int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
+int mdp_ppp_get_blit_imgs(struct fb_info *info, struct mdp_blit_req *req,
+			  struct mdp_blit_img *src, struct mdp_blit_img *dst)
 {
-	unsigned long src_start, dst_start;
-	unsigned long src_len = 0;
-	unsigned long dst_len = 0;
-	MDPIBUF iBuf;
-	u32 dst_width, dst_height;
-	struct file *p_src_file = 0 , *p_dst_file = 0;
-	struct msm_fb_data_type *mfd = (struct msm_fb_data_type *)info->par;
+	src->file = dst->file = NULL;
+	src->len = dst->len = 0;
 
-	if (req->dst.format == MDP_FB_FORMAT)
-		req->dst.format =  mfd->fb_imgType;
-	if (req->src.format == MDP_FB_FORMAT)
-		req->src.format = mfd->fb_imgType;
 	if (req->flags & MDP_BLIT_SRC_GEM)
-		get_gem_img(&req->src, &src_start, &src_len);
+		get_gem_img(&req->src, &src->start, &src->len);
 	else
-		get_img(&req->src, info, &src_start, &src_len, &p_src_file);
-	if (src_len == 0) {
+		get_img(&req->src, info, &src->start, &src->len, &src->file);
+	if (src->len == 0) {
 		printk(KERN_ERR "mdp_ppp: could not retrieve image from "
 		       "memory\n");
 		return -1;
 	}
 	if (req->flags & MDP_BLIT_DST_GEM)
-		get_gem_img(&req->dst, &dst_start, &dst_len);
+		get_gem_img(&req->dst, &dst->start, &dst->len);
 	else
-		get_img(&req->dst, info, &dst_start, &dst_len, &p_dst_file);
-	if (dst_len == 0) {
-		put_img(p_src_file);
+		get_img(&req->dst, info, &dst->start, &dst->len, &dst->file);
+	if (dst->len == 0) {
+		put_img(src->file);
+		src->file = NULL;
 		printk(KERN_ERR "mdp_ppp: could not retrieve image from "
 		       "memory\n");
 		return -1;
 	}
+	return 0;
+}
+
+void mdp_ppp_put_blit_imgs(struct mdp_blit_img *src, struct mdp_blit_img *dst)
+{
+	put_img(src->file);
+	put_img(dst->file);
+	src->file = dst->file = NULL;
+}
+
+int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
+{
+	struct mdp_blit_img src, dst;
+	int ret;
+
+	ret = mdp_ppp_get_blit_imgs(info, req, &src, &dst);
+	if (ret)
+		return ret;
+
+	ret = mdp_ppp_blit_imgs(info, req, &src, &dst);
+
+	mdp_ppp_put_blit_imgs(&src, &dst);
+	return ret;
+}
+
+/*
+ * Blit with images that have already been looked up (and pinned) by
+ * mdp_ppp_get_blit_imgs(), possibly from a different process context.
+ * The caller keeps ownership of the image references.
+ */
+int mdp_ppp_blit_imgs(struct fb_info *info, struct mdp_blit_req *req,
+		      struct mdp_blit_img *src, struct mdp_blit_img *dst)
+{
+	unsigned long src_start = src->start, dst_start = dst->start;
+	MDPIBUF iBuf;
+	u32 dst_width, dst_height;
+	struct file *p_src_file = src->file, *p_dst_file = dst->file;
+	struct msm_fb_data_type *mfd = (struct msm_fb_data_type *)info->par;
+
+	if (req->dst.format == MDP_FB_FORMAT)
+		req->dst.format =  mfd->fb_imgType;
+	if (req->src.format == MDP_FB_FORMAT)
+		req->src.format = mfd->fb_imgType;
 	if (mdp_ppp_verify_req(req)) {
 		printk(KERN_ERR "mdp_ppp: invalid image!\n");
-		put_img(p_src_file);
-		put_img(p_dst_file);
 		return -1;
 	}
 
@@ -1399,8 +1596,6 @@ int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
 #ifdef CONFIG_FB_MSM_MDP31
 		iBuf.mdpImg.mdpOp |= MDPOP_FG_PM_ALPHA;
 #else
-		put_img(p_src_file);
-		put_img(p_dst_file);
 		return -EINVAL;
 #endif
 	}
@@ -1410,8 +1605,6 @@ int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
 		if ((req->src.format != MDP_Y_CBCR_H2V2) &&
 			(req->src.format != MDP_Y_CRCB_H2V2)) {
 #endif
-			put_img(p_src_file);
-			put_img(p_dst_file);
 			return -EINVAL;
 #ifdef CONFIG_FB_MSM_MDP31
 		}
@@ -1450,16 +1643,12 @@ int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
 			printk(KERN_ERR
 				"%s: sharpening strength out of range\n",
 				__func__);
-			put_img(p_src_file);
-			put_img(p_dst_file);
 			return -EINVAL;
 		}
 
 		iBuf.mdpImg.mdpOp |= MDPOP_ASCALE | MDPOP_SHARPENING;
 		iBuf.mdpImg.sp_value = req->sharpening_strength & 0xff;
 #else
-		put_img(p_src_file);
-		put_img(p_dst_file);
 		return -EINVAL;
 #endif
 	}
@@ -1564,7 +1753,5 @@ int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
 	mdp_pipe_ctrl(MDP_CMD_BLOCK, MDP_BLOCK_POWER_OFF, FALSE);
 	up(&mdp_ppp_mutex);
 
-	put_img(p_src_file);
-	put_img(p_dst_file);
 	return 0;
 }
@@ -723,6 +723,68 @@ void mipi_dsi_cmd_mdp_sw_trigger(void)
 }
 
 
+static char set_col_addr[5] = {0x2a, 0x00, 0x00, 0x00, 0x00};
+static char set_page_addr[5] = {0x2b, 0x00, 0x00, 0x00, 0x00};
+
+static struct dsi_cmd_desc dsi_window_cmds[] = {
+	{DTYPE_DCS_LWRITE, 1, 0, 0, 0, sizeof(set_col_addr), set_col_addr},
+	{DTYPE_DCS_LWRITE, 1, 0, 0, 0, sizeof(set_page_addr), set_page_addr},
+};
+
+/*
+ * mipi_dsi_cmd_mdp_window: set up the panel column/page address
+ * window and the mdp stream size for the next memory write.
+ * Called with ov_mutex held and the dsi link idle, so the
+ * commands are sent directly rather than through mipi_dsi_cmds_tx().
+ */
+void mipi_dsi_cmd_mdp_window(struct mipi_panel_info *mipi,
+				int x, int y, int w, int h)
+{
+	uint32 data, ystride, bpp;
+	int x2, y2, i;
+
+	x2 = x + w - 1;
+	y2 = y + h - 1;
+
+	set_col_addr[1] = (x >> 8) & 0xff;
+	set_col_addr[2] = x & 0xff;
+	set_col_addr[3] = (x2 >> 8) & 0xff;
+	set_col_addr[4] = x2 & 0xff;
+
+	set_page_addr[1] = (y >> 8) & 0xff;
+	set_page_addr[2] = y & 0xff;
+	set_page_addr[3] = (y2 >> 8) & 0xff;
+	set_page_addr[4] = y2 & 0xff;
+
+	for (i = 0; i < ARRAY_SIZE(dsi_window_cmds); i++) {
+		mipi_dsi_buf_init(&dsi_tx_buf);
+		mipi_dsi_cmd_dma_add(&dsi_tx_buf, &dsi_window_cmds[i]);
+		mipi_dsi_cmd_dma_tx(&dsi_tx_buf);
+	}
+
+	if (mipi->dst_format == DSI_CMD_DST_FORMAT_RGB888)
+		bpp = 3;
+	else if (mipi->dst_format == DSI_CMD_DST_FORMAT_RGB666)
+		bpp = 3;
+	else if (mipi->dst_format == DSI_CMD_DST_FORMAT_RGB565)
+		bpp = 2;
+	else
+		bpp = 1;
+
+	ystride = w * bpp + 1;
+
+	/* DSI_COMMAND_MODE_MDP_STREAM_CTRL */
+	data = (ystride << 16) | (mipi->vc << 8) | DTYPE_DCS_LWRITE;
+	MIPI_OUTP(MIPI_DSI_BASE + 0x5c, data);
+	MIPI_OUTP(MIPI_DSI_BASE + 0x54, data);
+
+	/* DSI_COMMAND_MODE_MDP_STREAM_TOTAL */
+	data = h << 16 | w;
+	MIPI_OUTP(MIPI_DSI_BASE + 0x60, data);
+	MIPI_OUTP(MIPI_DSI_BASE + 0x58, data);
+	wmb();
+}
+
 void mipi_dsi_cmd_bta_sw_trigger(void)
 {
 	uint32 data;
@@ -35,6 +35,7 @@
 #include <linux/version.h>
 #include <linux/proc_fs.h>
 #include <linux/vmalloc.h>
+#include <linux/sort.h>
 #include <linux/debugfs.h>
 #include <linux/console.h>
 #include <linux/android_pmem.h>
@@ -104,6 +105,8 @@ static int msm_fb_set_par(struct fb_info *info);
 static int msm_fb_blank_sub(int blank_mode, struct fb_info *info,
 			    boolean op_enable);
 static int msm_fb_suspend_sub(struct msm_fb_data_type *mfd);
+static void msmfb_blit_async_init(struct msm_fb_data_type *mfd);
+static void msmfb_blit_async_drain(struct msm_fb_data_type *mfd);
 static int msm_fb_ioctl(struct fb_info *info, unsigned int cmd,
 			unsigned long arg);
 static int msm_fb_mmap(struct fb_info *info, struct vm_area_struct * vma);
@@ -383,6 +386,8 @@ static int msm_fb_probe(struct platform_device *pdev)
 	mfd->overlay_play_enable = 1;
 #endif
 
+	msmfb_blit_async_init(mfd);
+
 	rc = msm_fb_register(mfd);
 	if (rc)
 		return rc;
@@ -501,6 +506,9 @@ static int msm_fb_suspend_sub(struct msm_fb_data_type *mfd)
 	if ((!mfd) || (mfd->key != MFD_KEY))
 		return 0;
 
+	/* let queued PPP blits finish before the MDP is powered down */
+	msmfb_blit_async_drain(mfd);
+
 	/*
 	 * suspend this channel
 	 */
@@ -1791,9 +1799,24 @@ int msm_fb_resume_sw_refresher(struct msm_fb_data_type *mfd)
 	return 0;
 }
 
+/*
+ * imgs, when not NULL, holds the source and destination images already
+ * looked up by mdp_ppp_get_blit_imgs() for the request being split.
+ */
+static int msm_fb_ppp_blit(struct fb_info *info, struct mdp_blit_req *req,
+			   struct mdp_blit_img *imgs)
+{
+#ifdef CONFIG_FB_MSM_MDP_PPP_ASYNC
+	if (imgs)
+		return mdp_ppp_blit_imgs(info, req, &imgs[0], &imgs[1]);
+#endif
+	return mdp_ppp_blit(info, req);
+}
+
 #if defined CONFIG_FB_MSM_MDP31
 static int mdp_blit_split_height(struct fb_info *info,
-				struct mdp_blit_req *req)
+				struct mdp_blit_req *req,
+				struct mdp_blit_img *imgs)
 {
 	int ret;
 	struct mdp_blit_req splitreq;
@@ -1889,7 +1912,7 @@ static int mdp_blit_split_height(struct fb_info *info,
 		splitreq.dst_rect.x = d_x_1;
 		splitreq.dst_rect.w = d_w_1;
 	}
-	ret = mdp_ppp_blit(info, &splitreq);
+	ret = msm_fb_ppp_blit(info, &splitreq, imgs);
 	if (ret)
 		return ret;
 
@@ -1914,12 +1937,13 @@ static int mdp_blit_split_height(struct fb_info *info,
 		splitreq.dst_rect.x = d_x_0;
 		splitreq.dst_rect.w = d_w_0;
 	}
-	ret = mdp_ppp_blit(info, &splitreq);
+	ret = msm_fb_ppp_blit(info, &splitreq, imgs);
 	return ret;
 }
 #endif
 
-int mdp_blit(struct fb_info *info, struct mdp_blit_req *req)
+static int mdp_blit_imgs(struct fb_info *info, struct mdp_blit_req *req,
+			 struct mdp_blit_img *imgs)
 {
 	int ret;
 #if defined CONFIG_FB_MSM_MDP31 || defined CONFIG_FB_MSM_MDP30
@@ -2075,9 +2099,9 @@ int mdp_blit(struct fb_info *info, struct mdp_blit_req *req)
 		if ((splitreq.dst_rect.h % 32 == 3) ||
 			((req->dst_rect.h % 32) == 1 && req->dst_rect.h != 1) ||
 			((req->dst_rect.h % 32) == 2 && req->dst_rect.h != 2))
-			ret = mdp_blit_split_height(info, &splitreq);
+			ret = mdp_blit_split_height(info, &splitreq, imgs);
 		else
-			ret = mdp_ppp_blit(info, &splitreq);
+			ret = msm_fb_ppp_blit(info, &splitreq, imgs);
 		if (ret)
 			return ret;
 		/* blit second region */
@@ -2104,17 +2128,17 @@ int mdp_blit(struct fb_info *info, struct mdp_blit_req *req)
 		if (((splitreq.dst_rect.h % 32) == 3) ||
 			((req->dst_rect.h % 32) == 1 && req->dst_rect.h != 1) ||
 			((req->dst_rect.h % 32) == 2 && req->dst_rect.h != 2))
-			ret = mdp_blit_split_height(info, &splitreq);
+			ret = mdp_blit_split_height(info, &splitreq, imgs);
 		else
-			ret = mdp_ppp_blit(info, &splitreq);
+			ret = msm_fb_ppp_blit(info, &splitreq, imgs);
 		if (ret)
 			return ret;
 	} else if ((req->dst_rect.h % 32) == 3 ||
 		((req->dst_rect.h % 32) == 1 && req->dst_rect.h != 1) ||
 		((req->dst_rect.h % 32) == 2 && req->dst_rect.h != 2))
-		ret = mdp_blit_split_height(info, req);
+		ret = mdp_blit_split_height(info, req, imgs);
 	else
-		ret = mdp_ppp_blit(info, req);
+		ret = msm_fb_ppp_blit(info, req, imgs);
 	return ret;
 #elif defined CONFIG_FB_MSM_MDP30
 	/* MDP width split workaround */
@@ -2220,7 +2244,7 @@ int mdp_blit(struct fb_info *info, struct mdp_blit_req *req)
 		}
 
 		/* No need to split in height */
-		ret = mdp_ppp_blit(info, &splitreq);
+		ret = msm_fb_ppp_blit(info, &splitreq, imgs);
 
 		if (ret)
 			return ret;
@@ -2248,20 +2272,25 @@ int mdp_blit(struct fb_info *info, struct mdp_blit_req *req)
 		}
 
 		/* No need to split in height ... just width */
-		ret = mdp_ppp_blit(info, &splitreq);
+		ret = msm_fb_ppp_blit(info, &splitreq, imgs);
 
 		if (ret)
 			return ret;
 
 	} else
-		ret = mdp_ppp_blit(info, req);
+		ret = msm_fb_ppp_blit(info, req, imgs);
 	return ret;
 #else
-	ret = mdp_ppp_blit(info, req);
+	ret = msm_fb_ppp_blit(info, req, imgs);
 	return ret;
 #endif
 }
 
+int mdp_blit(struct fb_info *info, struct mdp_blit_req *req)
+{
+	return mdp_blit_imgs(info, req, NULL);
+}
+
 typedef void (*msm_dma_barrier_function_pointer) (void *, size_t);
 
 static inline void msm_fb_dma_barrier_for_rect(struct fb_info *info,
@@ -2292,6 +2321,98 @@ static inline void msm_fb_dma_barrier_for_rect(struct fb_info *info,
 
 }
 
+#ifdef CONFIG_ARCH_QSD8X50
+struct msm_fb_dma_range {
+	unsigned long start;
+	unsigned long end;
+};
+
+static int msm_fb_dma_range_cmp(const void *a, const void *b)
+{
+	const struct msm_fb_dma_range *x = a, *y = b;
+
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Same as calling msm_fb_dma_barrier_for_rect() for the src (when
+ * use_src is set) and dst rectangle of every request that does not have
+ * skip_flag set, except that overlapping and adjacent address ranges of
+ * the whole list are merged first so each cache line is maintained once.
+ */
+static void msm_fb_dma_barrier_for_list(struct fb_info *info,
+			struct mdp_blit_req *req_list, int req_list_count,
+			uint32_t skip_flag, int use_src,
+			msm_dma_barrier_function_pointer dma_barrier_fp)
+{
+	struct msm_fb_dma_range *r;
+	unsigned long base = (unsigned long)info->screen_base;
+	struct msm_fb_data_type *mfd = (struct msm_fb_data_type *)info->par;
+	int i, n = 0, bpp;
+
+	r = kmalloc(2 * req_list_count * sizeof(*r), GFP_KERNEL);
+	if (!r) {
+		for (i = 0; i < req_list_count; i++) {
+			if (req_list[i].flags & skip_flag)
+				continue;
+			if (use_src)
+				msm_fb_dma_barrier_for_rect(info,
+						&req_list[i].src,
+						&req_list[i].src_rect,
+						dma_barrier_fp);
+			msm_fb_dma_barrier_for_rect(info, &req_list[i].dst,
+						&req_list[i].dst_rect,
+						dma_barrier_fp);
+		}
+		return;
+	}
+
+	for (i = 0; i < req_list_count; i++) {
+		struct mdp_blit_req *req = &req_list[i];
+
+		if (req->flags & skip_flag)
+			continue;
+
+		if (use_src) {
+			bpp = mdp_get_bytes_per_pixel(req->src.format, mfd);
+			if (bpp > 0) {
+				r[n].start = base + req->src.offset +
+					(req->src.width * req->src_rect.y +
+					 req->src_rect.x) * bpp;
+				r[n].end = r[n].start + (req->src_rect.h *
+					req->src.width + req->src_rect.w) * bpp;
+				n++;
+			}
+		}
+
+		bpp = mdp_get_bytes_per_pixel(req->dst.format, mfd);
+		if (bpp > 0) {
+			r[n].start = base + req->dst.offset +
+				(req->dst.width * req->dst_rect.y +
+				 req->dst_rect.x) * bpp;
+			r[n].end = r[n].start + (req->dst_rect.h *
+				req->dst.width + req->dst_rect.w) * bpp;
+			n++;
+		}
+	}
+
+	sort(r, n, sizeof(*r), msm_fb_dma_range_cmp, NULL);
+
+	for (i = 0; i < n; ) {
+		unsigned long start = r[i].start, end = r[i].end;
+
+		for (i++; i < n && r[i].start <= end; i++)
+			end = max(end, r[i].end);
+
+		(*dma_barrier_fp) ((void *) start, end - start);
+	}
+
+	kfree(r);
+}
+#endif
+
 static inline void msm_dma_nc_pre(void)
 {
 	dmb();
@@ -2388,23 +2509,9 @@ static void msm_fb_ensure_memory_coherency_before_dma(struct fb_info *info,
 
 	case MDP_FB_PAGE_PROTECTION_WRITEBACKCACHE:
 	case MDP_FB_PAGE_PROTECTION_WRITEBACKWACACHE:
-		for (i = 0; i < req_list_count; i++) {
-			if (!(req_list[i].flags &
-					MDP_NO_DMA_BARRIER_START)) {
-
-				msm_fb_dma_barrier_for_rect(info,
-						&(req_list[i].src),
-						&(req_list[i].src_rect),
-						msm_dma_todevice_wb_pre
-						);
-
-				msm_fb_dma_barrier_for_rect(info,
-						&(req_list[i].dst),
-						&(req_list[i].dst_rect),
-						msm_dma_todevice_wb_pre
-						);
-			}
-		}
+		msm_fb_dma_barrier_for_list(info, req_list, req_list_count,
+					    MDP_NO_DMA_BARRIER_START, 1,
+					    msm_dma_todevice_wb_pre);
 		break;
 	}
 #else
@@ -2447,31 +2554,15 @@ static void msm_fb_ensure_memory_coherency_after_dma(struct fb_info *info,
 		break;
 
 	case MDP_FB_PAGE_PROTECTION_WRITETHROUGHCACHE:
-		for (i = 0; i < req_list_count; i++) {
-			if (!(req_list[i].flags &
-					MDP_NO_DMA_BARRIER_END)) {
-
-				msm_fb_dma_barrier_for_rect(info,
-						&(req_list[i].dst),
-						&(req_list[i].dst_rect),
-						msm_dma_fromdevice_wt_post
-						);
-			}
-		}
+		msm_fb_dma_barrier_for_list(info, req_list, req_list_count,
+					    MDP_NO_DMA_BARRIER_END, 0,
+					    msm_dma_fromdevice_wt_post);
 		break;
 	case MDP_FB_PAGE_PROTECTION_WRITEBACKCACHE:
 	case MDP_FB_PAGE_PROTECTION_WRITEBACKWACACHE:
-		for (i = 0; i < req_list_count; i++) {
-			if (!(req_list[i].flags &
-					MDP_NO_DMA_BARRIER_END)) {
-
-				msm_fb_dma_barrier_for_rect(info,
-						&(req_list[i].dst),
-						&(req_list[i].dst_rect),
-						msm_dma_fromdevice_wb_post
-						);
-			}
-		}
+		msm_fb_dma_barrier_for_list(info, req_list, req_list_count,
+					    MDP_NO_DMA_BARRIER_END, 0,
+					    msm_dma_fromdevice_wb_post);
 		break;
 	}
 #else
@@ -2497,10 +2588,11 @@ static int msmfb_blit(struct fb_info *info, void __user *p)
 	 * make sense.
 	 */
 	const int MAX_LIST_WINDOW = 16;
-	struct mdp_blit_req req_list[MAX_LIST_WINDOW];
+	struct mdp_blit_req req_window[MAX_LIST_WINDOW];
+	struct mdp_blit_req *req_list = req_window, *req_alloc = NULL;
 	struct mdp_blit_req_list req_list_header;
 
-	int count, i, req_list_count;
+	int count, i, req_list_count, window = MAX_LIST_WINDOW, ret = 0;
 
 	/* Get the count size for the total BLIT request. */
 	if (copy_from_user(&req_list_header, p, sizeof(req_list_header)))
@@ -2509,21 +2601,38 @@ static int msmfb_blit(struct fb_info *info, void __user *p)
 	count = req_list_header.count;
 	if (count < 0 || count >= MAX_BLIT_REQ)
 		return -EINVAL;
+
+	/*
+	 * Prefer handling the whole list in one window so that cache
+	 * maintenance can be coalesced across all of its requests; fall
+	 * back to the narrow stack window if that cannot be allocated.
+	 */
+	if (count > MAX_LIST_WINDOW) {
+		req_alloc = kmalloc(sizeof(struct mdp_blit_req) * count,
+				    GFP_KERNEL | __GFP_NOWARN);
+		if (req_alloc) {
+			req_list = req_alloc;
+			window = count;
+		}
+	}
+
 	while (count > 0) {
 		/*
-		 * Access the requests through a narrow window to decrease copy
+		 * Access the requests through a window to decrease copy
 		 * overhead and make larger requests accessible to the
 		 * coherency management code.
-		 * NOTE: The window size is intended to be larger than the
+		 * NOTE: The stack window is intended to be larger than the
 		 *       typical request size, but not require more than 2
 		 *       kbytes of stack storage.
 		 */
 		req_list_count = count;
-		if (req_list_count > MAX_LIST_WINDOW)
-			req_list_count = MAX_LIST_WINDOW;
-		if (copy_from_user(&req_list, p,
-				sizeof(struct mdp_blit_req)*req_list_count))
-			return -EFAULT;
+		if (req_list_count > window)
+			req_list_count = window;
+		if (copy_from_user(req_list, p,
+				sizeof(struct mdp_blit_req)*req_list_count)) {
+			ret = -EFAULT;
+			goto out;
+		}
 
 		/*
 		 * Ensure that any data CPU may have previously written to
@@ -2532,6 +2641,7 @@ static int msmfb_blit(struct fb_info *info, void __user *p)
 		 */
 		msm_fb_ensure_memory_coherency_before_dma(info,
 				req_list, req_list_count);
+		mdp_ppp_flush_blit_list(info, req_list, NULL, req_list_count);
 
 		/*
 		 * Do the blit DMA, if required -- returning early only if
@@ -2540,14 +2650,14 @@ static int msmfb_blit(struct fb_info *info, void __user *p)
 		for (i = 0; i < req_list_count; i++) {
 			if (!(req_list[i].flags & MDP_NO_BLIT)) {
 				/* Do the actual blit. */
-				int ret = mdp_blit(info, &(req_list[i]));
+				ret = mdp_blit(info, &(req_list[i]));
 
 				/*
 				 * Note that early returns don't guarantee
 				 * memory coherency.
 				 */
 				if (ret)
-					return ret;
+					goto out;
 			}
 		}
 
@@ -2564,7 +2674,9 @@ static int msmfb_blit(struct fb_info *info, void __user *p)
 		count -= req_list_count;
 		p += sizeof(struct mdp_blit_req)*req_list_count;
 	}
-	return 0;
+out:
+	kfree(req_alloc);
+	return ret;
 }
 
 #ifdef CONFIG_FB_MSM_OVERLAY
@@ -2732,6 +2844,210 @@ DECLARE_MUTEX(msm_fb_ioctl_ppp_sem);
 DEFINE_MUTEX(msm_fb_ioctl_lut_sem);
 DEFINE_MUTEX(msm_fb_ioctl_hist_sem);
 
+#ifdef CONFIG_FB_MSM_MDP_PPP_ASYNC
+/* Maximum number of blit lists queued to the PPP worker at once */
+#define MSMFB_BLIT_ASYNC_DEPTH 4
+
+struct msmfb_blit_job {
+	struct list_head list;
+	u32 timestamp;
+	int count;
+	struct mdp_blit_req *req;
+	struct mdp_blit_img *imgs;	/* src/dst pair per request */
+};
+
+static inline int msmfb_blit_ts_retired(struct msm_fb_data_type *mfd, u32 ts)
+{
+	return (int)(mfd->blit_retired - ts) >= 0;
+}
+
+static void msmfb_blit_job_free(struct msmfb_blit_job *job)
+{
+	int i;
+
+	for (i = 0; i < job->count; i++)
+		mdp_ppp_put_blit_imgs(&job->imgs[2 * i], &job->imgs[2 * i + 1]);
+	kfree(job);
+}
+
+static void msmfb_blit_work(struct work_struct *work)
+{
+	struct msm_fb_data_type *mfd =
+		container_of(work, struct msm_fb_data_type, blit_work);
+	struct fb_info *info = mfd->fbi;
+	struct msmfb_blit_job *job;
+	unsigned long flags;
+	int i, ret;
+
+	for (;;) {
+		spin_lock_irqsave(&mfd->blit_lock, flags);
+		if (list_empty(&mfd->blit_queue)) {
+			spin_unlock_irqrestore(&mfd->blit_lock, flags);
+			break;
+		}
+		job = list_first_entry(&mfd->blit_queue,
+				       struct msmfb_blit_job, list);
+		list_del(&job->list);
+		spin_unlock_irqrestore(&mfd->blit_lock, flags);
+
+		ret = 0;
+		down(&msm_fb_ioctl_ppp_sem);
+		for (i = 0; i < job->count; i++) {
+			if (job->req[i].flags & MDP_NO_BLIT)
+				continue;
+			ret = mdp_blit_imgs(info, &job->req[i],
+					    &job->imgs[2 * i]);
+			if (ret)
+				break;
+		}
+		if (!ret)
+			msm_fb_ensure_memory_coherency_after_dma(info,
+					job->req, job->count);
+		up(&msm_fb_ioctl_ppp_sem);
+
+		if (ret)
+			printk(KERN_ERR "%s: blit list %u failed at %d (%d)\n",
+			       __func__, job->timestamp, i, ret);
+
+		spin_lock_irqsave(&mfd->blit_lock, flags);
+		mfd->blit_retired = job->timestamp;
+		mfd->blit_pending--;
+		if (ret && !mfd->blit_error)
+			mfd->blit_error = ret;
+		spin_unlock_irqrestore(&mfd->blit_lock, flags);
+		wake_up_all(&mfd->blit_wait);
+
+		msmfb_blit_job_free(job);
+	}
+}
+
+static int msmfb_blit_async(struct fb_info *info, void __user *p)
+{
+	struct msm_fb_data_type *mfd = (struct msm_fb_data_type *)info->par;
+	struct mdp_blit_async_req areq;
+	struct msmfb_blit_job *job;
+	unsigned long flags;
+	int i, ret;
+	u32 ts;
+
+	if (copy_from_user(&areq, p, sizeof(areq)))
+		return -EFAULT;
+	if (areq.count == 0 || areq.count >= MAX_BLIT_REQ)
+		return -EINVAL;
+
+	job = kzalloc(sizeof(*job) + areq.count *
+		      (sizeof(struct mdp_blit_req) +
+		       2 * sizeof(struct mdp_blit_img)), GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+
+	job->imgs = (struct mdp_blit_img *)(job + 1);
+	job->req = (struct mdp_blit_req *)(job->imgs + 2 * areq.count);
+
+	if (copy_from_user(job->req, (void __user *)areq.req,
+			   sizeof(struct mdp_blit_req) * areq.count)) {
+		kfree(job);
+		return -EFAULT;
+	}
+
+	/*
+	 * Image memory ids are file descriptors of the caller, so they
+	 * must be looked up (and pinned) here rather than in the worker.
+	 */
+	for (i = 0; i < areq.count; i++) {
+		if (job->req[i].flags & MDP_NO_BLIT)
+			continue;
+		if (mdp_ppp_get_blit_imgs(info, &job->req[i],
+					  &job->imgs[2 * i],
+					  &job->imgs[2 * i + 1])) {
+			msmfb_blit_job_free(job);
+			return -EINVAL;
+		}
+		job->count = i + 1;
+	}
+	job->count = areq.count;
+
+	msm_fb_ensure_memory_coherency_before_dma(info, job->req, job->count);
+	mdp_ppp_flush_blit_list(info, job->req, job->imgs, job->count);
+
+	ret = wait_event_interruptible(mfd->blit_wait,
+			mfd->blit_pending < MSMFB_BLIT_ASYNC_DEPTH);
+	if (ret) {
+		msmfb_blit_job_free(job);
+		return ret;
+	}
+
+	spin_lock_irqsave(&mfd->blit_lock, flags);
+	ts = job->timestamp = ++mfd->blit_submitted;
+	list_add_tail(&job->list, &mfd->blit_queue);
+	mfd->blit_pending++;
+	spin_unlock_irqrestore(&mfd->blit_lock, flags);
+
+	queue_work(mfd->blit_wq, &mfd->blit_work);
+
+	if (put_user(ts, &((struct mdp_blit_async_req __user *)p)->timestamp))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int msmfb_blit_async_wait(struct fb_info *info, void __user *p)
+{
+	struct msm_fb_data_type *mfd = (struct msm_fb_data_type *)info->par;
+	struct mdp_blit_async_wait wreq;
+	unsigned long flags;
+	long ret;
+
+	if (copy_from_user(&wreq, p, sizeof(wreq)))
+		return -EFAULT;
+
+	if ((int)(wreq.timestamp - mfd->blit_submitted) > 0)
+		return -EINVAL;
+
+	if (wreq.timeout_ms == 0) {
+		if (!msmfb_blit_ts_retired(mfd, wreq.timestamp))
+			return -EBUSY;
+	} else {
+		ret = wait_event_interruptible_timeout(mfd->blit_wait,
+			msmfb_blit_ts_retired(mfd, wreq.timestamp),
+			msecs_to_jiffies(wreq.timeout_ms));
+		if (ret < 0)
+			return ret;
+		if (ret == 0)
+			return -ETIME;
+	}
+
+	/* Report (once) a failure of any list retired since the last wait */
+	spin_lock_irqsave(&mfd->blit_lock, flags);
+	ret = mfd->blit_error;
+	mfd->blit_error = 0;
+	spin_unlock_irqrestore(&mfd->blit_lock, flags);
+
+	return ret;
+}
+
+static void msmfb_blit_async_drain(struct msm_fb_data_type *mfd)
+{
+	if (mfd->blit_wq)
+		wait_event(mfd->blit_wait, mfd->blit_pending == 0);
+}
+
+static void msmfb_blit_async_init(struct msm_fb_data_type *mfd)
+{
+	INIT_LIST_HEAD(&mfd->blit_queue);
+	spin_lock_init(&mfd->blit_lock);
+	init_waitqueue_head(&mfd->blit_wait);
+	INIT_WORK(&mfd->blit_work, msmfb_blit_work);
+	mfd->blit_wq = create_singlethread_workqueue("msm_fb_blit");
+	if (!mfd->blit_wq)
+		printk(KERN_ERR "%s: no blit workqueue, async blits "
+		       "disabled\n", __func__);
+}
+#else
+static inline void msmfb_blit_async_drain(struct msm_fb_data_type *mfd) { }
+static inline void msmfb_blit_async_init(struct msm_fb_data_type *mfd) { }
+#endif
+
 /* Set color conversion matrix from user space */
 
 #ifndef CONFIG_FB_MSM_MDP40
@@ -2829,12 +3145,28 @@ static int msm_fb_ioctl(struct fb_info *info, unsigned int cmd,
 		break;
 #endif
 	case MSMFB_BLIT:
+		/* Keep synchronous blits ordered after queued ones */
+		msmfb_blit_async_drain(mfd);
 		down(&msm_fb_ioctl_ppp_sem);
 		ret = msmfb_blit(info, argp);
 		up(&msm_fb_ioctl_ppp_sem);
 
 		break;
 
+#ifdef CONFIG_FB_MSM_MDP_PPP_ASYNC
+	case MSMFB_BLIT_ASYNC:
+		if (!mfd->blit_wq)
+			return -ENODEV;
+		ret = msmfb_blit_async(info, argp);
+		break;
+
+	case MSMFB_BLIT_ASYNC_WAIT:
+		if (!mfd->blit_wq)
+			return -ENODEV;
+		ret = msmfb_blit_async_wait(info, argp);
+		break;
+#endif
+
 	/* Ioctl for setting ccs matrix from user space */
 	case MSMFB_SET_CCS_MATRIX:
 #ifndef CONFIG_FB_MSM_MDP40
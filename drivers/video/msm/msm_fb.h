@@ -163,6 +163,18 @@ struct msm_fb_data_type {
 
 	struct clk *ebi1_clk;
 	boolean dma_update_flag;
+
+#ifdef CONFIG_FB_MSM_MDP_PPP_ASYNC
+	struct workqueue_struct *blit_wq;
+	struct work_struct blit_work;
+	struct list_head blit_queue;
+	spinlock_t blit_lock;
+	wait_queue_head_t blit_wait;
+	u32 blit_submitted;
+	u32 blit_retired;
+	int blit_pending;
+	int blit_error;
+#endif
 };
 
 struct dentry *msm_fb_get_debugfs_root(void);
@@ -141,6 +141,7 @@ struct mipi_panel_info {
 	char wr_mem_continue;
 	char wr_mem_start;
 	char te_sel;
+	char partial_update;	/* panel honours column/page window */
 	char stream;	/* 0 or 1 */
 	char mdp_trigger;
 	char dma_trigger;
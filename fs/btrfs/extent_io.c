@@ -2003,7 +2003,8 @@ static int __extent_read_full_page(struct extent_io_tree *tree,
 				   struct page *page,
 				   get_extent_t *get_extent,
 				   struct bio **bio, int mirror_num,
-				   unsigned long *bio_flags)
+				   unsigned long *bio_flags,
+				   int cleancache_tried)
 {
 	struct inode *inode = page->mapping->host;
 	u64 start = (u64)page->index << PAGE_CACHE_SHIFT;
@@ -2028,7 +2029,7 @@ static int __extent_read_full_page(struct extent_io_tree *tree,
 
 	set_page_extent_mapped(page);
 
-        if (!PageUptodate(page)) {
+        if (!PageUptodate(page) && !cleancache_tried) {
            if (cleancache_get_page(page) == 0) {
                BUG_ON(blocksize != PAGE_SIZE);
                goto out;
@@ -2176,7 +2177,7 @@ int extent_read_full_page(struct extent_io_tree *tree, struct page *page,
 	int ret;
 
 	ret = __extent_read_full_page(tree, page, get_extent, &bio, 0,
-				      &bio_flags);
+				      &bio_flags, 0);
 	if (bio)
 		submit_one_bio(READ, bio, 0, bio_flags);
 	return ret;
@@ -2683,6 +2684,33 @@ int extent_writepages(struct extent_io_tree *tree,
 	return ret;
 }
 
+/*
+ * fill a batch of locked readahead pages from cleancache in one call and
+ * read the rest as usual, then drop the references extent_readpages kept
+ */
+static void extent_readpages_cleancache(struct extent_io_tree *tree,
+					struct page **pages, int nr,
+					get_extent_t get_extent,
+					struct bio **bio,
+					unsigned long *bio_flags)
+{
+	unsigned long hits;
+	int i;
+
+	cleancache_get_pages(pages[0]->mapping, pages, nr, &hits);
+	for (i = 0; i < nr; i++) {
+		if (hits & (1UL << i)) {
+			set_page_extent_mapped(pages[i]);
+			SetPageUptodate(pages[i]);
+			unlock_page(pages[i]);
+		} else {
+			__extent_read_full_page(tree, pages[i], get_extent,
+						bio, 0, bio_flags, 1);
+		}
+		page_cache_release(pages[i]);
+	}
+}
+
 int extent_readpages(struct extent_io_tree *tree,
 		     struct address_space *mapping,
 		     struct list_head *pages, unsigned nr_pages,
@@ -2691,6 +2719,13 @@ int extent_readpages(struct extent_io_tree *tree,
 	struct bio *bio = NULL;
 	unsigned page_idx;
 	unsigned long bio_flags = 0;
+	struct page *cc_pages[CLEANCACHE_BATCH];
+	int cc_batch, cc_nr = 0;
+
+	/* look readahead windows up in cleancache a batch at a time */
+	cc_batch = cleancache_enabled &&
+		   cleancache_fs_enabled_mapping(mapping) &&
+		   mapping->host->i_sb->s_blocksize == PAGE_CACHE_SIZE;
 
 	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
 		struct page *page = list_entry(pages->prev, struct page, lru);
@@ -2699,11 +2734,25 @@ int extent_readpages(struct extent_io_tree *tree,
 		list_del(&page->lru);
 		if (!add_to_page_cache_lru(page, mapping,
 					page->index, GFP_KERNEL)) {
+			if (cc_batch) {
+				/* keep our reference until it's been read */
+				cc_pages[cc_nr++] = page;
+				if (cc_nr == CLEANCACHE_BATCH) {
+					extent_readpages_cleancache(tree,
+						cc_pages, cc_nr, get_extent,
+						&bio, &bio_flags);
+					cc_nr = 0;
+				}
+				continue;
+			}
 			__extent_read_full_page(tree, page, get_extent,
-						&bio, 0, &bio_flags);
+						&bio, 0, &bio_flags, 0);
 		}
 		page_cache_release(page);
 	}
+	if (cc_nr)
+		extent_readpages_cleancache(tree, cc_pages, cc_nr, get_extent,
+					    &bio, &bio_flags);
 	BUG_ON(!list_empty(pages));
 	if (bio)
 		submit_one_bio(READ, bio, 0, bio_flags);
@@ -3442,7 +3491,8 @@ int read_extent_buffer_pages(struct extent_io_tree *tree,
 			ClearPageError(page);
 			err = __extent_read_full_page(tree, page,
 						      get_extent, &bio,
-						      mirror_num, &bio_flags);
+						      mirror_num, &bio_flags,
+						      0);
 			if (err)
 				ret = err;
 		} else {
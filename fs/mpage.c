@@ -165,11 +165,15 @@ map_buffer_to_page(struct page *page, struct buffer_head *bh, int page_block)
  * We pass a buffer_head back and forth and use its buffer_mapped() flag to
  * represent the validity of its disk mapping and to decide when to do the next
  * get_block() call.
+ *
+ * cleancache_tried is set when the caller already missed this page in a
+ * batched cleancache lookup, so it isn't looked up again.
  */
 static struct bio *
 do_mpage_readpage(struct bio *bio, struct page *page, unsigned nr_pages,
 		sector_t *last_block_in_bio, struct buffer_head *map_bh,
-		unsigned long *first_logical_block, get_block_t get_block)
+		unsigned long *first_logical_block, get_block_t get_block,
+		int cleancache_tried)
 {
 	struct inode *inode = page->mapping->host;
 	const unsigned blkbits = inode->i_blkbits;
@@ -288,7 +292,7 @@ do_mpage_readpage(struct bio *bio, struct page *page, unsigned nr_pages,
 	}
 
         if (fully_mapped && blocks_per_page == 1 && !PageUptodate(page) &&
-            cleancache_get_page(page) == 0) {
+            !cleancache_tried && cleancache_get_page(page) == 0) {
             SetPageUptodate(page);
             goto confused;
         }
@@ -334,6 +338,34 @@ confused:
 	goto out;
 }
 
+/*
+ * Fill a batch of locked readahead pages from cleancache in one call and
+ * read the ones it misses as usual, in order, so the bios still merge.
+ * Drops the references mpage_readpages kept on the batch.
+ */
+static struct bio *
+mpage_readpages_cleancache(struct bio *bio, struct page **pages,
+		unsigned *nr_pages, int nr, sector_t *last_block_in_bio,
+		struct buffer_head *map_bh, unsigned long *first_logical_block,
+		get_block_t get_block)
+{
+	unsigned long hits;
+	int i;
+
+	cleancache_get_pages(pages[0]->mapping, pages, nr, &hits);
+	for (i = 0; i < nr; i++) {
+		if (hits & (1UL << i)) {
+			SetPageUptodate(pages[i]);
+			unlock_page(pages[i]);
+		} else
+			bio = do_mpage_readpage(bio, pages[i], nr_pages[i],
+					last_block_in_bio, map_bh,
+					first_logical_block, get_block, 1);
+		page_cache_release(pages[i]);
+	}
+	return bio;
+}
+
 /**
  * mpage_readpages - populate an address space with some pages & start reads against them
  * @mapping: the address_space
@@ -386,6 +418,19 @@ mpage_readpages(struct address_space *mapping, struct list_head *pages,
 	sector_t last_block_in_bio = 0;
 	struct buffer_head map_bh;
 	unsigned long first_logical_block = 0;
+	struct page *cc_pages[CLEANCACHE_BATCH];
+	unsigned cc_nr_pages[CLEANCACHE_BATCH];
+	int cc_batch, cc_nr = 0;
+
+	/*
+	 * When cleancache may hold this file's pages, look the window up in
+	 * batches: the pages are locked in the page cache first, as many as
+	 * cleancache fills are done, and only the rest go to disk.  Like
+	 * the single-page hook this is limited to blocksize == PAGE_SIZE.
+	 */
+	cc_batch = cleancache_enabled &&
+		   cleancache_fs_enabled_mapping(mapping) &&
+		   mapping->host->i_blkbits == PAGE_CACHE_SHIFT;
 
 	map_bh.b_state = 0;
 	map_bh.b_size = 0;
@@ -396,14 +441,32 @@ mpage_readpages(struct address_space *mapping, struct list_head *pages,
 		list_del(&page->lru);
 		if (!add_to_page_cache_lru(page, mapping,
 					page->index, GFP_KERNEL)) {
+			if (cc_batch) {
+				/* keep our reference until it's been read */
+				cc_pages[cc_nr] = page;
+				cc_nr_pages[cc_nr++] = nr_pages - page_idx;
+				if (cc_nr == CLEANCACHE_BATCH) {
+					bio = mpage_readpages_cleancache(bio,
+						cc_pages, cc_nr_pages, cc_nr,
+						&last_block_in_bio, &map_bh,
+						&first_logical_block,
+						get_block);
+					cc_nr = 0;
+				}
+				continue;
+			}
 			bio = do_mpage_readpage(bio, page,
 					nr_pages - page_idx,
 					&last_block_in_bio, &map_bh,
 					&first_logical_block,
-					get_block);
+					get_block, 0);
 		}
 		page_cache_release(page);
 	}
+	if (cc_nr)
+		bio = mpage_readpages_cleancache(bio, cc_pages, cc_nr_pages,
+					cc_nr, &last_block_in_bio, &map_bh,
+					&first_logical_block, get_block);
 	BUG_ON(!list_empty(pages));
 	if (bio)
 		mpage_bio_submit(READ, bio);
@@ -424,7 +487,7 @@ int mpage_readpage(struct page *page, get_block_t get_block)
 	map_bh.b_state = 0;
 	map_bh.b_size = 0;
 	bio = do_mpage_readpage(bio, page, 1, &last_block_in_bio,
-			&map_bh, &first_logical_block, get_block);
+			&map_bh, &first_logical_block, get_block, 0);
 	if (bio)
 		mpage_bio_submit(READ, bio);
 	return 0;
@@ -82,6 +82,7 @@
 #include <linux/pid_namespace.h>
 #include <linux/fs_struct.h>
 #include <linux/slab.h>
+#include <linux/frontswap.h>
 #include "internal.h"
 
 /* NOTE:
@@ -1017,6 +1018,7 @@ static ssize_t oom_adjust_write(struct file *file, const char __user *buf,
 	char buffer[PROC_NUMBUF];
 	long oom_adjust;
 	unsigned long flags;
+	int old_adj;
 	int err;
 
 	memset(buffer, 0, sizeof(buffer));
@@ -1046,9 +1048,11 @@ static ssize_t oom_adjust_write(struct file *file, const char __user *buf,
 		return -EACCES;
 	}
 
+	old_adj = task->signal->oom_adj;
 	task->signal->oom_adj = oom_adjust;
 
 	unlock_task_sighand(task, &flags);
+	frontswap_prefetch_task(task, old_adj, oom_adjust);
 	put_task_struct(task);
 
 	return count;
@@ -94,26 +94,39 @@ static int yaffs_CountBits32(unsigned x)
 	return r;
 }
 
-/* Calculate the ECC for a 256-byte block of data */
-void yaffs_ECCCalculate(const unsigned char *data, unsigned char *ecc)
-{
-	unsigned int i;
+/* Parity summary of the four bytes of a 32-bit word, indexed by a nibble
+ * holding the parity of each byte (bit n = byte at bits 8n..8n+7).
+ * Bits 1..0 are the XOR of the offsets of the odd bytes on a little endian
+ * cpu. Bits 7..2 are all set if an odd number of the bytes are odd, so
+ * that the word index can be masked into the line parity.
+ */
+#define YAFFS_WL(m) \
+	((((m) & 2 ? 1 : 0) ^ ((m) & 4 ? 2 : 0) ^ ((m) & 8 ? 3 : 0)) | \
+	 ((((m) ^ ((m) >> 1) ^ ((m) >> 2) ^ ((m) >> 3)) & 1) ? 0xfc : 0))
+
+static const unsigned char word_line_table[16] = {
+	YAFFS_WL(0),  YAFFS_WL(1),  YAFFS_WL(2),  YAFFS_WL(3),
+	YAFFS_WL(4),  YAFFS_WL(5),  YAFFS_WL(6),  YAFFS_WL(7),
+	YAFFS_WL(8),  YAFFS_WL(9),  YAFFS_WL(10), YAFFS_WL(11),
+	YAFFS_WL(12), YAFFS_WL(13), YAFFS_WL(14), YAFFS_WL(15),
+};
 
-	unsigned char col_parity = 0;
-	unsigned char line_parity = 0;
-	unsigned char line_parity_prime = 0;
-	unsigned char t;
-	unsigned char b;
+static const union {
+	__u32 w;
+	unsigned char b[4];
+} yaffs_word_order = { 1 };
 
-	for (i = 0; i < 256; i++) {
-		b = column_parity_table[*data++];
-		col_parity ^= b;
+/* Use the word-at-a-time ECC calculation for aligned buffers.
+ * Clearing this falls back to the byte table reference code.
+ */
+unsigned int yaffs_ecc_wordwise = 1;
 
-		if (b & 0x01) {		/* odd number of bits in the byte */
-			line_parity ^= i;
-			line_parity_prime ^= ~i;
-		}
-	}
+static void yaffs_ECCPack(unsigned char col_parity,
+			  unsigned char line_parity,
+			  unsigned char line_parity_prime,
+			  unsigned char *ecc)
+{
+	unsigned char t;
 
 	ecc[2] = (~col_parity) | 0x03;
 
@@ -163,6 +176,94 @@ void yaffs_ECCCalculate(const unsigned char *data, unsigned char *ecc)
 #endif
 }
 
+/* Calculate the ECC a byte at a time. This is the reference version. */
+static void yaffs_ECCCalculateBytes(const unsigned char *data,
+				    unsigned char *ecc)
+{
+	unsigned int i;
+
+	unsigned char col_parity = 0;
+	unsigned char line_parity = 0;
+	unsigned char line_parity_prime = 0;
+	unsigned char b;
+
+	for (i = 0; i < 256; i++) {
+		b = column_parity_table[*data++];
+		col_parity ^= b;
+
+		if (b & 0x01) {		/* odd number of bits in the byte */
+			line_parity ^= i;
+			line_parity_prime ^= ~i;
+		}
+	}
+
+	yaffs_ECCPack(col_parity, line_parity, line_parity_prime, ecc);
+}
+
+/* Calculate the ECC a 32-bit word at a time.
+ *
+ * The column parity bits are linear in the data, so they are the table
+ * entry for the XOR of all the bytes. The line parity is the XOR of the
+ * indices of the odd-parity bytes: the per-byte parities of a word are
+ * folded into a nibble, whose table entry supplies the low two index bits
+ * and whether the word index contributes. line_parity_prime is the same
+ * XOR with every index complemented, so it only differs from line_parity
+ * by 0xff when the whole block has odd parity.
+ *
+ * data must be 32-bit aligned.
+ */
+static void yaffs_ECCCalculateWords(const unsigned char *data,
+				    unsigned char *ecc)
+{
+	const __u32 *w = (const __u32 *)data;
+	unsigned int i;
+	__u32 all = 0;
+	__u32 x;
+	unsigned char line_parity = 0;
+	unsigned char line_parity_prime;
+	unsigned char b;
+
+	for (i = 0; i < 64; i++) {
+		x = w[i];
+		all ^= x;
+
+		/* Bit 0 of each byte becomes that byte's parity */
+		x ^= x >> 4;
+		x ^= x >> 2;
+		x ^= x >> 1;
+		x &= 0x01010101;
+		x = (x | (x >> 7) | (x >> 14) | (x >> 21)) & 0x0f;
+
+		line_parity ^= word_line_table[x] & ((i << 2) | 0x03);
+	}
+
+	all ^= all >> 16;
+	all ^= all >> 8;
+	b = column_parity_table[all & 0xff];
+
+	/* On a big endian cpu the byte at bits 8n..8n+7 is at offset 3 - n,
+	 * which flips both low index bits of every odd byte. That cancels
+	 * out in pairs, leaving a flip only if the block has odd parity.
+	 */
+	if (yaffs_word_order.b[0] == 0 && (b & 0x01))
+		line_parity ^= 0x03;
+
+	line_parity_prime = line_parity;
+	if (b & 0x01)
+		line_parity_prime ^= 0xff;
+
+	yaffs_ECCPack(b, line_parity, line_parity_prime, ecc);
+}
+
+/* Calculate the ECC for a 256-byte block of data */
+void yaffs_ECCCalculate(const unsigned char *data, unsigned char *ecc)
+{
+	if (yaffs_ecc_wordwise && !(((unsigned long)data) & 3))
+		yaffs_ECCCalculateWords(data, ecc);
+	else
+		yaffs_ECCCalculateBytes(data, ecc);
+}
+
 
 /* Correct the ECC on a 256 byte block of data */
 
@@ -324,3 +425,97 @@ int yaffs_ECCCorrectOther(unsigned char *data, unsigned nBytes,
 
 	return -1;
 }
+
+#ifdef CONFIG_YAFFS_ECC_SELFTEST
+/*
+ * Cross-check the word-at-a-time ECC against the byte table version on
+ * fixed patterns and pseudo-random blocks, and check that single bit data
+ * and ECC errors are corrected and double bit data errors are reported.
+ * Returns the number of failures.
+ */
+#define YAFFS_ECC_TEST_BLOCKS 64
+
+static __u32 yaffs_ECCTestRandom(__u32 *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+int yaffs_ECCSelfTest(void)
+{
+	__u32 buf[65];	/* one spare word for the unaligned check */
+	__u32 good[64];
+	unsigned char *data = (unsigned char *)buf;
+	unsigned char ecc_ref[3];
+	unsigned char ecc_word[3];
+	unsigned char read_ecc[3];
+	__u32 seed = 0x59AFF5;
+	unsigned bit1, bit2;
+	int failures = 0;
+	int n, i;
+
+	for (n = 0; n < YAFFS_ECC_TEST_BLOCKS; n++) {
+		for (i = 0; i < 64; i++) {
+			if (n == 0)
+				buf[i] = 0;
+			else if (n == 1)
+				buf[i] = 0xffffffff;
+			else
+				buf[i] = (yaffs_ECCTestRandom(&seed) << 16) ^
+					yaffs_ECCTestRandom(&seed);
+			good[i] = buf[i];
+		}
+
+		yaffs_ECCCalculateBytes(data, ecc_ref);
+		yaffs_ECCCalculateWords(data, ecc_word);
+		if (memcmp(ecc_ref, ecc_word, 3))
+			failures++;
+
+		bit1 = yaffs_ECCTestRandom(&seed) & 2047;
+		do {
+			bit2 = yaffs_ECCTestRandom(&seed) & 2047;
+		} while (bit2 == bit1);
+
+		/* Single bit data error is found by both and corrected */
+		data[bit1 >> 3] ^= 1 << (bit1 & 7);
+		yaffs_ECCCalculateWords(data, ecc_word);
+		yaffs_ECCCalculateBytes(data, read_ecc);
+		if (memcmp(read_ecc, ecc_word, 3))
+			failures++;
+		memcpy(read_ecc, ecc_ref, 3);
+		if (yaffs_ECCCorrect(data, read_ecc, ecc_word) != 1 ||
+		    memcmp(buf, good, sizeof(good)))
+			failures++;
+
+		/* Double bit data error is detected but not "corrected" */
+		data[bit1 >> 3] ^= 1 << (bit1 & 7);
+		data[bit2 >> 3] ^= 1 << (bit2 & 7);
+		yaffs_ECCCalculateWords(data, ecc_word);
+		memcpy(read_ecc, ecc_ref, 3);
+		if (yaffs_ECCCorrect(data, read_ecc, ecc_word) != -1)
+			failures++;
+		memcpy(buf, good, sizeof(good));
+
+		/* Single bit error in a used ECC bit is corrected */
+		memcpy(read_ecc, ecc_ref, 3);
+		bit1 = yaffs_ECCTestRandom(&seed) % 22;
+		if (bit1 >= 16)
+			bit1 += 2;	/* skip the two unused bits of ecc[2] */
+		read_ecc[bit1 >> 3] ^= 1 << (bit1 & 7);
+		yaffs_ECCCalculateWords(data, ecc_word);
+		if (yaffs_ECCCorrect(data, read_ecc, ecc_word) != 1 ||
+		    memcmp(read_ecc, ecc_ref, 3) ||
+		    memcmp(buf, good, sizeof(good)))
+			failures++;
+	}
+
+	/* The dispatcher must also be right for unaligned buffers */
+	buf[64] = yaffs_ECCTestRandom(&seed);
+	yaffs_ECCCalculateBytes(data + 1, ecc_ref);
+	yaffs_ECCCalculate(data + 1, ecc_word);
+	if (memcmp(ecc_ref, ecc_word, 3))
+		failures++;
+
+	return failures;
+}
+#endif
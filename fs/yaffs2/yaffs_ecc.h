@@ -32,6 +32,8 @@ typedef struct {
 	unsigned lineParityPrime;
 } yaffs_ECCOther;
 
+extern unsigned int yaffs_ecc_wordwise;
+
 void yaffs_ECCCalculate(const unsigned char *data, unsigned char *ecc);
 int yaffs_ECCCorrect(unsigned char *data, unsigned char *read_ecc,
 		const unsigned char *test_ecc);
@@ -41,4 +43,8 @@ void yaffs_ECCCalculateOther(const unsigned char *data, unsigned nBytes,
 int yaffs_ECCCorrectOther(unsigned char *data, unsigned nBytes,
 			yaffs_ECCOther *read_ecc,
 			const yaffs_ECCOther *test_ecc);
+
+#ifdef CONFIG_YAFFS_ECC_SELFTEST
+int yaffs_ECCSelfTest(void);
+#endif
 #endif
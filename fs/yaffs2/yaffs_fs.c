@@ -112,6 +112,7 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 
 #include "yportenv.h"
 #include "yaffs_guts.h"
+#include "yaffs_ecc.h"
 
 #include <linux/mtd/mtd.h>
 #include "yaffs_mtdif.h"
@@ -121,16 +122,25 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
+/* Seconds without modifications after which write_super refreshes the
+ * checkpoint, so an unclean shutdown is less likely to force a full scan
+ * at the next mount. 0 disables.
+ */
+unsigned int yaffs_checkpoint_idle = 10;
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 module_param(yaffs_traceMask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
+module_param(yaffs_checkpoint_idle, uint, 0644);
+module_param(yaffs_ecc_wordwise, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
 MODULE_PARM(yaffs_auto_checkpoint, "i");
+MODULE_PARM(yaffs_checkpoint_idle, "i");
+MODULE_PARM(yaffs_ecc_wordwise, "i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25))
@@ -369,17 +379,65 @@ static const struct super_operations yaffs_super_ops = {
 	.write_super = yaffs_write_super,
 };
 
+/*
+ * Locking.
+ * grossLock is still a single device wide lock. Anything that modifies
+ * the file system, and so anything that can allocate or garbage collect,
+ * takes it exclusively. The read-only VFS ops (readpage, lookup,
+ * readdir, readlink, iget, statfs) take it shared, but that does not make
+ * them run in parallel: whatever they do in yaffs guts (NAND, short op
+ * cache, temp buffers, lazy loaded objects, search contexts) is still
+ * serialised by dataLock. Readers only overlap outside of it, between
+ * the chunks of a readpage (dev->lockData is taken per chunk by
+ * yaffs_ReadDataFromFile()) and while readdir is in filldir.
+ */
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_OS, ("yaffs locking %p\n", current));
-	down(&dev->grossLock);
+	down_write(&dev->grossLock);
 	T(YAFFS_TRACE_OS, ("yaffs locked %p\n", current));
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_OS, ("yaffs unlocking %p\n", current));
-	up(&dev->grossLock);
+	dev->lastModified = jiffies;
+	up_write(&dev->grossLock);
+}
+
+static void yaffs_GrossLockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_OS, ("yaffs locking shared %p\n", current));
+	down_read(&dev->grossLock);
+}
+
+static void yaffs_GrossUnlockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_OS, ("yaffs unlocking shared %p\n", current));
+	up_read(&dev->grossLock);
+}
+
+static void yaffs_LockData(yaffs_Device *dev)
+{
+	mutex_lock(&dev->dataLock);
+}
+
+static void yaffs_UnlockData(yaffs_Device *dev)
+{
+	mutex_unlock(&dev->dataLock);
+}
+
+/* Enter and leave yaffs as a reader that calls into the guts directly */
+static void yaffs_ReaderLock(yaffs_Device *dev)
+{
+	yaffs_GrossLockShared(dev);
+	yaffs_LockData(dev);
+}
+
+static void yaffs_ReaderUnlock(yaffs_Device *dev)
+{
+	yaffs_UnlockData(dev);
+	yaffs_GrossUnlockShared(dev);
 }
 
 
@@ -506,11 +564,11 @@ static int yaffs_readlink(struct dentry *dentry, char __user *buffer,
 
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaderLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_ReaderUnlock(dev);
 
 	if (!alias)
 		return -ENOMEM;
@@ -530,11 +588,11 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 	int ret;
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaderLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_ReaderUnlock(dev);
 
 	if (!alias) {
 		ret = -ENOMEM;
@@ -570,7 +628,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaderLock(dev);
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_lookup for %d:%s\n",
@@ -582,7 +640,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 	obj = yaffs_GetEquivalentObject(obj);	/* in case it was a hardlink */
 
 	/* Can't hold gross lock when calling yaffs_get_inode() */
-	yaffs_GrossUnlock(dev);
+	yaffs_ReaderUnlock(dev);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -744,13 +802,13 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	ret = yaffs_ReadDataFromFile(obj, pg_buf,
 				pg->index << PAGE_CACHE_SHIFT,
 				PAGE_CACHE_SIZE);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	if (ret >= 0)
 		ret = 0;
@@ -1259,7 +1317,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 	obj = yaffs_DentryToObject(f->f_dentry);
 	dev = obj->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaderLock(dev);
 
 	offset = f->f_pos;
 
@@ -1275,10 +1333,10 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 		T(YAFFS_TRACE_OS,
 			("yaffs_readdir: entry . ino %d \n",
 			(int)inode->i_ino));
-		yaffs_GrossUnlock(dev);
+		yaffs_ReaderUnlock(dev);
 		if (filldir(dirent, ".", 1, offset, inode->i_ino, DT_DIR) < 0)
 			goto out;
-		yaffs_GrossLock(dev);
+		yaffs_ReaderLock(dev);
 		offset++;
 		f->f_pos++;
 	}
@@ -1286,11 +1344,11 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 		T(YAFFS_TRACE_OS,
 			("yaffs_readdir: entry .. ino %d \n",
 			(int)f->f_dentry->d_parent->d_inode->i_ino));
-		yaffs_GrossUnlock(dev);
+		yaffs_ReaderUnlock(dev);
 		if (filldir(dirent, "..", 2, offset,
 			f->f_dentry->d_parent->d_inode->i_ino, DT_DIR) < 0)
 			goto out;
-		yaffs_GrossLock(dev);
+		yaffs_ReaderLock(dev);
 		offset++;
 		f->f_pos++;
 	}
@@ -1319,7 +1377,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 			  ("yaffs_readdir: %s inode %d\n", name,
 			   yaffs_GetObjectInode(l)));
 
-                        yaffs_GrossUnlock(dev);
+                        yaffs_ReaderUnlock(dev);
 
 			if (filldir(dirent,
 					name,
@@ -1329,7 +1387,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 					this_type) < 0)
 				goto out;
 
-                        yaffs_GrossLock(dev);
+                        yaffs_ReaderLock(dev);
 
 			offset++;
 			f->f_pos++;
@@ -1337,10 +1395,15 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
                 yaffs_SearchAdvance(sc);
 	}
 
-unlock_out:
-	yaffs_GrossUnlock(dev);
+	/* Ran off the end of the directory still holding the lock */
+	goto unlock_out;
+
 out:
-        yaffs_EndSearch(sc);
+	/* The search context list is shared, so drop it under the lock */
+	yaffs_ReaderLock(dev);
+unlock_out:
+	yaffs_EndSearch(sc);
+	yaffs_ReaderUnlock(dev);
 
 	return retVal;
 }
@@ -1688,7 +1751,7 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 
 	T(YAFFS_TRACE_OS, ("yaffs_statfs\n"));
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaderLock(dev);
 
 	buf->f_type = YAFFS_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
@@ -1737,7 +1800,7 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 	buf->f_ffree = 0;
 	buf->f_bavail = buf->f_bfree;
 
-	yaffs_GrossUnlock(dev);
+	yaffs_ReaderUnlock(dev);
 	return 0;
 }
 
@@ -1770,10 +1833,15 @@ static void yaffs_write_super(struct super_block *sb)
 static int yaffs_write_super(struct super_block *sb)
 #endif
 {
+	yaffs_Device *dev = yaffs_SuperToDevice(sb);
 
 	T(YAFFS_TRACE_OS, ("yaffs_write_super\n"));
 	if (yaffs_auto_checkpoint >= 2)
 		yaffs_do_sync_fs(sb);
+	else if (yaffs_auto_checkpoint >= 1 && yaffs_checkpoint_idle &&
+		 time_after(jiffies, dev->lastModified +
+				     yaffs_checkpoint_idle * HZ))
+		yaffs_do_sync_fs(sb);
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 18))
 	return 0;
 #endif
@@ -1816,13 +1884,13 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino)
 	 * need to lock again.
 	 */
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaderLock(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_ReaderUnlock(dev);
 
 	unlock_new_inode(inode);
 	return inode;
@@ -1843,13 +1911,13 @@ static void yaffs_read_inode(struct inode *inode)
 	T(YAFFS_TRACE_OS,
 		("yaffs_read_inode for %d\n", (int)inode->i_ino));
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaderLock(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_ReaderUnlock(dev);
 }
 
 #endif
@@ -1942,6 +2010,7 @@ typedef struct {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int cache_size;
 	int empty_lost_and_found_overridden;
 	int empty_lost_and_found;
 } yaffs_options;
@@ -1974,6 +2043,19 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 			options->inband_tags = 1;
 		else if (!strcmp(cur_opt, "no-cache"))
 			options->no_cache = 1;
+		else if (!strncmp(cur_opt, "cache-size=", 11)) {
+			char *end;
+
+			options->cache_size =
+				simple_strtoul(cur_opt + 11, &end, 10);
+			if (*end || options->cache_size < 1 ||
+			    options->cache_size > YAFFS_MAX_SHORT_OP_CACHES) {
+				printk(KERN_INFO
+					"yaffs: Bad cache size \"%s\"\n",
+					cur_opt + 11);
+				error = 1;
+			}
+		}
 		else if (!strcmp(cur_opt, "no-checkpoint-read"))
 			options->skip_checkpoint_read = 1;
 		else if (!strcmp(cur_opt, "no-checkpoint-write"))
@@ -2008,6 +2090,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	char devname_buf[BDEVNAME_SIZE + 1];
 	struct mtd_info *mtd;
 	int err;
+	unsigned long mountStart;
 	char *data_str = (char *)data;
 
 	yaffs_options options;
@@ -2198,7 +2281,12 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	if (options.no_cache)
+		dev->nShortOpCaches = 0;
+	else if (options.cache_size)
+		dev->nShortOpCaches = options.cache_size;
+	else
+		dev->nShortOpCaches = CONFIG_YAFFS_SHORT_OP_CACHES;
 	dev->inbandTags = options.inband_tags;
 
 	/* ... and the functions. */
@@ -2265,11 +2353,16 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         YINIT_LIST_HEAD(&dev->searchContexts);
         dev->removeObjectCallback = yaffs_RemoveObjectCallback;
 
-	init_MUTEX(&dev->grossLock);
+	init_rwsem(&dev->grossLock);
+	mutex_init(&dev->dataLock);
+	dev->lockData = yaffs_LockData;
+	dev->unlockData = yaffs_UnlockData;
 
 	yaffs_GrossLock(dev);
 
+	mountStart = jiffies;
 	err = yaffs_GutsInitialise(dev);
+	dev->mountTimeMs = jiffies_to_msecs(jiffies - mountStart);
 
 	T(YAFFS_TRACE_OS,
 	  ("yaffs_read_super: guts initialised %s\n",
@@ -2416,6 +2509,10 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "nErasedBlocks...... %d\n", dev->nErasedBlocks);
 	buf += sprintf(buf, "nReservedBlocks.... %d\n", dev->nReservedBlocks);
 	buf += sprintf(buf, "blocksInCheckpoint. %d\n", dev->blocksInCheckpoint);
+	buf += sprintf(buf, "mountTimeMs........ %u\n", dev->mountTimeMs);
+	buf += sprintf(buf, "mountFromCkpt...... %d\n", dev->mountFromCheckpoint);
+	buf += sprintf(buf, "mountBlocksScanned. %d\n", dev->mountBlocksScanned);
+	buf += sprintf(buf, "mountPageReads..... %d\n", dev->mountPageReads);
 	buf += sprintf(buf, "nTnodesCreated..... %d\n", dev->nTnodesCreated);
 	buf += sprintf(buf, "nFreeTnodes........ %d\n", dev->nFreeTnodes);
 	buf += sprintf(buf, "nObjectsCreated.... %d\n", dev->nObjectsCreated);
@@ -2436,6 +2533,8 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %d\n", dev->cacheMisses);
+	buf += sprintf(buf, "cacheDirty......... %d\n", dev->srCacheNDirty);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
@@ -2642,6 +2741,17 @@ static int __init init_yaffs_fs(void)
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs " __DATE__ " " __TIME__ " Installing. \n"));
 
+#ifdef CONFIG_YAFFS_ECC_SELFTEST
+	error = yaffs_ECCSelfTest();
+	if (error) {
+		T(YAFFS_TRACE_ALWAYS,
+		  ("yaffs: ECC self test failed %d checks,"
+		   " using byte ECC\n", error));
+		yaffs_ecc_wordwise = 0;
+		error = 0;
+	}
+#endif
+
 	/* Install the proc_fs entry */
 	my_proc_entry = create_proc_entry("yaffs",
 					       S_IRUGO | S_IFREG,
@@ -40,6 +40,7 @@ const char *yaffs_guts_c_version =
 
 /* Robustification (if it ever comes about...) */
 static void yaffs_RetireBlock(yaffs_Device *dev, int blockInNAND);
+static void yaffs_UpdateGCIndex(yaffs_Device *dev, yaffs_BlockInfo *bi);
 static void yaffs_HandleWriteChunkError(yaffs_Device *dev, int chunkInNAND,
 		int erasedOk);
 static void yaffs_HandleWriteChunkOk(yaffs_Device *dev, int chunkInNAND,
@@ -454,6 +455,13 @@ static void yaffs_VerifyBlock(yaffs_Device *dev, yaffs_BlockInfo *bi, int n)
 		n, bi->pagesInUse, bi->softDeletions));
 
 
+	/* Check the gc index agrees with the block state */
+	if ((bi->blockState == YAFFS_BLOCK_STATE_FULL) !=
+	    (dev->gcBlockBucket[n - dev->internalStartBlock] >= 0))
+		T(YAFFS_TRACE_VERIFY, (TSTR("Block %d state %d is wrongly %s the gc index"TENDSTR),
+		n, bi->blockState,
+		(bi->blockState == YAFFS_BLOCK_STATE_FULL) ? "missing from" : "in"));
+
 	/* Check chunk bitmap legal */
 	inUse = yaffs_CountChunkBits(dev, n);
 	if (inUse != bi->pagesInUse)
@@ -1048,6 +1056,7 @@ static void yaffs_RetireBlock(yaffs_Device *dev, int blockInNAND)
 	bi->blockState = YAFFS_BLOCK_STATE_DEAD;
 	bi->gcPrioritise = 0;
 	bi->needsRetiring = 0;
+	yaffs_UpdateGCIndex(dev, bi);
 
 	dev->nRetiredBlocks++;
 }
@@ -1074,6 +1083,7 @@ void yaffs_HandleChunkError(yaffs_Device *dev, yaffs_BlockInfo *bi)
 		bi->gcPrioritise = 1;
 		dev->hasPendingPrioritisedGCs = 1;
 		bi->chunkErrorStrikes++;
+		yaffs_UpdateGCIndex(dev, bi);
 
 		if (bi->chunkErrorStrikes > 3) {
 			bi->needsRetiring = 1; /* Too many stikes, so retire this */
@@ -1665,6 +1675,7 @@ static void yaffs_SoftDeleteChunk(yaffs_Device *dev, int chunk)
 	if (theBlock) {
 		theBlock->softDeletions++;
 		dev->nFreeChunks++;
+		yaffs_UpdateGCIndex(dev, theBlock);
 	}
 }
 
@@ -2527,6 +2538,115 @@ int yaffs_RenameObject(yaffs_Object *oldDir, const YCHAR *oldName,
 	return YAFFS_FAIL;
 }
 
+/*------------------------- GC victim index ----------------------------------
+ * Full blocks are kept on doubly linked lists, one per count of live
+ * (in use and not soft deleted) chunks, so the dirtiest block can be found
+ * without walking the blockInfo array. Prioritised full blocks sit on their
+ * own list. yaffs_UpdateGCIndex() recomputes a block's bucket from its
+ * blockInfo and is called wherever the state or chunk counts change.
+ */
+
+static Y_INLINE int yaffs_GCPrioritisedBucket(yaffs_Device *dev)
+{
+	return dev->nChunksPerBlock + 1;
+}
+
+static void yaffs_ResetGCIndex(yaffs_Device *dev)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int i;
+
+	for (i = 0; i <= yaffs_GCPrioritisedBucket(dev); i++) {
+		dev->gcBucketHead[i] = -1;
+		dev->gcBucketTail[i] = -1;
+	}
+
+	for (i = 0; i < nBlocks; i++) {
+		dev->gcBlockNext[i] = -1;
+		dev->gcBlockPrev[i] = -1;
+		dev->gcBlockBucket[i] = -1;
+	}
+}
+
+static void yaffs_UnlinkGCIndex(yaffs_Device *dev, int idx)
+{
+	int bucket = dev->gcBlockBucket[idx];
+	int next = dev->gcBlockNext[idx];
+	int prev = dev->gcBlockPrev[idx];
+
+	if (bucket < 0)
+		return;
+
+	if (prev >= 0)
+		dev->gcBlockNext[prev] = next;
+	else
+		dev->gcBucketHead[bucket] = next;
+
+	if (next >= 0)
+		dev->gcBlockPrev[next] = prev;
+	else
+		dev->gcBucketTail[bucket] = prev;
+
+	dev->gcBlockNext[idx] = -1;
+	dev->gcBlockPrev[idx] = -1;
+	dev->gcBlockBucket[idx] = -1;
+}
+
+static void yaffs_UpdateGCIndex(yaffs_Device *dev, yaffs_BlockInfo *bi)
+{
+	int idx;
+	int bucket = -1;
+	int live;
+
+	if (!dev->gcBlockBucket)
+		return;
+
+	idx = bi - dev->blockInfo;
+
+	if (bi->blockState == YAFFS_BLOCK_STATE_FULL) {
+		if (bi->gcPrioritise) {
+			bucket = yaffs_GCPrioritisedBucket(dev);
+			dev->hasPendingPrioritisedGCs = 1;
+		} else {
+			live = bi->pagesInUse - bi->softDeletions;
+			if (live < 0)
+				live = 0;
+			if (live > dev->nChunksPerBlock)
+				live = dev->nChunksPerBlock;
+			bucket = live;
+		}
+	}
+
+	if (bucket == dev->gcBlockBucket[idx])
+		return;
+
+	yaffs_UnlinkGCIndex(dev, idx);
+
+	if (bucket < 0)
+		return;
+
+	/* Add to the tail so blocks of equal dirtiness are taken in turn */
+	dev->gcBlockBucket[idx] = bucket;
+	dev->gcBlockNext[idx] = -1;
+	dev->gcBlockPrev[idx] = dev->gcBucketTail[bucket];
+	if (dev->gcBucketTail[bucket] >= 0)
+		dev->gcBlockNext[dev->gcBucketTail[bucket]] = idx;
+	else
+		dev->gcBucketHead[bucket] = idx;
+	dev->gcBucketTail[bucket] = idx;
+}
+
+/* Rebuild the whole index, eg. after scanning or restoring a checkpoint. */
+static void yaffs_RebuildGCIndex(yaffs_Device *dev)
+{
+	int i;
+
+	yaffs_ResetGCIndex(dev);
+
+	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++)
+		yaffs_UpdateGCIndex(dev, yaffs_GetBlockInfo(dev, i));
+}
+
 /*------------------------- Block Management and Page Allocation ----------------*/
 
 static int yaffs_InitialiseBlocks(yaffs_Device *dev)
@@ -2557,9 +2677,18 @@ static int yaffs_InitialiseBlocks(yaffs_Device *dev)
 			dev->chunkBitsAlt = 0;
 	}
 
-	if (dev->blockInfo && dev->chunkBits) {
+	dev->gcBucketHead = YMALLOC((dev->nChunksPerBlock + 2) * sizeof(int));
+	dev->gcBucketTail = YMALLOC((dev->nChunksPerBlock + 2) * sizeof(int));
+	dev->gcBlockNext = YMALLOC(nBlocks * sizeof(int));
+	dev->gcBlockPrev = YMALLOC(nBlocks * sizeof(int));
+	dev->gcBlockBucket = YMALLOC(nBlocks * sizeof(short));
+
+	if (dev->blockInfo && dev->chunkBits &&
+	    dev->gcBucketHead && dev->gcBucketTail && dev->gcBlockNext &&
+	    dev->gcBlockPrev && dev->gcBlockBucket) {
 		memset(dev->blockInfo, 0, nBlocks * sizeof(yaffs_BlockInfo));
 		memset(dev->chunkBits, 0, dev->chunkBitmapStride * nBlocks);
+		yaffs_ResetGCIndex(dev);
 		return YAFFS_OK;
 	}
 
@@ -2583,6 +2712,22 @@ static void yaffs_DeinitialiseBlocks(yaffs_Device *dev)
 		YFREE(dev->chunkBits);
 	dev->chunkBitsAlt = 0;
 	dev->chunkBits = NULL;
+
+	if (dev->gcBucketHead)
+		YFREE(dev->gcBucketHead);
+	if (dev->gcBucketTail)
+		YFREE(dev->gcBucketTail);
+	if (dev->gcBlockNext)
+		YFREE(dev->gcBlockNext);
+	if (dev->gcBlockPrev)
+		YFREE(dev->gcBlockPrev);
+	if (dev->gcBlockBucket)
+		YFREE(dev->gcBlockBucket);
+	dev->gcBucketHead = NULL;
+	dev->gcBucketTail = NULL;
+	dev->gcBlockNext = NULL;
+	dev->gcBlockPrev = NULL;
+	dev->gcBlockBucket = NULL;
 }
 
 static int yaffs_BlockNotDisqualifiedFromGC(yaffs_Device *dev,
@@ -2624,93 +2769,65 @@ static int yaffs_BlockNotDisqualifiedFromGC(yaffs_Device *dev,
 
 /* FindDiretiestBlock is used to select the dirtiest block (or close enough)
  * for garbage collection.
+ * Prioritised blocks come first, then the buckets are walked from the fewest
+ * live chunks upwards, skipping blocks that are disqualified from gc.
  */
 
 static int yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 					int aggressive)
 {
-	int b = dev->currentDirtyChecker;
-
-	int i;
-	int iterations;
+	int bucket;
+	int maxBucket;
+	int idx;
 	int dirtiest = -1;
 	int pagesInUse = 0;
 	int prioritised = 0;
 	yaffs_BlockInfo *bi;
-	int pendingPrioritisedExist = 0;
 
 	/* First let's see if we need to grab a prioritised block */
 	if (dev->hasPendingPrioritisedGCs) {
-		for (i = dev->internalStartBlock; i < dev->internalEndBlock && !prioritised; i++) {
-
-			bi = yaffs_GetBlockInfo(dev, i);
-			/* yaffs_VerifyBlock(dev,bi,i); */
-
-			if (bi->gcPrioritise) {
-				pendingPrioritisedExist = 1;
-				if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
-				   yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
-					pagesInUse = (bi->pagesInUse - bi->softDeletions);
-					dirtiest = i;
-					prioritised = 1;
-					aggressive = 1; /* Fool the non-aggressive skip logiv below */
-				}
+		bucket = yaffs_GCPrioritisedBucket(dev);
+		for (idx = dev->gcBucketHead[bucket]; idx >= 0 && !prioritised;
+		     idx = dev->gcBlockNext[idx]) {
+			bi = &dev->blockInfo[idx];
+			if (yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
+				pagesInUse = (bi->pagesInUse - bi->softDeletions);
+				dirtiest = idx + dev->internalStartBlock;
+				prioritised = 1;
 			}
 		}
 
-		if (!pendingPrioritisedExist) /* None found, so we can clear this */
+		/* Prioritised blocks that are not full yet set the flag
+		 * again when they fill up and get indexed.
+		 */
+		if (dev->gcBucketHead[bucket] < 0)
 			dev->hasPendingPrioritisedGCs = 0;
 	}
 
-	/* If we're doing aggressive GC then we are happy to take a less-dirty block, and
-	 * search harder.
+	/* If we're doing aggressive GC then we are happy to take a less-dirty block.
 	 * else (we're doing a leasurely gc), then we only bother to do this if the
 	 * block has only a few pages in use.
 	 */
 
 	dev->nonAggressiveSkip--;
 
-	if (!aggressive && (dev->nonAggressiveSkip > 0))
+	if (!prioritised && !aggressive && (dev->nonAggressiveSkip > 0))
 		return -1;
 
-	if (!prioritised)
-		pagesInUse =
-			(aggressive) ? dev->nChunksPerBlock : YAFFS_PASSIVE_GC_CHUNKS + 1;
-
-	if (aggressive)
-		iterations =
-		    dev->internalEndBlock - dev->internalStartBlock + 1;
-	else {
-		iterations =
-		    dev->internalEndBlock - dev->internalStartBlock + 1;
-		iterations = iterations / 16;
-		if (iterations > 200)
-			iterations = 200;
-	}
-
-	for (i = 0; i <= iterations && pagesInUse > 0 && !prioritised; i++) {
-		b++;
-		if (b < dev->internalStartBlock || b > dev->internalEndBlock)
-			b = dev->internalStartBlock;
+	maxBucket = (aggressive) ? dev->nChunksPerBlock - 1 : YAFFS_PASSIVE_GC_CHUNKS;
 
-		if (b < dev->internalStartBlock || b > dev->internalEndBlock) {
-			T(YAFFS_TRACE_ERROR,
-			  (TSTR("**>> Block %d is not valid" TENDSTR), b));
-			YBUG();
-		}
-
-		bi = yaffs_GetBlockInfo(dev, b);
-
-		if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
-			(bi->pagesInUse - bi->softDeletions) < pagesInUse &&
-				yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
-			dirtiest = b;
-			pagesInUse = (bi->pagesInUse - bi->softDeletions);
+	for (bucket = 0; bucket <= maxBucket && !prioritised && dirtiest < 0; bucket++) {
+		for (idx = dev->gcBucketHead[bucket]; idx >= 0;
+		     idx = dev->gcBlockNext[idx]) {
+			bi = &dev->blockInfo[idx];
+			if (yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
+				dirtiest = idx + dev->internalStartBlock;
+				pagesInUse = (bi->pagesInUse - bi->softDeletions);
+				break;
+			}
 		}
 	}
 
-	dev->currentDirtyChecker = b;
-
 	if (dirtiest > 0) {
 		T(YAFFS_TRACE_GC,
 		  (TSTR("GC Selected block %d with %d free, prioritised:%d" TENDSTR), dirtiest,
@@ -2740,6 +2857,7 @@ static void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
 		blockNo, bi->blockState, (bi->needsRetiring) ? "needs retiring" : ""));
 
 	bi->blockState = YAFFS_BLOCK_STATE_DIRTY;
+	yaffs_UpdateGCIndex(dev, bi);
 
 	if (!bi->needsRetiring) {
 		yaffs_InvalidateCheckpoint(dev);
@@ -2935,6 +3053,7 @@ static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		if (dev->allocationPage >= dev->nChunksPerBlock) {
 			bi->blockState = YAFFS_BLOCK_STATE_FULL;
 			dev->allocationBlock = -1;
+			yaffs_UpdateGCIndex(dev, bi);
 		}
 
 		if (blockUsedPtr)
@@ -2998,6 +3117,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 
 	if(bi->blockState == YAFFS_BLOCK_STATE_FULL)
 		bi->blockState = YAFFS_BLOCK_STATE_COLLECTING;
+	yaffs_UpdateGCIndex(dev, bi);
 	
 	bi->hasShrinkHeader = 0;	/* clear the flag so that the block can erase */
 
@@ -3613,6 +3733,7 @@ void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn)
 		yaffs_ClearChunkBit(dev, block, page);
 
 		bi->pagesInUse--;
+		yaffs_UpdateGCIndex(dev, bi);
 
 		if (bi->pagesInUse == 0 &&
 		    !bi->hasShrinkHeader &&
@@ -3855,77 +3976,134 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Cache chunks are found through a hash on (object, chunkId) and sit on one of
+ *   three lists: free, clean or dirty, the latter two kept in most recently used
+ *   order. That keeps lookups and replacement O(1) so a device can have hundreds
+ *   of cache chunks.
+ */
+
+/* The OS glue may let read-only operations in under a shared lock. They
+ * still take the data lock one at a time around anything that touches
+ * NAND, the cache or temp buffers.
  */
+static Y_INLINE void yaffs_LockData(yaffs_Device *dev)
+{
+	if (dev->lockData)
+		dev->lockData(dev);
+}
+
+static Y_INLINE void yaffs_UnlockData(yaffs_Device *dev)
+{
+	if (dev->unlockData)
+		dev->unlockData(dev);
+}
+
+static Y_INLINE struct ylist_head *yaffs_ChunkCacheBucket(yaffs_Device *dev,
+						const yaffs_Object *obj,
+						int chunkId)
+{
+	return &dev->srCacheHash[(obj->objectId * 31 + chunkId) &
+				 dev->srCacheHashMask];
+}
+
+/* Attach a grabbed cache chunk to (obj, chunkId). It starts out clean. */
+static void yaffs_AssignChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
+				   yaffs_Object *obj, int chunkId)
+{
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+	ylist_add(&cache->hashLink, yaffs_ChunkCacheBucket(dev, obj, chunkId));
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srCacheClean);
+}
+
+/* Detach a cache chunk from its object and put it on the free list. */
+static void yaffs_ReleaseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	if (!cache->object)
+		return;
+
+	if (cache->dirty)
+		dev->srCacheNDirty--;
+
+	cache->object = NULL;
+	cache->dirty = 0;
+	ylist_del_init(&cache->hashLink);
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srCacheFree);
+}
 
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	struct ylist_head *i;
 	yaffs_ChunkCache *cache;
-	int nCaches = obj->myDev->nShortOpCaches;
 
-	for (i = 0; i < nCaches; i++) {
-		cache = &dev->srCache[i];
-		if (cache->object == obj &&
-		    cache->dirty)
+	if (dev->nShortOpCaches < 1)
+		return 0;
+
+	ylist_for_each(i, &dev->srCacheDirty) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+		if (cache->object == obj)
 			return 1;
 	}
 
 	return 0;
 }
 
+static int yaffs_ChunkCacheCompare(const void *a, const void *b)
+{
+	const yaffs_ChunkCache *ca = *(yaffs_ChunkCache * const *)a;
+	const yaffs_ChunkCache *cb = *(yaffs_ChunkCache * const *)b;
+
+	return ca->chunkId - cb->chunkId;
+}
 
+/* Write out all the dirty cache chunks of an object, in chunk order. */
 static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
+	struct ylist_head *i;
 	yaffs_ChunkCache *cache;
-	int chunkWritten = 0;
-	int nCaches = obj->myDev->nShortOpCaches;
-
-	if (nCaches > 0) {
-		do {
-			cache = NULL;
-
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
-			}
+	int chunkWritten;
+	int n = 0;
+	int j;
+
+	if (dev->nShortOpCaches < 1)
+		return;
 
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+	ylist_for_each(i, &dev->srCacheDirty) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+		if (cache->object == obj)
+			dev->srCacheSort[n++] = cache;
+	}
 
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
-			}
+	if (n > 1)
+		yaffs_qsort(dev->srCacheSort, n, sizeof(yaffs_ChunkCache *),
+			    yaffs_ChunkCacheCompare);
 
-		} while (cache && chunkWritten > 0);
+	for (j = 0; j < n; j++) {
+		cache = dev->srCacheSort[j];
+		if (cache->locked)
+			continue;
 
-		if (cache) {
+		/* Write it out and free it up */
+		chunkWritten = yaffs_WriteChunkDataToObject(cache->object,
+							    cache->chunkId,
+							    cache->data,
+							    cache->nBytes,
+							    1);
+		if (chunkWritten <= 0) {
 			/* Hoosterman, disk full while writing cache out. */
 			T(YAFFS_TRACE_ERROR,
 			  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
-
+			break;
 		}
-	}
 
+		yaffs_ReleaseChunkCache(dev, cache);
+	}
 }
 
 /*yaffs_FlushEntireDeviceCache(dev)
@@ -3935,97 +4113,76 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 {
-	yaffs_Object *obj;
-	int nCaches = dev->nShortOpCaches;
-	int i;
-
-	/* Find a dirty object in the cache and flush it...
-	 * until there are no further dirty objects.
-	 */
-	do {
-		obj = NULL;
-		for (i = 0; i < nCaches && !obj; i++) {
-			if (dev->srCache[i].object &&
-			    dev->srCache[i].dirty)
-				obj = dev->srCache[i].object;
-
-		}
-		if (obj)
-			yaffs_FlushFilesChunkCache(obj);
+	yaffs_ChunkCache *cache;
 
-	} while (obj);
+	if (dev->nShortOpCaches < 1)
+		return;
 
+	/* Flush the object owning the least recently used dirty chunk...
+	 * until there are no further dirty chunks or no progress is made.
+	 */
+	while (!ylist_empty(&dev->srCacheDirty)) {
+		cache = ylist_entry(dev->srCacheDirty.prev,
+				    yaffs_ChunkCache, lruLink);
+		yaffs_FlushFilesChunkCache(cache->object);
+		if (cache->object && cache->dirty)
+			break;
+	}
 }
 
-
-/* Grab us a cache chunk for use.
- * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
- */
-static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
+/* Least recently used chunk on a list that is not locked. */
+static yaffs_ChunkCache *yaffs_ChunkCacheLRU(struct ylist_head *list)
 {
-	int i;
+	struct ylist_head *i;
+	yaffs_ChunkCache *cache;
 
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
+	for (i = list->prev; i != list; i = i->prev) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+		if (!cache->locked)
+			return cache;
 	}
 
 	return NULL;
 }
 
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
+/* Grab us a cache chunk for use.
+ * First look for an empty one.
+ * Then take the least recently used clean one, unless too much of the cache
+ * is dirty.
+ * Else flush the object owning the least recently used dirty one and look again.
+ * Readers pass canFlush = 0 since they may run alongside other readers and
+ * must not write to NAND; they get NULL rather than a dirty chunk.
+ */
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev, int canFlush)
 {
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
-
-	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
-		cache = yaffs_GrabChunkCacheWorker(dev);
-
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
-
-			/* With locking we can't assume we can use entry zero */
 
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+	if (dev->nShortOpCaches < 1)
+		return NULL;
 
-			for (i = 0; i < dev->nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
+	if (!ylist_empty(&dev->srCacheFree))
+		return ylist_entry(dev->srCacheFree.next,
+				   yaffs_ChunkCache, lruLink);
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+	cache = NULL;
+	if (!canFlush || dev->srCacheNDirty < dev->srCacheDirtyLimit)
+		cache = yaffs_ChunkCacheLRU(&dev->srCacheClean);
 
+	if (!cache && canFlush) {
+		cache = yaffs_ChunkCacheLRU(&dev->srCacheDirty);
+		if (cache) {
+			yaffs_FlushFilesChunkCache(cache->object);
+			if (!ylist_empty(&dev->srCacheFree))
+				return ylist_entry(dev->srCacheFree.next,
+						   yaffs_ChunkCache, lruLink);
 		}
-		return cache;
-	} else
-		return NULL;
+		cache = yaffs_ChunkCacheLRU(&dev->srCacheClean);
+	}
 
+	if (cache)
+		yaffs_ReleaseChunkCache(dev, cache);
+
+	return cache;
 }
 
 /* Find a cached chunk */
@@ -4033,41 +4190,39 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
+	struct ylist_head *bucket;
+	struct ylist_head *i;
+	yaffs_ChunkCache *cache;
 
-				return &dev->srCache[i];
-			}
+	if (dev->nShortOpCaches < 1)
+		return NULL;
+
+	bucket = yaffs_ChunkCacheBucket(dev, obj, chunkId);
+	ylist_for_each(i, bucket) {
+		cache = ylist_entry(i, yaffs_ChunkCache, hashLink);
+		if (cache->object == obj && cache->chunkId == chunkId) {
+			dev->cacheHits++;
+			return cache;
 		}
 	}
+
+	dev->cacheMisses++;
 	return NULL;
 }
 
-/* Mark the chunk for the least recently used algorithym */
+/* Mark the chunk as most recently used */
 static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 				int isAWrite)
 {
-
 	if (dev->nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
+		if (isAWrite && !cache->dirty) {
+			cache->dirty = 1;
+			dev->srCacheNDirty++;
 		}
 
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
-
-		if (isAWrite)
-			cache->dirty = 1;
+		ylist_del(&cache->lruLink);
+		ylist_add(&cache->lruLink, cache->dirty ?
+			  &dev->srCacheDirty : &dev->srCacheClean);
 	}
 }
 
@@ -4077,11 +4232,13 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
  */
 static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 {
-	if (object->myDev->nShortOpCaches > 0) {
+	yaffs_Device *dev = object->myDev;
+
+	if (dev->nShortOpCaches > 0) {
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_ReleaseChunkCache(dev, cache);
 	}
 }
 
@@ -4097,7 +4254,7 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->nShortOpCaches; i++) {
 			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+				yaffs_ReleaseChunkCache(dev, &dev->srCache[i]);
 		}
 	}
 }
@@ -4658,6 +4815,7 @@ int yaffs_CheckpointRestore(yaffs_Device *dev)
 	retval = yaffs_ReadCheckpointData(dev);
 
 	if (dev->isCheckpointed) {
+		yaffs_RebuildGCIndex(dev);
 		yaffs_VerifyObjects(dev);
 		yaffs_VerifyBlocks(dev);
 		yaffs_VerifyFreeChunks(dev);
@@ -4707,6 +4865,8 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		else
 			nToCopy = dev->nDataBytesPerChunk - start;
 
+		yaffs_LockData(dev);
+
 		cache = yaffs_FindChunkCache(in, chunk);
 
 		/* If the chunk is already in the cache or it is less than a whole chunk
@@ -4714,22 +4874,22 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		 * else bypass the cache.
 		 */
 		if (cache || nToCopy != dev->nDataBytesPerChunk || dev->inbandTags) {
-			if (dev->nShortOpCaches > 0) {
 
-				/* If we can't find the data in the cache, then load it up. */
+			/* If we can't find the data in the cache, then load it up. */
 
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+			if (!cache) {
+				cache = yaffs_GrabChunkCache(dev, 0);
+				if (cache) {
+					yaffs_AssignChunkCache(dev, cache,
+							       in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
 					cache->nBytes = 0;
 				}
+			}
 
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -4739,7 +4899,9 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 				cache->locked = 0;
 			} else {
-				/* Read into the local buffer then copy..*/
+				/* No cache, or only dirty chunks to displace.
+				 * Read into the local buffer then copy..
+				 */
 
 				__u8 *localBuffer =
 				    yaffs_GetTempBuffer(dev, __LINE__);
@@ -4760,6 +4922,8 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 		}
 
+		yaffs_UnlockData(dev);
+
 		n -= nToCopy;
 		offset += nToCopy;
 		buffer += nToCopy;
@@ -4849,11 +5013,9 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					cache = yaffs_GrabChunkCache(in->myDev, 1);
+					yaffs_AssignChunkCache(dev, cache,
+							       in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
@@ -4886,6 +5048,8 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 						     cache->data, cache->nBytes,
 						     1);
 						cache->dirty = 0;
+						dev->srCacheNDirty--;
+						yaffs_UseChunkCache(dev, cache, 0);
 					}
 
 				} else {
@@ -5625,6 +5789,7 @@ static int yaffs_Scan(yaffs_Device *dev)
 	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 	dev->sequenceNumber = YAFFS_LOWEST_SEQUENCE_NUMBER;
+	dev->mountBlocksScanned = dev->internalEndBlock - dev->internalStartBlock + 1;
 
 	/* Scan all the blocks to determine their state */
 	for (blk = dev->internalStartBlock; blk <= dev->internalEndBlock; blk++) {
@@ -6245,6 +6410,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	/* Now scan the blocks looking at the data. */
 	startIterator = 0;
 	endIterator = nBlocksToScan - 1;
+	dev->mountBlocksScanned = nBlocksToScan;
 	T(YAFFS_TRACE_SCAN_DEBUG,
 	  (TSTR("%d blocks to be scanned" TENDSTR), nBlocksToScan));
 
@@ -7438,7 +7604,6 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
-	dev->currentDirtyChecker = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
 	dev->nDeletedFiles = 0;
@@ -7458,38 +7623,68 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->srCacheHash = NULL;
+	dev->srCacheSort = NULL;
 	dev->gcCleanupList = NULL;
 
+	YINIT_LIST_HEAD(&dev->srCacheFree);
+	YINIT_LIST_HEAD(&dev->srCacheClean);
+	YINIT_LIST_HEAD(&dev->srCacheDirty);
+	dev->srCacheNDirty = 0;
 
 	if (!init_failed &&
 	    dev->nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
+		int nBuckets = 16;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+
+		/* Keep the hash chains short: at least one bucket per chunk */
+		while (nBuckets < dev->nShortOpCaches)
+			nBuckets <<= 1;
+		dev->srCacheHashMask = nBuckets - 1;
+
+		/* Let at most 3/4 of the cache be dirty before clean chunks
+		 * stop being reclaimed in preference to flushing.
+		 */
+		dev->srCacheDirtyLimit = (dev->nShortOpCaches * 3) / 4;
+		if (dev->srCacheDirtyLimit < 1)
+			dev->srCacheDirtyLimit = 1;
+
 		dev->srCache =  YMALLOC(srCacheBytes);
+		dev->srCacheHash = YMALLOC(nBuckets * sizeof(struct ylist_head));
+		dev->srCacheSort = YMALLOC(dev->nShortOpCaches *
+					   sizeof(yaffs_ChunkCache *));
 
 		buf = (__u8 *) dev->srCache;
+		if (!dev->srCacheHash || !dev->srCacheSort)
+			buf = NULL;
 
 		if (dev->srCache)
 			memset(dev->srCache, 0, srCacheBytes);
 
+		for (i = 0; i < nBuckets && buf; i++)
+			YINIT_LIST_HEAD(&dev->srCacheHash[i]);
+
 		for (i = 0; i < dev->nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
 			dev->srCache[i].dirty = 0;
+			YINIT_LIST_HEAD(&dev->srCache[i].hashLink);
+			ylist_add_tail(&dev->srCache[i].lruLink,
+				       &dev->srCacheFree);
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->totalBytesPerChunk);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
@@ -7510,10 +7705,14 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 
+	dev->mountFromCheckpoint = 0;
+	dev->mountBlocksScanned = 0;
+
 	if (!init_failed) {
 		/* Now scan the flash. */
 		if (dev->isYaffs2) {
 			if (yaffs_CheckpointRestore(dev)) {
+				dev->mountFromCheckpoint = 1;
 				yaffs_CheckObjectDetailsLoaded(dev->rootDir);
 				T(YAFFS_TRACE_ALWAYS,
 				  (TSTR("yaffs: restored from checkpoint" TENDSTR)));
@@ -7555,6 +7754,11 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		yaffs_FixHangingObjects(dev);
 		if(dev->emptyLostAndFound)
 			yaffs_EmptyLostAndFound(dev);
+
+		/* Scanning and checkpoint restore set up the block infos
+		 * directly, so index them for gc from scratch.
+		 */
+		yaffs_RebuildGCIndex(dev);
 	}
 
 	if (init_failed) {
@@ -7566,7 +7770,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		return YAFFS_FAIL;
 	}
 
-	/* Zero out stats */
+	/* Keep the cost of the mount, then zero out stats */
+	dev->mountPageReads = dev->nPageReads;
+
 	dev->nPageReads = 0;
 	dev->nPageWrites = 0;
 	dev->nBlockErasures = 0;
@@ -7609,6 +7815,13 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			dev->srCache = NULL;
 		}
 
+		if (dev->srCacheHash)
+			YFREE(dev->srCacheHash);
+		dev->srCacheHash = NULL;
+		if (dev->srCacheSort)
+			YFREE(dev->srCacheSort);
+		dev->srCacheSort = NULL;
+
 		YFREE(dev->gcCleanupList);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
@@ -7656,7 +7869,6 @@ int yaffs_GetNumberOfFreeChunks(yaffs_Device *dev)
 	int nFree;
 	int nDirtyCacheChunks;
 	int blocksForCheckpoint;
-	int i;
 
 #if 1
 	nFree = dev->nFreeChunks;
@@ -7668,10 +7880,7 @@ int yaffs_GetNumberOfFreeChunks(yaffs_Device *dev)
 
 	/* Now count the number of dirty chunks in the cache and subtract those */
 
-	for (nDirtyCacheChunks = 0, i = 0; i < dev->nShortOpCaches; i++) {
-		if (dev->srCache[i].dirty)
-			nDirtyCacheChunks++;
-	}
+	nDirtyCacheChunks = dev->srCacheNDirty;
 
 	nFree -= nDirtyCacheChunks;
 
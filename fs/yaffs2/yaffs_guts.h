@@ -88,7 +88,7 @@
 
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	512
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -115,7 +115,8 @@
 typedef struct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
+	struct ylist_head hashLink;	/* chain in the (object, chunkId) hash */
+	struct ylist_head lruLink;	/* on the free, clean or dirty list */
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -604,6 +605,13 @@ struct yaffs_DeviceStruct {
 	/* Callback to mark the superblock dirsty */
 	void (*markSuperBlockDirty)(void *superblock);
 
+	/* Optional callbacks for OS flavours that let several readers into
+	 * yaffs at once. yaffs_ReadDataFromFile() holds the data lock around
+	 * each chunk's NAND, cache and temp buffer accesses.
+	 */
+	void (*lockData)(struct yaffs_DeviceStruct *dev);
+	void (*unlockData)(struct yaffs_DeviceStruct *dev);
+
 	int wideTnodesDisabled; /* Set to disable wide tnodes */
 
 	YCHAR *pathDividers;	/* String of legal path dividers */
@@ -636,7 +644,9 @@ struct yaffs_DeviceStruct {
 #ifdef __KERNEL__
 
 	struct semaphore sem;	/* Semaphore for waiting on erasure.*/
-	struct semaphore grossLock;	/* Gross locking semaphore */
+	struct rw_semaphore grossLock;	/* Shared by read-only ops */
+	struct mutex dataLock;	/* Serialises their calls into the guts */
+	unsigned long lastModified;	/* jiffies at last exclusive unlock */
 	struct rw_semaphore dirLock; /* Lock the directory structure */
 	__u8 *spareBuffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
@@ -712,7 +722,15 @@ struct yaffs_DeviceStruct {
 
 	int nFreeChunks;
 
-	int currentDirtyChecker;	/* Used to find current dirtiest block */
+	/* GC victim index. Full blocks are kept on lists bucketed by the
+	 * number of live chunks, plus one extra bucket for prioritised blocks.
+	 * Links are block indices relative to internalStartBlock, -1 ends a list.
+	 */
+	int *gcBucketHead;
+	int *gcBucketTail;
+	int *gcBlockNext;
+	int *gcBlockPrev;
+	short *gcBlockBucket;	/* -1 if the block is not indexed */
 
 	__u32 *gcCleanupList;	/* objects to delete at the end of a GC. */
 	int nonAggressiveSkip;	/* GC state/mode */
@@ -734,6 +752,12 @@ struct yaffs_DeviceStruct {
 	int nDeletions;
 	int nUnmarkedDeletions;
 
+	/* Mount statistics */
+	int mountFromCheckpoint;	/* Restored from checkpoint, no scan */
+	int mountBlocksScanned;
+	int mountPageReads;		/* NAND reads done by the mount */
+	unsigned mountTimeMs;		/* Filled in by the OS glue */
+
 	int hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 
 	/* Special directories */
@@ -749,9 +773,17 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	struct ylist_head *srCacheHash;
+	int srCacheHashMask;
+	struct ylist_head srCacheFree;	/* unassigned cache chunks */
+	struct ylist_head srCacheClean;	/* most recently used first */
+	struct ylist_head srCacheDirty;	/* most recently used first */
+	int srCacheNDirty;
+	int srCacheDirtyLimit;
+	yaffs_ChunkCache **srCacheSort;	/* scratch for ordered flushing */
 
 	int cacheHits;
+	int cacheMisses;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -61,6 +61,10 @@
 
 #define PMEM_GET_FREE_SPACE	_IOW(PMEM_IOCTL_MAGIC, 14, unsigned int)
 #define PMEM_ALLOCATE_ALIGNED	_IOW(PMEM_IOCTL_MAGIC, 15, unsigned int)
+/* arg != 0 lets compaction move this file's allocation while no kernel
+ * driver holds it; PMEM_GET_SIZE then reports offset 0, and
+ * PMEM_GET_PHYS or connecting a file to it turns this off for good */
+#define PMEM_SET_RELOCATABLE	_IOW(PMEM_IOCTL_MAGIC, 16, unsigned int)
 struct pmem_region {
 	unsigned long offset;
 	unsigned long len;
@@ -92,6 +96,9 @@ void put_pmem_file(struct file* file);
 void put_pmem_fd(int fd);
 void flush_pmem_fd(int fd, unsigned long start, unsigned long len);
 void flush_pmem_file(struct file *file, unsigned long start, unsigned long len);
+int pmem_flush_extent(struct file *file, unsigned long offset,
+		      unsigned long len, unsigned long *start,
+		      unsigned long *size);
 int pmem_cache_maint(struct file *file, unsigned int cmd,
 		struct pmem_addr *pmem_addr);
 
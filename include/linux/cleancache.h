@@ -7,6 +7,12 @@
 
 #define CLEANCACHE_KEY_MAX 6
 
+/*
+ * Most pages handed to cleancache_get_pages/put_pages at once.  Backends
+ * may keep interrupts off for a whole batch, so keep it modest.
+ */
+#define CLEANCACHE_BATCH 8
+
 /*
  * cleancache requires every file with a page in cleancache to have a
  * unique key unless/until the file is removed/truncated.  For some
@@ -28,6 +34,11 @@ struct cleancache_ops {
 			pgoff_t, struct page *);
 	void (*put_page)(int, struct cleancache_filekey,
 			pgoff_t, struct page *);
+	/* optional, cleancache falls back to get_page/put_page per page */
+	int (*get_pages)(int, struct cleancache_filekey,
+			struct page **, int, unsigned long *);
+	void (*put_pages)(int, struct cleancache_filekey,
+			struct page **, int);
 	void (*flush_page)(int, struct cleancache_filekey, pgoff_t);
 	void (*flush_inode)(int, struct cleancache_filekey);
 	void (*flush_fs)(int);
@@ -39,6 +50,10 @@ extern void __cleancache_init_fs(struct super_block *);
 extern void __cleancache_init_shared_fs(char *, struct super_block *);
 extern int  __cleancache_get_page(struct page *);
 extern void __cleancache_put_page(struct page *);
+extern int  __cleancache_get_pages(struct address_space *, struct page **,
+					int, unsigned long *);
+extern void __cleancache_put_pages(struct address_space *, struct page **,
+					int);
 extern void __cleancache_flush_page(struct address_space *, struct page *);
 extern void __cleancache_flush_inode(struct address_space *);
 extern void __cleancache_flush_fs(struct super_block *);
@@ -95,6 +110,25 @@ static inline void cleancache_put_page(struct page *page)
 		__cleancache_put_page(page);
 }
 
+static inline int cleancache_get_pages(struct address_space *mapping,
+					struct page **pages, int nr,
+					unsigned long *hits)
+{
+	int ret = 0;
+
+	*hits = 0;
+	if (cleancache_enabled && cleancache_fs_enabled_mapping(mapping))
+		ret = __cleancache_get_pages(mapping, pages, nr, hits);
+	return ret;
+}
+
+static inline void cleancache_put_pages(struct address_space *mapping,
+					struct page **pages, int nr)
+{
+	if (cleancache_enabled && cleancache_fs_enabled_mapping(mapping))
+		__cleancache_put_pages(mapping, pages, nr);
+}
+
 static inline void cleancache_flush_page(struct address_space *mapping,
 					struct page *page)
 {
@@ -18,6 +18,13 @@ extern int sysctl_compaction_handler(struct ctl_table *table, int write,
 extern int sysctl_extfrag_threshold;
 extern int sysctl_extfrag_handler(struct ctl_table *table, int write,
 			void __user *buffer, size_t *length, loff_t *ppos);
+extern int sysctl_compact_proactive_orders;
+extern int sysctl_compact_proactive_threshold;
+extern int sysctl_compact_proactive_min_idle;
+extern int sysctl_compact_proactive_interval;
+extern int sysctl_compact_proactive_pages;
+extern int sysctl_compact_proactive_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos);
 
 extern int fragmentation_index(struct zone *zone, unsigned int order);
 extern unsigned long try_to_compact_pages(struct zonelist *zonelist,
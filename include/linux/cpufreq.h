@@ -396,6 +396,9 @@ extern struct cpufreq_governor cpufreq_gov_lagfree;
 #elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_SMOOTHASS)
 extern struct cpufreq_governor cpufreq_gov_smoothass;
 #define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_smoothass)
+#elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_UNIFIED)
+extern struct cpufreq_governor cpufreq_gov_unified;
+#define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_unified)
 #endif
 
 
@@ -4,6 +4,8 @@
 #include <linux/swap.h>
 #include <linux/mm.h>
 
+struct task_struct;
+
 struct frontswap_ops {
 	void (*init)(unsigned);
 	int (*put_page)(unsigned, pgoff_t, struct page *);
@@ -23,6 +25,7 @@ extern int __frontswap_put_page(struct page *page);
 extern int __frontswap_get_page(struct page *page);
 extern void __frontswap_flush_page(unsigned, pgoff_t);
 extern void __frontswap_flush_area(unsigned);
+extern void __frontswap_prefetch_task(struct task_struct *, int, int);
 
 #ifndef CONFIG_FRONTSWAP
 /* all inline routines become no-ops and all externs are ignored */
@@ -77,6 +80,13 @@ static inline void frontswap_flush_page(unsigned type, pgoff_t offset)
 		__frontswap_flush_page(type, offset);
 }
 
+static inline void frontswap_prefetch_task(struct task_struct *task,
+					int old_adj, int new_adj)
+{
+	if (frontswap_enabled)
+		__frontswap_prefetch_task(task, old_adj, new_adj);
+}
+
 static inline void frontswap_flush_area(unsigned type)
 {
 	if (frontswap_enabled)
@@ -109,4 +109,13 @@ extern void account_process_tick(struct task_struct *, int user);
 extern void account_steal_ticks(unsigned long ticks);
 extern void account_idle_ticks(unsigned long ticks);
 
+struct cpu_idle_sample {
+	u64 idle;
+	u64 wall;
+	unsigned int pct;
+};
+
+extern unsigned int cpu_idle_percent(struct cpu_idle_sample *s,
+				     unsigned long min_interval);
+
 #endif /* _LINUX_KERNEL_STAT_H */
@@ -49,6 +49,10 @@
 
 #define MSMFB_OVERLAY_3D       _IOWR(MSMFB_IOCTL_MAGIC, 146, \
 						struct msmfb_overlay_3d)
+#define MSMFB_BLIT_ASYNC       _IOWR(MSMFB_IOCTL_MAGIC, 147, \
+						struct mdp_blit_async_req)
+#define MSMFB_BLIT_ASYNC_WAIT  _IOW(MSMFB_IOCTL_MAGIC, 148, \
+						struct mdp_blit_async_wait)
 
 #define MDP_IMGTYPE2_START 0x10000
 
@@ -173,6 +177,22 @@ struct mdp_blit_req_list {
 	struct mdp_blit_req req[];
 };
 
+/*
+ * Asynchronous blit list. The whole list is queued and the returned
+ * timestamp retires once every request in it has been composed.
+ */
+struct mdp_blit_async_req {
+	uint32_t count;
+	struct mdp_blit_req *req;
+	uint32_t timestamp;	/* out */
+};
+
+/* timeout_ms of 0 polls: -EBUSY is returned if not yet retired */
+struct mdp_blit_async_wait {
+	uint32_t timestamp;
+	uint32_t timeout_ms;
+};
+
 #define MSMFB_DATA_VERSION 2
 
 struct msmfb_data {
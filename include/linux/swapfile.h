@@ -9,5 +9,7 @@ extern spinlock_t swap_lock;
 extern struct swap_list_t swap_list;
 extern struct swap_info_struct *swap_info[];
 extern int try_to_unuse(unsigned int, bool, unsigned long);
+extern int frontswap_unuse_mm(struct mm_struct *, unsigned long *, int,
+				unsigned long *, unsigned long *);
 
 #endif /* _LINUX_SWAPFILE_H */
\ No newline at end of file
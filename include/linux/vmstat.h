@@ -46,6 +46,9 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 #ifdef CONFIG_COMPACTION
 		COMPACTBLOCKS, COMPACTPAGES, COMPACTPAGEFAILED,
 		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
+		COMPACTDIRECTBLOCKS, COMPACTDIRECTPAGES,
+		COMPACTPROACTIVE, COMPACTPROACTIVEBLOCKS, COMPACTPROACTIVEPAGES,
+		COMPACTPROACTIVESUCCESS,
 #endif
 #ifdef CONFIG_HUGETLB_PAGE
 		HTLB_BUDDY_PGALLOC, HTLB_BUDDY_PGALLOC_FAIL,
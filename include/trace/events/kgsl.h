@@ -0,0 +1,56 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM kgsl
+
+#if !defined(_TRACE_KGSL_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_KGSL_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * kgsl_fp_frame - a frame completed under the framepredict policy
+ * @timestamp: last command timestamp submitted in the frame
+ * @busy: busy time of the frame at the active clock, in us
+ * @work: @busy normalized to the turbo clock, in us
+ * @pred: predicted work of the next frame, in us
+ * @old_level: power level the frame ran at
+ * @new_level: power level selected for the next frame
+ * @missed: the frame did not fit in the vsync period
+ */
+TRACE_EVENT(kgsl_fp_frame,
+
+	TP_PROTO(unsigned int timestamp, unsigned int busy, unsigned int work,
+		 unsigned int pred, unsigned int old_level,
+		 unsigned int new_level, int missed),
+
+	TP_ARGS(timestamp, busy, work, pred, old_level, new_level, missed),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	timestamp	)
+		__field(	unsigned int,	busy		)
+		__field(	unsigned int,	work		)
+		__field(	unsigned int,	pred		)
+		__field(	unsigned int,	old_level	)
+		__field(	unsigned int,	new_level	)
+		__field(	int,		missed		)
+	),
+
+	TP_fast_assign(
+		__entry->timestamp	= timestamp;
+		__entry->busy		= busy;
+		__entry->work		= work;
+		__entry->pred		= pred;
+		__entry->old_level	= old_level;
+		__entry->new_level	= new_level;
+		__entry->missed		= missed;
+	),
+
+	TP_printk("ts=%u busy=%u work=%u pred=%u lvl=%u->%u miss=%d",
+		  __entry->timestamp, __entry->busy, __entry->work,
+		  __entry->pred, __entry->old_level, __entry->new_level,
+		  __entry->missed)
+);
+
+#endif /* _TRACE_KGSL_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
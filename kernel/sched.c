@@ -3307,6 +3307,40 @@ DEFINE_PER_CPU(struct kernel_stat, kstat);
 
 EXPORT_PER_CPU_SYMBOL(kstat);
 
+/**
+ * cpu_idle_percent - share of CPU time spent idle since the last sample
+ * @s: the caller's sample, zeroed or with ->pct preset before first use
+ * @min_interval: jiffies within which the previous result is reused
+ *
+ * Returns the percentage of time the online cpus spent idle or waiting
+ * for I/O since the previous call with @s, for background work that
+ * should only run when the system has time to spare.  The first call
+ * only takes a sample and returns the preset ->pct.
+ */
+unsigned int cpu_idle_percent(struct cpu_idle_sample *s,
+			      unsigned long min_interval)
+{
+	u64 idle = 0, wall = get_jiffies_64();
+	u64 delta_wall = wall - s->wall;
+	int cpu;
+
+	if (s->wall && delta_wall < max(min_interval, 1UL))
+		return s->pct;
+
+	for_each_online_cpu(cpu)
+		idle += cputime64_to_jiffies64(cputime64_add(
+				kstat_cpu(cpu).cpustat.idle,
+				kstat_cpu(cpu).cpustat.iowait));
+
+	/* cpus going offline take their idle time with them */
+	if (s->wall && idle >= s->idle)
+		s->pct = min_t(u64, 100, div64_u64((idle - s->idle) * 100,
+				delta_wall * num_online_cpus()));
+	s->idle = idle;
+	s->wall = wall;
+	return s->pct;
+}
+
 /*
  * Return any ns on the sched_clock that have not yet been accounted in
  * @p in case that task is currently running.
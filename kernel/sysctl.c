@@ -267,6 +267,7 @@ static int max_sched_shares_ratelimit = NSEC_PER_SEC; /* 1 second */
 #ifdef CONFIG_COMPACTION
 static int min_extfrag_threshold;
 static int max_extfrag_threshold = 1000;
+static int max_compact_proactive_orders = (1 << MAX_ORDER) - 1;
 #endif
 
 static struct ctl_table kern_table[] = {
@@ -1154,6 +1155,49 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &min_extfrag_threshold,
 		.extra2		= &max_extfrag_threshold,
 	},
+	{
+		.procname	= "compact_proactive_orders",
+		.data		= &sysctl_compact_proactive_orders,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= sysctl_compact_proactive_handler,
+		.extra1		= &zero,
+		.extra2		= &max_compact_proactive_orders,
+	},
+	{
+		.procname	= "compact_proactive_threshold",
+		.data		= &sysctl_compact_proactive_threshold,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &min_extfrag_threshold,
+		.extra2		= &max_extfrag_threshold,
+	},
+	{
+		.procname	= "compact_proactive_min_idle",
+		.data		= &sysctl_compact_proactive_min_idle,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+	{
+		.procname	= "compact_proactive_interval",
+		.data		= &sysctl_compact_proactive_interval,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+	},
+	{
+		.procname	= "compact_proactive_pages",
+		.data		= &sysctl_compact_proactive_pages,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -61,11 +61,16 @@ _lzo1x_1_do_compress(const unsigned char *in, size_t in_len,
 		goto literal;
 
 try_match:
+#ifdef LZO_FAST_UNALIGNED
+		if (!((lzo_get32(m_pos) ^ lzo_get32(ip)) & 0xffffff))
+			goto match;
+#else
 		if (get_unaligned((const unsigned short *)m_pos)
 				== get_unaligned((const unsigned short *)ip)) {
 			if (likely(m_pos[2] == ip[2]))
 					goto match;
 		}
+#endif
 
 literal:
 		dict[dindex] = ip;
@@ -93,16 +98,31 @@ match:
 				}
 				*op++ = tt;
 			}
+#ifdef LZO_FAST_UNALIGNED
+			for (; t >= 4; t -= 4) {
+				COPY4(op, ii);
+				op += 4;
+				ii += 4;
+			}
+			while (t--)
+				*op++ = *ii++;
+#else
 			do {
 				*op++ = *ii++;
 			} while (--t > 0);
+#endif
 		}
 
 		ip += 3;
+#ifdef LZO_FAST_UNALIGNED
+		ip += lzo_match_run(m_pos + 3, ip, 6);
+		if (ip - ii < 9) {
+#else
 		if (m_pos[3] != *ip++ || m_pos[4] != *ip++
 				|| m_pos[5] != *ip++ || m_pos[6] != *ip++
 				|| m_pos[7] != *ip++ || m_pos[8] != *ip++) {
 			--ip;
+#endif
 			m_len = ip - ii;
 
 			if (m_off <= M2_MAX_OFFSET) {
@@ -125,10 +145,14 @@ match:
 			end = in_end;
 			m = m_pos + M2_MAX_LEN + 1;
 
+#ifdef LZO_FAST_UNALIGNED
+			ip += lzo_match_run(m, ip, end - ip);
+#else
 			while (ip < end && *m == *ip) {
 				m++;
 				ip++;
 			}
+#endif
 			m_len = ip - ii;
 
 			if (m_off <= M3_MAX_OFFSET) {
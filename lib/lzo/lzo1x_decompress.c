@@ -24,9 +24,6 @@
 #define HAVE_OP(x, op_end, op) ((size_t)(op_end - op) < (x))
 #define HAVE_LB(m_pos, out, op) (m_pos < out || m_pos >= op)
 
-#define COPY4(dst, src)	\
-		put_unaligned(get_unaligned((const u32 *)(src)), (u32 *)(dst))
-
 int lzo1x_decompress_safe(const unsigned char *in, size_t in_len,
 			unsigned char *out, size_t *out_len)
 {
@@ -72,6 +69,27 @@ int lzo1x_decompress_safe(const unsigned char *in, size_t in_len,
 		if (HAVE_IP(t + 4, ip_end, ip))
 			goto input_overrun;
 
+#ifdef LZO_FAST_UNALIGNED
+		/*
+		 * With room to spare in both buffers, copy the t + 3 literals
+		 * eight bytes at a time and let the last copy run over; the
+		 * excess output is overwritten by what follows.
+		 */
+		if (!HAVE_OP(t + 3 + 7, op_end, op) &&
+		    !HAVE_IP(t + 4 + 7, ip_end, ip)) {
+			unsigned char *oe = op + t + 3;
+
+			do {
+				COPY8(op, ip);
+				op += 8;
+				ip += 8;
+			} while (op < oe);
+			ip -= op - oe;
+			op = oe;
+			goto first_literal_run;
+		}
+#endif
+
 		COPY4(op, ip);
 		op += 4;
 		ip += 4;
@@ -183,6 +201,25 @@ match:
 			if (HAVE_OP(t + 3 - 1, op_end, op))
 				goto output_overrun;
 
+#ifdef LZO_FAST_UNALIGNED
+			/*
+			 * The t + 2 byte match is at least eight bytes back, so
+			 * each eight byte copy only reads finished output.
+			 */
+			if ((op - m_pos) >= 8 &&
+			    !HAVE_OP(t + 2 + 7, op_end, op)) {
+				unsigned char *oe = op + t + 2;
+
+				do {
+					COPY8(op, m_pos);
+					op += 8;
+					m_pos += 8;
+				} while (op < oe);
+				op = oe;
+				goto match_done;
+			}
+#endif
+
 			if (t >= 2 * 4 - (3 - 1) && (op - m_pos) >= 4) {
 				COPY4(op, m_pos);
 				op += 4;
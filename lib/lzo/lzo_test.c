@@ -0,0 +1,228 @@
+/*
+ *  LZO1X round-trip test and benchmark module
+ *
+ *  Builds a corpus of page sized buffers resembling what zram and
+ *  zcache see (zero pages, sparse pages, text, repeated records, mixed
+ *  and random data), compresses and decompresses each page, checks the
+ *  result against the original, and reports the ratio and MB/s for
+ *  each kind of data.  The corpus comes from a fixed seed so runs on
+ *  different kernels can be compared directly.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/lzo.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#define LZO_TEST_LEN		PAGE_SIZE
+#define LZO_TEST_BUF		lzo1x_worst_compress(LZO_TEST_LEN)
+
+static unsigned int pages = 64;
+module_param(pages, uint, S_IRUGO);
+MODULE_PARM_DESC(pages, "Pages of each kind of data in the corpus");
+
+static unsigned int rounds = 16;
+module_param(rounds, uint, S_IRUGO);
+MODULE_PARM_DESC(rounds, "Times each page is compressed and decompressed");
+
+enum lzo_test_kind {
+	LZO_TEST_ZERO,
+	LZO_TEST_SPARSE,
+	LZO_TEST_TEXT,
+	LZO_TEST_RECORDS,
+	LZO_TEST_MIXED,
+	LZO_TEST_RANDOM,
+	LZO_TEST_KINDS
+};
+
+static const char * const lzo_test_names[LZO_TEST_KINDS] = {
+	"zero", "sparse", "text", "records", "mixed", "random",
+};
+
+static const char * const lzo_test_words[] = {
+	"the ", "page ", "swap ", "memory ", "android ", "binder ",
+	"struct ", "0x00000000 ", "return ", "\n", "\t", "com.android.",
+};
+
+static void lzo_test_fill(unsigned char *buf, enum lzo_test_kind kind,
+			  struct rnd_state *rnd)
+{
+	size_t i, len;
+	const char *w;
+
+	switch (kind) {
+	case LZO_TEST_ZERO:
+		memset(buf, 0, LZO_TEST_LEN);
+		break;
+	case LZO_TEST_SPARSE:
+		/* mostly zero with the odd pointer, as in fresh heaps */
+		memset(buf, 0, LZO_TEST_LEN);
+		for (i = 0; i < LZO_TEST_LEN / 4; i++)
+			if (!(prandom32(rnd) & 15))
+				((u32 *)buf)[i] = 0xc0000000 |
+						  (prandom32(rnd) & 0xffffc);
+		break;
+	case LZO_TEST_TEXT:
+		for (i = 0; i < LZO_TEST_LEN; ) {
+			w = lzo_test_words[prandom32(rnd) %
+					   ARRAY_SIZE(lzo_test_words)];
+			for (len = strlen(w); len && i < LZO_TEST_LEN; len--)
+				buf[i++] = *w++;
+		}
+		break;
+	case LZO_TEST_RECORDS:
+		/* 24 byte records differing in a counter and a flag */
+		for (i = 0; i < LZO_TEST_LEN / 4; i++) {
+			u32 v = (i % 6) ? 0x10000 * (i % 6) : i / 6;
+
+			if (i % 6 == 5)
+				v |= prandom32(rnd) & 1;
+			((u32 *)buf)[i] = v;
+		}
+		break;
+	case LZO_TEST_MIXED:
+		/* byte noise with back references at odd distances */
+		for (i = 0; i < LZO_TEST_LEN; i++) {
+			if (i < 64 || !(prandom32(rnd) & 7))
+				buf[i] = prandom32(rnd);
+			else
+				buf[i] = buf[i - 1 - (prandom32(rnd) % 63)];
+		}
+		break;
+	default:
+		for (i = 0; i < LZO_TEST_LEN; i += 4)
+			*(u32 *)(buf + i) = prandom32(rnd);
+		break;
+	}
+}
+
+static unsigned int lzo_test_rate(u64 bytes, s64 ns)
+{
+	if (ns <= 0)
+		return 0;
+	return div64_u64(bytes * 1000, ns);
+}
+
+static int lzo_test_run(enum lzo_test_kind kind, unsigned char *src,
+			unsigned char *dst, size_t *dst_len,
+			unsigned char *out, void *wrkmem)
+{
+	struct rnd_state rnd;
+	unsigned int i, r;
+	ktime_t start;
+	s64 comp_ns = 0, decomp_ns = 0;
+	u64 in_bytes = 0, out_bytes = 0;
+	size_t len;
+	int ret, failed = 0;
+
+	prandom32_seed(&rnd, 0x6c7a6f00 + kind);
+	for (i = 0; i < pages; i++)
+		lzo_test_fill(src + i * LZO_TEST_LEN, kind, &rnd);
+
+	for (r = 0; r < rounds; r++) {
+		start = ktime_get();
+		for (i = 0; i < pages; i++)
+			lzo1x_1_compress(src + i * LZO_TEST_LEN, LZO_TEST_LEN,
+					 dst + i * LZO_TEST_BUF, &dst_len[i],
+					 wrkmem);
+		comp_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		start = ktime_get();
+		for (i = 0; i < pages; i++) {
+			len = LZO_TEST_LEN;
+			ret = lzo1x_decompress_safe(dst + i * LZO_TEST_BUF,
+						    dst_len[i],
+						    out + i * LZO_TEST_LEN,
+						    &len);
+			if (ret != LZO_E_OK || len != LZO_TEST_LEN)
+				failed++;
+		}
+		decomp_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		for (i = 0; i < pages; i++)
+			out_bytes += dst_len[i];
+		in_bytes += pages * LZO_TEST_LEN;
+		cond_resched();
+	}
+
+	if (memcmp(src, out, pages * LZO_TEST_LEN))
+		failed++;
+
+	/* a truncated stream must be rejected, not decoded */
+	for (i = 0; i < pages; i++) {
+		len = LZO_TEST_LEN;
+		ret = lzo1x_decompress_safe(dst + i * LZO_TEST_BUF,
+					    dst_len[i] - 1,
+					    out + i * LZO_TEST_LEN, &len);
+		if (ret == LZO_E_OK)
+			failed++;
+	}
+
+	printk(KERN_INFO "lzo_test: %-8s %3u%% %8u %8u %s\n",
+	       lzo_test_names[kind],
+	       (unsigned int)div64_u64(out_bytes * 100, in_bytes),
+	       lzo_test_rate(in_bytes, comp_ns),
+	       lzo_test_rate(in_bytes, decomp_ns),
+	       failed ? "FAILED" : "ok");
+	return failed;
+}
+
+static int __init lzo_test_init(void)
+{
+	unsigned char *src, *dst, *out;
+	size_t *dst_len;
+	void *wrkmem;
+	int kind, failed = 0;
+
+	if (!pages || !rounds)
+		return -EINVAL;
+
+	src = vmalloc(pages * LZO_TEST_LEN);
+	out = vmalloc(pages * LZO_TEST_LEN);
+	dst = vmalloc(pages * LZO_TEST_BUF);
+	dst_len = vmalloc(pages * sizeof(*dst_len));
+	wrkmem = vmalloc(LZO1X_MEM_COMPRESS);
+	if (!src || !out || !dst || !dst_len || !wrkmem) {
+		failed = -ENOMEM;
+		goto out;
+	}
+
+	printk(KERN_INFO "lzo_test: %u pages x %u rounds per kind\n",
+	       pages, rounds);
+	printk(KERN_INFO "lzo_test: %-8s %4s %8s %8s\n", "kind", "size",
+	       "comp", "decomp");
+	for (kind = 0; kind < LZO_TEST_KINDS; kind++)
+		failed += lzo_test_run(kind, src, dst, dst_len, out, wrkmem);
+	printk(KERN_INFO "lzo_test: rates in MB/s of uncompressed data, "
+	       "%d failure(s)\n", failed);
+	if (failed)
+		failed = -EINVAL;
+
+out:
+	vfree(wrkmem);
+	vfree(dst_len);
+	vfree(dst);
+	vfree(out);
+	vfree(src);
+	return failed;
+}
+
+static void __exit lzo_test_exit(void)
+{
+}
+
+module_init(lzo_test_init);
+module_exit(lzo_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZO1X round-trip test and benchmark");
@@ -41,3 +41,58 @@
 #define DX2(p, s1, s2)	(((((size_t)((p)[2]) << (s2)) ^ (p)[1]) \
 							<< (s1)) ^ (p)[0])
 #define DX3(p, s1, s2, s3)	((DX2((p)+1, s2, s3) << (s1)) ^ (p)[0])
+
+/*
+ * ARMv6 and later perform unaligned single word loads and stores in
+ * hardware once alignment_init() has cleared SCTLR.A, so literal and
+ * match runs can move a word at a time and match lengths can be found
+ * by comparing words.  The accesses are kept in inline asm because gcc
+ * would otherwise be free to merge neighbouring ones into ldrd/ldm,
+ * which still fault on unaligned addresses.  The pre-boot decompressor
+ * (STATIC) runs before any of that is set up and keeps byte accesses.
+ */
+#if defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 6 && \
+	!defined(__ARMEB__) && !defined(STATIC)
+#define LZO_FAST_UNALIGNED
+
+static inline u32 lzo_get32(const unsigned char *p)
+{
+	u32 v;
+
+	asm("ldr	%0, %1" : "=r" (v) : "m" (*(const u32 *)p));
+	return v;
+}
+
+static inline void lzo_put32(unsigned char *p, u32 v)
+{
+	asm("str	%1, %0" : "=m" (*(u32 *)p) : "r" (v));
+}
+
+/* Number of leading bytes, up to max, that are equal at a and b. */
+static inline size_t lzo_match_run(const unsigned char *a,
+				   const unsigned char *b, size_t max)
+{
+	size_t n = 0;
+	u32 x;
+
+	while (max - n >= 4) {
+		x = lzo_get32(a + n) ^ lzo_get32(b + n);
+		if (x)
+			return n + (__ffs(x) >> 3);
+		n += 4;
+	}
+	while (n < max && a[n] == b[n])
+		n++;
+	return n;
+}
+#else
+#define lzo_get32(p)		get_unaligned((const u32 *)(p))
+#define lzo_put32(p, v)		put_unaligned((v), (u32 *)(p))
+#endif
+
+#define COPY4(dst, src)		lzo_put32((dst), lzo_get32(src))
+#define COPY8(dst, src)		\
+		do {							\
+			COPY4(dst, src);				\
+			COPY4((dst) + 4, (src) + 4);			\
+		} while (0)
@@ -38,6 +38,10 @@ static unsigned long cleancache_succ_gets;
 static unsigned long cleancache_failed_gets;
 static unsigned long cleancache_puts;
 static unsigned long cleancache_flushes;
+static unsigned long cleancache_batch_gets;
+static unsigned long cleancache_batch_get_pages;
+static unsigned long cleancache_batch_puts;
+static unsigned long cleancache_batch_put_pages;
 
 /*
  * register operations for cleancache, returning previous thus allowing
@@ -146,6 +150,85 @@ void __cleancache_put_page(struct page *page)
 }
 EXPORT_SYMBOL(__cleancache_put_page);
 
+/*
+ * "Get" up to CLEANCACHE_BATCH pages of one mapping at once, e.g. a
+ * readahead window, so the backend can find the file once for all of
+ * them instead of once per page.  Sets bit i of *hits for each pages[i]
+ * that was filled and returns the number filled; pages that miss are
+ * unchanged, as with __cleancache_get_page.  Pages must be locked by
+ * caller.
+ */
+int __cleancache_get_pages(struct address_space *mapping,
+			   struct page **pages, int nr, unsigned long *hits)
+{
+	int ret = 0;
+	int pool_id;
+	int i;
+	struct cleancache_filekey key = { .u.key = { 0 } };
+
+	*hits = 0;
+	VM_BUG_ON(nr > CLEANCACHE_BATCH);
+	pool_id = mapping->host->i_sb->cleancache_poolid;
+	if (pool_id < 0 || nr <= 0)
+		goto out;
+
+	if (cleancache_get_key(mapping->host, &key) < 0)
+		goto out;
+
+	if (cleancache_ops.get_pages != NULL) {
+		ret = (*cleancache_ops.get_pages)(pool_id, key, pages, nr,
+							hits);
+	} else {
+		for (i = 0; i < nr; i++) {
+			VM_BUG_ON(!PageLocked(pages[i]));
+			if ((*cleancache_ops.get_page)(pool_id, key,
+					pages[i]->index, pages[i]) == 0) {
+				*hits |= 1UL << i;
+				ret++;
+			}
+		}
+	}
+	cleancache_batch_gets++;
+	cleancache_batch_get_pages += nr;
+	cleancache_succ_gets += ret;
+	cleancache_failed_gets += nr - ret;
+out:
+	return ret;
+}
+EXPORT_SYMBOL(__cleancache_get_pages);
+
+/*
+ * "Put" up to CLEANCACHE_BATCH locked pages of one mapping at once, with
+ * the same semantics as __cleancache_put_page for each of them.
+ */
+void __cleancache_put_pages(struct address_space *mapping,
+			    struct page **pages, int nr)
+{
+	int pool_id;
+	int i;
+	struct cleancache_filekey key = { .u.key = { 0 } };
+
+	VM_BUG_ON(nr > CLEANCACHE_BATCH);
+	pool_id = mapping->host->i_sb->cleancache_poolid;
+	if (pool_id < 0 || nr <= 0 ||
+	    cleancache_get_key(mapping->host, &key) < 0)
+		return;
+
+	if (cleancache_ops.put_pages != NULL) {
+		(*cleancache_ops.put_pages)(pool_id, key, pages, nr);
+	} else {
+		for (i = 0; i < nr; i++) {
+			VM_BUG_ON(!PageLocked(pages[i]));
+			(*cleancache_ops.put_page)(pool_id, key,
+						pages[i]->index, pages[i]);
+		}
+	}
+	cleancache_batch_puts++;
+	cleancache_batch_put_pages += nr;
+	cleancache_puts += nr;
+}
+EXPORT_SYMBOL(__cleancache_put_pages);
+
 /*
  * Flush any data from cleancache associated with the poolid and the
  * page's inode and page index so that a subsequent "get" will fail.
@@ -231,11 +314,48 @@ static ssize_t cleancache_flushes_show(struct kobject *kobj,
 }
 CLEANCACHE_ATTR_RO(cleancache_flushes);
 
+/*
+ * The batch counters count calls and pages of the batched interface;
+ * those pages are also included in the per-page counters above, so
+ * single-page operations are the difference.
+ */
+static ssize_t cleancache_batch_gets_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", cleancache_batch_gets);
+}
+CLEANCACHE_ATTR_RO(cleancache_batch_gets);
+
+static ssize_t cleancache_batch_get_pages_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", cleancache_batch_get_pages);
+}
+CLEANCACHE_ATTR_RO(cleancache_batch_get_pages);
+
+static ssize_t cleancache_batch_puts_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", cleancache_batch_puts);
+}
+CLEANCACHE_ATTR_RO(cleancache_batch_puts);
+
+static ssize_t cleancache_batch_put_pages_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", cleancache_batch_put_pages);
+}
+CLEANCACHE_ATTR_RO(cleancache_batch_put_pages);
+
 static struct attribute *cleancache_attrs[] = {
 	&cleancache_succ_gets_attr.attr,
 	&cleancache_failed_gets_attr.attr,
 	&cleancache_puts_attr.attr,
 	&cleancache_flushes_attr.attr,
+	&cleancache_batch_gets_attr.attr,
+	&cleancache_batch_get_pages_attr.attr,
+	&cleancache_batch_puts_attr.attr,
+	&cleancache_batch_put_pages_attr.attr,
 	NULL,
 };
 
@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/kernel_stat.h>
 #include "internal.h"
 
 /*
@@ -35,9 +38,16 @@ struct compact_control {
 	unsigned long nr_anon;
 	unsigned long nr_file;
 
+	/* Account for the work done by this run */
+	unsigned long nr_blocks;
+	unsigned long nr_moved;
+
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
 	struct zone *zone;
+
+	bool proactive;			/* kcompactd, scanners preset */
+	unsigned long migrate_limit;	/* kcompactd stops the run here */
 };
 
 static unsigned long release_freepages(struct list_head *freelist)
@@ -354,6 +364,19 @@ static int compact_finished(struct zone *zone,
 	if (cc->free_pfn <= cc->migrate_pfn)
 		return COMPACT_COMPLETE;
 
+	/*
+	 * kcompactd: stop when this run's share of the zone is scanned or
+	 * the order it is working for is no longer fragmented
+	 */
+	if (cc->proactive) {
+		if (cc->migrate_pfn >= cc->migrate_limit)
+			return COMPACT_PARTIAL;
+		if (fragmentation_index(zone, cc->order) <=
+					sysctl_compact_proactive_threshold)
+			return COMPACT_PARTIAL;
+		return COMPACT_CONTINUE;
+	}
+
 	/* Compaction run is not finished if the watermark is not met */
 	if (!zone_watermark_ok(zone, cc->order, watermark, 0, 0))
 		return COMPACT_CONTINUE;
@@ -379,10 +402,15 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 {
 	int ret;
 
-	/* Setup to move all movable pages to the end of the zone */
-	cc->migrate_pfn = zone->zone_start_pfn;
-	cc->free_pfn = cc->migrate_pfn + zone->spanned_pages;
-	cc->free_pfn &= ~(pageblock_nr_pages-1);
+	/*
+	 * Setup to move all movable pages to the end of the zone. kcompactd
+	 * sets the scanners itself so that it can pick up where it left off
+	 */
+	if (!cc->proactive) {
+		cc->migrate_pfn = zone->zone_start_pfn;
+		cc->free_pfn = cc->migrate_pfn + zone->spanned_pages;
+		cc->free_pfn &= ~(pageblock_nr_pages-1);
+	}
 
 	migrate_prep_local();
 
@@ -400,6 +428,8 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 
 		count_vm_event(COMPACTBLOCKS);
 		count_vm_events(COMPACTPAGES, nr_migrate - nr_remaining);
+		cc->nr_blocks++;
+		cc->nr_moved += nr_migrate - nr_remaining;
 		if (nr_remaining)
 			count_vm_events(COMPACTPAGEFAILED, nr_remaining);
 
@@ -428,10 +458,16 @@ static unsigned long compact_zone_order(struct zone *zone,
 		.migratetype = allocflags_to_migratetype(gfp_mask),
 		.zone = zone,
 	};
+	unsigned long ret;
+
 	INIT_LIST_HEAD(&cc.freepages);
 	INIT_LIST_HEAD(&cc.migratepages);
 
-	return compact_zone(zone, &cc);
+	ret = compact_zone(zone, &cc);
+
+	count_vm_events(COMPACTDIRECTBLOCKS, cc.nr_blocks);
+	count_vm_events(COMPACTDIRECTPAGES, cc.nr_moved);
+	return ret;
 }
 
 int sysctl_extfrag_threshold = 500;
@@ -583,6 +619,199 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * Proactive compaction. One kcompactd thread per node wakes every
+ * sysctl_compact_proactive_interval milliseconds and, if the CPUs were
+ * mostly idle since it last looked, compacts a slice of each zone in
+ * which one of the orders in sysctl_compact_proactive_orders would fail
+ * due to fragmentation. Each run scans at most
+ * sysctl_compact_proactive_pages pages with the migrate scanner and the
+ * next run resumes where it stopped, so the cost of a full pass over
+ * the zone is spread over many idle periods instead of landing on a
+ * high-order allocation in the page allocator slow path.
+ */
+int sysctl_compact_proactive_orders = (1 << 3) | (1 << 4);
+int sysctl_compact_proactive_threshold = 500;
+int sysctl_compact_proactive_min_idle = 80;
+int sysctl_compact_proactive_interval = 1000;
+int sysctl_compact_proactive_pages = 2048;
+
+static DECLARE_WAIT_QUEUE_HEAD(kcompactd_wait);
+
+/* Where the last run in a zone stopped, and how long to leave it alone */
+struct kcompactd_state {
+	unsigned long migrate_pfn;
+	unsigned long free_pfn;
+	bool resume;
+	unsigned int skip;
+	unsigned int skip_shift;
+};
+
+int sysctl_compact_proactive_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+
+	if (!ret && write)
+		wake_up_interruptible(&kcompactd_wait);
+
+	return ret;
+}
+
+/*
+ * Highest order kcompactd is asked to look after that would currently
+ * fail in this zone because of fragmentation, or -1 if there is none.
+ */
+static int kcompactd_order(struct zone *zone)
+{
+	int order;
+
+	for (order = MAX_ORDER - 1; order > 0; order--) {
+		if (!(sysctl_compact_proactive_orders & (1 << order)))
+			continue;
+		if (fragmentation_index(zone, order) >
+					sysctl_compact_proactive_threshold)
+			return order;
+	}
+
+	return -1;
+}
+
+static void kcompactd_zone(struct zone *zone, struct kcompactd_state *kz)
+{
+	struct compact_control cc = {
+		.nr_freepages = 0,
+		.nr_migratepages = 0,
+		.migratetype = MIGRATE_UNMOVABLE,
+		.zone = zone,
+		.proactive = true,
+	};
+	unsigned long watermark;
+	int order, ret;
+
+	if (kz->skip) {
+		kz->skip--;
+		return;
+	}
+
+	order = kcompactd_order(zone);
+	if (order < 0) {
+		kz->skip_shift = 0;
+		return;
+	}
+
+	/* As for direct compaction, order-0 watermarks must be met */
+	watermark = low_wmark_pages(zone) + (2UL << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return;
+
+	cc.order = order;
+	if (kz->resume && kz->migrate_pfn >= zone->zone_start_pfn &&
+			kz->free_pfn <= zone->zone_start_pfn +
+					zone->spanned_pages) {
+		cc.migrate_pfn = kz->migrate_pfn;
+		cc.free_pfn = kz->free_pfn;
+	} else {
+		cc.migrate_pfn = zone->zone_start_pfn;
+		cc.free_pfn = cc.migrate_pfn + zone->spanned_pages;
+		cc.free_pfn &= ~(pageblock_nr_pages-1);
+	}
+	cc.migrate_limit = cc.migrate_pfn + sysctl_compact_proactive_pages;
+	INIT_LIST_HEAD(&cc.freepages);
+	INIT_LIST_HEAD(&cc.migratepages);
+
+	count_vm_event(COMPACTPROACTIVE);
+	ret = compact_zone(zone, &cc);
+
+	count_vm_events(COMPACTPROACTIVEBLOCKS, cc.nr_blocks);
+	count_vm_events(COMPACTPROACTIVEPAGES, cc.nr_moved);
+
+	kz->migrate_pfn = cc.migrate_pfn;
+	kz->free_pfn = cc.free_pfn;
+	kz->resume = ret != COMPACT_COMPLETE;
+
+	if (kcompactd_order(zone) < order) {
+		count_vm_event(COMPACTPROACTIVESUCCESS);
+		kz->skip_shift = 0;
+	} else if (ret == COMPACT_COMPLETE) {
+		/*
+		 * A whole pass did not help, most likely because of
+		 * unmovable pages. Back off before scanning the zone again.
+		 */
+		if (kz->skip_shift < COMPACT_MAX_DEFER_SHIFT)
+			kz->skip_shift++;
+		kz->skip = 1 << kz->skip_shift;
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+	struct kcompactd_state kz[MAX_NR_ZONES];
+	struct cpu_idle_sample idle;
+	int zoneid;
+
+	memset(kz, 0, sizeof(kz));
+	memset(&idle, 0, sizeof(idle));
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+	set_user_nice(current, 5);
+
+	while (!kthread_should_stop()) {
+		if (!sysctl_compact_proactive_orders) {
+			wait_event_freezable(kcompactd_wait,
+					sysctl_compact_proactive_orders ||
+					kthread_should_stop());
+			/* the idle sample is stale, start a new one */
+			memset(&idle, 0, sizeof(idle));
+		} else {
+			long timeout = msecs_to_jiffies(
+					sysctl_compact_proactive_interval);
+
+			wait_event_freezable_timeout(kcompactd_wait,
+					kthread_should_stop(), timeout);
+		}
+
+		if (kthread_should_stop())
+			break;
+
+		/* measured over the whole sleep, however long it was */
+		if (cpu_idle_percent(&idle, 0) <
+					sysctl_compact_proactive_min_idle)
+			continue;
+
+		for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+			struct zone *zone = &pgdat->node_zones[zoneid];
+
+			if (!populated_zone(zone))
+				continue;
+			kcompactd_zone(zone, &kz[zoneid]);
+			cond_resched();
+		}
+	}
+
+	return 0;
+}
+
+static int __init kcompactd_init(void)
+{
+	struct task_struct *task;
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		task = kthread_run(kcompactd, NODE_DATA(nid),
+					"kcompactd%d", nid);
+		if (IS_ERR(task))
+			printk(KERN_ERR "kcompactd: failed to start on node %d\n",
+			       nid);
+	}
+
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
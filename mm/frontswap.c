@@ -23,6 +23,12 @@
 #include <linux/uaccess.h>
 #include <linux/frontswap.h>
 #include <linux/swapfile.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/pid.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/oom.h>
 
 /*
  * frontswap_ops is set by frontswap_register_ops to contain the pointers
@@ -214,6 +220,114 @@ out:
 }
 EXPORT_SYMBOL(frontswap_shrink);
 
+/*
+ * Frontswap prefetch.  When a task comes to the foreground (on Android,
+ * the activity manager lowers its oom_adj to prefetch_oom_adj or below),
+ * a background thread brings its pages back from frontswap and maps them
+ * before it faults on them, so an app relaunch doesn't stall on a string
+ * of decompressing swap-ins.  It is a partial swapoff of the one mm:
+ * pages only on the swap device are left for the fault path.  Work is
+ * rate limited to prefetch_batch pages every prefetch_interval_ms, at
+ * most prefetch_max_pages per foreground switch, and stops when free
+ * memory runs low or another task comes to the foreground.
+ */
+static unsigned int frontswap_prefetch_enable = 1;
+static int frontswap_prefetch_oom_adj;
+static unsigned int frontswap_prefetch_batch = 32;
+static unsigned int frontswap_prefetch_interval_ms = 20;
+static unsigned int frontswap_prefetch_max_pages = 4096;
+
+static unsigned long frontswap_prefetch_tasks;
+static unsigned long frontswap_prefetch_pages;
+static unsigned long frontswap_prefetch_scanned;
+static unsigned long frontswap_prefetch_missed;
+static unsigned long frontswap_prefetch_lowmem;
+
+static DEFINE_SPINLOCK(frontswap_prefetch_lock);
+static struct pid *frontswap_prefetch_pid;
+static DECLARE_WAIT_QUEUE_HEAD(frontswap_prefetch_wait);
+static struct task_struct *frontswap_prefetch_thread;
+
+/* Called when task's oom_adj is written, with its old and new value */
+void __frontswap_prefetch_task(struct task_struct *task, int old_adj,
+				int new_adj)
+{
+	struct pid *old;
+
+	if (!frontswap_prefetch_enable || frontswap_prefetch_thread == NULL)
+		return;
+	if (old_adj <= frontswap_prefetch_oom_adj ||
+	    new_adj > frontswap_prefetch_oom_adj)
+		return;
+	spin_lock(&frontswap_prefetch_lock);
+	old = frontswap_prefetch_pid;
+	frontswap_prefetch_pid = get_task_pid(task, PIDTYPE_PID);
+	spin_unlock(&frontswap_prefetch_lock);
+	put_pid(old);
+	wake_up(&frontswap_prefetch_wait);
+}
+EXPORT_SYMBOL(__frontswap_prefetch_task);
+
+static void frontswap_prefetch_mm(struct mm_struct *mm)
+{
+	unsigned long addr = 0, scanned = 0, missed = 0;
+	unsigned int budget = frontswap_prefetch_max_pages;
+	int batch;
+
+	frontswap_prefetch_tasks++;
+	while (addr < TASK_SIZE && budget > 0) {
+		/* a newer foreground task takes over */
+		if (frontswap_prefetch_pid != NULL ||
+		    !frontswap_prefetch_enable || kthread_should_stop())
+			break;
+		batch = min(budget, max(frontswap_prefetch_batch, 1U));
+		/* each page comes back uncompressed, keep clear of reclaim */
+		if (nr_free_pages() < totalreserve_pages + batch) {
+			frontswap_prefetch_lowmem++;
+			break;
+		}
+		batch = frontswap_unuse_mm(mm, &addr, batch, &scanned, &missed);
+		frontswap_prefetch_pages += batch;
+		budget -= batch;
+		if (addr < TASK_SIZE && budget > 0)
+			msleep_interruptible(frontswap_prefetch_interval_ms);
+	}
+	frontswap_prefetch_scanned += scanned;
+	frontswap_prefetch_missed += missed;
+}
+
+static int frontswap_prefetchd(void *unused)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+	struct pid *pid;
+
+	set_user_nice(current, 5);
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(frontswap_prefetch_wait,
+				frontswap_prefetch_pid != NULL ||
+				kthread_should_stop());
+		spin_lock(&frontswap_prefetch_lock);
+		pid = frontswap_prefetch_pid;
+		frontswap_prefetch_pid = NULL;
+		spin_unlock(&frontswap_prefetch_lock);
+		if (pid == NULL)
+			continue;
+		task = get_pid_task(pid, PIDTYPE_PID);
+		put_pid(pid);
+		if (task == NULL)
+			continue;
+		mm = get_task_mm(task);
+		put_task_struct(task);
+		if (mm == NULL)
+			continue;
+		if (frontswap_enabled)
+			frontswap_prefetch_mm(mm);
+		mmput(mm);
+	}
+	return 0;
+}
+
 /*
  * count and return the number of pages frontswap pages across all
  * swap devices.  This is exported so that a kernel module can
@@ -296,12 +410,80 @@ static ssize_t flushes_show(struct kobject *kobj,
 }
 FRONTSWAP_ATTR_RO(flushes);
 
+#define FRONTSWAP_PREFETCH_ATTR_RO(_name) \
+	static ssize_t prefetch_##_name##_show(struct kobject *kobj, \
+			       struct kobj_attribute *attr, char *buf) \
+	{ \
+		return sprintf(buf, "%lu\n", frontswap_prefetch_##_name); \
+	} \
+	FRONTSWAP_ATTR_RO(prefetch_##_name)
+
+#define FRONTSWAP_PREFETCH_ATTR(_name, _min) \
+	static ssize_t prefetch_##_name##_show(struct kobject *kobj, \
+			       struct kobj_attribute *attr, char *buf) \
+	{ \
+		return sprintf(buf, "%u\n", frontswap_prefetch_##_name); \
+	} \
+	static ssize_t prefetch_##_name##_store(struct kobject *kobj, \
+			       struct kobj_attribute *attr, \
+			       const char *buf, size_t count) \
+	{ \
+		unsigned long val; \
+		if (strict_strtoul(buf, 10, &val) || val < (_min) || \
+		    val > UINT_MAX) \
+			return -EINVAL; \
+		frontswap_prefetch_##_name = val; \
+		return count; \
+	} \
+	FRONTSWAP_ATTR(prefetch_##_name)
+
+FRONTSWAP_PREFETCH_ATTR(enable, 0);
+FRONTSWAP_PREFETCH_ATTR(batch, 1);
+FRONTSWAP_PREFETCH_ATTR(interval_ms, 0);
+FRONTSWAP_PREFETCH_ATTR(max_pages, 0);
+
+static ssize_t prefetch_oom_adj_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", frontswap_prefetch_oom_adj);
+}
+
+static ssize_t prefetch_oom_adj_store(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	long val;
+
+	if (strict_strtol(buf, 10, &val) ||
+	    val < OOM_ADJUST_MIN || val > OOM_ADJUST_MAX)
+		return -EINVAL;
+	frontswap_prefetch_oom_adj = val;
+	return count;
+}
+FRONTSWAP_ATTR(prefetch_oom_adj);
+
+FRONTSWAP_PREFETCH_ATTR_RO(tasks);
+FRONTSWAP_PREFETCH_ATTR_RO(pages);
+FRONTSWAP_PREFETCH_ATTR_RO(scanned);
+FRONTSWAP_PREFETCH_ATTR_RO(missed);
+FRONTSWAP_PREFETCH_ATTR_RO(lowmem);
+
 static struct attribute *frontswap_attrs[] = {
 	&curr_pages_attr.attr,
 	&succ_puts_attr.attr,
 	&failed_puts_attr.attr,
 	&gets_attr.attr,
 	&flushes_attr.attr,
+	&prefetch_enable_attr.attr,
+	&prefetch_oom_adj_attr.attr,
+	&prefetch_batch_attr.attr,
+	&prefetch_interval_ms_attr.attr,
+	&prefetch_max_pages_attr.attr,
+	&prefetch_tasks_attr.attr,
+	&prefetch_pages_attr.attr,
+	&prefetch_scanned_attr.attr,
+	&prefetch_missed_attr.attr,
+	&prefetch_lowmem_attr.attr,
 	NULL,
 };
 
@@ -319,6 +501,10 @@ static int __init init_frontswap(void)
 
 	err = sysfs_create_group(mm_kobj, &frontswap_attr_group);
 #endif /* CONFIG_SYSFS */
+	frontswap_prefetch_thread = kthread_run(frontswap_prefetchd, NULL,
+						"kfsprefetchd");
+	if (IS_ERR(frontswap_prefetch_thread))
+		frontswap_prefetch_thread = NULL;
 	return 0;
 }
 
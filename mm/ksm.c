@@ -33,6 +33,9 @@
 #include <linux/mmu_notifier.h>
 #include <linux/swap.h>
 #include <linux/ksm.h>
+#include <linux/oom.h>
+#include <linux/kernel_stat.h>
+#include <linux/earlysuspend.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -83,12 +86,16 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @oom_adj: owner's oom_adj as last seen by android mode (else OOM_ADJUST_MAX)
+ * @map_count: mm->map_count when android mode last marked its vmas
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	int oom_adj;
+	int map_count;
 };
 
 /**
@@ -190,6 +197,38 @@ static unsigned int ksm_thread_sleep_millisecs = 20;
 #define KSM_RUN_UNMERGE	2
 static unsigned int ksm_run = KSM_RUN_STOP;
 
+/* Yield of the last completed full scan */
+static unsigned long ksm_cycle_start;
+static unsigned long ksm_cycle_sharing;
+static unsigned long ksm_cycle_scanned;
+static unsigned long ksm_last_cycle_scanned;
+static long ksm_last_cycle_merged;
+static unsigned int ksm_last_cycle_msecs;
+
+/*
+ * Android mode: ksmd registers the private anonymous vmas of processes
+ * forked from zygote itself, skips those of foreground apps, and paces
+ * its batches by CPU idle time and screen state.
+ */
+#define KSM_ANDROID_ZYGOTE	"zygote"
+#define KSM_ANDROID_BATCH	16
+
+static unsigned int ksm_android;
+
+/* Apps with oom_adj below this are foreground: their pages are hot */
+static int ksm_android_fg_adj = 1;
+
+/* Percentage of CPU time that must be idle for ksmd to scan a batch */
+static unsigned int ksm_android_min_idle = 50;
+
+/* Percentage of pages_to_scan scanned while the screen is off */
+static unsigned int ksm_android_screen_off_scan;
+
+/* Number of mms registered by android mode */
+static unsigned long ksm_android_registered;
+
+static int ksm_android_screen_off;
+
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
 static DEFINE_MUTEX(ksm_thread_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
@@ -1256,6 +1295,115 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/*
+ * Note the owner's oom_adj.  An app that has just left the foreground is
+ * moved to the front of the list so that ksmd gets to it next: its heap
+ * has stopped changing and is the most likely to hold fresh duplicates.
+ * Called with ksm_mmlist_lock held and the cursor at ksm_mm_head.
+ */
+static void ksm_android_set_adj(struct mm_slot *mm_slot, int adj)
+{
+	if (mm_slot->oom_adj < ksm_android_fg_adj &&
+	    adj >= ksm_android_fg_adj)
+		list_move(&mm_slot->mm_list, &ksm_mm_head.mm_list);
+	mm_slot->oom_adj = adj;
+}
+
+/*
+ * Mark the private anonymous vmas of each child of zygote as mergeable,
+ * as MADV_MERGEABLE would.  This is done at the start of a full scan, at
+ * most once a second, and an mm is only walked again once its number of
+ * vmas has changed.
+ */
+static void ksm_android_register(void)
+{
+	static unsigned long next_register;
+	struct mm_struct *mms[KSM_ANDROID_BATCH];
+	int adjs[KSM_ANDROID_BATCH];
+	struct vm_area_struct *vma;
+	struct task_struct *p;
+	struct mm_slot *mm_slot;
+	struct mm_struct *mm;
+	int i, n = 0, was_mergeable;
+
+	if (next_register && time_before(jiffies, next_register))
+		return;
+	next_register = jiffies + HZ;
+
+	read_lock(&tasklist_lock);
+	for_each_process(p) {
+		if (strcmp(p->real_parent->comm, KSM_ANDROID_ZYGOTE))
+			continue;
+
+		task_lock(p);
+		mm = p->mm;
+		if (!mm || (p->flags & PF_KTHREAD)) {
+			task_unlock(p);
+			continue;
+		}
+
+		spin_lock(&ksm_mmlist_lock);
+		mm_slot = get_mm_slot(mm);
+		if (mm_slot)
+			ksm_android_set_adj(mm_slot, p->signal->oom_adj);
+		if ((!mm_slot || mm_slot->map_count != mm->map_count) &&
+		    n < KSM_ANDROID_BATCH) {
+			atomic_inc(&mm->mm_users);
+			adjs[n] = p->signal->oom_adj;
+			mms[n++] = mm;
+		}
+		spin_unlock(&ksm_mmlist_lock);
+		task_unlock(p);
+	}
+	read_unlock(&tasklist_lock);
+
+	for (i = 0; i < n; i++) {
+		mm = mms[i];
+		down_write(&mm->mmap_sem);
+		was_mergeable = test_bit(MMF_VM_MERGEABLE, &mm->flags);
+		for (vma = mm->mmap; vma; vma = vma->vm_next) {
+			if (vma->vm_file)
+				continue;
+			/* ksm_madvise() itself skips unsuitable vmas */
+			if (ksm_madvise(vma, vma->vm_start, vma->vm_end,
+					MADV_MERGEABLE, &vma->vm_flags))
+				break;
+		}
+
+		spin_lock(&ksm_mmlist_lock);
+		mm_slot = get_mm_slot(mm);
+		if (mm_slot) {
+			mm_slot->map_count = mm->map_count;
+			mm_slot->oom_adj = adjs[i];
+			if (!was_mergeable)
+				ksm_android_registered++;
+		}
+		spin_unlock(&ksm_mmlist_lock);
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+}
+
+/*
+ * Leave a foreground app's mm out of this full scan.  Its unstable tree
+ * entries belong to an earlier scan, so drop them now, as visiting the
+ * rmap_items would have done; stable ones stay as they are.
+ */
+static int ksm_android_skip(struct mm_slot *mm_slot)
+{
+	struct rmap_item *rmap_item;
+
+	if (!ksm_android || mm_slot->oom_adj >= ksm_android_fg_adj ||
+	    ksm_test_exit(mm_slot->mm))
+		return 0;
+
+	for (rmap_item = mm_slot->rmap_list; rmap_item;
+	     rmap_item = rmap_item->rmap_list)
+		if (rmap_item->address & UNSTABLE_FLAG)
+			remove_rmap_item_from_tree(rmap_item);
+	return 1;
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
@@ -1263,6 +1411,9 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
 
+	if (ksm_android && ksm_scan.mm_slot == &ksm_mm_head)
+		ksm_android_register();
+
 	if (list_empty(&ksm_mm_head.mm_list))
 		return NULL;
 
@@ -1281,6 +1432,9 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
                  lru_add_drain_all();
 
 		root_unstable_tree = RB_ROOT;
+		ksm_cycle_start = jiffies;
+		ksm_cycle_scanned = 0;
+		ksm_cycle_sharing = ksm_pages_sharing;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1289,6 +1443,14 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 next_mm:
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
+
+		if (ksm_android_skip(slot)) {
+			spin_lock(&ksm_mmlist_lock);
+			ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
+			spin_unlock(&ksm_mmlist_lock);
+			goto next_slot;
+		}
 	}
 
 	mm = slot->mm;
@@ -1367,12 +1529,16 @@ next_mm:
 		up_read(&mm->mmap_sem);
 	}
 
+next_slot:
 	/* Repeat until we've completed scanning the whole list */
 	slot = ksm_scan.mm_slot;
 	if (slot != &ksm_mm_head)
 		goto next_mm;
 
 	ksm_scan.seqnr++;
+	ksm_last_cycle_scanned = ksm_cycle_scanned;
+	ksm_last_cycle_merged = ksm_pages_sharing - ksm_cycle_sharing;
+	ksm_last_cycle_msecs = jiffies_to_msecs(jiffies - ksm_cycle_start);
 	return NULL;
 }
 
@@ -1390,17 +1556,71 @@ static void ksm_do_scan(unsigned int scan_npages)
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
 			return;
+		ksm_cycle_scanned++;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
 	}
 }
 
+/* Android mode with the screen off and screen_off_scan at 0: sleep */
+static int ksm_android_paused(void)
+{
+	return ksm_android && ksm_android_screen_off &&
+	       !ksm_android_screen_off_scan;
+}
+
 static int ksmd_should_run(void)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) &&
+	       (!list_empty(&ksm_mm_head.mm_list) || ksm_android) &&
+	       !ksm_android_paused();
+}
+
+/*
+ * Percentage of CPU time spent idle across the online cpus.  Idle time
+ * is only accounted in ticks, so the figure is refreshed at most twice a
+ * second and the previous one returned in between.
+ */
+static struct cpu_idle_sample ksm_android_idle_sample = { .pct = 100 };
+
+static unsigned int ksm_android_idle(void)
+{
+	return cpu_idle_percent(&ksm_android_idle_sample, HZ / 2);
+}
+
+/* Number of pages ksmd should scan in this batch */
+static unsigned int ksm_android_batch(void)
+{
+	if (!ksm_android)
+		return ksm_thread_pages_to_scan;
+	if (ksm_android_screen_off)
+		return ksm_thread_pages_to_scan *
+			ksm_android_screen_off_scan / 100;
+	if (ksm_android_idle() < ksm_android_min_idle)
+		return 0;
+	return ksm_thread_pages_to_scan;
 }
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+static void ksm_android_early_suspend(struct early_suspend *h)
+{
+	ksm_android_screen_off = 1;
+}
+
+static void ksm_android_late_resume(struct early_suspend *h)
+{
+	ksm_android_screen_off = 0;
+	wake_up_interruptible(&ksm_thread_wait);
+}
+
+static struct early_suspend ksm_android_early_suspend_desc = {
+	.level = EARLY_SUSPEND_LEVEL_DISABLE_FB,
+	.suspend = ksm_android_early_suspend,
+	.resume = ksm_android_late_resume,
+};
+#endif
+
 static int ksm_scan_thread(void *nothing)
 {
 	set_user_nice(current, 5);
@@ -1408,7 +1628,7 @@ static int ksm_scan_thread(void *nothing)
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
 		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
+			ksm_do_scan(ksm_android_batch());
 		mutex_unlock(&ksm_thread_mutex);
 
 		if (ksmd_should_run()) {
@@ -1477,6 +1697,8 @@ int __ksm_enter(struct mm_struct *mm)
 	/* Check ksm_run too?  Would need tighter locking */
 	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
 
+	mm_slot->oom_adj = OOM_ADJUST_MAX;
+
 	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
@@ -1934,6 +2156,129 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t cycle_pages_scanned_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_last_cycle_scanned);
+}
+KSM_ATTR_RO(cycle_pages_scanned);
+
+static ssize_t cycle_pages_merged_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%ld\n", ksm_last_cycle_merged);
+}
+KSM_ATTR_RO(cycle_pages_merged);
+
+static ssize_t cycle_msecs_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_last_cycle_msecs);
+}
+KSM_ATTR_RO(cycle_msecs);
+
+static ssize_t android_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_android);
+}
+
+static ssize_t android_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long enable;
+	int err;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	ksm_android = enable;
+	wake_up_interruptible(&ksm_thread_wait);
+
+	return count;
+}
+KSM_ATTR(android);
+
+static ssize_t android_fg_adj_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", ksm_android_fg_adj);
+}
+
+static ssize_t android_fg_adj_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	long adj;
+	int err;
+
+	err = strict_strtol(buf, 10, &adj);
+	if (err || adj < OOM_DISABLE || adj > OOM_ADJUST_MAX + 1)
+		return -EINVAL;
+
+	ksm_android_fg_adj = adj;
+
+	return count;
+}
+KSM_ATTR(android_fg_adj);
+
+static ssize_t android_min_idle_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_android_min_idle);
+}
+
+static ssize_t android_min_idle_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	unsigned long pct;
+	int err;
+
+	err = strict_strtoul(buf, 10, &pct);
+	if (err || pct > 100)
+		return -EINVAL;
+
+	ksm_android_min_idle = pct;
+
+	return count;
+}
+KSM_ATTR(android_min_idle);
+
+static ssize_t android_screen_off_scan_show(struct kobject *kobj,
+					    struct kobj_attribute *attr,
+					    char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_android_screen_off_scan);
+}
+
+static ssize_t android_screen_off_scan_store(struct kobject *kobj,
+					     struct kobj_attribute *attr,
+					     const char *buf, size_t count)
+{
+	unsigned long pct;
+	int err;
+
+	err = strict_strtoul(buf, 10, &pct);
+	if (err || pct > 100)
+		return -EINVAL;
+
+	ksm_android_screen_off_scan = pct;
+	wake_up_interruptible(&ksm_thread_wait);
+
+	return count;
+}
+KSM_ATTR(android_screen_off_scan);
+
+static ssize_t android_registered_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_android_registered);
+}
+KSM_ATTR_RO(android_registered);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1943,6 +2288,14 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&cycle_pages_scanned_attr.attr,
+	&cycle_pages_merged_attr.attr,
+	&cycle_msecs_attr.attr,
+	&android_attr.attr,
+	&android_fg_adj_attr.attr,
+	&android_min_idle_attr.attr,
+	&android_screen_off_scan_attr.attr,
+	&android_registered_attr.attr,
 	NULL,
 };
 
@@ -1984,6 +2337,10 @@ static int __init ksm_init(void)
 
 #endif /* CONFIG_SYSFS */
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	register_early_suspend(&ksm_android_early_suspend_desc);
+#endif
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 	/*
 	 * Choose a high priority since the callback takes ksm_thread_mutex:
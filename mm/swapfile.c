@@ -1045,6 +1045,129 @@ static int unuse_mm(struct mm_struct *mm,
 	return (ret < 0)? ret: 0;
 }
 
+#ifdef CONFIG_FRONTSWAP
+/*
+ * Frontswap prefetch: bring one swapped-out page of a vma back from
+ * frontswap and map it again.  Returns 1 if it was mapped, 0 if the pte
+ * changed under us or the read did not come back, or -ENOMEM.
+ */
+static int frontswap_unuse_one(struct vm_area_struct *vma, pmd_t *pmd,
+				unsigned long addr, swp_entry_t entry)
+{
+	struct page *page;
+	int ret = 0;
+
+	page = read_swap_cache_async(entry, GFP_HIGHUSER_MOVABLE, vma, addr);
+	if (!page)
+		return -ENOMEM;
+	lock_page(page);
+	if (PageSwapCache(page) && page_private(page) == entry.val &&
+	    PageUptodate(page)) {
+		ret = unuse_pte(vma, pmd, addr, entry, page);
+		/* drops the frontswap copy unless another mm shares it */
+		if (ret > 0)
+			try_to_free_swap(page);
+	}
+	unlock_page(page);
+	page_cache_release(page);
+	return ret;
+}
+
+static int frontswap_unuse_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
+				unsigned long *addrp, unsigned long end,
+				int *done, int nr_pages, unsigned long *scanned,
+				unsigned long *missed)
+{
+	unsigned long addr = *addrp;
+	swp_entry_t entry;
+	pte_t *pte, ptent;
+	int ret = 0;
+
+	/* no pte lock while scanning, unuse_pte rechecks under it */
+	pte = pte_offset_map(pmd, addr);
+	do {
+		ptent = *pte;
+		if (pte_none(ptent) || pte_present(ptent) || pte_file(ptent))
+			continue;
+		entry = pte_to_swp_entry(ptent);
+		if (non_swap_entry(entry))
+			continue;
+		(*scanned)++;
+		/* leave anything that would need disk I/O to the fault */
+		if (!frontswap_test(swap_info[swp_type(entry)],
+				    swp_offset(entry))) {
+			(*missed)++;
+			continue;
+		}
+		pte_unmap(pte);
+		ret = frontswap_unuse_one(vma, pmd, addr, entry);
+		pte = pte_offset_map(pmd, addr);
+		if (ret > 0)
+			(*done)++;
+		else
+			(*missed)++;
+	} while (pte++, addr += PAGE_SIZE,
+		 addr != end && *done < nr_pages && ret >= 0);
+	pte_unmap(pte - 1);
+	*addrp = addr;
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Partial swapoff of a single mm for frontswap prefetch: walk mm's
+ * anonymous vmas from *addrp, bringing back and mapping pages that
+ * frontswap holds, until nr_pages were brought back.  *addrp is left
+ * where to resume, TASK_SIZE once the whole mm has been walked.  Swap
+ * entries that frontswap doesn't hold are counted in *missed and left
+ * alone, so this never waits on the swap device.  Returns the number of
+ * pages brought back.
+ */
+int frontswap_unuse_mm(struct mm_struct *mm, unsigned long *addrp,
+			int nr_pages, unsigned long *scanned,
+			unsigned long *missed)
+{
+	struct vm_area_struct *vma;
+	unsigned long addr = *addrp, next;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	int done = 0;
+
+	down_read(&mm->mmap_sem);
+	for (vma = find_vma(mm, addr); vma; vma = vma->vm_next) {
+		if (!vma->anon_vma)
+			continue;
+		if (addr < vma->vm_start)
+			addr = vma->vm_start;
+		while (addr < vma->vm_end) {
+			next = pmd_addr_end(addr, vma->vm_end);
+			pgd = pgd_offset(mm, addr);
+			if (pgd_none_or_clear_bad(pgd))
+				goto next_pmd;
+			pud = pud_offset(pgd, addr);
+			if (pud_none_or_clear_bad(pud))
+				goto next_pmd;
+			pmd = pmd_offset(pud, addr);
+			if (pmd_none_or_clear_bad(pmd))
+				goto next_pmd;
+			if (frontswap_unuse_pte_range(vma, pmd, &addr, next,
+					&done, nr_pages, scanned, missed) ||
+			    done >= nr_pages)
+				goto out;
+			cond_resched();
+			continue;
+next_pmd:
+			addr = next;
+		}
+	}
+	addr = TASK_SIZE;
+out:
+	up_read(&mm->mmap_sem);
+	*addrp = addr;
+	return done;
+}
+#endif /* CONFIG_FRONTSWAP */
+
 /*
  * Scan swap_map from current position to next entry still in use.
  * Recycle to start on reaching the end, returning 0 when empty.
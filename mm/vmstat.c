@@ -862,6 +862,12 @@ static const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_direct_blocks_moved",
+	"compact_direct_pages_moved",
+	"compact_proactive_runs",
+	"compact_proactive_blocks_moved",
+	"compact_proactive_pages_moved",
+	"compact_proactive_success",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE